@@ -72,6 +72,16 @@
  */
 static u32 started_business = 0;
 
+#ifndef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+/*
+ * When XMHF does not quiesce other CPUs during hypercalls, this lock
+ * serializes TrustVisor hypercalls and EPT violations, which both access the
+ * PAL whitelist. Changes to EPT01 are protected by the EPT lock and followed
+ * by a TLB shootdown (see scode_ept01_write_end()).
+ */
+static volatile u32 tv_hypercall_lock = 1;
+#endif /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+
 const cmdline_option_t gc_trustvisor_available_cmdline_options[] = {
   { "nvpalpcr0", "0000000000000000000000000000000000000000"}, /* Req'd PCR[0] of NvMuxPal */
   { "nvenforce", "true" }, /* true|false - actually enforce nvpalpcr0? */
@@ -590,6 +600,10 @@ u32 tv_app_handlehypercall(VCPU *vcpu, struct regs *r)
 //  xmhf_smpguest_quiesce(vcpu);
 //#endif
 
+#ifndef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+  spin_lock(&tv_hypercall_lock);
+#endif /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+
   if (vcpu->cpu_vendor == CPU_VENDOR_INTEL) {
 #ifdef __XMHF_AMD64__
     cmd = (u32)r->rax;
@@ -658,6 +672,10 @@ u32 tv_app_handlehypercall(VCPU *vcpu, struct regs *r)
     HALT();
   }
 
+#ifndef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+  spin_unlock(&tv_hypercall_lock);
+#endif /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+
 //#ifdef __MP_VERSION__
 //  xmhf_smpguest_endquiesce(vcpu);
 //#endif
@@ -691,6 +709,10 @@ u32 tv_app_handleintercept_hwpgtblviolation(VCPU *vcpu,
 //  xmhf_smpguest_quiesce(vcpu);
 //#endif
 
+#ifndef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+  spin_lock(&tv_hypercall_lock);
+#endif /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+
 #if !defined(__LDN_TV_INTEGRATION__)
   eu_trace("CPU(0x%02x): gva=%#llx, gpa=%#llx, code=%#llx", (int)vcpu->id,
           gva, gpa, violationcode);
@@ -702,6 +724,10 @@ u32 tv_app_handleintercept_hwpgtblviolation(VCPU *vcpu,
 	ret = hpt_scode_npf(vcpu, gpa, violationcode, r);
 #endif //__LDN_TV_INTEGRATION__
 
+#ifndef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+  spin_unlock(&tv_hypercall_lock);
+#endif /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+
 //#ifdef __MP_VERSION__
 //  xmhf_smpguest_endquiesce(vcpu);
 //#endif
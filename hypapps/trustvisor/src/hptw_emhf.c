@@ -54,15 +54,6 @@ static hpt_pa_t hptw_emhf_host_ctx_ptr2pa(void *vctx, void *ptr)
   return hva2spa(ptr);
 }
 
-static void* hptw_emhf_host_ctx_pa2ptr(void *vctx, hpt_pa_t spa, size_t sz, hpt_prot_t access_type, hptw_cpl_t cpl, size_t *avail_sz)
-{
-  (void)vctx;
-  (void)access_type;
-  (void)cpl;
-  *avail_sz = sz;
-  return spa2hva(spa);
-}
-
 static void* hptw_emhf_host_ctx_gzp(void *vctx, size_t alignment, size_t sz)
 {
   hptw_emhf_host_ctx_t *ctx = vctx;
@@ -79,7 +70,7 @@ int hptw_emhf_host_ctx_init(hptw_emhf_host_ctx_t *ctx, hpt_pa_t root_pa, hpt_typ
   *ctx = (hptw_emhf_host_ctx_t) {
     .super = (hptw_ctx_t) {
       .ptr2pa = hptw_emhf_host_ctx_ptr2pa,
-      .pa2ptr = hptw_emhf_host_ctx_pa2ptr,
+      .pa2ptr = hptw_identity_pa2ptr,
       .gzp = hptw_emhf_host_ctx_gzp,
       .root_pa = root_pa,
       .t = t,
@@ -138,7 +129,7 @@ int hptw_emhf_host_nested_ctx_init(hptw_emhf_host_ctx_t *ctx, hpt_pa_t root_pa01
     },
     .lower = (hptw_ctx_t) {
       .ptr2pa = hptw_emhf_host_nested01_ctx_ptr2pa,
-      .pa2ptr = hptw_emhf_host_ctx_pa2ptr,
+      .pa2ptr = hptw_identity_pa2ptr,
       .gzp = hptw_emhf_host_nested01_ctx_gzp,
       .root_pa = root_pa01,
       .t = t,
@@ -49,9 +49,10 @@
 
 #include <xmhf.h>
 
+#define PAGELIST_MAX_PAGES 128
+
 typedef struct {
-  void *buf;
-  void *page_base;
+  void *pages[PAGELIST_MAX_PAGES];
   size_t num_allocd;
   size_t num_used;
 } pagelist_t;
@@ -100,6 +100,19 @@ typedef struct {
   u32 section_type;
 } tv_pal_section_int_t;
 
+/*
+ * Range of L1 physical addresses [lo, hi) whose EPT01 entries are changed by
+ * scode_lend_section() / scode_return_section(). Passed to
+ * xmhf_memprot_flushmappings_alltlb_range() so that XMHF only needs to flush
+ * EPT02 entries derived from this range.
+ */
+typedef struct {
+  u64 lo;
+  u64 hi;
+} tv_ept01_range_t;
+
+#define TV_EPT01_RANGE_EMPTY ((tv_ept01_range_t){ .lo = ~0ULL, .hi = 0ULL })
+
 /* scode state struct */
 typedef struct whitelist_entry{
   u64       gcr3;
@@ -182,17 +195,21 @@ u64 scode_register(VCPU * vcpu, u64 scode_info, u64 scode_pm, u64 gventry);
 u64 scode_unregister(VCPU * vcpu, u64 gvaddr);
 void init_scode(VCPU * vcpu);
 
-void scode_lend_section( hptw_ctx_t *reg_npm02_ctx,
+void scode_lend_section( VCPU *vcpu,
+                         hptw_ctx_t *reg_npm02_ctx,
                          hptw_ctx_t *reg_npm01_ctx,
                          bool is_nested_ept,
                          hptw_ctx_t *reg_gpm_ctx,
                          hptw_ctx_t *pal_npm_ctx,
                          hptw_ctx_t *pal_gpm_ctx,
-                         const tv_pal_section_int_t *section);
-void scode_return_section( hptw_ctx_t *reg_npm_ctx,
+                         const tv_pal_section_int_t *section,
+                         tv_ept01_range_t *changed);
+void scode_return_section( VCPU *vcpu,
+                           hptw_ctx_t *reg_npm_ctx,
                            hptw_ctx_t *pal_npm_ctx,
                            hptw_ctx_t *pal_gpm_ctx,
-                           const tv_pal_section_int_t *section);
+                           const tv_pal_section_int_t *section,
+                           tv_ept01_range_t *changed);
 
 #if 0
 int scode_clone_gdt(VCPU *vcpu,
@@ -51,17 +51,17 @@
 
 #include <tv_log.h>
 
+/* Pages are allocated from the page slab of the XMHF heap, so that they do
+   not fragment the TrustVisor heap and are returned to a per-CPU cache. */
 void pagelist_init(pagelist_t *pl)
 {
-  const int pages = 128;
-  pl->buf = malloc(pages*PAGE_SIZE_4K);
-  EU_VERIFY(pl->buf != NULL);
+  size_t i;
 
-  pl->page_base = (void*)PAGE_ALIGN_UP_4K((uintptr_t)pl->buf);
-  pl->num_allocd =
-    (pl->page_base == pl->buf)
-    ? pages
-    : pages-1;
+  for (i=0; i < PAGELIST_MAX_PAGES; i++) {
+    pl->pages[i] = xmhf_mm_alloc_page(1);
+    EU_VERIFY(pl->pages[i] != NULL);
+  }
+  pl->num_allocd = PAGELIST_MAX_PAGES;
 
   pl->num_used = 0;
 }
@@ -74,7 +74,7 @@ void* pagelist_get_page(pagelist_t *pl)
   /* we'll handle allocating more on-demand later */
   EU_VERIFY(pl->num_used < pl->num_allocd);
 
-  page = pl->page_base + (pl->num_used*PAGE_SIZE_4K);
+  page = pl->pages[pl->num_used];
   pl->num_used++;
 
   return page;
@@ -89,7 +89,11 @@ void* pagelist_get_zeroedpage(pagelist_t *pl)
 
 void pagelist_free_all(pagelist_t *pl)
 {
-  free(pl->buf);
-  pl->buf=NULL;
+  size_t i;
+
+  for (i=0; i < pl->num_allocd; i++) {
+    xmhf_mm_free(pl->pages[i]);
+    pl->pages[i] = NULL;
+  }
   pl->num_allocd=0;
 }
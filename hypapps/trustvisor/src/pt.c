@@ -120,6 +120,19 @@ int copy_from_current_guest(VCPU * vcpu, void *dst, gva_t gvaddr, size_t len)
   hptw_emhf_checked_guest_ctx_t ctx;
   int rv=1;
 
+  /*
+   * On Intel, use the guestmem software TLB. The walk uses the same EPT01
+   * root as hptw_emhf_host_ctx_init_of_vcpu() (overlays hidden). L2 guests
+   * need the EPT12 + EPT01 walk below.
+   */
+  if (vcpu->cpu_vendor == CPU_VENDOR_INTEL &&
+      hpt_emhf_get_l1l2_root_pm_pa(vcpu) == HPTW_EMHF_EPT12_INVALID) {
+    guestmem_hptw_ctx_pair_t ctx_pair;
+    guestmem_init(vcpu, &ctx_pair);
+    ctx_pair.host_ctx.root_pa = hpt_emhf_get_root_pm_pa(vcpu);
+    return guestmem_checked_copy_gv2h(&ctx_pair, HPTW_CPL3, dst, gvaddr, len);
+  }
+
   EU_CHKN( hptw_emhf_checked_guest_ctx_init_of_vcpu( &ctx, vcpu));
 
   EU_CHKN( hptw_checked_copy_from_va( &ctx.super, ctx.cpl, dst, gvaddr, len));
@@ -196,6 +209,21 @@ int scode_clone_gdt(VCPU *vcpu,
 }
 #endif
 
+/* add the 4K page at gpa to changed, if changed is not NULL */
+static void scode_ept01_range_add(tv_ept01_range_t *changed, u64 gpa)
+{
+  if (changed == NULL) {
+    return;
+  }
+  gpa &= ~(u64)(PAGE_SIZE_4K - 1);
+  if (gpa < changed->lo) {
+    changed->lo = gpa;
+  }
+  if (gpa + PAGE_SIZE_4K > changed->hi) {
+    changed->hi = gpa + PAGE_SIZE_4K;
+  }
+}
+
 /*
  * lend a section of memory from a user-space process (on the commodity OS) to
  * a pal.
@@ -207,14 +235,19 @@ int scode_clone_gdt(VCPU *vcpu,
  * reg_npm02_ctx should be used to convert L2 physical address to L1 physical
  * address. reg_npm01_ctx should be used to convert L1 physical address to L0
  * physical address. To remove a page from EPT02, use reg_npm01_ctx.
+ *
+ * The L1 physical addresses whose EPT01 entries are changed are added to
+ * changed (may be NULL). EPT01 large pages are split by vcpu before changing.
  */
-void scode_lend_section( hptw_ctx_t *reg_npm02_ctx,
+void scode_lend_section( VCPU *vcpu,
+                         hptw_ctx_t *reg_npm02_ctx,
                          hptw_ctx_t *reg_npm01_ctx,
                          bool is_nested_ept,
                          hptw_ctx_t *reg_gpm_ctx,
                          hptw_ctx_t *pal_npm_ctx,
                          hptw_ctx_t *pal_gpm_ctx,
-                         const tv_pal_section_int_t *section)
+                         const tv_pal_section_int_t *section,
+                         tv_ept01_range_t *changed)
 {
   size_t offset;
   int hpt_err;
@@ -281,6 +314,7 @@ void scode_lend_section( hptw_ctx_t *reg_npm02_ctx,
     }
 
     /* Get relevant entry in EPT01 (regular EPT when not nested) */
+    xmhf_memprot_split_page(vcpu, page_reg_gpa);
     hpt_err = hptw_checked_get_pmeo(&page_reg_npmeo,
                                     reg_npm01_ctx,
                                     section->pal_prot,
@@ -289,7 +323,7 @@ void scode_lend_section( hptw_ctx_t *reg_npm02_ctx,
     CHK_RV(hpt_err);
     eu_trace("got npme %016llx, level %d, type %d",
              page_reg_npmeo.pme, page_reg_npmeo.lvl, page_reg_npmeo.t);
-    HALT_ON_ERRORCOND(page_reg_npmeo.lvl==1); /* EPT01 does not have large pages */
+    HALT_ON_ERRORCOND(page_reg_npmeo.lvl==1); /* EPT01 large page is split above */
     page_reg_spa = hpt_pmeo_va_to_pa(&page_reg_npmeo, page_reg_gpa);
 
     /* revoke access from 'reg' VM (using EPT01) */
@@ -298,6 +332,7 @@ void scode_lend_section( hptw_ctx_t *reg_npm02_ctx,
                                    &page_reg_npmeo,
                                    page_reg_spa);
     CHK_RV(hpt_err);
+    scode_ept01_range_add(changed, page_reg_spa);
 
     /* for simplicity, we don't bother removing from guest page
        tables. removing from nested page tables is sufficient */
@@ -341,11 +376,16 @@ void scode_lend_section( hptw_ctx_t *reg_npm02_ctx,
  * and the nested guest's future access to the memory will cause EPT02
  * violation. XMHF will update EPT02 using EPT01 and retry the access. See also
  * scode_lend_section(). Again, EPT01 is assumed to be identity mapping.
+ *
+ * The L1 physical addresses whose EPT01 entries are changed are added to
+ * changed (may be NULL). EPT01 large pages are split by vcpu before changing.
  */
-void scode_return_section(hptw_ctx_t *reg_npm01_ctx,
+void scode_return_section(VCPU *vcpu,
+                          hptw_ctx_t *reg_npm01_ctx,
                           hptw_ctx_t *pal_npm_ctx,
                           hptw_ctx_t *pal_gpm_ctx,
-                          const tv_pal_section_int_t *section)
+                          const tv_pal_section_int_t *section,
+                          tv_ept01_range_t *changed)
 {
   size_t offset;
 
@@ -397,9 +437,11 @@ void scode_return_section(hptw_ctx_t *reg_npm01_ctx,
 
     /* add access to reg nested page tables */
     // TODO: should not assume EPT01 entry is RWX
+    xmhf_memprot_split_page(vcpu, page_reg_spa);
     hptw_set_prot(reg_npm01_ctx,
                        page_reg_spa,
                        HPT_PROTS_RWX);
+    scode_ept01_range_add(changed, page_reg_spa);
 
 #ifdef __DMAP__
     /* Enable device accesses to these memory (via IOMMU) */
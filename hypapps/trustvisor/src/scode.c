@@ -107,6 +107,41 @@ int * scode_curr = NULL;
 
 void scode_release_all_shared_pages(VCPU *vcpu, whitelist_entry_t* entry);
 
+/*
+ * Bracket modifications to EPT01 (g_hptw_reg_host_ctx). When XMHF quiesces
+ * other CPUs during hypercalls, no lock is needed and the TLB flush is
+ * deferred to the end of quiesce. Otherwise, other CPUs are running, so hold
+ * the EPT lock while modifying and then send a TLB shootdown for the changed
+ * range to all CPUs. The bracket is provided by memprot, so that memprot calls
+ * inside it (e.g. xmhf_memprot_split_page()) do not take the lock again, and
+ * CPU-private copies of a shared EPT01 are updated at the end. Before
+ * flushing, EPT01 tables in the changed range are merged back into large
+ * pages where possible.
+ */
+static void scode_ept01_write_begin(VCPU *vcpu)
+{
+#ifdef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+  xmhf_memprot_write_begin(vcpu, false);
+#else /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+  xmhf_memprot_write_begin(vcpu, true);
+#endif /* __XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+}
+
+static void scode_ept01_write_end(VCPU *vcpu, const tv_ept01_range_t *changed)
+{
+  if (changed->lo < changed->hi) {
+    xmhf_memprot_coalesce_range(vcpu, changed->lo, changed->hi);
+  }
+  xmhf_memprot_write_end(vcpu);
+#ifdef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
+  xmhf_memprot_flushmappings_alltlb_range(vcpu, MEMP_FLUSHTLB_ENTRY,
+                                          changed->lo, changed->hi);
+#else /* !__XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+  xmhf_memprot_flushmappings_shootdown(vcpu, NULL, MEMP_FLUSHTLB_ENTRY,
+                                       changed->lo, changed->hi);
+#endif /* __XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
+}
+
 /* search scode in whitelist */
 int scode_in_list(u64 gcr3, uintptr_t gvaddr, bool g64, u64 ept12)
 {
@@ -427,6 +462,7 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
   hpt_pmo_t pal_npmo_root, pal_gpmo_root;
   hptw_emhf_checked_guest_ctx_t reg_guest_walk_ctx;
   hptw_emhf_host_ctx_t hptw_reg_host_ctx;
+  tv_ept01_range_t ept01_changed = TV_EPT01_RANGE_EMPTY;
   u64 rv=1;
 
   /* set all CPUs to use the same 'reg' nested page tables,
@@ -497,6 +533,10 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
           }
           hptw_emhf_host_l1_ctx_init_of_vcpu(&ctx_other, vcpu_other);
           hptw_get_pmo(&pmo_other, &ctx_other.super, 4, 0);
+          if (pmo_other.pm == pmo.pm) {
+            /* EPT01 is shared among CPUs (--enable-vmx-shared-ept) */
+            continue;
+          }
           eu_trace("cpu %d copying PML4E 0x%016lx from 0x%016lx", i,
                    (uintptr_t)pmo_other.pm, (uintptr_t)pmo.pm);
           memcpy(pmo_other.pm, pmo.pm, PAGE_SIZE_4K);
@@ -584,8 +624,8 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
   /* add all gpl pages to pal's nested page tables, ensuring that
      the guest page tables allocated from it will be accessible to the
      pal */
-  /* XXX breaks pagelist abstraction. will break if pagelist ever dynamically
-     allocates more buffers. consider doing this on-demand inside pal's gzp fn instead. */
+  /* XXX breaks pagelist abstraction. will break if pagelist ever allocates
+     pages on demand. consider doing this on-demand inside pal's gzp fn instead. */
   eu_trace("adding gpl to pal's npt:");
   for (i=0; i < whitelist_new.gpl->num_allocd; i++) {
     hpt_pmeo_t pmeo = {
@@ -593,7 +633,7 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
       .t = pal_npmo_root.t,
       .lvl = 1,
     };
-    void *page = whitelist_new.gpl->page_base + i*PAGE_SIZE_4K;
+    void *page = whitelist_new.gpl->pages[i];
     hpt_pmeo_setprot(&pmeo, HPT_PROTS_RWX);
     hpt_pmeo_setuser(&pmeo, true);
     hpt_pmeo_set_address(&pmeo, hva2spa(page));
@@ -605,6 +645,7 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
   eu_trace("adding sections to pal's npts and gpts:");
   /* map each requested section into the pal */
   whitelist_new.sections_num = whitelist_new.scode_info.num_sections;
+  scode_ept01_write_begin(vcpu);
   for (i=0; i<whitelist_new.scode_info.num_sections; i++) {
     whitelist_new.sections[i] = (tv_pal_section_int_t) {
       .reg_gva = whitelist_new.scode_info.sections[i].start_addr,
@@ -614,14 +655,18 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
       .reg_prot = reg_prot_of_type(whitelist_new.scode_info.sections[i].type),
       .section_type = whitelist_new.scode_info.sections[i].type,
     };
-    scode_lend_section( &hptw_reg_host_ctx.super,
+    scode_lend_section( vcpu,
+                        &hptw_reg_host_ctx.super,
                         &g_hptw_reg_host_ctx.super,
                         whitelist_new.ept12 != HPTW_EMHF_EPT12_INVALID,
                         &reg_guest_walk_ctx.super,
                         &whitelist_new.hptw_pal_host_ctx.super,
                         &whitelist_new.hptw_pal_checked_guest_ctx.super,
-                        &whitelist_new.sections[i]);
+                        &whitelist_new.sections[i],
+                        &ept01_changed);
   }
+  /* flush TLB for page table modifications to take effect. */
+  scode_ept01_write_end(vcpu, &ept01_changed);
 
   /* clone gdt */
   /* eu_warn("skipping scode_clone_gdt"); */
@@ -663,12 +708,15 @@ u64 scode_register(VCPU *vcpu, u64 scode_info, u64 scode_pm, u64 gventry)
                                                 VCPU_gcr3( vcpu), /* XXX should build trusted cr3 from scratch */
                                                 whitelist_new.hptw_pal_checked_guest_ctx.super.root_pa);
 
-  /* flush TLB for page table modifications to take effect. */
-  xmhf_memprot_flushmappings_alltlb(vcpu, MEMP_FLUSHTLB_ENTRY);
-
 #ifdef __DMAP__
-  /* Disable device accesses to these memory (via IOMMU) */
-  xmhf_dmaprot_invalidate_cache();
+  /*
+   * Disable device accesses to these memory (via IOMMU). EPT01 identity maps
+   * L1 physical memory, so the changed EPT01 range is also the DMA range.
+   */
+  if (ept01_changed.lo < ept01_changed.hi) {
+    xmhf_dmaprot_invalidate_range(ept01_changed.lo,
+                                  ept01_changed.hi - ept01_changed.lo);
+  }
 #endif /* __DMAP__ */
 
   /* initialize Micro-TPM instance */
@@ -714,6 +762,7 @@ u64 scode_unregister(VCPU * vcpu, u64 gvaddr)
   bool g64;
   u64 gcr3;
   u64 ept12;
+  tv_ept01_range_t ept01_changed = TV_EPT01_RANGE_EMPTY;
 
   gcr3 = VCPU_gcr3(vcpu);
   g64 = VCPU_g64(vcpu);
@@ -753,6 +802,7 @@ u64 scode_unregister(VCPU * vcpu, u64 gvaddr)
   /* eu_perf("total mem mallocd: %u", heapmem_get_used_size()); */
 
   /* restore permissions for remapped sections */
+  scode_ept01_write_begin(vcpu);
   for(j = 0; j < whitelist[i].sections_num; j++) {
     /* zero the contents of any sections that are writable by the PAL, and not readable by the reg guest */
     if ((whitelist[i].sections[j].pal_prot & HPT_PROTS_W)
@@ -768,13 +818,15 @@ u64 scode_unregister(VCPU * vcpu, u64 gvaddr)
       HALT_ON_ERRORCOND(!err);
     }
 
-    scode_return_section( &g_hptw_reg_host_ctx.super,
+    scode_return_section( vcpu,
+                          &g_hptw_reg_host_ctx.super,
                           &whitelist[i].hptw_pal_host_ctx.super,
                           &whitelist[i].hptw_pal_checked_guest_ctx.super,
-                          &whitelist[i].sections[j]);
+                          &whitelist[i].sections[j],
+                          &ept01_changed);
   }
   /* flush TLB for page table modifications to take effect. */
-  xmhf_memprot_flushmappings_alltlb(vcpu, MEMP_FLUSHTLB_ENTRY);
+  scode_ept01_write_end(vcpu, &ept01_changed);
 
   /* delete entry from scode whitelist */
   /* CRITICAL SECTION in MP scenario: need to quiesce other CPUs or at least acquire spinlock */
@@ -1178,6 +1230,7 @@ u32 hpt_scode_switch_scode(VCPU * vcpu, struct regs *r)
   if(vcpu->cpu_vendor == CPU_VENDOR_AMD) {
     /* set the sensitive code to run in ring 3 */
     ((struct _svm_vmcbfields *)(vcpu->vmcb_vaddr_ptr))->cpl = 3;
+    svm_vmcb_dirty(vcpu->vmcb_vaddr_ptr, VMCB_CLEAN_SEG);
   }
 
   perf_ctr_timer_record(&g_tv_perf_ctrs[TV_PERF_CTR_SWITCH_SCODE], vcpu->idx);
@@ -1589,16 +1642,20 @@ void scode_release_all_shared_pages(VCPU *vcpu, whitelist_entry_t* wle)
       i >= 0 && wle->sections[i].section_type == TV_PAL_SECTION_SHARED;
       i--) {
     eu_trace("returning shared section num %d at 0x%08llx", i, wle->sections[i].pal_gva);
-    scode_return_section( &g_hptw_reg_host_ctx.super,
+    scode_return_section( vcpu,
+                          &g_hptw_reg_host_ctx.super,
                           &wle->hptw_pal_host_ctx.super,
                           &wle->hptw_pal_checked_guest_ctx.super,
-                          &wle->sections[i]);
+                          &wle->sections[i],
+                          NULL);
     wle->sections_num--;
   }
 }
 
-/* note- caller is responsible for flushing page tables afterwards */
-u32 scode_share_range(VCPU * vcpu, whitelist_entry_t *wle, u32 gva_base, u32 gva_len)
+/* note- caller is responsible for flushing page tables afterwards (changed
+   records the range to flush) */
+u32 scode_share_range(VCPU * vcpu, whitelist_entry_t *wle, u32 gva_base, u32 gva_len,
+                      tv_ept01_range_t *changed)
 {
   u32 err=1;
   hptw_emhf_checked_guest_ctx_t vcpu_guest_walk_ctx;
@@ -1617,13 +1674,15 @@ u32 scode_share_range(VCPU * vcpu, whitelist_entry_t *wle, u32 gva_base, u32 gva
     .section_type = TV_PAL_SECTION_SHARED,
   };
 
-  scode_lend_section( &hptw_reg_host_ctx.super,
+  scode_lend_section( vcpu,
+                      &hptw_reg_host_ctx.super,
                       &g_hptw_reg_host_ctx.super,
                       hpt_emhf_get_l1l2_root_pm_pa(vcpu) != HPTW_EMHF_EPT12_INVALID,
                       &vcpu_guest_walk_ctx.super,
                       &wle->hptw_pal_host_ctx.super,
                       &wle->hptw_pal_checked_guest_ctx.super,
-                      &wle->sections[wle->sections_num]);
+                      &wle->sections[wle->sections_num],
+                      changed);
 
   wle->sections_num++;
 
@@ -1638,18 +1697,24 @@ u32 scode_share_ranges(VCPU * vcpu, u32 scode_entry, u32 gva_base[], u32 gva_len
   whitelist_entry_t* entry;
   bool g64;
   u64 ept12;
+  tv_ept01_range_t ept01_changed = TV_EPT01_RANGE_EMPTY;
   u32 err=1;
 
   g64 = VCPU_g64(vcpu);
   ept12 = hpt_emhf_get_l1l2_root_pm_pa(vcpu);
   EU_CHK( entry = find_scode_by_entry(VCPU_gcr3(vcpu), scode_entry, g64, ept12));
 
+  /* do not jump to out while EPT01 is being modified */
+  scode_ept01_write_begin(vcpu);
   for(i=0; i<count; i++) {
-    EU_CHKN( scode_share_range(vcpu, entry, gva_base[i], gva_len[i]));
+    if (scode_share_range(vcpu, entry, gva_base[i], gva_len[i],
+                          &ept01_changed)) {
+      break;
+    }
   }
-
   /* flush TLB for page table modifications to take effect. */
-  xmhf_memprot_flushmappings_alltlb(vcpu, MEMP_FLUSHTLB_ENTRY);
+  scode_ept01_write_end(vcpu, &ept01_changed);
+  EU_CHK( i == count);
 
   err=0;
 out:
@@ -0,0 +1,176 @@
+/*
+ * Userspace stress test for the EPT lock in memp-x86vmx-eptlock.c.
+ *
+ * Build and run from this directory:
+ *   make && ./eptlock_stress [seconds] && ./eptlock_stress_seqlock [seconds]
+ *
+ * The lock source file is compiled unmodified against the small xmhf.h in
+ * this directory, once in the default mode and once with
+ * __VMX_EPTLOCK_SEQLOCK__. Each thread plays the role of a CPU:
+ * * Writers modify a fake EPT entry (two words that are equal outside of the
+ *   writer's critical section) while holding the writer lock.
+ * * Lock readers use memprot_x86vmx_eptlock_read_lock() and check that no
+ *   writer is in its critical section at the same time (mutual exclusion).
+ * * Fast path readers use memprot_x86vmx_eptlock_read_begin() / retry() and
+ *   check that every result they accept is consistent.
+ * Any violation aborts the program with a non-zero exit status.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xmhf.h"
+
+#define NWRITERS 2
+#define NLOCK_READERS 3
+#define NFAST_READERS 3
+#define NTHREADS (NWRITERS + NLOCK_READERS + NFAST_READERS)
+
+VCPU g_vcpus[NTHREADS];
+MIDTAB g_midtable[NTHREADS];
+u32 g_midtable_numentries = NTHREADS;
+
+/* Fake EPT entry, g_pte_lo == g_pte_hi when no writer is writing */
+static volatile u64 g_pte_lo;
+static volatile u64 g_pte_hi;
+
+/* Number of threads in critical section */
+static volatile u32 g_writers_in;
+static volatile u32 g_readers_in;
+
+static volatile bool g_stop;
+
+static u64 g_ops[NTHREADS];
+static u64 g_retries[NTHREADS];
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "violation: %s (line %d)\n", #cond, __LINE__); \
+			exit(1); \
+		} \
+	} while (0)
+
+/* Busy loop for a pseudo random short time */
+static void delay(u32 *seed)
+{
+	u32 n;
+	*seed = *seed * 1103515245 + 12345;
+	n = (*seed >> 16) & 0x3f;
+	while (n--) {
+		xmhf_cpu_relax();
+	}
+}
+
+static void *writer(void *arg)
+{
+	u32 id = (u32)(uintptr_t)arg;
+	VCPU *vcpu = &g_vcpus[id];
+	u32 seed = id;
+	while (!g_stop) {
+		memprot_x86vmx_eptlock_write_lock(vcpu);
+		CHECK(__atomic_add_fetch(&g_writers_in, 1, __ATOMIC_SEQ_CST) == 1);
+		CHECK(__atomic_load_n(&g_readers_in, __ATOMIC_SEQ_CST) == 0);
+		g_pte_lo = g_pte_lo + 1;
+		delay(&seed);
+		g_pte_hi = g_pte_lo;
+		CHECK(__atomic_load_n(&g_readers_in, __ATOMIC_SEQ_CST) == 0);
+		__atomic_sub_fetch(&g_writers_in, 1, __ATOMIC_SEQ_CST);
+		memprot_x86vmx_eptlock_write_unlock(vcpu);
+		g_ops[id]++;
+		delay(&seed);
+		delay(&seed);
+	}
+	return NULL;
+}
+
+static void *lock_reader(void *arg)
+{
+	u32 id = (u32)(uintptr_t)arg;
+	VCPU *vcpu = &g_vcpus[id];
+	u32 seed = id;
+	while (!g_stop) {
+		u64 lo, hi;
+		memprot_x86vmx_eptlock_read_lock(vcpu);
+		__atomic_add_fetch(&g_readers_in, 1, __ATOMIC_SEQ_CST);
+		CHECK(__atomic_load_n(&g_writers_in, __ATOMIC_SEQ_CST) == 0);
+		lo = g_pte_lo;
+		delay(&seed);
+		hi = g_pte_hi;
+		CHECK(lo == hi);
+		CHECK(__atomic_load_n(&g_writers_in, __ATOMIC_SEQ_CST) == 0);
+		__atomic_sub_fetch(&g_readers_in, 1, __ATOMIC_SEQ_CST);
+		memprot_x86vmx_eptlock_read_unlock(vcpu);
+		g_ops[id]++;
+		delay(&seed);
+	}
+	return NULL;
+}
+
+static void *fast_reader(void *arg)
+{
+	u32 id = (u32)(uintptr_t)arg;
+	VCPU *vcpu = &g_vcpus[id];
+	u32 seed = id;
+	while (!g_stop) {
+		u64 lo, hi;
+		u32 seq;
+		bool retry = false;
+		do {
+			g_retries[id] += retry;
+			seq = memprot_x86vmx_eptlock_read_begin(vcpu);
+			lo = g_pte_lo;
+			delay(&seed);
+			hi = g_pte_hi;
+		} while ((retry = memprot_x86vmx_eptlock_read_retry(vcpu, seq)));
+		CHECK(lo == hi);
+		g_ops[id]++;
+		delay(&seed);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[NTHREADS];
+	u32 seconds = 2;
+	u64 ops[3] = { 0, 0, 0 };
+	u64 retries = 0;
+	u32 i;
+
+	if (argc > 1) {
+		seconds = (u32)atoi(argv[1]);
+	}
+
+	for (i = 0; i < NTHREADS; i++) {
+		g_midtable[i].vcpu_vaddr_ptr = (hva_t)&g_vcpus[i];
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		void *(*fn)(void *) = i < NWRITERS ? writer :
+			i < NWRITERS + NLOCK_READERS ? lock_reader : fast_reader;
+		CHECK(pthread_create(&threads[i], NULL, fn, (void *)(uintptr_t)i) == 0);
+	}
+	sleep(seconds);
+	g_stop = true;
+	for (i = 0; i < NTHREADS; i++) {
+		CHECK(pthread_join(threads[i], NULL) == 0);
+	}
+
+	for (i = 0; i < NTHREADS; i++) {
+		ops[i < NWRITERS ? 0 : i < NWRITERS + NLOCK_READERS ? 1 : 2] +=
+			g_ops[i];
+		retries += g_retries[i];
+	}
+	CHECK(g_pte_lo == ops[0] && g_pte_hi == ops[0]);
+	printf("%s: %llu writes, %llu locked reads, %llu fast reads "
+		   "(%llu retries), no violation\n",
+#ifdef __VMX_EPTLOCK_SEQLOCK__
+		   "seqlock",
+#else
+		   "default",
+#endif
+		   (unsigned long long)ops[0], (unsigned long long)ops[1],
+		   (unsigned long long)ops[2], (unsigned long long)retries);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Minimal replacement of <xmhf.h> for compiling memp-x86vmx-eptlock.c as a
+ * userspace program. Only the definitions used by that file are provided.
+ */
+
+#ifndef EPTLOCK_STRESS_XMHF_H
+#define EPTLOCK_STRESS_XMHF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef uintptr_t hva_t;
+
+typedef struct {
+	volatile bool vmx_eptlock_reading;
+} VCPU;
+
+typedef struct {
+	hva_t vcpu_vaddr_ptr;
+} MIDTAB;
+
+extern MIDTAB g_midtable[];
+extern u32 g_midtable_numentries;
+
+#define mb()	asm volatile("mfence" ::: "memory")
+
+static inline void xmhf_cpu_relax(void)
+{
+	asm volatile ("pause");
+}
+
+static inline void spin_lock(volatile u32 *lock)
+{
+	while (!__sync_bool_compare_and_swap(lock, 1, 0)) {
+		xmhf_cpu_relax();
+	}
+}
+
+static inline void spin_unlock(volatile u32 *lock)
+{
+	__sync_lock_test_and_set(lock, 1);
+}
+
+#define HALT_ON_ERRORCOND(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: assertion %s failed\n", __FILE__, \
+					__LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+
+void memprot_x86vmx_eptlock_write_lock(VCPU *vcpu);
+void memprot_x86vmx_eptlock_write_unlock(VCPU *vcpu);
+void memprot_x86vmx_eptlock_read_lock(VCPU *vcpu);
+void memprot_x86vmx_eptlock_read_unlock(VCPU *vcpu);
+u32 memprot_x86vmx_eptlock_read_begin(VCPU *vcpu);
+bool memprot_x86vmx_eptlock_read_retry(VCPU *vcpu, u32 seq);
+u32 memprot_x86vmx_eptlock_generation(void);
+
+#endif /* EPTLOCK_STRESS_XMHF_H */
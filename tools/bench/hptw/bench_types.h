@@ -0,0 +1,19 @@
+/*
+ * Definitions normally provided by libxmhfc, force included when compiling
+ * the libxmhfutil page table sources as a userspace program.
+ */
+
+#ifndef HPTW_BENCH_TYPES_H
+#define HPTW_BENCH_TYPES_H
+
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+/* The benchmark walks invalid addresses on purpose, do not print errors */
+#define EU_LOG_PRINTLN(prefix, fmt, args...) do { (void)(prefix); } while (0)
+
+#endif /* HPTW_BENCH_TYPES_H */
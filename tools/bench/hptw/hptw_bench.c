@@ -0,0 +1,288 @@
+/*
+ * Userspace microbenchmark comparing the generic page table walker in
+ * libxmhfutil (hptw_checked_access_va_generic) with the walkers specialized
+ * for each paging type (hptw_checked_access_va, see hptw_spec.h).
+ *
+ * Build and run from this directory:
+ *   make && ./hptw_bench
+ *
+ * For each paging type, synthetic page tables with random permissions and
+ * large pages are built in memory below 4G (pointers are used as physical
+ * addresses). Both walkers are first run on the same random addresses,
+ * access types and CPLs, and must return the same results. Then both walk
+ * mapped addresses and nanoseconds per walk are printed, once for a context
+ * using hptw_identity_pa2ptr (direct map fast path) and once for a context
+ * with another pa2ptr function.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <hpt.h>
+#include <hptw.h>
+
+#define ARENA_SIZE (64UL << 20)
+#define MAX_VAS (1 << 16)
+#define NCHECKS 200000
+#define NOPS 2000000
+
+static u8 *arena;
+static size_t arena_used;
+static u64 rng_state = 0x123456789abcdefULL;
+
+static hpt_va_t vas[MAX_VAS];
+static u32 nvas;
+
+static u64 rnd(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static hpt_pm_t alloc_pm(void)
+{
+	hpt_pm_t pm;
+	if (arena_used + HPT_PM_SIZE > ARENA_SIZE) {
+		fprintf(stderr, "arena full\n");
+		exit(1);
+	}
+	pm = (hpt_pm_t)(arena + arena_used);
+	arena_used += HPT_PM_SIZE;
+	memset(pm, 0, HPT_PM_SIZE);
+	return pm;
+}
+
+/* Same as hptw_identity_pa2ptr(), but not recognized as direct mapped */
+static void *indirect_pa2ptr(void *vctx, hpt_pa_t pa, size_t sz,
+							 hpt_prot_t access_type, hptw_cpl_t cpl,
+							 size_t *avail_sz)
+{
+	*avail_sz = sz;
+	return (void *)(uintptr_t)pa;
+}
+
+/* Random protection that is valid for the paging type and level */
+static hpt_prot_t rnd_prot(hpt_type_t t, int lvl)
+{
+	static const hpt_prot_t norm[] = { HPT_PROTS_RX, HPT_PROTS_RWX };
+	static const hpt_prot_t pae[] = { HPT_PROTS_RX, HPT_PROTS_RW,
+									  HPT_PROTS_RWX };
+	static const hpt_prot_t lng[] = { HPT_PROTS_R, HPT_PROTS_RX, HPT_PROTS_RW,
+									  HPT_PROTS_RWX };
+	switch (t) {
+	case HPT_TYPE_NORM:
+		return norm[rnd() % 2];
+	case HPT_TYPE_PAE:
+		return lvl == 3 ? HPT_PROTS_RWX : pae[rnd() % 3];
+	case HPT_TYPE_LONG:
+		return lng[rnd() % 4];
+	default:
+		return 1 + rnd() % 7;
+	}
+}
+
+/* Random address of a page of level lvl */
+static hpt_pa_t rnd_page_addr(hpt_type_t t, int lvl)
+{
+	u64 max = (t == HPT_TYPE_NORM) ? (1ULL << 32) : (1ULL << 40);
+	u64 size = 1ULL << (t == HPT_TYPE_NORM ? 12 + 10 * (lvl - 1) :
+						12 + 9 * (lvl - 1));
+	return (rnd() % max) & ~(size - 1);
+}
+
+static int va_idx_lo(hpt_type_t t, int lvl)
+{
+	return t == HPT_TYPE_NORM ? 12 + 10 * (lvl - 1) : 12 + 9 * (lvl - 1);
+}
+
+static int pm_nentries(hpt_type_t t, int lvl)
+{
+	if (t == HPT_TYPE_NORM) {
+		return 1024;
+	} else if (t == HPT_TYPE_PAE && lvl == 3) {
+		return 4;
+	} else {
+		return 512;
+	}
+}
+
+/* Fill page map pm at level lvl mapping virtual addresses from va_base */
+static void build_pm(hpt_type_t t, int lvl, hpt_pm_t pm, hpt_va_t va_base)
+{
+	hpt_pmo_t pmo = { .pm = pm, .t = t, .lvl = lvl };
+	int n = pm_nentries(t, lvl);
+	int fill = lvl == 1 ? n : (n < 8 ? n : 8);
+	bool large_ok = (lvl == 2) || (lvl == 3 && (t == HPT_TYPE_LONG ||
+												 t == HPT_TYPE_EPT));
+	for (int i = 0; i < fill; i++) {
+		int idx = lvl == 1 ? i : (int)(rnd() % n);
+		hpt_va_t va = va_base | ((hpt_va_t)idx << va_idx_lo(t, lvl));
+		hpt_pmeo_t pmeo;
+		u64 r = rnd() % 100;
+		hpt_pm_get_pmeo_by_va(&pmeo, &pmo, va);
+		if (hpt_pmeo_is_present(&pmeo)) {
+			continue;
+		}
+		pmeo = (hpt_pmeo_t) { .pme = 0, .t = t, .lvl = lvl };
+		if (r < 5) {
+			/* Not present */
+			continue;
+		} else if (lvl == 1 || (large_ok && r < 20)) {
+			hpt_pmeo_set_page(&pmeo, true);
+			hpt_pmeo_set_address(&pmeo, rnd_page_addr(t, lvl));
+			hpt_pmeo_setprot(&pmeo, rnd_prot(t, lvl));
+			if (nvas < MAX_VAS) {
+				vas[nvas++] = va | (rnd() & ((1ULL << va_idx_lo(t, lvl)) - 1));
+			}
+		} else {
+			hpt_pm_t child = alloc_pm();
+			hpt_pmeo_set_address(&pmeo, (hpt_pa_t)(uintptr_t)child);
+			hpt_pmeo_setprot(&pmeo, rnd_prot(t, lvl));
+			build_pm(t, lvl - 1, child, va);
+		}
+		if (t != HPT_TYPE_EPT && !(t == HPT_TYPE_PAE && lvl == 3)) {
+			hpt_pmeo_setuser(&pmeo, rnd() % 4 != 0);
+		}
+		hpt_pmo_set_pme_by_va(&pmo, &pmeo, va);
+	}
+}
+
+static double elapsed_ns(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static void check(hptw_ctx_t *ctx, const char *name)
+{
+	static const hpt_prot_t accesses[] = {
+		HPT_PROTS_NONE, HPT_PROTS_R, HPT_PROTS_W, HPT_PROTS_X,
+		HPT_PROTS_RW, HPT_PROTS_RX, HPT_PROTS_RWX,
+	};
+	u32 nok = 0;
+	for (u32 i = 0; i < NCHECKS; i++) {
+		hpt_va_t va = (i % 2) ? vas[rnd() % nvas] : rnd();
+		hpt_prot_t access = accesses[rnd() % 7];
+		hptw_cpl_t cpl = (rnd() % 2) ? HPTW_CPL0 : HPTW_CPL3;
+		size_t req = 1 + rnd() % 8192;
+		hpt_pmeo_t p0, p1;
+		size_t a0, a1;
+		void *r0, *r1;
+		int rc0, rc1;
+		if (ctx->t == HPT_TYPE_NORM || ctx->t == HPT_TYPE_PAE) {
+			va &= 0xffffffffULL;
+		}
+		rc0 = hptw_checked_get_pmeo_generic(&p0, ctx, access, cpl, va);
+		rc1 = hptw_checked_get_pmeo(&p1, ctx, access, cpl, va);
+		if (rc0 != rc1 || (rc0 == 0 && (p0.pme != p1.pme || p0.t != p1.t ||
+										p0.lvl != p1.lvl))) {
+			fprintf(stderr, "%s: get_pmeo mismatch at va 0x%llx\n", name,
+					(unsigned long long)va);
+			exit(1);
+		}
+		r0 = hptw_checked_access_va_generic(ctx, access, cpl, va, req, &a0);
+		r1 = hptw_checked_access_va(ctx, access, cpl, va, req, &a1);
+		if (r0 != r1 || (r0 && a0 != a1)) {
+			fprintf(stderr, "%s: access_va mismatch at va 0x%llx\n", name,
+					(unsigned long long)va);
+			exit(1);
+		}
+		nok += (rc0 == 0);
+	}
+	printf("%-6s checked %u walks (%u valid), no mismatch\n", name, NCHECKS,
+		   nok);
+}
+
+static double bench(hptw_ctx_t *ctx, bool generic)
+{
+	struct timespec t0, t1;
+	uintptr_t sum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (u32 i = 0; i < NOPS; i++) {
+		hpt_va_t va = vas[i % nvas];
+		size_t avail;
+		void *p;
+		if (generic) {
+			p = hptw_checked_access_va_generic(ctx, HPT_PROTS_NONE,
+											   HPTW_CPL0, va, 1, &avail);
+		} else {
+			p = hptw_checked_access_va(ctx, HPT_PROTS_NONE, HPTW_CPL0, va, 1,
+									   &avail);
+		}
+		sum += (uintptr_t)p + avail;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (sum == 1) {
+		printf("unlikely\n");
+	}
+	return elapsed_ns(&t0, &t1) / NOPS;
+}
+
+int main(void)
+{
+	static const struct {
+		hpt_type_t t;
+		const char *name;
+	} types[] = {
+		{ HPT_TYPE_NORM, "NORM" },
+		{ HPT_TYPE_PAE, "PAE" },
+		{ HPT_TYPE_LONG, "LONG" },
+		{ HPT_TYPE_EPT, "EPT" },
+	};
+
+	arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (arena == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	printf("%-6s %12s %12s %12s %12s\n", "type", "generic", "spec",
+		   "generic", "spec");
+	printf("%-6s %12s %12s %12s %12s\n", "", "(direct)", "(direct)",
+		   "(indirect)", "(indirect)");
+	for (u32 i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		hpt_type_t t = types[i].t;
+		hpt_pm_t root;
+		hptw_ctx_t direct, indirect;
+		double ns[4];
+		u32 j = 0;
+
+		arena_used = 0;
+		nvas = 0;
+		root = alloc_pm();
+		build_pm(t, hpt_root_lvl(t), root, 0);
+		/* Discard addresses that do not resolve */
+		direct = (hptw_ctx_t) {
+			.pa2ptr = hptw_identity_pa2ptr,
+			.root_pa = (hpt_pa_t)(uintptr_t)root,
+			.t = t,
+		};
+		indirect = direct;
+		indirect.pa2ptr = indirect_pa2ptr;
+		for (u32 k = 0; k < nvas; k++) {
+			hpt_pmeo_t pmeo;
+			if (!hptw_checked_get_pmeo_generic(&pmeo, &direct, HPT_PROTS_NONE,
+											   HPTW_CPL0, vas[k])) {
+				vas[j++] = vas[k];
+			}
+		}
+		nvas = j;
+
+		check(&direct, types[i].name);
+		check(&indirect, types[i].name);
+		ns[0] = bench(&direct, true);
+		ns[1] = bench(&direct, false);
+		ns[2] = bench(&indirect, true);
+		ns[3] = bench(&indirect, false);
+		printf("%-6s %10.1fns %10.1fns %10.1fns %10.1fns\n", types[i].name,
+			   ns[0], ns[1], ns[2], ns[3]);
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Userspace microbenchmark comparing the linear LRU in xmhf-lru.h with the
+ * hashed LRU in xmhf-lru-hash.h.
+ *
+ * Build and run from this directory:
+ *   make && ./lru_bench
+ *
+ * For each set size, both implementations run the same random key sequence
+ * (keys are 4K aligned, like EPT12 pointers). The benchmark checks that they
+ * report the same hit / miss for every access, then prints nanoseconds per
+ * operation.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#include "../../../xmhf/src/xmhf-core/include/stl/xmhf-lru.h"
+#include "../../../xmhf/src/xmhf-core/include/stl/xmhf-lru-hash.h"
+
+#define NOPS 2000000
+
+#define DEFINE_BENCH(N) \
+LRU_NEW_SET(lin_set_##N##_t, lin_line_##N##_t, N, u32, u64, u64); \
+LRU_HASH_NEW_SET(hash_set_##N##_t, hash_line_##N##_t, N, u32, u64, u64); \
+static lin_set_##N##_t lin_set_##N; \
+static hash_set_##N##_t hash_set_##N; \
+\
+static void bench_##N(const u64 *keys, u32 nkeys) \
+{ \
+	struct timespec t0, t1, t2; \
+	u32 i; \
+	u32 index; \
+	bool hit; \
+	u32 nhit = 0; \
+	u8 *hits = malloc(nkeys); \
+	LRU_SET_INIT(&lin_set_##N); \
+	LRU_HASH_SET_INIT(&hash_set_##N); \
+	clock_gettime(CLOCK_MONOTONIC, &t0); \
+	for (i = 0; i < nkeys; i++) { \
+		lin_line_##N##_t *line = LRU_SET_FIND_EVICT(&lin_set_##N, keys[i], \
+													index, hit); \
+		line->value = index; \
+		hits[i] = hit; \
+		if ((keys[i] & 0xff000) == 0) { \
+			LRU_SET_INVALIDATE(&lin_set_##N, keys[i], line); \
+		} \
+	} \
+	clock_gettime(CLOCK_MONOTONIC, &t1); \
+	for (i = 0; i < nkeys; i++) { \
+		hash_line_##N##_t *line = LRU_HASH_SET_FIND_EVICT(&hash_set_##N, \
+														  keys[i], index, \
+														  hit); \
+		line->value = index; \
+		if (hits[i] != hit) { \
+			printf("Mismatch at %u (N=%d)\n", i, N); \
+			exit(1); \
+		} \
+		nhit += hit; \
+		if ((keys[i] & 0xff000) == 0) { \
+			LRU_HASH_SET_INVALIDATE(&hash_set_##N, keys[i], line); \
+		} \
+	} \
+	clock_gettime(CLOCK_MONOTONIC, &t2); \
+	printf("%6d %8.1f%% %10.1f %10.1f\n", N, 100.0 * nhit / nkeys, \
+		   ns_diff(&t0, &t1) / nkeys, ns_diff(&t1, &t2) / nkeys); \
+	free(hits); \
+}
+
+static double ns_diff(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+DEFINE_BENCH(4)
+DEFINE_BENCH(8)
+DEFINE_BENCH(16)
+DEFINE_BENCH(32)
+DEFINE_BENCH(64)
+DEFINE_BENCH(128)
+DEFINE_BENCH(256)
+
+/*
+ * Generate keys from a working set slightly larger than the cache, with a
+ * skewed distribution so that both hits and capacity misses occur.
+ */
+static void gen_keys(u64 *keys, u32 nkeys, u32 nlines)
+{
+	u32 i;
+	u32 wset = nlines + nlines / 4 + 1;
+	for (i = 0; i < nkeys; i++) {
+		u32 r = (u32)rand() % wset;
+		if (rand() % 4 != 0) {
+			r %= (nlines / 2 + 1);
+		}
+		keys[i] = 0x100000000ULL + ((u64)r << 12);
+	}
+}
+
+int main(void)
+{
+	u64 *keys = malloc(sizeof(u64) * NOPS);
+	srand(1);
+	printf("%6s %9s %10s %10s\n", "lines", "hit", "linear ns", "hash ns");
+#define RUN(N) gen_keys(keys, NOPS, N); bench_##N(keys, NOPS);
+	RUN(4)
+	RUN(8)
+	RUN(16)
+	RUN(32)
+	RUN(64)
+	RUN(128)
+	RUN(256)
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Userspace stress test and microbenchmark for the XMHF heap (xmhf-mm.c).
+ *
+ * Build and run from this directory:
+ *   make && ./mm_stress
+ *
+ * NTHREADS threads run on stacks inside a fake g_cpustacks, so that each of
+ * them uses the per-CPU caches of a different CPU, and one more thread runs
+ * on its own stack (the locked path used before the runtime stacks are set
+ * up). Each thread allocates and frees random sizes and alignments, checks
+ * that returned memory is zeroed, aligned and not shared with another
+ * allocation, and frees memory allocated by other threads. Then allocation
+ * records are exercised, and nanoseconds per malloc / free pair are printed
+ * for each size class.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+
+#include "xmhf.h"
+
+#define NTHREADS (MAX_VCPU_ENTRIES - 1)
+#define NSLOTS 512
+#define NOPS 200000
+#define NRECORDS 4000
+#define NBENCH 2000000
+
+u8 g_cpustacks[RUNTIME_STACK_SIZE * MAX_VCPU_ENTRIES]
+	__attribute__((aligned(PAGE_SIZE_4K)));
+
+struct slot {
+	u8 *p;
+	size_t size;
+	u8 tag;
+};
+
+/* Allocations handed between threads, freed by the next thread */
+static struct slot handoff[NTHREADS + 1][NSLOTS];
+static volatile u32 handoff_lock = 1;
+
+static u64 rnd(u64 *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static size_t rnd_size(u64 *state)
+{
+	switch (rnd(state) % 8) {
+	case 0:
+		return PAGE_SIZE_4K;
+	case 1:
+		return 1 + rnd(state) % (4 * PAGE_SIZE_4K);
+	default:
+		return 1 + rnd(state) % 2048;
+	}
+}
+
+static void check_and_free(struct slot *s)
+{
+	size_t i;
+	for (i = 0; i < s->size; i++) {
+		HALT_ON_ERRORCOND(s->p[i] == s->tag);
+	}
+	xmhf_mm_free(s->p);
+	s->p = NULL;
+}
+
+static void *worker(void *arg)
+{
+	u32 id = (u32)(uintptr_t)arg;
+	u64 state = 0x9e3779b97f4a7c15ULL * (id + 1);
+	struct slot slots[NSLOTS];
+	u32 i, j;
+
+	memset(slots, 0, sizeof(slots));
+	for (i = 0; i < NOPS; i++) {
+		struct slot *s = &slots[rnd(&state) % NSLOTS];
+		u32 align = 0;
+		size_t k;
+
+		if (s->p) {
+			if (rnd(&state) % 16 == 0) {
+				/* Give it to the next thread */
+				struct slot *h = &handoff[(id + 1) % (NTHREADS + 1)]
+					[rnd(&state) % NSLOTS];
+				struct slot old;
+				spin_lock(&handoff_lock);
+				old = *h;
+				*h = *s;
+				spin_unlock(&handoff_lock);
+				s->p = NULL;
+				if (old.p) {
+					check_and_free(&old);
+				}
+			} else {
+				check_and_free(s);
+			}
+			continue;
+		}
+
+		s->size = rnd_size(&state);
+		if (rnd(&state) % 4 == 0) {
+			align = 1U << (3 + rnd(&state) % 10);
+		}
+		s->p = xmhf_mm_malloc_align(align, s->size);
+		HALT_ON_ERRORCOND(s->p != NULL);
+		if (align) {
+			HALT_ON_ERRORCOND(((uintptr_t)s->p & (align - 1)) == 0);
+		}
+		s->tag = (u8)(rnd(&state) | 1);
+		for (k = 0; k < s->size; k++) {
+			HALT_ON_ERRORCOND(s->p[k] == 0);
+			s->p[k] = s->tag;
+		}
+	}
+	for (j = 0; j < NSLOTS; j++) {
+		if (slots[j].p) {
+			check_and_free(&slots[j]);
+		}
+	}
+	return NULL;
+}
+
+static void run_threads(void *(*fn)(void *))
+{
+	pthread_t threads[NTHREADS + 1];
+	u32 i;
+
+	for (i = 0; i <= NTHREADS; i++) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (i < NTHREADS) {
+			/* CPU i + 1; CPU 0 is left to the main thread's benchmark */
+			pthread_attr_setstack(&attr,
+								  g_cpustacks + (i + 1) * RUNTIME_STACK_SIZE,
+								  RUNTIME_STACK_SIZE);
+		}
+		if (pthread_create(&threads[i], &attr, fn, (void *)(uintptr_t)i)) {
+			perror("pthread_create");
+			exit(1);
+		}
+		pthread_attr_destroy(&attr);
+	}
+	for (i = 0; i <= NTHREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+static void *records(void *arg)
+{
+	static void *ptrs[NRECORDS];
+	XMHFList *list = xmhfstl_list_create();
+	u64 state = 42;
+	u32 i;
+
+	for (i = 0; i < NRECORDS; i++) {
+		if (i % 4 == 0) {
+			ptrs[i] = xmhf_mm_alloc_page_with_record(list, 1);
+		} else {
+			ptrs[i] = xmhf_mm_malloc_with_record(list, rnd_size(&state));
+		}
+		HALT_ON_ERRORCOND(ptrs[i] != NULL);
+	}
+	for (i = 0; i < NRECORDS; i += 2) {
+		xmhf_mm_free_from_record(list, ptrs[i]);
+	}
+	HALT_ON_ERRORCOND(XMHFList_count(list) == NRECORDS / 2);
+	xmhf_mm_free_all_records(list);
+	return arg;
+}
+
+static double elapsed_ns(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static void *bench(void *arg)
+{
+	static const size_t sizes[] = { 16, 64, 256, 2048, 4096, 3 * 4096 };
+	u32 i, j;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		struct timespec t0, t1;
+		void *p[16];
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (j = 0; j < NBENCH; j++) {
+			if (j >= 16) {
+				xmhf_mm_free(p[j % 16]);
+			}
+			p[j % 16] = xmhf_mm_malloc(sizes[i]);
+		}
+		for (j = 0; j < 16; j++) {
+			xmhf_mm_free(p[j]);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		printf("%6zu B: %8.1f ns per malloc + free (%s)\n", sizes[i],
+			   elapsed_ns(&t0, &t1) / NBENCH, arg ? "per-CPU" : "global");
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t t;
+	pthread_attr_t attr;
+
+	xmhf_mm_init();
+
+	run_threads(worker);
+	printf("stress: %u threads x %u ops, no corruption\n", NTHREADS + 1, NOPS);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, g_cpustacks, RUNTIME_STACK_SIZE);
+	pthread_create(&t, &attr, records, NULL);
+	pthread_join(t, NULL);
+	printf("records: %u allocations, no error\n", NRECORDS);
+
+	pthread_create(&t, &attr, bench, (void *)1);
+	pthread_join(t, NULL);
+	bench(NULL);
+
+	xmhf_mm_print_stats();
+	xmhf_mm_fini();
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Minimal replacement of <xmhf.h> for compiling xmhf-mm.c, xmhf-tlsf.c and
+ * xmhfc-dlist.c as a userspace program. Only the definitions used by those
+ * files are provided.
+ */
+
+#ifndef MM_STRESS_XMHF_H
+#define MM_STRESS_XMHF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef uintptr_t hva_t;
+
+#define PAGE_SHIFT_4K		12
+#define PAGE_SIZE_4K		(1UL << PAGE_SHIFT_4K)
+#define PAGE_ALIGNED_4K(x)	(((x) & (PAGE_SIZE_4K - 1)) == 0)
+
+#define MAX_VCPU_ENTRIES	8
+#define RUNTIME_STACK_SIZE	65536
+
+extern u8 g_cpustacks[];
+
+static inline void spin_lock(volatile u32 *lock)
+{
+	while (!__sync_bool_compare_and_swap(lock, 1, 0)) {
+		asm volatile ("pause");
+	}
+}
+
+static inline void spin_unlock(volatile u32 *lock)
+{
+	__sync_lock_test_and_set(lock, 1);
+}
+
+#define HALT_ON_ERRORCOND(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: assertion %s failed\n", __FILE__, \
+					__LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+
+#include <stl/xmhfc-dlist.h>
+#include <xmhf-mm.h>
+
+#endif /* MM_STRESS_XMHF_H */
@@ -0,0 +1,410 @@
+/*
+ * Userspace microbenchmark comparing the switch statements previously used to
+ * emulate L1's VMREAD / VMWRITE with the encoding-indexed VMCS12 field table
+ * in nested-x86vmx-vmcs12-access.c.
+ *
+ * Build and run from this directory:
+ *   make && ./vmcs12_bench [trace]
+ *
+ * A trace is a text file with one VMREAD / VMWRITE per line:
+ *   r <encoding> <operand size>
+ *   w <encoding> <operand size>
+ * Encodings are in hex. Without a trace, a built-in trace is used. It
+ * resembles a KVM L1 handling L2 VMEXITs without shadow VMCS: reading exit
+ * information and guest state, then writing guest RIP and event injection.
+ *
+ * First every encoding in 0 - 0x7fff (and some with higher bits set) is
+ * checked: both implementations must agree on readability, writability and
+ * the dirty bitmap index, and reads / writes with each operand size must
+ * produce the same values and the same VMCS12 contents. Then the trace is
+ * replayed by both implementations, which must produce identical results,
+ * and nanoseconds per access are printed.
+ */
+
+#include <time.h>
+
+#include "xmhf.h"
+#include "nested-x86vmx-vmcs12-access.h"
+
+#define NREPLAY 200000
+#define MAX_TRACE (1 << 16)
+
+struct access {
+	bool write;
+	ulong_t encoding;
+	size_t size;
+};
+
+static struct access trace[MAX_TRACE];
+static u32 ntrace;
+static u64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static u64 rnd(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+/* Switch based implementation, as in nested-x86vmx-vmcs12.c before */
+
+static bool ref_readable(ulong_t encoding)
+{
+	switch (encoding) {
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	case encoding: \
+		return true;
+#define DECLARE_FIELD_64(encoding, name, ...) \
+	case encoding: \
+		return true; \
+	case encoding + 1: \
+		return true;
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
+	default:
+		return false;
+	}
+}
+
+static bool ref_writable(ulong_t encoding)
+{
+	switch (encoding) {
+#define DECLARE_FIELD_16_RW(encoding, name, ...) \
+	case encoding: \
+		return true;
+#define DECLARE_FIELD_64_RW(encoding, name, ...) \
+	case encoding: \
+		return true; \
+	case encoding + 1: \
+		return true;
+#define DECLARE_FIELD_32_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
+	default:
+		return false;
+	}
+}
+
+static ulong_t ref_read(struct _vmx_vmcsfields *vmcs12, ulong_t encoding,
+						size_t size)
+{
+	switch (encoding) {
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	case encoding: \
+		return (ulong_t) vmcs12->name;
+#define DECLARE_FIELD_64(encoding, name, ...) \
+	case encoding: \
+		if (size == sizeof(u64)) { \
+			return (ulong_t) vmcs12->name; \
+		} else { \
+			HALT_ON_ERRORCOND(size == sizeof(u32)); \
+			return (ulong_t) *(u32 *)(void *)&vmcs12->name; \
+		} \
+	case encoding + 1: \
+		HALT_ON_ERRORCOND(size == sizeof(u32)); \
+		return (ulong_t) ((u32 *)(void *)&vmcs12->name)[1];
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
+	default:
+		HALT_ON_ERRORCOND(0 && "Unknown guest VMCS field");
+		return 0;
+	}
+}
+
+static void ref_write(struct _vmx_vmcsfields *vmcs12, ulong_t encoding,
+					  ulong_t value, size_t size)
+{
+	switch (encoding) {
+#define DECLARE_FIELD_16_RO(encoding, name, ...) \
+	case encoding: \
+		HALT_ON_ERRORCOND(0 && "Write to read-only VMCS field"); \
+		break;
+#define DECLARE_FIELD_64_RO(encoding, name, ...) \
+	case encoding: \
+		HALT_ON_ERRORCOND(0 && "Write to read-only VMCS field"); \
+		break; \
+	case encoding + 1: \
+		HALT_ON_ERRORCOND(0 && "Write to read-only VMCS field"); \
+		break;
+#define DECLARE_FIELD_32_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_16_RW(encoding, name, ...) \
+	case encoding: \
+		vmcs12->name = (u16) value; \
+		break;
+#define DECLARE_FIELD_64_RW(encoding, name, ...) \
+	case encoding: \
+		if (size == sizeof(u64)) { \
+			vmcs12->name = (u64) value; \
+		} else { \
+			HALT_ON_ERRORCOND(size == sizeof(u32)); \
+			*(u32 *)(void *)&vmcs12->name = (u32) value; \
+		} \
+		break; \
+	case encoding + 1: \
+		HALT_ON_ERRORCOND(size == sizeof(u32)); \
+		((u32 *)(void *)&vmcs12->name)[1] = (u32) value; \
+		break;
+#define DECLARE_FIELD_32_RW(encoding, name, ...) \
+	case encoding: \
+		vmcs12->name = (u32) value; \
+		break;
+#define DECLARE_FIELD_NW_RW(encoding, name, ...) \
+	case encoding: \
+		vmcs12->name = (ulong_t) value; \
+		break;
+#include "nested-x86vmx-vmcs12-fields.h"
+	default:
+		HALT_ON_ERRORCOND(0 && "Unknown guest VMCS field");
+	}
+}
+
+/* Index in the dirty bitmap, as computed by the old mark_dirty */
+static u32 ref_index(ulong_t encoding)
+{
+	switch (encoding) {
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	case encoding: \
+		return VMCSIDX_##name;
+#define DECLARE_FIELD_64(encoding, name, ...) \
+	case encoding: \
+	case encoding + 1: \
+		return VMCSIDX_##name;
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
+	default:
+		HALT_ON_ERRORCOND(0 && "Unknown guest VMCS field");
+		return 0;
+	}
+}
+
+static u32 new_index(ulong_t encoding)
+{
+	const vmcs12_field_t *field = vmcs12_field_lookup(encoding);
+	HALT_ON_ERRORCOND(field != NULL);
+	return field->index;
+}
+
+static void fill_random(struct _vmx_vmcsfields *vmcs12)
+{
+	u8 *p = (u8 *)vmcs12;
+	size_t i;
+	for (i = 0; i < sizeof(*vmcs12); i++) {
+		p[i] = (u8)rnd();
+	}
+}
+
+static void check_encoding(ulong_t encoding)
+{
+	static struct _vmx_vmcsfields a, b;
+	static const size_t sizes[] = { sizeof(u32), sizeof(u64) };
+	bool readable = ref_readable(encoding);
+	bool writable = ref_writable(encoding);
+	u32 i;
+
+	if (readable != xmhf_nested_arch_x86vmx_vmcs_readable(encoding) ||
+		writable != xmhf_nested_arch_x86vmx_vmcs_writable(encoding)) {
+		fprintf(stderr, "permission mismatch at encoding 0x%lx\n", encoding);
+		exit(1);
+	}
+	if (!readable) {
+		return;
+	}
+	if (ref_index(encoding) != new_index(encoding)) {
+		fprintf(stderr, "index mismatch at encoding 0x%lx\n", encoding);
+		exit(1);
+	}
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t size = sizes[i];
+		ulong_t value = (ulong_t)rnd();
+		/* 64-bit fields only allow 32-bit high access */
+		if ((encoding & 1) && size != sizeof(u32)) {
+			continue;
+		}
+		fill_random(&a);
+		b = a;
+		if (ref_read(&a, encoding, size) !=
+			xmhf_nested_arch_x86vmx_vmcs_read(&b, encoding, size)) {
+			fprintf(stderr, "read mismatch at encoding 0x%lx size %zu\n",
+					encoding, size);
+			exit(1);
+		}
+		if (!writable) {
+			continue;
+		}
+		ref_write(&a, encoding, value, size);
+		xmhf_nested_arch_x86vmx_vmcs_write(&b, encoding, value, size);
+		if (memcmp(&a, &b, sizeof(a)) != 0) {
+			fprintf(stderr, "write mismatch at encoding 0x%lx size %zu\n",
+					encoding, size);
+			exit(1);
+		}
+	}
+}
+
+static void add_access(bool write, ulong_t encoding, size_t size)
+{
+	if (ntrace >= MAX_TRACE) {
+		fprintf(stderr, "trace too long\n");
+		exit(1);
+	}
+	trace[ntrace++] = (struct access) { write, encoding, size };
+}
+
+static void load_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char op;
+	unsigned long encoding;
+	size_t size;
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fscanf(f, " %c %lx %zu", &op, &encoding, &size) == 3) {
+		if ((op != 'r' && op != 'w') ||
+			(size != sizeof(u32) && size != sizeof(u64))) {
+			fprintf(stderr, "%s: bad line %u\n", path, ntrace + 1);
+			exit(1);
+		}
+		add_access(op == 'w', encoding, size);
+	}
+	fclose(f);
+}
+
+/* Accesses by L1 when handling one L2 VMEXIT */
+static void builtin_trace(void)
+{
+	static const ulong_t reads[] = {
+		0x4402,					/* VM-exit reason */
+		0x6400,					/* Exit qualification */
+		0x4404,					/* VM-exit interruption information */
+		0x4408,					/* IDT-vectoring information */
+		0x440C,					/* VM-exit instruction length */
+		0x681E,					/* Guest RIP */
+		0x681C,					/* Guest RSP */
+		0x6820,					/* Guest RFLAGS */
+		0x4824,					/* Guest interruptibility state */
+		0x0802,					/* Guest CS selector */
+		0x6800,					/* Guest CR0 */
+		0x6802,					/* Guest CR3 */
+		0x2400,					/* Guest-physical address */
+		0x2010,					/* TSC offset */
+	};
+	static const ulong_t writes[] = {
+		0x681E,					/* Guest RIP */
+		0x4824,					/* Guest interruptibility state */
+		0x4016,					/* VM-entry interruption information */
+		0x401A,					/* VM-entry instruction length */
+		0x2010,					/* TSC offset */
+	};
+	u32 i, j;
+	for (i = 0; i < 64; i++) {
+		for (j = 0; j < sizeof(reads) / sizeof(reads[0]); j++) {
+			if (j < 6 || rnd() % 4 == 0) {
+				add_access(false, reads[j], sizeof(u64));
+			}
+		}
+		for (j = 0; j < sizeof(writes) / sizeof(writes[0]); j++) {
+			if (j == 0 || rnd() % 4 == 0) {
+				add_access(true, writes[j], sizeof(u64));
+			}
+		}
+	}
+}
+
+static double elapsed_ns(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+/*
+ * Replay the trace the way the VMREAD / VMWRITE intercepts do. Return the sum
+ * of values read, which must be the same for both implementations.
+ */
+static u64 replay(struct _vmx_vmcsfields *vmcs12, vmcs_bitmap_t *dirty,
+				  bool ref, u32 n)
+{
+	u64 sum = 0;
+	u32 i, j;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < ntrace; j++) {
+			struct access *a = &trace[j];
+			if (ref) {
+				if (!a->write && ref_readable(a->encoding)) {
+					sum += ref_read(vmcs12, a->encoding, a->size);
+				} else if (a->write && ref_writable(a->encoding)) {
+					ref_write(vmcs12, a->encoding, sum + j, a->size);
+					vmcs_bitmap_set(dirty, ref_index(a->encoding));
+				}
+			} else {
+				if (!a->write &&
+					xmhf_nested_arch_x86vmx_vmcs_readable(a->encoding)) {
+					sum += xmhf_nested_arch_x86vmx_vmcs_read(vmcs12,
+															 a->encoding,
+															 a->size);
+				} else if (a->write &&
+						   xmhf_nested_arch_x86vmx_vmcs_writable(a->encoding)) {
+					xmhf_nested_arch_x86vmx_vmcs_write(vmcs12, a->encoding,
+													   sum + j, a->size);
+					vmcs_bitmap_set(dirty, new_index(a->encoding));
+				}
+			}
+		}
+	}
+	return sum;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct _vmx_vmcsfields a, b;
+	vmcs_bitmap_t dirty_a, dirty_b;
+	struct timespec t0, t1, t2;
+	u64 sum_a, sum_b;
+	ulong_t encoding;
+	u32 i, n;
+
+	for (encoding = 0; encoding < 0x8000; encoding++) {
+		check_encoding(encoding);
+	}
+	for (i = 0; i < 100000; i++) {
+		check_encoding((ulong_t)rnd());
+	}
+	printf("checked all encodings, no mismatch\n");
+
+	if (argc > 1) {
+		load_trace(argv[1]);
+	} else {
+		builtin_trace();
+	}
+	if (ntrace == 0) {
+		fprintf(stderr, "empty trace\n");
+		return 1;
+	}
+	n = NREPLAY * 64 / ntrace + 1;
+
+	fill_random(&a);
+	b = a;
+	memset(&dirty_a, 0, sizeof(dirty_a));
+	memset(&dirty_b, 0, sizeof(dirty_b));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sum_a = replay(&a, &dirty_a, true, n);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sum_b = replay(&b, &dirty_b, false, n);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	if (sum_a != sum_b || memcmp(&a, &b, sizeof(a)) != 0 ||
+		memcmp(&dirty_a, &dirty_b, sizeof(dirty_a)) != 0) {
+		fprintf(stderr, "replay mismatch\n");
+		return 1;
+	}
+	printf("replayed %u accesses x %u, identical results\n", ntrace, n);
+	printf("switch: %6.2f ns per access\n",
+		   elapsed_ns(&t0, &t1) / ((double)ntrace * n));
+	printf("table:  %6.2f ns per access\n",
+		   elapsed_ns(&t1, &t2) / ((double)ntrace * n));
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Minimal replacement of <xmhf.h> for compiling nested-x86vmx-vmcs12-access.c
+ * as a userspace program. Only the definitions used by that file are
+ * provided.
+ */
+
+#ifndef VMCS12_BENCH_XMHF_H
+#define VMCS12_BENCH_XMHF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef unsigned long ulong_t;
+
+#define HALT_ON_ERRORCOND(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: assertion %s failed\n", __FILE__, \
+					__LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+
+#include <arch/x86/_vmx.h>
+
+#endif /* VMCS12_BENCH_XMHF_H */
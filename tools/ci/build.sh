@@ -6,11 +6,15 @@
 #   --dmap: enable DMAP (--disable-dmap)
 #   --vga: use VGA instead of serial (--disable-debug-serial --enable-debug-vga)
 #   --event-logger: enable event logger (--enable-debug-event-logger)
+#   --trace-ring: log events to binary trace rings (--enable-debug-trace-ring)
 #   --no-dbg: do not use QEMU debug workarounds (--enable-debug-qemu)
 #   --no-ucode: disable Intel microcode update (--enable-update-intel-ucode)
 #   --app APP: set hypapp, default is "hypapps/trustvisor" (--with-approot)
 #   --mem MEM: if amd64, set physical memory, default is 0x140000000 (5GiB)
 #   --no-x2apic: hide x2APIC to workaround a bug (--enable-hide-x2apic)
+#   --seqlock: use sequence lock for EPT walks (--enable-vmx-eptlock-seqlock)
+#   --shared-ept: share one EPT among all CPUs (--enable-vmx-shared-ept)
+#   --no-hc-quiesce: do not quiesce in hypercalls (--disable-quiesce-in-hypercall)
 #   --no-rt-bss: skip runtime bss in image (--enable-skip-runtime-bss)
 #   --no-bl-hash: skip bootloader hashing (--enable-skip-bootloader-hash)
 #   --no-init-smp: disable SMP in bootloader (--enable-skip-init-smp)
@@ -21,6 +25,8 @@
 #   no_nv: disable nested virtualization (--disable-nested-virtualization)
 #   --ept-num EPT_NUM: # max active ept (--with-vmx-nested-max-active-ept)
 #   --ept-pool EPT_POOL: pool for ept (--with-vmx-nested-ept02-page-pool-size)
+#   --ept-prefetch NUM: EPT02 prefetch window (--with-vmx-nested-ept02-prefetch-window)
+#   --vpid-num VPID_NUM: # max active vpid (--with-vmx-nested-max-active-vpid)
 #   release: equivalent to --drt --dmap --no-dbg (For GitHub actions)
 #   debug: ignored (For GitHub actions)
 #   O0: ignored (For GitHub actions)
@@ -41,12 +47,16 @@ DRT="n"
 DMAP="n"
 VGA="n"
 EVENT_LOGGER="n"
+TRACE_RING="n"
 QEMU="y"
 UCODE="y"
 AMD64MEM="0x140000000"
 DRY_RUN="n"
 CIRCLE_CI="n"
 NO_X2APIC="n"
+EPTLOCK_SEQLOCK="n"
+SHARED_EPT="n"
+NO_HC_QUIESCE="n"
 NO_RT_BSS="n"
 NO_BL_HASH="n"
 NO_INIT_SMP="n"
@@ -55,6 +65,8 @@ SL_BASE="0x10000000"
 NV="y"
 EPT_NUM="8"
 EPT_POOL="512"
+EPT_PREFETCH="16"
+VPID_NUM="256"
 OPT=""
 
 # Determine LINUX_BASE (may not be 100% correct all the time)
@@ -116,6 +128,10 @@ while [ "$#" -gt 0 ]; do
 		--event-logger)
 			EVENT_LOGGER="y"
 			;;
+		--trace-ring)
+			EVENT_LOGGER="y"
+			TRACE_RING="y"
+			;;
 		--no-dbg)
 			QEMU="n"
 			;;
@@ -133,6 +149,15 @@ while [ "$#" -gt 0 ]; do
 		--no-x2apic)
 			NO_X2APIC="y"
 			;;
+		--seqlock)
+			EPTLOCK_SEQLOCK="y"
+			;;
+		--shared-ept)
+			SHARED_EPT="y"
+			;;
+		--no-hc-quiesce)
+			NO_HC_QUIESCE="y"
+			;;
 		--no-rt-bss)
 			NO_RT_BSS="y"
 			;;
@@ -168,6 +193,14 @@ while [ "$#" -gt 0 ]; do
 			EPT_POOL="$2"
 			shift
 			;;
+		--ept-prefetch)
+			EPT_PREFETCH="$2"
+			shift
+			;;
+		--vpid-num)
+			VPID_NUM="$2"
+			shift
+			;;
 		release)
 			# For GitHub actions
             # DRT="y" # Force disable DRT because (1) We need to separate Intel code and AMD code to reduce its size, 
@@ -244,6 +277,10 @@ if [ "$EVENT_LOGGER" == "y" ]; then
 	CONF+=("--enable-debug-event-logger")
 fi
 
+if [ "$TRACE_RING" == "y" ]; then
+	CONF+=("--enable-debug-trace-ring")
+fi
+
 if [ "$QEMU" == "y" ]; then
 	CONF+=("--enable-debug-qemu")
 fi
@@ -262,6 +299,18 @@ if [ "$NO_X2APIC" == "y" ]; then
 	CONF+=("--enable-hide-x2apic")
 fi
 
+if [ "$EPTLOCK_SEQLOCK" == "y" ]; then
+	CONF+=("--enable-vmx-eptlock-seqlock")
+fi
+
+if [ "$SHARED_EPT" == "y" ]; then
+	CONF+=("--enable-vmx-shared-ept")
+fi
+
+if [ "$NO_HC_QUIESCE" == "y" ]; then
+	CONF+=("--disable-quiesce-in-hypercall")
+fi
+
 if [ "$NO_RT_BSS" == "y" ]; then
 	CONF+=("--enable-skip-runtime-bss")
 fi
@@ -286,6 +335,8 @@ if [ "$NV" == "y" ]; then
 	CONF+=("--enable-nested-virtualization")
 	CONF+=("--with-vmx-nested-max-active-ept=$EPT_NUM")
 	CONF+=("--with-vmx-nested-ept02-page-pool-size=$EPT_POOL")
+	CONF+=("--with-vmx-nested-ept02-prefetch-window=$EPT_PREFETCH")
+	CONF+=("--with-vmx-nested-max-active-vpid=$VPID_NUM")
 fi
 
 # Output configure arguments, if `-n`
@@ -0,0 +1,96 @@
+'''
+Decode binary trace records in XMHF serial output.
+
+XMHF configured with --enable-debug-trace-ring sends event logger events as
+16 byte frames (see XMHF_DBG_TRACE_* in xmhf-debug.h) mixed with normal text
+output. This script prints the text unchanged and each frame as one line:
+
+	TR[cpu]: tsc=<tsc> +<cycles since previous record of cpu> <event> <key>
+
+Cd to XMHF's directory, then run
+"python3 tools/trace/decode_trace.py serial.log". Event names and key formats
+are read from xmhf-debug-event-logger-fields.h. Use --no-nv if XMHF is built
+with --disable-nested-virtualization.
+'''
+
+import argparse, re, sys
+
+FIELDS = 'xmhf/src/xmhf-core/include/xmhf-debug-event-logger-fields.h'
+
+SYNC = 0xff
+FRAME_SIZE = 16
+LOST = 0xff
+
+def read_fields(path, nested):
+	'''Return list of (name, key_fmt) indexed by xmhf_dbg_eventlog_t'''
+	ans = []
+	enabled = [True]
+	for line in open(path):
+		line = line.strip()
+		if line.startswith('#ifdef __NESTED_VIRTUALIZATION__'):
+			enabled.append(nested)
+		elif line.startswith('#if'):
+			enabled.append(enabled[-1])
+		elif line.startswith('#endif'):
+			enabled.pop()
+		elif line.startswith('DEFINE_EVENT_FIELD(') and all(enabled):
+			# DEFINE_EVENT_FIELD(vmexit_cpuid, u32, "%d", 4, u16, u32, "0x%08x")
+			matched = re.fullmatch(r'DEFINE_EVENT_FIELD\((\w+),.*"([^"]*)"\)',
+									line)
+			name, key_fmt = matched.groups()
+			# Python does not know length modifiers
+			ans.append((name, re.sub('(hh|h|ll|l)([dux])', r'\2', key_fmt)))
+	return ans
+
+def decode(data, fields, out):
+	last_tsc = {}
+	last_seq = {}
+	text = bytearray()
+	i = 0
+	while i < len(data):
+		if data[i] != SYNC or i + FRAME_SIZE > len(data):
+			text.append(data[i])
+			i += 1
+			continue
+		if text:
+			out.write(text.decode('ascii', 'replace'))
+			text.clear()
+		frame = data[i:i + FRAME_SIZE]
+		i += FRAME_SIZE
+		cpu, event, seq = frame[1], frame[2], frame[3]
+		tsc = int.from_bytes(frame[4:10], 'little')
+		payload = int.from_bytes(frame[10:16], 'little')
+		if cpu in last_seq and (last_seq[cpu] + 1) % 256 != seq:
+			out.write('TR[%d]: %d frames missing\n' %
+						(cpu, (seq - last_seq[cpu] - 1) % 256))
+		last_seq[cpu] = seq
+		delta = (tsc - last_tsc.get(cpu, tsc)) % (1 << 48)
+		last_tsc[cpu] = tsc
+		if event == LOST:
+			desc = 'lost %d records (ring full)' % payload
+		elif event < len(fields):
+			name, key_fmt = fields[event]
+			desc = '%s %s' % (name, key_fmt % payload)
+		else:
+			desc = 'unknown event %d payload 0x%x' % (event, payload)
+		out.write('TR[%d]: tsc=0x%012x +%d %s\n' % (cpu, tsc, delta, desc))
+	if text:
+		out.write(text.decode('ascii', 'replace'))
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[1])
+	parser.add_argument('log', nargs='?', help='serial output, default stdin')
+	parser.add_argument('--fields', default=FIELDS,
+						help='path to xmhf-debug-event-logger-fields.h')
+	parser.add_argument('--no-nv', action='store_true',
+						help='XMHF is built without nested virtualization')
+	args = parser.parse_args()
+	fields = read_fields(args.fields, not args.no_nv)
+	if args.log:
+		data = open(args.log, 'rb').read()
+	else:
+		data = sys.stdin.buffer.read()
+	decode(data, fields, sys.stdout)
+
+if __name__ == '__main__':
+	main()
@@ -49,6 +49,7 @@
 #include <string.h> /* for memset */
 
 #include "hpt_log.h"
+#include "hptw_spec.h"
 
 /*
  * Get the root page map object (pmo) for context (ctx)
@@ -358,17 +359,37 @@ void* hptw_access_va(hptw_ctx_t *ctx,
 }
 
 /*
- * Get the page map entry object (pmeo) to context (ctx) at virtual address
- * (va). Also perform access check using access_type and cpl.
- * Return 0 if successful, 1 if failed (e.g. invalid permission).
- * access_type and cpl are used to check permissions when accessing va.
- * pmeo is undefined when this function returns 1.
+ * Translate physical address (pa) to pointer for contexts where hypervisor
+ * virtual address equals physical address. Contexts using this function as
+ * pa2ptr are walked without indirect calls, see hptw_spec.h.
  */
-int hptw_checked_get_pmeo(hpt_pmeo_t *pmeo,
-                          hptw_ctx_t *ctx,
-                          hpt_prot_t access_type,
-                          hptw_cpl_t cpl,
-                          hpt_va_t va)
+void* hptw_identity_pa2ptr(void *vctx,
+                           hpt_pa_t pa,
+                           size_t sz,
+                           hpt_prot_t access_type,
+                           hptw_cpl_t cpl,
+                           size_t *avail_sz)
+{
+  (void)vctx;
+  (void)access_type;
+  (void)cpl;
+  if ((hpt_pa_t)(uintptr_t)pa != pa) {
+    *avail_sz = 0;
+    return NULL;
+  }
+  *avail_sz = sz;
+  return (void *)(uintptr_t)pa;
+}
+
+/*
+ * Same as hptw_checked_get_pmeo(), but always use the accessors in hpt.c.
+ * Used for paging types without a specialized walker and to handle errors.
+ */
+int hptw_checked_get_pmeo_generic(hpt_pmeo_t *pmeo,
+                                  hptw_ctx_t *ctx,
+                                  hpt_prot_t access_type,
+                                  hptw_cpl_t cpl,
+                                  hpt_va_t va)
 {
   hpt_pmo_t pmo;
 
@@ -404,27 +425,22 @@ int hptw_checked_get_pmeo(hpt_pmeo_t *pmeo,
 }
 
 /*
- * Access virtual address (va) in context (ctx) in software. Return NULL when
- * error (e.g. invalid permission).
- * access_type and cpl are used to check permissions when accessing va.
- * return value is the physical address that can be accessed by the caller.
- * requested_sz is the size caller wants to access.
- * avail_sz is the size available in the same page.
- * If avail_sz < requested_sz, the caller needs to call this function again.
+ * Same as hptw_checked_access_va(), but always use the accessors in hpt.c.
+ * Used for paging types without a specialized walker and to handle errors.
  */
-void* hptw_checked_access_va(hptw_ctx_t *ctx,
-                             hpt_prot_t access_type,
-                             hptw_cpl_t cpl,
-                             hpt_va_t va,
-                             size_t requested_sz,
-                             size_t *avail_sz)
+void* hptw_checked_access_va_generic(hptw_ctx_t *ctx,
+                                     hpt_prot_t access_type,
+                                     hptw_cpl_t cpl,
+                                     hpt_va_t va,
+                                     size_t requested_sz,
+                                     size_t *avail_sz)
 {
   hpt_pmeo_t pmeo;
   hpt_pa_t pa;
   void *rv=NULL;
   *avail_sz=0;
 
-  EU_CHKN_W(hptw_checked_get_pmeo(&pmeo, ctx, access_type, cpl, va));
+  EU_CHKN_W(hptw_checked_get_pmeo_generic(&pmeo, ctx, access_type, cpl, va));
 
   pa = hpt_pmeo_va_to_pa(&pmeo, va);
   *avail_sz = MIN(requested_sz, hpt_remaining_on_page(&pmeo, pa));
@@ -436,6 +452,128 @@ void* hptw_checked_access_va(hptw_ctx_t *ctx,
   return rv;
 }
 
+/*
+ * Walkers specialized for each paging type, and for whether pa2ptr is
+ * hptw_identity_pa2ptr(). See hptw_spec.h.
+ */
+#define HPTW_SPEC_DEFINE(name, t, direct)                               \
+  static bool hptw_checked_get_pmeo_##name(hpt_pmeo_t *pmeo,            \
+                                           hptw_ctx_t *ctx,             \
+                                           hpt_prot_t access_type,      \
+                                           hptw_cpl_t cpl,              \
+                                           hpt_va_t va)                 \
+  {                                                                     \
+    return hptw_spec_checked_get_pmeo(pmeo, ctx, access_type, cpl, va,  \
+                                      t, direct);                       \
+  }                                                                     \
+  static void* hptw_checked_access_va_##name(hptw_ctx_t *ctx,           \
+                                             hpt_prot_t access_type,    \
+                                             hptw_cpl_t cpl,            \
+                                             hpt_va_t va,               \
+                                             size_t requested_sz,       \
+                                             size_t *avail_sz)          \
+  {                                                                     \
+    return hptw_spec_checked_access_va(ctx, access_type, cpl, va,       \
+                                       requested_sz, avail_sz,          \
+                                       t, direct);                      \
+  }
+
+HPTW_SPEC_DEFINE(norm, HPT_TYPE_NORM, false)
+HPTW_SPEC_DEFINE(pae, HPT_TYPE_PAE, false)
+HPTW_SPEC_DEFINE(long, HPT_TYPE_LONG, false)
+HPTW_SPEC_DEFINE(ept, HPT_TYPE_EPT, false)
+HPTW_SPEC_DEFINE(norm_direct, HPT_TYPE_NORM, true)
+HPTW_SPEC_DEFINE(pae_direct, HPT_TYPE_PAE, true)
+HPTW_SPEC_DEFINE(long_direct, HPT_TYPE_LONG, true)
+HPTW_SPEC_DEFINE(ept_direct, HPT_TYPE_EPT, true)
+
+typedef struct {
+  bool (*get_pmeo)(hpt_pmeo_t *pmeo, hptw_ctx_t *ctx,
+                   hpt_prot_t access_type, hptw_cpl_t cpl, hpt_va_t va);
+  void* (*access_va)(hptw_ctx_t *ctx, hpt_prot_t access_type,
+                     hptw_cpl_t cpl, hpt_va_t va, size_t requested_sz,
+                     size_t *avail_sz);
+} hptw_spec_walker_t;
+
+#define HPTW_SPEC_WALKER(name) \
+  { hptw_checked_get_pmeo_##name, hptw_checked_access_va_##name }
+
+/* Indexed by whether pa2ptr is hptw_identity_pa2ptr(), then paging type */
+static const hptw_spec_walker_t hptw_spec_walkers[2][HPT_TYPE_NUM] =
+  {
+    {
+      [HPT_TYPE_NORM] = HPTW_SPEC_WALKER(norm),
+      [HPT_TYPE_PAE]  = HPTW_SPEC_WALKER(pae),
+      [HPT_TYPE_LONG] = HPTW_SPEC_WALKER(long),
+      [HPT_TYPE_EPT]  = HPTW_SPEC_WALKER(ept),
+    },
+    {
+      [HPT_TYPE_NORM] = HPTW_SPEC_WALKER(norm_direct),
+      [HPT_TYPE_PAE]  = HPTW_SPEC_WALKER(pae_direct),
+      [HPT_TYPE_LONG] = HPTW_SPEC_WALKER(long_direct),
+      [HPT_TYPE_EPT]  = HPTW_SPEC_WALKER(ept_direct),
+    },
+  };
+
+/* Return the specialized walker for context (ctx), or NULL if none. */
+static const hptw_spec_walker_t *hptw_spec_get_walker(hptw_ctx_t *ctx)
+{
+  if (!hpt_type_is_valid(ctx->t)) {
+    return NULL;
+  }
+  return &hptw_spec_walkers[ctx->pa2ptr == hptw_identity_pa2ptr][ctx->t];
+}
+
+/*
+ * Get the page map entry object (pmeo) to context (ctx) at virtual address
+ * (va). Also perform access check using access_type and cpl.
+ * Return 0 if successful, 1 if failed (e.g. invalid permission).
+ * access_type and cpl are used to check permissions when accessing va.
+ * pmeo is undefined when this function returns 1.
+ */
+int hptw_checked_get_pmeo(hpt_pmeo_t *pmeo,
+                          hptw_ctx_t *ctx,
+                          hpt_prot_t access_type,
+                          hptw_cpl_t cpl,
+                          hpt_va_t va)
+{
+  const hptw_spec_walker_t *walker = hptw_spec_get_walker(ctx);
+
+  if (walker && walker->get_pmeo(pmeo, ctx, access_type, cpl, va)) {
+    return 0;
+  }
+  return hptw_checked_get_pmeo_generic(pmeo, ctx, access_type, cpl, va);
+}
+
+/*
+ * Access virtual address (va) in context (ctx) in software. Return NULL when
+ * error (e.g. invalid permission).
+ * access_type and cpl are used to check permissions when accessing va.
+ * return value is the physical address that can be accessed by the caller.
+ * requested_sz is the size caller wants to access.
+ * avail_sz is the size available in the same page.
+ * If avail_sz < requested_sz, the caller needs to call this function again.
+ */
+void* hptw_checked_access_va(hptw_ctx_t *ctx,
+                             hpt_prot_t access_type,
+                             hptw_cpl_t cpl,
+                             hpt_va_t va,
+                             size_t requested_sz,
+                             size_t *avail_sz)
+{
+  const hptw_spec_walker_t *walker = hptw_spec_get_walker(ctx);
+  void *rv;
+
+  if (walker) {
+    rv = walker->access_va(ctx, access_type, cpl, va, requested_sz, avail_sz);
+    if (rv) {
+      return rv;
+    }
+  }
+  return hptw_checked_access_va_generic(ctx, access_type, cpl, va,
+                                        requested_sz, avail_sz);
+}
+
 /*
  * Memory copy from virtual address (src_va_base) to physical address (dst),
  * assuming privilege level at (cpl) when reading from source.
@@ -0,0 +1,316 @@
+/*
+ * @XMHF_LICENSE_HEADER_START@
+ *
+ * eXtensible, Modular Hypervisor Framework (XMHF)
+ * Copyright (c) 2009-2012 Carnegie Mellon University
+ * Copyright (c) 2010-2012 VDG Inc.
+ * All Rights Reserved.
+ *
+ * Developed by: XMHF Team
+ *               Carnegie Mellon University / CyLab
+ *               VDG Inc.
+ *               http://xmhf.org
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * Neither the names of Carnegie Mellon or VDG Inc, nor the names of
+ * its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @XMHF_LICENSE_HEADER_END@
+ */
+
+/* hptw_spec.h - page table walkers specialized for each paging type
+ *
+ * The page map entry accessors in hpt.c switch on the paging type and level
+ * at run time, and hptw_next_lvl() translates every page map through
+ * ctx->pa2ptr. The functions in this file take the paging type, and whether
+ * ctx->pa2ptr is hptw_identity_pa2ptr(), as extra arguments. They are always
+ * inlined, so calling them with constants (see HPTW_SPEC_DEFINE in hptw.c)
+ * generates one walker per paging type with entry decoding folded into a few
+ * bit operations, and with no indirect calls for direct mapped contexts.
+ *
+ * The walkers only implement the successful path. When they return failure
+ * the caller redoes the walk with the generic functions in hptw.c, which
+ * report the error.
+ */
+
+#ifndef HPTW_SPEC_H
+#define HPTW_SPEC_H
+
+#define HPTW_SPEC_INLINE static inline __attribute__((always_inline))
+
+/* Number of levels in the paging (same as hpt_type_max_lvl). */
+HPTW_SPEC_INLINE int hptw_spec_root_lvl(hpt_type_t t)
+{
+  return (t == HPT_TYPE_NORM) ? 2 : (t == HPT_TYPE_PAE) ? 3 : 4;
+}
+
+/* Size of page map in bytes (same as hpt_pm_size). */
+HPTW_SPEC_INLINE size_t hptw_spec_pm_size(hpt_type_t t, int lvl)
+{
+  return (t == HPT_TYPE_PAE && lvl == 3) ? 4*sizeof(hpt_pme_t) : HPT_PM_SIZE;
+}
+
+/*
+ * Low bit of va used to index into the page map of the given level. This is
+ * also the log2 of the size of the region controlled by an entry.
+ */
+HPTW_SPEC_INLINE int hptw_spec_idx_lo(hpt_type_t t, int lvl)
+{
+  return 12 + ((t == HPT_TYPE_NORM) ? 10 : 9) * (lvl - 1);
+}
+
+/* Get page table entry in page table (pm) using virtual address (va). */
+HPTW_SPEC_INLINE hpt_pme_t hptw_spec_get_pme(hpt_type_t t, int lvl,
+                                             hpt_pm_t pm, hpt_va_t va)
+{
+  int lo = hptw_spec_idx_lo(t, lvl);
+  int bits = (t == HPT_TYPE_NORM) ? 10 : (t == HPT_TYPE_PAE && lvl == 3) ? 2 : 9;
+  unsigned int idx = (va >> lo) & ((1u << bits) - 1);
+  if (t == HPT_TYPE_NORM) {
+    return ((u32*)pm)[idx];
+  } else {
+    return ((u64*)pm)[idx];
+  }
+}
+
+/* Same as hpt_pme_getprot(). */
+HPTW_SPEC_INLINE hpt_prot_t hptw_spec_getprot(hpt_type_t t, int lvl,
+                                              hpt_pme_t pme)
+{
+  bool r, w, x;
+  if (t == HPT_TYPE_NORM) {
+    r = pme & MASKBIT64(HPT_NORM_P_L21_MP_BIT);
+    w = pme & MASKBIT64(HPT_NORM_RW_L21_MP_BIT);
+    x = r;
+  } else if (t == HPT_TYPE_PAE) {
+    r = pme & MASKBIT64(HPT_PAE_P_L321_MP_BIT);
+    if (lvl == 2 || lvl == 1) {
+      w = pme & MASKBIT64(HPT_PAE_RW_L21_MP_BIT);
+      x = !(pme & MASKBIT64(HPT_PAE_NX_L21_MP_BIT));
+    } else {
+      w = r;
+      x = r;
+    }
+  } else if (t == HPT_TYPE_LONG) {
+    r = pme & MASKBIT64(HPT_LONG_P_L4321_MP_BIT);
+    w = pme & MASKBIT64(HPT_LONG_RW_L4321_MP_BIT);
+    x = !(pme & MASKBIT64(HPT_LONG_NX_L4321_MP_BIT));
+  } else {
+    r = pme & MASKBIT64(HPT_EPT_R_L4321_MP_BIT);
+    w = pme & MASKBIT64(HPT_EPT_W_L4321_MP_BIT);
+    x = pme & MASKBIT64(HPT_EPT_X_L4321_MP_BIT);
+  }
+  return (r ? HPT_PROT_READ_MASK : 0) |
+         (w ? HPT_PROT_WRITE_MASK : 0) |
+         (x ? HPT_PROT_EXEC_MASK : 0);
+}
+
+/* Same as hpt_pme_getuser(). */
+HPTW_SPEC_INLINE bool hptw_spec_getuser(hpt_type_t t, int lvl, hpt_pme_t pme)
+{
+  if (t == HPT_TYPE_NORM) {
+    return pme & MASKBIT64(HPT_NORM_US_L21_MP_BIT);
+  } else if (t == HPT_TYPE_PAE) {
+    return lvl == 3 || (pme & MASKBIT64(HPT_PAE_US_L21_MP_BIT));
+  } else if (t == HPT_TYPE_LONG) {
+    return pme & MASKBIT64(HPT_LONG_US_L4321_MP_BIT);
+  } else {
+    return true;
+  }
+}
+
+/* Same as hpt_pme_is_present(). */
+HPTW_SPEC_INLINE bool hptw_spec_is_present(hpt_type_t t, int lvl,
+                                           hpt_pme_t pme)
+{
+  if (t == HPT_TYPE_EPT) {
+    return hptw_spec_getprot(t, lvl, pme) & HPT_PROTS_RWX;
+  } else {
+    return hptw_spec_getprot(t, lvl, pme) & HPT_PROT_READ_MASK;
+  }
+}
+
+/* Same as hpt_pme_is_page(). */
+HPTW_SPEC_INLINE bool hptw_spec_is_page(hpt_type_t t, int lvl, hpt_pme_t pme)
+{
+  if (lvl == 1) {
+    return true;
+  } else if (t == HPT_TYPE_NORM) {
+    return BR64_GET_BIT(pme, HPT_NORM_PS_L2_MP_BIT);
+  } else if (t == HPT_TYPE_PAE) {
+    return lvl == 2 && BR64_GET_BIT(pme, HPT_PAE_PS_L2_MP_BIT);
+  } else if (t == HPT_TYPE_LONG) {
+    return lvl != 4 && BR64_GET_BIT(pme, HPT_LONG_PS_L32_MP_BIT);
+  } else {
+    return lvl != 4 && BR64_GET_BIT(pme, HPT_EPT_PS_L32_MP_BIT);
+  }
+}
+
+/* Same as hpt_pme_get_address(). */
+HPTW_SPEC_INLINE hpt_pa_t hptw_spec_get_address(hpt_type_t t, int lvl,
+                                                hpt_pme_t pme)
+{
+  bool is_page = hptw_spec_is_page(t, lvl, pme);
+  if (t == HPT_TYPE_NORM) {
+    if (lvl == 2 && is_page) {
+      /* 4 MB page */
+      hpt_pa_t rv = 0;
+      rv = BR64_COPY_BITS_HL(rv, pme, 39, 32, 32-HPT_NORM_ADDR3932_L2_P_LO);
+      rv = BR64_COPY_BITS_HL(rv, pme, 31, 22, 22-HPT_NORM_ADDR3122_L2_P_LO);
+      return rv;
+    }
+    return BR64_COPY_BITS_HL(0, pme, HPT_NORM_ADDR_L1_P_HI,
+                             HPT_NORM_ADDR_L1_P_LO, 0);
+  } else if (t == HPT_TYPE_PAE) {
+    if (lvl == 2 && is_page) {
+      return BR64_COPY_BITS_HL(0, pme, HPT_PAE_ADDR_L2_P_HI,
+                               HPT_PAE_ADDR_L2_P_LO, 0);
+    }
+    return BR64_COPY_BITS_HL(0, pme, HPT_PAE_ADDR_L321_M_HI,
+                             HPT_PAE_ADDR_L321_M_LO, 0);
+  } else if (t == HPT_TYPE_LONG) {
+    if (lvl != 1 && is_page) {
+      return BR64_COPY_BITS_HL(0, pme, HPT_LONG_ADDR_L32_P_HI,
+                               HPT_LONG_ADDR_L32_P_LO, 0);
+    }
+    return BR64_COPY_BITS_HL(0, pme, HPT_LONG_ADDR_L4321_M_HI,
+                             HPT_LONG_ADDR_L4321_M_LO, 0);
+  } else {
+    return BR64_COPY_BITS_HL(0, pme, HPT_EPT_ADDR_L4321_MP_HI,
+                             HPT_EPT_ADDR_L4321_MP_LO, 0);
+  }
+}
+
+/*
+ * Translate a physical address to a pointer of sz bytes. When direct is
+ * true, ctx->pa2ptr is known to be hptw_identity_pa2ptr().
+ */
+HPTW_SPEC_INLINE void *hptw_spec_pa2ptr(hptw_ctx_t *ctx, hpt_pa_t pa,
+                                        size_t sz, hpt_prot_t access_type,
+                                        hptw_cpl_t cpl, bool direct)
+{
+  if (direct) {
+    if ((hpt_pa_t)(uintptr_t)pa != pa) {
+      return NULL;
+    }
+    return (void *)(uintptr_t)pa;
+  } else {
+    size_t avail;
+    void *ptr = ctx->pa2ptr(ctx, pa, sz, access_type, cpl, &avail);
+    if (!ptr || avail != sz) {
+      return NULL;
+    }
+    return ptr;
+  }
+}
+
+/*
+ * Specialized hptw_checked_get_pmeo() for paging type t. ctx->t must be t.
+ * Return true if successful. Otherwise the content of pmeo is undefined.
+ */
+HPTW_SPEC_INLINE bool hptw_spec_checked_get_pmeo(hpt_pmeo_t *pmeo,
+                                                 hptw_ctx_t *ctx,
+                                                 hpt_prot_t access_type,
+                                                 hptw_cpl_t cpl,
+                                                 hpt_va_t va,
+                                                 hpt_type_t t,
+                                                 bool direct)
+{
+  int lvl = hptw_spec_root_lvl(t);
+  hpt_pm_t pm;
+  hpt_pme_t pme;
+
+  pm = hptw_spec_pa2ptr(ctx, ctx->root_pa, hptw_spec_pm_size(t, lvl),
+                        HPT_PROTS_RW, HPTW_CPL0, direct);
+  if (!pm) {
+    return false;
+  }
+
+  while (1) {
+    pme = hptw_spec_get_pme(t, lvl, pm, va);
+    if ((access_type & hptw_spec_getprot(t, lvl, pme)) != access_type
+        || (cpl != HPTW_CPL0 && !hptw_spec_getuser(t, lvl, pme))
+        || !hptw_spec_is_present(t, lvl, pme)) {
+      return false;
+    }
+    if (hptw_spec_is_page(t, lvl, pme)) {
+      break;
+    }
+    pm = hptw_spec_pa2ptr(ctx, hptw_spec_get_address(t, lvl, pme),
+                          hptw_spec_pm_size(t, lvl-1), HPT_PROTS_R,
+                          HPTW_CPL0, direct);
+    if (!pm) {
+      return false;
+    }
+    lvl--;
+  }
+
+  *pmeo = (hpt_pmeo_t) {
+    .pme = pme,
+    .t = t,
+    .lvl = lvl,
+  };
+  return true;
+}
+
+/*
+ * Specialized hptw_checked_access_va() for paging type t. ctx->t must be t.
+ * Return NULL if failed, in which case *avail_sz is undefined.
+ */
+HPTW_SPEC_INLINE void *hptw_spec_checked_access_va(hptw_ctx_t *ctx,
+                                                   hpt_prot_t access_type,
+                                                   hptw_cpl_t cpl,
+                                                   hpt_va_t va,
+                                                   size_t requested_sz,
+                                                   size_t *avail_sz,
+                                                   hpt_type_t t,
+                                                   bool direct)
+{
+  hpt_pmeo_t pmeo;
+  hpt_pa_t pa;
+  hpt_pa_t page_mask;
+
+  if (!hptw_spec_checked_get_pmeo(&pmeo, ctx, access_type, cpl, va, t,
+                                  direct)) {
+    return NULL;
+  }
+
+  /* Same as hpt_pmeo_va_to_pa() and hpt_remaining_on_page() */
+  page_mask = (1ull << hptw_spec_idx_lo(t, pmeo.lvl)) - 1;
+  pa = hptw_spec_get_address(t, pmeo.lvl, pmeo.pme) + (va & page_mask);
+  *avail_sz = MIN(requested_sz, (size_t)(page_mask + 1 - (pa & page_mask)));
+
+  if (direct) {
+    return hptw_spec_pa2ptr(ctx, pa, *avail_sz, access_type, cpl, direct);
+  } else {
+    return ctx->pa2ptr(ctx, pa, *avail_sz, access_type, cpl, avail_sz);
+  }
+}
+
+#endif
@@ -127,6 +127,14 @@ void hptw_set_prot( hptw_ctx_t *ctx,
 hpt_pa_t hptw_va_to_pa( hptw_ctx_t *ctx,
                         hpt_va_t va);
 
+/* pa2ptr for contexts where virtual address equals physical address */
+void* hptw_identity_pa2ptr( void *vctx,
+                            hpt_pa_t pa,
+                            size_t sz,
+                            hpt_prot_t access_type,
+                            hptw_cpl_t cpl,
+                            size_t *avail_sz);
+
 int hptw_checked_get_pmeo(hpt_pmeo_t *pmeo,
                           hptw_ctx_t *ctx,
                           hpt_prot_t access_type,
@@ -140,6 +148,23 @@ void* hptw_checked_access_va( hptw_ctx_t *ctx,
                               size_t requested_sz,
                               size_t *avail_sz);
 
+/*
+ * Same as hptw_checked_get_pmeo() and hptw_checked_access_va(), but never
+ * use the walkers specialized for each paging type.
+ */
+int hptw_checked_get_pmeo_generic(hpt_pmeo_t *pmeo,
+                                  hptw_ctx_t *ctx,
+                                  hpt_prot_t access_type,
+                                  hptw_cpl_t cpl,
+                                  hpt_va_t va);
+
+void* hptw_checked_access_va_generic( hptw_ctx_t *ctx,
+                                      hpt_prot_t access_type,
+                                      hptw_cpl_t cpl,
+                                      hpt_va_t va,
+                                      size_t requested_sz,
+                                      size_t *avail_sz);
+
 int hptw_checked_copy_from_va( hptw_ctx_t *ctx,
                                hptw_cpl_t cpl,
                                void *dst,
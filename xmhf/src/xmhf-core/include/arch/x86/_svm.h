@@ -61,6 +61,32 @@
 //exception is intercepted
 #define	EXCEPTION_INTERCEPT_DB 	(1UL << 1)
 
+//SVM Feature Identification (CPUID Fn8000_000A EDX)
+//Appendix E.4.10, AMD SDM
+#define SVM_FEATURE_NP                  (1UL << 0)
+#define SVM_FEATURE_NRIPS               (1UL << 3)
+#define SVM_FEATURE_VMCBCLEAN           (1UL << 5)
+#define SVM_FEATURE_DECODEASSISTS       (1UL << 7)
+
+//SVM VMCB Clean Bits
+//Sec. 15.15.3 AMD SDM
+//a set bit tells the CPU that the corresponding VMCB state group is
+//unchanged since the last VMRUN of this VMCB and may be taken from its
+//cache; fields not covered by any bit (e.g., RIP, RSP, RAX, RFLAGS,
+//EVENTINJ and TLB_CONTROL) are always reloaded
+#define VMCB_CLEAN_I                    (1UL << 0)  //intercepts, TSC offset
+#define VMCB_CLEAN_IOPM                 (1UL << 1)  //IOPM_BASE, MSRPM_BASE
+#define VMCB_CLEAN_ASID                 (1UL << 2)  //ASID
+#define VMCB_CLEAN_TPR                  (1UL << 3)  //V_TPR, V_IRQ, ...
+#define VMCB_CLEAN_NP                   (1UL << 4)  //NP_ENABLE, N_CR3, G_PAT
+#define VMCB_CLEAN_CRX                  (1UL << 5)  //CR0, CR3, CR4, EFER
+#define VMCB_CLEAN_DRX                  (1UL << 6)  //DR6, DR7
+#define VMCB_CLEAN_DT                   (1UL << 7)  //GDTR, IDTR
+#define VMCB_CLEAN_SEG                  (1UL << 8)  //CS, DS, SS, ES, CPL
+#define VMCB_CLEAN_CR2                  (1UL << 9)  //CR2
+#define VMCB_CLEAN_LBR                  (1UL << 10) //DBGCTL, LBR MSRs
+#define VMCB_CLEAN_ALL                  ((1UL << 11) - 1)
+
 //SVM Class-1 and Class-2 Intercepts
 //Appendix B-1, AMD SDM
 
@@ -180,7 +206,12 @@ struct _svm_vmcbfields {
   u8 __reserved2[16];
   struct svmeventinj eventinj;       				//byte offset 0xA8
   u64 n_cr3;                  						//byte offset 0xB0
-  u8 __reserved3[840];
+  u32 vmcb_clean;             						//byte offset 0xB8
+  u8 __reserved3[4];
+  u64 nrip;                   						//byte offset 0xC0
+  u8 guest_insn_len;          						//byte offset 0xC8
+  u8 guest_insn_bytes[15];    						//byte offset 0xC9
+  u8 __reserved10[808];
   struct svmdesc es;      							//byte offset 0x400
   struct svmdesc cs;
   struct svmdesc ss;
@@ -214,6 +245,12 @@ struct _svm_vmcbfields {
   u8 __reserved9[2448];
 } __attribute__ ((packed));
 
+//mark VMCB state groups (VMCB_CLEAN_*) as modified by the hypervisor so
+//that the next VMRUN reloads them from memory
+static inline void svm_vmcb_dirty(struct _svm_vmcbfields *vmcb, u32 bits){
+  vmcb->vmcb_clean &= ~bits;
+}
+
 //macros for saving and storing additional VMCB state information
 static inline void vmsave(u32 vmcb){
   __asm__("vmsave"
@@ -294,6 +294,13 @@
 #define IO_INSN_REP			0x1
 #define IO_INSN_OPCODE_IMM	0x1
 
+//VMEXIT_APIC_ACCESS defines
+#define APIC_ACCESS_OFFSET_MASK		0xfffUL
+#define APIC_ACCESS_TYPE_SHIFT		12
+#define APIC_ACCESS_TYPE_MASK		0xfUL
+#define APIC_ACCESS_LINEAR_READ		0x0
+#define APIC_ACCESS_LINEAR_WRITE	0x1
+
 
 #ifndef __ASSEMBLY__
 
@@ -517,6 +524,37 @@ struct _vmx_vmcsfields {
 #include "_vmx_vmcs_fields.h"
 };
 
+//Index of VMCS fields in bitmaps (e.g. VMCS cache in VCPU)
+enum _vmcs_indices {
+#define DECLARE_FIELD_16(encoding, name, ...) \
+  VMCSIDX_##name,
+#define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include "_vmx_vmcs_fields.h"
+  VMCSIDX_COUNT
+};
+
+//Number of u32 needed to store a bitmap of all VMCS fields
+#define VMCS_BITMAP_WORDS ((VMCSIDX_COUNT + 31) / 32)
+
+//Bitmap of VMCS fields, indexed by VMCSIDX_*
+typedef struct {
+  u32 bits[VMCS_BITMAP_WORDS];
+} vmcs_bitmap_t;
+
+static inline bool vmcs_bitmap_test(const vmcs_bitmap_t *bitmap, u32 index){
+  return (bitmap->bits[index / 32] >> (index % 32)) & 1U;
+}
+
+static inline void vmcs_bitmap_set(vmcs_bitmap_t *bitmap, u32 index){
+  bitmap->bits[index / 32] |= (1U << (index % 32));
+}
+
+static inline void vmcs_bitmap_clear(vmcs_bitmap_t *bitmap, u32 index){
+  bitmap->bits[index / 32] &= ~(1U << (index % 32));
+}
+
 /* VM-Entry Interruption-Information Field */
 struct _vmx_event_injection {
     u32 vector:      8;
@@ -64,6 +64,10 @@
 #define VTD_FSTS_REG_OFF 0x034	 // report fault/error status (32-bit)
 #define VTD_FECTL_REG_OFF 0x038	 // interrupt control (32-bit)
 #define VTD_PMEN_REG_OFF 0x064	 // enable DMA protected memory regions (32-bits)
+#define VTD_IQH_REG_OFF 0x080	 // invalidation queue head (64-bit)
+#define VTD_IQT_REG_OFF 0x088	 // invalidation queue tail (64-bit)
+#define VTD_IQA_REG_OFF 0x090	 // invalidation queue address (64-bit)
+#define VTD_ICS_REG_OFF 0x09C	 // invalidation completion status (32-bit)
 #define VTD_IVA_REG_OFF 0x0DEAD	 // invalidate address register (64-bits)
 								// note: the offset of this register is computed
 // at runtime for a specified DMAR device
@@ -106,6 +110,10 @@
 #define VTD_SUPERPAGE (0x1UL << 7)
 #define VTD_SNOOP (0x1UL << 11)
 
+// Super-page sizes in VTD_CAP_REG.sps
+#define VTD_SPS_2M 0x1
+#define VTD_SPS_1G 0x2
+
 #define VTD_CAP_REG_FRO_MULTIPLIER (16UL) // If the register base address is X, and the value reported in this field
 										  // is Y, the address for the first fault recording register is calculated as X+(16*Y).
 
@@ -271,6 +279,54 @@ typedef union
 	} bits;
 } __attribute__((packed)) VTD_IVA_REG;
 
+// VTD_IQH_REG (sec. 10.4.22)
+typedef union
+{
+	u64 value;
+	struct
+	{
+		u64 rsvdz0 : 4,	 // reserved
+			qh : 15,	 // queue head (index of next descriptor to fetch)
+			rsvdz1 : 45; // reserved
+	} bits;
+} __attribute__((packed)) VTD_IQH_REG;
+
+// VTD_IQT_REG (sec. 10.4.23)
+typedef union
+{
+	u64 value;
+	struct
+	{
+		u64 rsvdz0 : 4,	 // reserved
+			qt : 15,	 // queue tail (index of next descriptor to write)
+			rsvdz1 : 45; // reserved
+	} bits;
+} __attribute__((packed)) VTD_IQT_REG;
+
+// VTD_IQA_REG (sec. 10.4.24)
+typedef union
+{
+	u64 value;
+	struct
+	{
+		u64 qs : 3,		// queue size (2^qs 4K pages)
+			rsvdz0 : 8, // reserved
+			dw : 1,		// descriptor width (0 = 128-bit)
+			iqa : 52;	// invalidation queue base address
+	} bits;
+} __attribute__((packed)) VTD_IQA_REG;
+
+// Queued invalidation descriptor, 128-bit (sec. 6.5.2)
+typedef struct
+{
+	u64 lo;
+	u64 hi;
+} __attribute__((packed)) VTD_QI_DESC;
+
+#define VTD_QI_TYPE_CC		0x1	// context-cache invalidate descriptor
+#define VTD_QI_TYPE_IOTLB	0x2	// IOTLB invalidate descriptor
+#define VTD_QI_TYPE_WAIT	0x5	// invalidation wait descriptor
+
 // VTD_FSTS_REG	(sec. 10.4.9)
 typedef union
 {
@@ -350,6 +406,10 @@ typedef struct
 
 	// Flags (not part of DRHD structure, but useful for DRHD programming)
 	VTD_IOMMU_FLAGS iommu_flags;
+
+	// Queued invalidation state (not part of DRHD structure). NULL when the
+	// register based invalidation interface is used
+	struct vtd_qi *qi;
 } __attribute__((packed)) VTD_DRHD;
 
 #define ACPI_DMAR_INCLUDE_ALL       (1)
@@ -359,9 +419,12 @@ typedef struct
 #define vtd_cap_require_wbf(drhd)	(drhd->iommu_flags.cap.bits.rwbf)
 #define vtd_cap_plmr(drhd)	(drhd->iommu_flags.cap.bits.plmr)
 #define vtd_cap_phmr(drhd)	(drhd->iommu_flags.cap.bits.phmr)
+#define vtd_cap_psi(drhd)	(drhd->iommu_flags.cap.bits.psi)
+#define vtd_cap_mamv(drhd)	(uint32_t)(drhd->iommu_flags.cap.bits.mamv)
 
 #define vtd_ecap_sc(drhd)	(drhd->iommu_flags.ecap.bits.sc)
 #define vtd_ecap_c(drhd)	(drhd->iommu_flags.ecap.bits.c)
+#define vtd_ecap_qi(drhd)	(drhd->iommu_flags.ecap.bits.qi)
 
 #endif //__ASSEMBLY__
 #endif //__VMX_EAP_H__
\ No newline at end of file
@@ -173,6 +173,28 @@ struct _guestmtrrmsrs {
 //---platform
 #define IA32_VMX_MSRCOUNT                       18
 
+//max number of EPT01 page tables waiting to be freed by a CPU
+#define VMX_EPT01_RETIRED_MAX                   64
+
+//max number of 4K EPT01 entries a CPU can override in a shared EPT01
+#define VMX_EPT01_OVERLAY_MAX                   4
+
+//number of copies of the static EPT01 PML4 and PDP tables
+#ifdef __VMX_SHARED_EPT__
+#define VMX_EPT01_NCOPIES                       1
+#else /* !__VMX_SHARED_EPT__ */
+#define VMX_EPT01_NCOPIES                       MAX_VCPU_ENTRIES
+#endif /* __VMX_SHARED_EPT__ */
+
+//number of entries in the guestmem software TLB (power of 2)
+#define VMX_GUESTMEM_TLB_SIZE                   16
+
+//number of entries in the decoded instruction cache of the emulator (power of 2)
+#define VMX_EMU_CACHE_SIZE                      8
+
+//maximum length of an x86 instruction
+#define VMX_EMU_INST_LEN_MAX                    15
+
 #ifndef __ASSEMBLY__
 
 /*
@@ -191,6 +213,50 @@ typedef struct {
   u32 guest_nmi_pending;
 } guest_nmi_t;
 
+/*
+ * Entry of the guestmem software TLB, which caches the translation of a 4K
+ * page by the guest page table and EPT. See memp-x86vmx-guestmem.c.
+ */
+typedef struct {
+  bool valid;
+  u8 t;           //type of the page table walked (hpt_type_t)
+  u8 cpl;         //privilege level of the access (hptw_cpl_t)
+  u8 access_type; //type of the access (hpt_prot_t)
+  u32 ept_gen;    //memprot_x86vmx_eptlock_generation() when filled
+  u64 vcpu_gen;   //vcpu->vmx_guestmem_tlb_gen when filled
+  u64 root_pa;    //root of the page table walked (e.g. guest CR3)
+  u64 eptp_pa;    //root of the EPT used to walk the page table
+  u64 va;         //4K aligned address translated
+  hva_t hva;      //hypervisor address of the page
+} guestmem_tlb_entry_t;
+
+/*
+ * Entry of the decoded instruction cache of the x86 VMX emulator. An entry
+ * is keyed by guest CR3, RIP, CPU mode and the instruction bytes, and holds
+ * the result of decoding them. See x86vmx-emulation.c.
+ */
+typedef struct {
+  bool valid;
+  bool g64;       //guest is in 64-bit mode
+  bool cs_d;      //D/B field of CS segment
+  u8 inst_len;
+  u8 form;        //decoded form (EMU_FORM_*)
+  u8 opcode;      //last opcode byte
+  u8 prefix_seg;  //segment override prefix (cpu_segment_t)
+  u8 prefix_bits; //other legacy prefixes (EMU_PREFIX_*)
+  u8 rex;
+  u8 modrm;
+  u8 sib;
+  u8 disp_off;    //offset of displacement in instruction bytes
+  u8 disp_len;
+  u8 imm_off;     //offset of immediate in instruction bytes
+  u8 imm_len;
+  u32 hash;       //hash of instruction bytes
+  u64 cr3;
+  u64 rip;
+  u8 inst[VMX_EMU_INST_LEN_MAX];
+} emu_cache_entry_t;
+
 //the vcpu structure which holds the current state of a core
 typedef struct _vcpu {
   //common fields
@@ -226,6 +292,7 @@ typedef struct _vcpu {
   u32 npt_asid;           //NPT ASID for this core
   hva_t npt_vaddr_pts;      //NPT page-tables for protection manipulation
   hva_t svm_vaddr_iobitmap; //virtual address of the I/O Bitmap area
+  u32 svm_features;       //SVM_FEATURE_* bits from CPUID 0x8000000A EDX
 
   //VMX specific fields
   u64 vmx_msrs[IA32_VMX_MSRCOUNT];  //VMX msr values
@@ -245,8 +312,32 @@ typedef struct _vcpu {
 
   hva_t vmx_vaddr_ept_pml4_table; //virtual address of EPT PML4 table
   hva_t vmx_vaddr_ept_pdp_table;  //virtual address of EPT PDP table
-  hva_t vmx_vaddr_ept_pd_tables;  //virtual address of base of EPT PD tables
-  hva_t vmx_vaddr_ept_p_tables;   //virtual address of base of EPT P tables
+  //EPT PD and P tables are allocated on demand, see memp-x86vmx.c
+  u32 vmx_ept01_max_leaf_lvl;     //largest EPT page supported (1 = 4K, 2 = 2M, 3 = 1G)
+  /*
+   * EPT PD and P tables removed by this CPU when coalescing large pages. They
+   * are freed after every CPU has flushed EPT TLB since
+   * vmx_ept01_retired_epoch. vmx_ept01_flushed_epoch is updated by this CPU
+   * after each INVEPT.
+   */
+  hva_t vmx_ept01_retired[VMX_EPT01_RETIRED_MAX];
+  u32 vmx_ept01_retired_count;
+  u32 vmx_ept01_retired_epoch;
+  volatile u32 vmx_ept01_flushed_epoch;
+  u32 vmx_ept01_write_depth;      //nesting of EPT01 modification brackets
+  bool vmx_ept01_write_locked;    //outermost bracket holds the EPT lock
+#ifdef __VMX_SHARED_EPT__
+  /*
+   * When EPT01 is shared, 4K entries this CPU maps differently from other
+   * CPUs (e.g. LAPIC during SIPI interception). If vmx_ept01_overlay_count is
+   * not 0, EPTP points to vmx_ept01_overlay[4], a private copy of the path
+   * (vmx_ept01_overlay[l] at level l) to the 2M page containing all entries.
+   */
+  hva_t vmx_ept01_overlay[5];
+  u64 vmx_ept01_overlay_gpa[VMX_EPT01_OVERLAY_MAX];
+  u64 vmx_ept01_overlay_value[VMX_EPT01_OVERLAY_MAX];
+  u32 vmx_ept01_overlay_count;
+#endif /* __VMX_SHARED_EPT__ */
 
 
   u32 vmx_ept_defaulttype;        //default EPT memory type
@@ -282,11 +373,62 @@ typedef struct _vcpu {
    * details.
    */
   volatile bool vmx_eptlock_reading;
+  /* The CPU holds memprot_x86vmx_eptlock_write_lock() (e.g. quiescing) */
+  bool vmx_eptlock_writing;
+
+  /*
+   * Software TLB for guestmem_copy_*(). Entries not filled during the current
+   * generation are invalid. Counters are for performance monitoring.
+   */
+  guestmem_tlb_entry_t vmx_guestmem_tlb[VMX_GUESTMEM_TLB_SIZE];
+  u64 vmx_guestmem_tlb_gen;
+  u64 vmx_guestmem_tlb_hits;
+  u64 vmx_guestmem_tlb_misses;
+  u64 vmx_guestmem_tlb_invalidations;
+
+  /*
+   * Decoded instruction cache of x86_vmx_emulate_instruction(). Counters are
+   * for performance monitoring.
+   */
+  emu_cache_entry_t vmx_emu_cache[VMX_EMU_CACHE_SIZE];
+  u64 vmx_emu_cache_hits;
+  u64 vmx_emu_cache_misses;
+
+  /*
+   * TLB shootdown request posted by another CPU. vmx_shootdown_pending is set
+   * by the requesting CPU after filling the other fields, and cleared by this
+   * CPU after flushing. See xmhf_smpguest_arch_x86vmx_tlb_shootdown().
+   *
+   * The request may be processed by polling before its NMI arrives, so NMIs
+   * are classified by counting: vmx_shootdown_nmi_sent is incremented by the
+   * requesting CPU for each NMI sent, and vmx_shootdown_nmi_received by this
+   * CPU for each NMI classified as a shootdown NMI.
+   */
+  volatile u32 vmx_shootdown_pending;
+  u32 vmx_shootdown_flags;
+  u64 vmx_shootdown_gpa_lo;
+  u64 vmx_shootdown_gpa_hi;
+  volatile u32 vmx_shootdown_nmi_sent;
+  volatile u32 vmx_shootdown_nmi_received;
 
   //guest state fields
   u32 vmx_guest_unrestricted;   //this is 1 if the CPU VMX implementation supports unrestricted guest execution
   struct _vmx_vmcsfields vmcs;   //the VMCS fields
 
+  /*
+   * Lazy cache of the hardware VMCS in vmcs. After a VMEXIT, a field is
+   * VMREAD when it is first needed, and at VMENTRY only modified fields are
+   * VMWRITE'n. See bplt-x86vmx-vmcs.c for details.
+   */
+  vmcs_bitmap_t vmcs_cache_exist; //fields supported by the CPU
+  vmcs_bitmap_t vmcs_cache_valid; //fields in vmcs that are up to date
+  vmcs_bitmap_t vmcs_cache_dirty; //fields in vmcs that need VMWRITE
+  struct _vmx_vmcsfields vmcs_hw; //last value read from / written to VMCS
+#ifdef __DEBUG_VMCS_FOOTPRINT__
+  struct _vmx_vmcsfields vmcs_footprint;  //vmcs before intercept fast path
+  vmcs_bitmap_t vmcs_footprint_valid;     //vmcs_cache_valid before fast path
+#endif /* __DEBUG_VMCS_FOOTPRINT__ */
+
 #ifdef __NESTED_VIRTUALIZATION__
   /*
    * Current CPU mode w.r.t. VMX operation.
@@ -321,6 +463,12 @@ typedef struct _vcpu {
    * to xmhf_memprot_flushmappings_*().
    */
   volatile u32 vmx_nested_ept02_flush_visited;
+  /*
+   * L1 physical address range [lo, hi) of the calls recorded in
+   * vmx_nested_ept02_flush_visited (empty when lo >= hi).
+   */
+  volatile u64 vmx_nested_ept02_flush_gpa_lo;
+  volatile u64 vmx_nested_ept02_flush_gpa_hi;
 #endif /* __NESTED_VIRTUALIZATION__ */
 } VCPU;
 
@@ -563,6 +711,35 @@ void xmhf_baseplatform_arch_x86vmx_putVMCS(VCPU *vcpu);
 // routine takes CPU VMCS and stores it in vcpu vmcsfields
 void xmhf_baseplatform_arch_x86vmx_getVMCS(VCPU *vcpu);
 
+// initialize VMCS cache, all fields in vcpu vmcsfields will be VMWRITE'n
+void xmhf_baseplatform_arch_x86vmx_vmcs_cache_init(VCPU *vcpu);
+
+// invalidate VMCS cache after VMEXIT, fields will be VMREAD on demand
+void xmhf_baseplatform_arch_x86vmx_vmcs_cache_reset(VCPU *vcpu);
+
+// VMREAD a single field into vcpu vmcsfields (slow path of VCPU_VMCS_FETCH)
+void xmhf_baseplatform_arch_x86vmx_vmcs_cache_fetch(VCPU *vcpu, u32 index);
+
+// Make sure vcpu->vmcs.name contains the value in the hardware VMCS
+#define VCPU_VMCS_FETCH(vcpu, name) \
+  do { \
+    if (!vmcs_bitmap_test(&(vcpu)->vmcs_cache_valid, VMCSIDX_##name)) { \
+      xmhf_baseplatform_arch_x86vmx_vmcs_cache_fetch((vcpu), VMCSIDX_##name); \
+    } \
+  } while (0)
+
+// Read a field through the VMCS cache
+#define VCPU_VMCS_READ(vcpu, name) \
+  ({ VCPU_VMCS_FETCH(vcpu, name); (vcpu)->vmcs.name; })
+
+// Write a field through the VMCS cache (no need to read the field first)
+#define VCPU_VMCS_WRITE(vcpu, name, value) \
+  do { \
+    (vcpu)->vmcs.name = (value); \
+    vmcs_bitmap_set(&(vcpu)->vmcs_cache_valid, VMCSIDX_##name); \
+    vmcs_bitmap_set(&(vcpu)->vmcs_cache_dirty, VMCSIDX_##name); \
+  } while (0)
+
 //--debug: dump_vcpu dumps vcpu contents (including VMCS)
 void xmhf_baseplatform_arch_x86vmx_dump_vcpu(VCPU *vcpu);
 
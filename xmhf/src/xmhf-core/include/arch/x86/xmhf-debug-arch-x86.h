@@ -72,6 +72,7 @@ extern uart_config_t g_uart_config;
 void dbg_x86_uart_init(char *params);
 void dbg_x86_uart_putc(char ch);
 void dbg_x86_uart_putstr(const char *str);
+bool dbg_x86_uart_try_write(const u8 *buf, u32 len);
 
 void dbg_x86_uart_pci_init(char *params);
 void dbg_x86_uart_pci_putc(char ch);
@@ -126,6 +126,7 @@ void xmhf_smpguest_arch_x86_eventhandler_nmiexception(VCPU *vcpu, struct regs *r
 void xmhf_smpguest_arch_x86vmx_initialize(VCPU *vcpu, u32 unmaplapic);
 void xmhf_smpguest_arch_x86vmx_link_lapic(VCPU *vcpu);
 void xmhf_smpguest_arch_x86vmx_eventhandler_dbexception(VCPU *vcpu, struct regs *r);
+void xmhf_smpguest_arch_x86vmx_eventhandler_apicaccess(VCPU *vcpu, struct regs *r);
 int xmhf_smpguest_arch_x86vmx_eventhandler_x2apic_icrwrite(VCPU *vcpu, u64 value);
 u32 xmhf_smpguest_arch_x86vmx_nmi_check_quiesce(VCPU *vcpu);
 void xmhf_smpguest_arch_x86vmx_eventhandler_nmiexception(VCPU *vcpu, struct regs *r, u32 from_guest);
@@ -133,6 +134,11 @@ u32 xmhf_smpguest_arch_x86vmx_eventhandler_hwpgtblviolation(VCPU *vcpu, struct r
 void xmhf_smpguest_arch_x86vmx_unblock_nmi(void);
 void xmhf_smpguest_arch_x86vmx_quiesce(VCPU *vcpu);
 void xmhf_smpguest_arch_x86vmx_endquiesce(VCPU *vcpu);
+// Flush EPT TLB of CPUs in cpus (all CPUs if NULL) using directed NMIs
+void xmhf_smpguest_arch_x86vmx_tlb_shootdown(VCPU *vcpu,
+											 const memp_cpuset_t *cpus,
+											 u32 flags, u64 gpa_lo,
+											 u64 gpa_hi);
 
 // Check whether xmhf_smpguest_arch_x86vmx_mhv_nmi_disable() is in effect
 bool xmhf_smpguest_arch_x86vmx_mhv_nmi_disabled(VCPU *vcpu);
@@ -210,6 +216,11 @@ extern u32 volatile g_vmx_lock_quiesce_resume_signal __attribute__(( section(".d
 //smpguest x86vmx
 extern u32 volatile g_vmx_flush_all_tlb_signal __attribute__(( section(".data") ));
 
+//Guest physical address range [lo, hi) of g_vmx_flush_all_tlb_signal
+//smpguest x86vmx
+extern u64 volatile g_vmx_flush_all_tlb_gpa_lo __attribute__(( section(".data") ));
+extern u64 volatile g_vmx_flush_all_tlb_gpa_hi __attribute__(( section(".data") ));
+
 
 //----------------------------------------------------------------------
 //x86svm SUBARCH. INTERFACES
@@ -0,0 +1,310 @@
+/*
+ * @XMHF_LICENSE_HEADER_START@
+ *
+ * eXtensible, Modular Hypervisor Framework (XMHF)
+ * Copyright (c) 2009-2012 Carnegie Mellon University
+ * Copyright (c) 2010-2012 VDG Inc.
+ * All Rights Reserved.
+ *
+ * Developed by: XMHF Team
+ *               Carnegie Mellon University / CyLab
+ *               VDG Inc.
+ *               http://xmhf.org
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * Neither the names of Carnegie Mellon or VDG Inc, nor the names of
+ * its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @XMHF_LICENSE_HEADER_END@
+ */
+
+// xmhf-lru-hash.h
+// Provide a template for implementing fully associative software LRU cache
+// with O(1) lookup, eviction and invalidation
+
+/*
+ * This file provides the same interface as xmhf-lru.h, with macros prefixed
+ * by LRU_HASH_ instead of LRU_. A set is indexed by a small open-addressed
+ * hash table (linear probing, backward shift deletion) that maps keys to
+ * lines. Valid lines are linked in recency order by an intrusive doubly
+ * linked list, and invalid lines are linked in a free list. So finding,
+ * evicting and invalidating a line do not scan the set.
+ *
+ * The linear implementation in xmhf-lru.h is faster for very small sets
+ * (e.g. 4 lines), so each cache chooses the implementation that fits its
+ * size. LRU_FOREACH() works for sets of both implementations, and the valid
+ * field of a line has the same meaning in both.
+ *
+ * LRU_KEY_TYPE must be an integer type, because keys are hashed.
+ */
+
+/*
+ * Number of slots in the hash table for a set of LRU_SIZE lines: the
+ * smallest power of 2 that is at least 2 * LRU_SIZE. Sets with more than 32768
+ * lines are not supported (compile error due to negative array size).
+ */
+#define LRU_HASH_BUCKETS(LRU_SIZE) \
+	((LRU_SIZE) <= 2 ? 4 : (LRU_SIZE) <= 4 ? 8 : (LRU_SIZE) <= 8 ? 16 : \
+	 (LRU_SIZE) <= 16 ? 32 : (LRU_SIZE) <= 32 ? 64 : \
+	 (LRU_SIZE) <= 64 ? 128 : (LRU_SIZE) <= 128 ? 256 : \
+	 (LRU_SIZE) <= 256 ? 512 : (LRU_SIZE) <= 512 ? 1024 : \
+	 (LRU_SIZE) <= 1024 ? 2048 : (LRU_SIZE) <= 2048 ? 4096 : \
+	 (LRU_SIZE) <= 4096 ? 8192 : (LRU_SIZE) <= 8192 ? 16384 : \
+	 (LRU_SIZE) <= 16384 ? 32768 : (LRU_SIZE) <= 32768 ? 65536 : -1)
+
+/*
+ * Create a new type (LRU_LINE_TYPE) for storing a cache line and a new type
+ * (LRU_SET_TYPE) for storing a cache set. LRU_INDEX_TYPE needs to be able to
+ * hold integers in [0, LRU_SIZE].
+ */
+#define LRU_HASH_NEW_SET(LRU_SET_TYPE, LRU_LINE_TYPE, LRU_SIZE, LRU_INDEX_TYPE, \
+						 LRU_KEY_TYPE, LRU_VALUE_TYPE) \
+	typedef struct LRU_LINE_TYPE { \
+		/* 1 if the cache line is valid, 0 if invalid */ \
+		LRU_INDEX_TYPE valid; \
+		/*
+		 * For a valid line, the more / less recently used line in the recency
+		 * list. For an invalid line, next is the next line in the free list.
+		 * LRU_SIZE means no line.
+		 */ \
+		LRU_INDEX_TYPE prev; \
+		LRU_INDEX_TYPE next; \
+		/* The key to determine whether cache matches, using operator "==" */ \
+		LRU_KEY_TYPE key; \
+		/* The value of the cache */ \
+		LRU_VALUE_TYPE value; \
+	} LRU_LINE_TYPE; \
+	\
+	typedef struct LRU_SET_TYPE { \
+		LRU_LINE_TYPE elems[LRU_SIZE]; \
+		/* Most recently used valid line, or LRU_SIZE if none */ \
+		LRU_INDEX_TYPE head; \
+		/* Least recently used valid line, or LRU_SIZE if none */ \
+		LRU_INDEX_TYPE tail; \
+		/* First invalid line, or LRU_SIZE if none */ \
+		LRU_INDEX_TYPE free; \
+		/* Hash table: index of line + 1, or 0 if slot is empty */ \
+		LRU_INDEX_TYPE hash[LRU_HASH_BUCKETS(LRU_SIZE)]; \
+	} LRU_SET_TYPE;
+
+/* Number of lines in set LRU_SET, also used as "no line" */
+#define _LRU_HASH_NLINES(LRU_SET) \
+	(sizeof((LRU_SET)->elems) / sizeof((LRU_SET)->elems[0]))
+
+/* Mask to compute slot index in hash table of LRU_SET */
+#define _LRU_HASH_MASK(LRU_SET) \
+	((u32) (sizeof((LRU_SET)->hash) / sizeof((LRU_SET)->hash[0]) - 1))
+
+/* Home slot of KEY in hash table of LRU_SET (Fibonacci hashing) */
+#define _LRU_HASH_HOME(LRU_SET, KEY) \
+	((u32) (((u64) (KEY) * 0x9e3779b97f4a7c15ULL) >> 32) & \
+	 _LRU_HASH_MASK(LRU_SET))
+
+/*
+ * Return the slot in hash table of LRU_SET that contains KEY. If KEY is not
+ * present, return the empty slot where KEY should be inserted. The hash table
+ * is at most half full, so the loop always terminates.
+ */
+#define _LRU_HASH_LOOKUP(LRU_SET, KEY) \
+	({ \
+		u32 _slot = _LRU_HASH_HOME(LRU_SET, KEY); \
+		while ((LRU_SET)->hash[_slot] != 0 && \
+			   (LRU_SET)->elems[(LRU_SET)->hash[_slot] - 1].key != (KEY)) { \
+			_slot = (_slot + 1) & _LRU_HASH_MASK(LRU_SET); \
+		} \
+		_slot; \
+	})
+
+/*
+ * Remove the entry at SLOT in hash table of LRU_SET. Later entries in the
+ * same cluster are shifted backward, so lookups do not need tombstones.
+ */
+#define _LRU_HASH_REMOVE(LRU_SET, SLOT) \
+	do { \
+		u32 _hole = (SLOT); \
+		u32 _next = _hole; \
+		(LRU_SET)->hash[_hole] = 0; \
+		while (1) { \
+			u32 _home; \
+			_next = (_next + 1) & _LRU_HASH_MASK(LRU_SET); \
+			if ((LRU_SET)->hash[_next] == 0) { \
+				break; \
+			} \
+			_home = _LRU_HASH_HOME(LRU_SET, \
+				(LRU_SET)->elems[(LRU_SET)->hash[_next] - 1].key); \
+			/* Move if the hole is cyclically within [_home, _next) */ \
+			if (((_next - _home) & _LRU_HASH_MASK(LRU_SET)) >= \
+				((_next - _hole) & _LRU_HASH_MASK(LRU_SET))) { \
+				(LRU_SET)->hash[_hole] = (LRU_SET)->hash[_next]; \
+				(LRU_SET)->hash[_next] = 0; \
+				_hole = _next; \
+			} \
+		} \
+	} while (0)
+
+/* Remove line INDEX from the recency list of LRU_SET */
+#define _LRU_HASH_UNLINK(LRU_SET, INDEX) \
+	do { \
+		typeof(&((LRU_SET)->elems[0])) _ul = &(LRU_SET)->elems[(INDEX)]; \
+		if (_ul->prev == _LRU_HASH_NLINES(LRU_SET)) { \
+			(LRU_SET)->head = _ul->next; \
+		} else { \
+			(LRU_SET)->elems[_ul->prev].next = _ul->next; \
+		} \
+		if (_ul->next == _LRU_HASH_NLINES(LRU_SET)) { \
+			(LRU_SET)->tail = _ul->prev; \
+		} else { \
+			(LRU_SET)->elems[_ul->next].prev = _ul->prev; \
+		} \
+	} while (0)
+
+/* Insert line INDEX as the most recently used line of LRU_SET */
+#define _LRU_HASH_PUSH_FRONT(LRU_SET, INDEX) \
+	do { \
+		typeof(&((LRU_SET)->elems[0])) _pl = &(LRU_SET)->elems[(INDEX)]; \
+		_pl->prev = _LRU_HASH_NLINES(LRU_SET); \
+		_pl->next = (LRU_SET)->head; \
+		if ((LRU_SET)->head == _LRU_HASH_NLINES(LRU_SET)) { \
+			(LRU_SET)->tail = (INDEX); \
+		} else { \
+			(LRU_SET)->elems[(LRU_SET)->head].prev = (INDEX); \
+		} \
+		(LRU_SET)->head = (INDEX); \
+	} while (0)
+
+/*
+ * Initialize all lines in a cache set.
+ * The type of LRU_SET is LRU_SET_TYPE *. It is the cache set to be initialized.
+ */
+#define LRU_HASH_SET_INIT(LRU_SET) LRU_HASH_SET_INVALIDATE_ALL(LRU_SET)
+
+/*
+ * Find a key KEY in cache set LRU_SET, without changing the cache state.
+ * If a line is found, the pointer to the line is put in FOUND_LINE
+ * (type LRU_LINE_TYPE *) and true is returned. Otherwise, false is returned.
+ */
+#define LRU_HASH_SET_FIND_IMMUTABLE(LRU_SET, KEY, FOUND_LINE) \
+	({ \
+		bool _ans = false; \
+		u32 _slot = _LRU_HASH_LOOKUP(LRU_SET, KEY); \
+		if ((LRU_SET)->hash[_slot] != 0) { \
+			(FOUND_LINE) = &(LRU_SET)->elems[(LRU_SET)->hash[_slot] - 1]; \
+			_ans = true; \
+		} \
+		_ans; \
+	})
+
+/*
+ * Find a key KEY in cache set LRU_SET, updating the LRU order, evicting when
+ * necessary. The pointer to the line found is returned (type LRU_LINE_TYPE *).
+ * The index of the line is set in INDEX (type LRU_INDEX_TYPE).
+ * When CACHE_HIT is false, the caller needs to initialize / re-initialize the
+ * value of the line.
+ */
+#define LRU_HASH_SET_FIND_EVICT(LRU_SET, KEY, INDEX, CACHE_HIT) \
+	({ \
+		const typeof((LRU_SET)->elems[0].valid) _nlines = \
+			_LRU_HASH_NLINES(LRU_SET); \
+		typeof((LRU_SET)->elems[0].valid) _ans_index; \
+		typeof(&((LRU_SET)->elems[0])) _ans_line; \
+		bool _cache_hit = false; \
+		u32 _slot = _LRU_HASH_LOOKUP(LRU_SET, KEY); \
+		if ((LRU_SET)->hash[_slot] != 0) { \
+			/* Hit */ \
+			_cache_hit = true; \
+			_ans_index = (LRU_SET)->hash[_slot] - 1; \
+			_LRU_HASH_UNLINK(LRU_SET, _ans_index); \
+		} else if ((LRU_SET)->free != _nlines) { \
+			/* Cold miss */ \
+			_ans_index = (LRU_SET)->free; \
+			(LRU_SET)->free = (LRU_SET)->elems[_ans_index].next; \
+			(LRU_SET)->hash[_slot] = _ans_index + 1; \
+		} else { \
+			/* Capacity miss */ \
+			_ans_index = (LRU_SET)->tail; \
+			_LRU_HASH_UNLINK(LRU_SET, _ans_index); \
+			_LRU_HASH_REMOVE(LRU_SET, _LRU_HASH_LOOKUP(LRU_SET, \
+				(LRU_SET)->elems[_ans_index].key)); \
+			/* Removal may shift entries, so search for empty slot again */ \
+			_slot = _LRU_HASH_LOOKUP(LRU_SET, KEY); \
+			(LRU_SET)->hash[_slot] = _ans_index + 1; \
+		} \
+		_LRU_HASH_PUSH_FRONT(LRU_SET, _ans_index); \
+		_ans_line = &((LRU_SET)->elems[_ans_index]); \
+		_ans_line->valid = 1; \
+		_ans_line->key = (KEY); \
+		(INDEX) = _ans_index; \
+		(CACHE_HIT) = _cache_hit; \
+		_ans_line; \
+	})
+
+/*
+ * Find a key KEY in cache set LRU_SET and invalidate it.
+ * If a line is found, the pointer to the line is put in FOUND_LINE
+ * (type LRU_LINE_TYPE *) and true is returned. Otherwise, false is returned.
+ *
+ * Note that when this function returns true, the returned line is already
+ * invalidated (valid = 0). However, when race condition is not considered,
+ * the caller can still safely inspect the value in FOUND_LINE.
+ */
+#define LRU_HASH_SET_INVALIDATE(LRU_SET, KEY, FOUND_LINE) \
+	({ \
+		bool _ans = false; \
+		u32 _slot = _LRU_HASH_LOOKUP(LRU_SET, KEY); \
+		if ((LRU_SET)->hash[_slot] != 0) { \
+			typeof((LRU_SET)->elems[0].valid) _index = \
+				(LRU_SET)->hash[_slot] - 1; \
+			_LRU_HASH_REMOVE(LRU_SET, _slot); \
+			_LRU_HASH_UNLINK(LRU_SET, _index); \
+			(FOUND_LINE) = &(LRU_SET)->elems[_index]; \
+			(FOUND_LINE)->valid = 0; \
+			(FOUND_LINE)->next = (LRU_SET)->free; \
+			(LRU_SET)->free = _index; \
+			_ans = true; \
+		} \
+		_ans; \
+	})
+
+/* Invalidate all cache lines in cache set LRU_SET */
+#define LRU_HASH_SET_INVALIDATE_ALL(LRU_SET) \
+	do { \
+		typeof((LRU_SET)->elems[0].valid) _i; \
+		typeof(&((LRU_SET)->elems[0])) _line; \
+		u32 _slot; \
+		LRU_FOREACH(_i, _line, LRU_SET) { \
+			_line->valid = 0; \
+			_line->next = _i + 1; \
+		} \
+		for (_slot = 0; _slot <= _LRU_HASH_MASK(LRU_SET); _slot++) { \
+			(LRU_SET)->hash[_slot] = 0; \
+		} \
+		(LRU_SET)->head = _LRU_HASH_NLINES(LRU_SET); \
+		(LRU_SET)->tail = _LRU_HASH_NLINES(LRU_SET); \
+		(LRU_SET)->free = 0; \
+	} while (0)
@@ -56,15 +56,17 @@
 #define LRU_NEW_SET(LRU_SET_TYPE, LRU_LINE_TYPE, LRU_SIZE, LRU_INDEX_TYPE, \
 					LRU_KEY_TYPE, LRU_VALUE_TYPE) \
 	typedef struct LRU_LINE_TYPE { \
+		/* 1 if the cache line is valid, 0 if invalid */ \
+		LRU_INDEX_TYPE valid; \
 		/*
-		 * If 0, cache line is invalid. Otherwise, track LRU order (1 is most
-		 * recently used; when all valid, LRU_SIZE is LRU).
+		 * For a valid line, track LRU order (1 is most recently used; when all
+		 * valid, LRU_SIZE is LRU). Undefined for an invalid line.
 		 *
-		 * When considering the valid fields of all lines in a set, the
-		 * non-zero values never repeat and are within 1 and LRU_SIZE
+		 * When considering the ranks of all valid lines in a set, the values
+		 * never repeat and are within 1 and the number of valid lines
 		 * (inclusive).
 		 */ \
-		LRU_INDEX_TYPE valid; \
+		LRU_INDEX_TYPE rank; \
 		/* The key to determine whether cache matches, using operator "==" */ \
 		LRU_KEY_TYPE key; \
 		/* The value of the cache */ \
@@ -136,7 +138,7 @@
 		/* Index of LRU entry during search (less preferred than invalid) */ \
 		typeof((LRU_SET)->elems[0].valid) _evict_index = _nlines; \
 		/* When updating LRU order, do not exceed this amount */ \
-		typeof((LRU_SET)->elems[0].valid) _max_valid = _nlines; \
+		typeof((LRU_SET)->elems[0].valid) _max_rank = _nlines; \
 		typeof((LRU_SET)->elems[0].valid) _index; \
 		typeof(&((LRU_SET)->elems[0])) _line; \
 		typeof(&((LRU_SET)->elems[0])) _ans_line = NULL; \
@@ -144,14 +146,15 @@
 		LRU_FOREACH(_index, _line, LRU_SET) { \
 			if (_line->valid == 0) { \
 				_available_index = _index; \
-			} else if (_line->valid == _nlines) { \
-				_evict_index = _index; \
 			} else if (_line->key == (KEY)) { \
 				_cache_hit = true; \
 				_ans_index = _index; \
 				_ans_line = _line; \
-				_max_valid = _line->valid; \
+				_max_rank = _line->rank; \
 				break; \
+			} else if (_line->rank == _nlines) { \
+				/* Checked after the key, the LRU line may also be a hit */ \
+				_evict_index = _index; \
 			} \
 		} \
 		if (!_cache_hit) { \
@@ -166,11 +169,12 @@
 		} \
 		/* Update LRU order */ \
 		LRU_FOREACH(_index, _line, LRU_SET) { \
-			if (_line->valid && _line->valid < _max_valid) { \
-				_line->valid++; \
+			if (_line->valid && _line->rank < _max_rank) { \
+				_line->rank++; \
 			} \
 		} \
 		_ans_line->valid = 1; \
+		_ans_line->rank = 1; \
 		_ans_line->key = (KEY); \
 		(INDEX) = _ans_index; \
 		(CACHE_HIT) = _cache_hit; \
@@ -193,10 +197,19 @@
 		LRU_FOREACH(_i, FOUND_LINE, LRU_SET) { \
 			if ((FOUND_LINE)->valid && (FOUND_LINE)->key == (KEY)) { \
 				_ans = true; \
-				(FOUND_LINE)->valid = 0; \
 				break; \
 			} \
 		} \
+		if (_ans) { \
+			/* Keep the LRU order of valid lines within 1 and #valid lines */ \
+			typeof(&((LRU_SET)->elems[0])) _line; \
+			LRU_FOREACH(_i, _line, LRU_SET) { \
+				if (_line->valid && _line->rank > (FOUND_LINE)->rank) { \
+					_line->rank--; \
+				} \
+			} \
+			(FOUND_LINE)->valid = 0; \
+		} \
 		_ans; \
 	})
 
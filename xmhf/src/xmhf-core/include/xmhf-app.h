@@ -159,7 +159,10 @@ extern void xmhf_app_handleshutdown(VCPU *vcpu, struct regs *r);
  * Hypapp should return APP_SUCCESS if hyper call is handled. Otherwise hypapp
  * should return APP_ERROR (XMHF will halt).
  *
- * When this function is called, other CPUs are quiesced.
+ * When this function is called, other CPUs are quiesced, unless
+ * __XMHF_QUIESCE_CPU_IN_HYPERCALL__ is not defined (Intel only). In that case
+ * the hypapp needs to perform its own synchronization, and can use
+ * xmhf_memprot_flushmappings_shootdown() to flush EPT TLB of other CPUs.
  */
 extern u32 xmhf_app_handlehypercall(VCPU *vcpu, struct regs *r);
 
@@ -76,6 +76,7 @@ DEFINE_EVENT_FIELD(vmexit_201, u32, "%d", 8, u16, u32, "%d")
 DEFINE_EVENT_FIELD(vmexit_202, u32, "%d", 4, u16, u32, "%d")
 DEFINE_EVENT_FIELD(ept02_full, u32, "%d", 2, u16, gpa_t, "0x%08llx")
 DEFINE_EVENT_FIELD(ept02_miss, u32, "%d", 2, u16, gpa_t, "0x%08llx")
+DEFINE_EVENT_FIELD(vpid02_miss, u32, "%d", 2, u16, u16, "0x%04x")
 #endif /* !__NESTED_VIRTUALIZATION__ */
 
 #undef DEFINE_EVENT_FIELD
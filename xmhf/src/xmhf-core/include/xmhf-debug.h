@@ -137,6 +137,38 @@ typedef enum xmhf_dbg_eventlog_t {
 
 #endif /* __DEBUG_EVENT_LOGGER__ */
 
+#ifdef __DEBUG_TRACE_RING__
+
+/*
+ * Number of records in the trace ring of each CPU (power of 2). When a ring
+ * is full, new records are dropped and a XMHF_DBG_TRACE_LOST record is added
+ * when there is space again.
+ */
+#define XMHF_DBG_TRACE_RING_SIZE	1024
+
+/*
+ * On the serial port, each record is a 16 byte frame:
+ *   [0]      XMHF_DBG_TRACE_SYNC (never printed by printf, which is ASCII)
+ *   [1]      CPU index
+ *   [2]      event (xmhf_dbg_eventlog_t or XMHF_DBG_TRACE_LOST)
+ *   [3]      low 8 bits of per-CPU sequence number
+ *   [4..9]   low 48 bits of TSC, little endian
+ *   [10..15] low 48 bits of payload, little endian
+ * See tools/trace/decode_trace.py.
+ */
+#define XMHF_DBG_TRACE_SYNC			0xff
+#define XMHF_DBG_TRACE_FRAME_SIZE	16
+#define XMHF_DBG_TRACE_LOST			0xff
+
+typedef struct xmhf_dbg_trace_rec_t {
+	u64 tsc;
+	u64 payload;
+	u8 event;
+	u8 seq;
+} xmhf_dbg_trace_rec_t;
+
+#endif /* __DEBUG_TRACE_RING__ */
+
 //----------------------------------------------------------------------
 //exported FUNCTIONS
 void xmhf_debug_init(char *params);
@@ -165,6 +197,14 @@ void xmhf_dbg_log_event(void *_vcpu, bool can_print, xmhf_dbg_eventlog_t event,
 
 #endif /* __DEBUG_EVENT_LOGGER__ */
 
+#ifdef __DEBUG_TRACE_RING__
+
+void xmhf_dbg_trace(u32 cpu, u8 event, u64 payload);
+void xmhf_dbg_trace_drain(void);
+bool emhfc_putchar_linetrylock(void *arg);
+
+#endif /* __DEBUG_TRACE_RING__ */
+
 extern void xmhf_event_clear_all_counters(void);
 extern void xmhf_event_counter_inc(void* _vcpu, uint32_t event_slot_sel);
 extern void xmhf_event_print_all_counters(void);
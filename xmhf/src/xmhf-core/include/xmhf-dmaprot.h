@@ -173,6 +173,11 @@ extern void xmhf_dmaprot_unprotect(spa_t start_paddr, size_t size);
 
 extern void xmhf_dmaprot_invalidate_cache(void);
 
+// Invalidate the cached DMA translations of [start_paddr, start_paddr + size)
+// after changing them with xmhf_dmaprot_protect/unprotect. Use
+// xmhf_dmaprot_invalidate_cache() when other DMA structures are modified.
+extern void xmhf_dmaprot_invalidate_range(spa_t start_paddr, size_t size);
+
 //----------------------------------------------------------------------
 //ARCH. BACKENDS
 //----------------------------------------------------------------------
@@ -191,6 +196,8 @@ extern void xmhf_dmaprot_arch_unprotect(spa_t start_paddr, size_t size);
 
 extern void xmhf_dmaprot_arch_invalidate_cache(void);
 
+extern void xmhf_dmaprot_arch_invalidate_range(spa_t start_paddr, size_t size);
+
 
 //----------------------------------------------------------------------
 //x86_vmx SUBARCH. INTERFACES
@@ -200,7 +207,8 @@ struct dmap_vmx_cap
 {
 	u32 nd:3;
 	u32 sagaw:5;
-	u32 _reserved1:24;
+	u32 sps:4;		// Super-page sizes supported by all VT-d units
+	u32 _reserved1:20;
 } __attribute__ ((packed));
 
 //----------------------------------------------------------------------
@@ -217,6 +225,7 @@ u32 xmhf_dmaprot_arch_x86_vmx_enable(spa_t protectedbuffer_paddr,
 void xmhf_dmaprot_arch_x86_vmx_protect(spa_t start_paddr, size_t size);
 extern void xmhf_dmaprot_arch_x86_vmx_unprotect(spa_t start_paddr, size_t size);
 extern void xmhf_dmaprot_arch_x86_vmx_invalidate_cache(void);
+extern void xmhf_dmaprot_arch_x86_vmx_invalidate_range(spa_t start_paddr, size_t size);
 
 
 
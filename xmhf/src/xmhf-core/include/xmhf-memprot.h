@@ -75,6 +75,19 @@ typedef struct emu_env emu_env_t;
 #define MEMP_FLUSHTLB_ENTRY		2	// Entries in EPT changed
 #define MEMP_FLUSHTLB_MT_ENTRY	4	// Entries changed, but only EPT MT bits
 
+// guest physical address range [lo, hi) for xmhf_memprot_flushmappings_*_range
+// that means all addresses may have changed
+#define MEMP_FLUSHTLB_GPA_LO_ALL	(0ULL)
+#define MEMP_FLUSHTLB_GPA_HI_ALL	(~0ULL)
+
+// set of CPUs (indexed by vcpu->idx) for xmhf_memprot_flushmappings_shootdown
+typedef struct {
+	u32 bits[(MAX_VCPU_ENTRIES + 31) / 32];
+} memp_cpuset_t;
+
+#define MEMP_CPUSET_ADD(set, idx)	((set)->bits[(idx) / 32] |= (1U << ((idx) % 32)))
+#define MEMP_CPUSET_HAS(set, idx)	(((set)->bits[(idx) / 32] >> ((idx) % 32)) & 1U)
+
 // Structures for guestmem
 typedef struct {
 	/* guest_ctx must be the first member, see guestmem_guest_ctx_pa2ptr() */
@@ -129,12 +142,47 @@ void xmhf_memprot_flushmappings_localtlb(VCPU *vcpu, u32 flags);
 //flags is bitwise or of MEMP_FLUSHTLB_* macros. 0 is effectively NOP.
 void xmhf_memprot_flushmappings_alltlb(VCPU *vcpu, u32 flags);
 
+//same as xmhf_memprot_flushmappings_localtlb(), but only entries for guest
+//physical addresses in [gpa_lo, gpa_hi) changed. Mappings derived from the
+//nested page tables (e.g. EPT02) outside the range are kept.
+void xmhf_memprot_flushmappings_localtlb_range(VCPU *vcpu, u32 flags,
+                                               u64 gpa_lo, u64 gpa_hi);
+
+//same as xmhf_memprot_flushmappings_alltlb(), but only entries for guest
+//physical addresses in [gpa_lo, gpa_hi) changed (need quiesce).
+void xmhf_memprot_flushmappings_alltlb_range(VCPU *vcpu, u32 flags,
+                                             u64 gpa_lo, u64 gpa_hi);
+
+//flush the TLB of nested page tables in CPUs in cpus (all CPUs if NULL), only
+//entries for guest physical addresses in [gpa_lo, gpa_hi) changed. Does not
+//need quiesce: other CPUs in cpus are interrupted to flush their own TLB, and
+//CPUs not in cpus keep running. Returns after all CPUs in cpus have flushed.
+void xmhf_memprot_flushmappings_shootdown(VCPU *vcpu, const memp_cpuset_t *cpus,
+                                          u32 flags, u64 gpa_lo, u64 gpa_hi);
+
 //set protection for a given physical memory address
 void xmhf_memprot_setprot(VCPU *vcpu, u64 gpa, u32 prottype);
 
 //get protection for a given physical memory address
 u32 xmhf_memprot_getprot(VCPU *vcpu, u64 gpa);
 
+//split large pages in the nested page table so that gpa is mapped by a 4K
+//page. Must be called before modifying the 4K entry of gpa directly (e.g.
+//using hptw). Caller needs to prevent concurrent changes to the page table.
+void xmhf_memprot_split_page(VCPU *vcpu, u64 gpa);
+
+//merge page tables mapping [gpa_lo, gpa_hi) in the nested page table into
+//large pages when their entries become uniform. Caller needs to flush TLB of
+//all CPUs afterwards, and prevent concurrent changes to the page table.
+void xmhf_memprot_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi);
+
+//bracket direct modifications to the nested page table (e.g. using hptw).
+//Other xmhf_memprot_* calls that modify the page table may nest inside. If
+//lock, other CPUs cannot modify or walk the page table until
+//xmhf_memprot_write_end(), which also updates CPU-private copies of it.
+void xmhf_memprot_write_begin(VCPU *vcpu, bool lock);
+void xmhf_memprot_write_end(VCPU *vcpu);
+
 // Is the given system paddr belong to mHV (XMHF + hypapp)?
 bool xmhf_is_mhv_memory(spa_t spa);
 
@@ -142,6 +190,15 @@ bool xmhf_is_mhv_memory(spa_t spa);
 // On 64-bit machine, the function queries the E820 map for the used memory region.
 bool xmhf_get_machine_paddr_range(spa_t* machine_base_spa, spa_t* machine_limit_spa);
 
+// Maximum length of an instruction handled by the instruction emulator
+#ifdef __I386__
+#define X86_INST_MAX_LEN 9
+#elif defined(__AMD64__)
+#define X86_INST_MAX_LEN 15
+#else
+#error "Unsupported Arch"
+#endif /* __I386__ */
+
 /// @brief Emulate instruction by changing the VMCS values.
 /// Currently XMHF will crash if the instruction is invalid.
 /// @param vcpu 
@@ -214,12 +271,33 @@ u32 xmhf_memprot_arch_x86vmx_mtrr_write(VCPU *vcpu, u32 msr, u64 val);
 //flush the TLB of all nested page tables in the current core
 void xmhf_memprot_arch_flushmappings_localtlb(VCPU *vcpu, u32 flags);
 
+//flush the TLB of all nested page tables in the current core, only entries for
+//guest physical addresses in [gpa_lo, gpa_hi) changed
+void xmhf_memprot_arch_flushmappings_localtlb_range(VCPU *vcpu, u32 flags,
+                                                    u64 gpa_lo, u64 gpa_hi);
+
+//flush the TLB of nested page tables in CPUs in cpus without quiesce
+void xmhf_memprot_arch_flushmappings_shootdown(VCPU *vcpu,
+											   const memp_cpuset_t *cpus,
+											   u32 flags, u64 gpa_lo,
+											   u64 gpa_hi);
+
 //set protection for a given physical memory address
 void xmhf_memprot_arch_setprot(VCPU *vcpu, u64 gpa, u32 prottype);
 
 //get protection for a given physical memory address
 u32 xmhf_memprot_arch_getprot(VCPU *vcpu, u64 gpa);
 
+//split large pages so that gpa is mapped by a 4K page
+void xmhf_memprot_arch_split_page(VCPU *vcpu, u64 gpa);
+
+//merge page tables mapping [gpa_lo, gpa_hi) into large pages when possible
+void xmhf_memprot_arch_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi);
+
+//bracket direct modifications to the nested page table
+void xmhf_memprot_arch_write_begin(VCPU *vcpu, bool lock);
+void xmhf_memprot_arch_write_end(VCPU *vcpu);
+
 // On 32bit machine, we always return 0 - 4G as the machine physical address range, no matter how many memory is installed
 // On 64-bit machine, the function queries the E820 map for the used memory region.
 bool xmhf_arch_get_machine_paddr_range(spa_t* machine_base_spa, spa_t* machine_limit_spa);
@@ -236,8 +314,15 @@ bool xmhf_arch_get_machine_paddr_range(spa_t* machine_base_spa, spa_t* machine_l
 
 void xmhf_memprot_arch_x86vmx_initialize(VCPU *vcpu);	//initialize memory protection for a core
 void xmhf_memprot_arch_x86vmx_flushmappings_localtlb(VCPU *vcpu, u32 flags); // flush TLB in current CPU
+void xmhf_memprot_arch_x86vmx_flushmappings_localtlb_range(VCPU *vcpu, u32 flags, u64 gpa_lo, u64 gpa_hi); // flush TLB in current CPU, [gpa_lo, gpa_hi) changed
 void xmhf_memprot_arch_x86vmx_setprot(VCPU *vcpu, u64 gpa, u32 prottype); //set protection for a given physical memory address
 u32 xmhf_memprot_arch_x86vmx_getprot(VCPU *vcpu, u64 gpa); //get protection for a given physical memory address
+void xmhf_memprot_arch_x86vmx_split_page(VCPU *vcpu, u64 gpa); //split EPT01 large pages so that gpa is mapped by a 4K page
+void xmhf_memprot_arch_x86vmx_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi); //merge EPT01 page tables into large pages
+void xmhf_memprot_arch_x86vmx_write_begin(VCPU *vcpu, bool lock); //start modifying EPT01 directly
+void xmhf_memprot_arch_x86vmx_write_end(VCPU *vcpu); //finish modifying EPT01 directly
+void xmhf_memprot_arch_x86vmx_set_pte(VCPU *vcpu, u64 gpa, u64 value); //set 4K EPT01 entry of gpa (splits large pages)
+void xmhf_memprot_arch_x86vmx_reset_pte(VCPU *vcpu, u64 gpa); //restore identity 4K EPT01 entry of gpa
 u64 xmhf_memprot_arch_x86vmx_get_EPTP(VCPU *vcpu); // get or set EPTP01 (only valid on Intel)
 void xmhf_memprot_arch_x86vmx_set_EPTP(VCPU *vcpu, u64 eptp);
 
@@ -245,10 +330,19 @@ void memprot_x86vmx_eptlock_write_lock(VCPU *vcpu);
 void memprot_x86vmx_eptlock_write_unlock(VCPU *vcpu);
 void memprot_x86vmx_eptlock_read_lock(VCPU *vcpu);
 void memprot_x86vmx_eptlock_read_unlock(VCPU *vcpu);
+u32 memprot_x86vmx_eptlock_read_begin(VCPU *vcpu);
+bool memprot_x86vmx_eptlock_read_retry(VCPU *vcpu, u32 seq);
+u32 memprot_x86vmx_eptlock_generation(void);
+void memprot_x86vmx_eptlock_invalidate(void);
 
 void guestmem_init(VCPU *vcpu, guestmem_hptw_ctx_pair_t *ctx_pair);
+void guestmem_tlb_invalidate(VCPU *vcpu);
+void guestmem_tlb_print_stats(VCPU *vcpu);
 void guestmem_copy_gv2h(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
 						void *dst, hpt_va_t src, size_t len);
+int guestmem_checked_copy_gv2h(guestmem_hptw_ctx_pair_t *ctx_pair,
+							   hptw_cpl_t cpl, void *dst, hpt_va_t src,
+							   size_t len);
 void guestmem_copy_gp2h(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
 						void *dst, hpt_va_t src, size_t len);
 void guestmem_copy_h2gv(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
@@ -369,6 +463,8 @@ typedef struct emu_env {
 	cpu_segment_t seg;
 	size_t displacement_len;
 	size_t immediate_len;
+	u8 opcode;	/// Last opcode byte
+	u8 form;	/// Decoded form (EMU_FORM_*), EMU_FORM_NONE if not cacheable
 } emu_env_t;
 
 /// @brief Emulate instruction by changing the VMCS values.
@@ -381,18 +477,16 @@ typedef struct emu_env {
 /// @return 
 extern int x86_vmx_emulate_instruction(VCPU * vcpu, struct regs *r, emu_env_t* emu_env, unsigned char* inst, uint32_t inst_len);
 
+/// @brief Print statistics of the decoded instruction cache of the emulator.
+/// @param vcpu 
+extern void x86_vmx_emulate_cache_print_stats(VCPU * vcpu);
+
 //VMX EPT PML4 table buffers
 extern u8 g_vmx_ept_pml4_table_buffers[] __attribute__((aligned(PAGE_SIZE_4K)));
 
 //VMX EPT PDP table buffers
 extern u8 g_vmx_ept_pdp_table_buffers[] __attribute__((aligned(PAGE_SIZE_4K)));
 
-//VMX EPT PD table buffers
-extern u8 g_vmx_ept_pd_table_buffers[] __attribute__((aligned(PAGE_SIZE_4K)));
-
-//VMX EPT P table buffers
-extern u8 g_vmx_ept_p_table_buffers[] __attribute__((aligned(PAGE_SIZE_4K)));
-
 
 //----------------------------------------------------------------------
 //x86svm SUBARCH. INTERFACES
@@ -402,6 +496,8 @@ void xmhf_memprot_arch_x86svm_initialize(VCPU *vcpu);	//initialize memory protec
 void xmhf_memprot_arch_x86svm_flushmappings(VCPU *vcpu); //flush hardware page table mappings (TLB)
 void xmhf_memprot_arch_x86svm_setprot(VCPU *vcpu, u64 gpa, u32 prottype); //set protection for a given physical memory address
 u32 xmhf_memprot_arch_x86svm_getprot(VCPU *vcpu, u64 gpa); //get protection for a given physical memory address
+void xmhf_memprot_arch_x86svm_split_page(VCPU *vcpu, u64 gpa); //split 2M page so that gpa is mapped by a 4K page
+void xmhf_memprot_arch_x86svm_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi); //merge 4K pages into 2M pages when possible
 u64 xmhf_memprot_arch_x86svm_get_h_cr3(VCPU *vcpu); // get or set host cr3 (only valid on AMD)
 void xmhf_memprot_arch_x86svm_set_h_cr3(VCPU *vcpu, u64 hcr3);
 
@@ -12,8 +12,29 @@ struct xmhf_mm_alloc_info
 	void* 		hva;
 	uint32_t 	alignment;
 	size_t 		size;
+	XMHFList*	list;		// List holding this record
+	XMHFListNode*	node;		// Node of this record in <list>
+	struct xmhf_mm_alloc_info*	hash_next;	// Next record in the same bucket of the record hash
 };
 
+//! Size classes of the allocator. Requests up to 2048 bytes are served by the
+//! object slab in power of 2 classes (16, 32, ..., 2048 bytes). Single 4K pages
+//! are served by the page slab. Larger requests go to the TLSF heap.
+#define XMHF_MM_SLAB_MIN_SHIFT		4
+#define XMHF_MM_SLAB_MAX_SHIFT		11
+#define XMHF_MM_SLAB_CLASSES		(XMHF_MM_SLAB_MAX_SHIFT - XMHF_MM_SLAB_MIN_SHIFT + 1)
+#define XMHF_MM_CLASS_PAGE			(XMHF_MM_SLAB_CLASSES)
+#define XMHF_MM_CLASS_LARGE			(XMHF_MM_SLAB_CLASSES + 1)
+#define XMHF_MM_NUM_CLASSES			(XMHF_MM_SLAB_CLASSES + 2)
+
+//! Allocation statistics of a size class
+typedef struct {
+	u64 allocs;		// Number of allocations
+	u64 frees;		// Number of frees
+	u64 refills;	// Number of per-CPU cache refills from the shared depot
+	u64 pages;		// Number of 4K pages carved into the slab of this class
+} xmhf_mm_stats_t;
+
 void xmhf_mm_init(void);
 void xmhf_mm_fini(void);
 void* xmhf_mm_alloc_page(uint32_t num_pages);
@@ -21,6 +42,16 @@ void* xmhf_mm_malloc(size_t size);
 void* xmhf_mm_malloc_align(uint32_t alignment, size_t size);
 void xmhf_mm_free(void* ptr);
 
+//! Allocate / free 4K pages using a per-CPU page cache, O(1) in common case
+void* xmhf_mm_pcpu_alloc_page(u32 cpu);
+void xmhf_mm_pcpu_free_page(u32 cpu, void* page);
+
+//! Get allocation statistics of <size_class> (XMHF_MM_*), summed over all CPUs
+void xmhf_mm_get_stats(u32 size_class, xmhf_mm_stats_t* stats);
+
+//! Print allocation statistics of all size classes
+void xmhf_mm_print_stats(void);
+
 //! Allocate an aligned memory from the heap of XMHF. Also it records the allocation in the <mm_alloc_infolist>
 extern void* xmhf_mm_alloc_align_with_record(XMHFList* mm_alloc_infolist, uint32_t alignment, size_t size);
 
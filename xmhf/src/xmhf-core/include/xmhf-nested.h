@@ -88,6 +88,7 @@ void xmhf_nested_arch_x86vmx_handle_vmxoff(VCPU *vcpu, struct regs *r);
 void xmhf_nested_arch_x86vmx_handle_vmxon(VCPU *vcpu, struct regs *r);
 
 void xmhf_nested_arch_x86vmx_update_nested_nmi(VCPU * vcpu);
+void xmhf_nested_arch_x86vmx_vmcs02_written(VCPU * vcpu, ulong_t encoding);
 void *xmhf_nested_arch_x86vmx_access_ept02(VCPU * vcpu, void* cache_line,
 										   hpt_prot_t access_type,
 										   hpt_va_t va, size_t requested_sz,
@@ -95,6 +96,8 @@ void *xmhf_nested_arch_x86vmx_access_ept02(VCPU * vcpu, void* cache_line,
 bool xmhf_nested_arch_x86vmx_get_ept12(VCPU * vcpu, gpa_t * ept12);
 void xmhf_nested_arch_x86vmx_set_ept12(VCPU * vcpu, bool enable, gpa_t ept12);
 void xmhf_nested_arch_x86vmx_flush_ept02(VCPU *vcpu, u32 flags);
+void xmhf_nested_arch_x86vmx_flush_ept02_range(VCPU *vcpu, u32 flags,
+											   u64 gpa_lo, u64 gpa_hi);
 
 #endif	//__ASSEMBLY__
 
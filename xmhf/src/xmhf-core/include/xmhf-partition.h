@@ -124,6 +124,10 @@ bool xmhf_partition_arch_x86vmx_get_xmhf_msr(u32 msr, u32 *index);
 
 void xmhf_partition_arch_x86vmx_set_msrbitmap_x2apic_icr(VCPU *vcpu);
 void xmhf_partition_arch_x86vmx_clear_msrbitmap_x2apic_icr(VCPU *vcpu);
+#ifdef __NESTED_VIRTUALIZATION__
+void xmhf_partition_arch_x86vmx_merge_msrbitmap(VCPU *vcpu, u8 *bitmap02,
+												const u8 *bitmap12);
+#endif /* __NESTED_VIRTUALIZATION__ */
 
 void xmhf_partition_arch_x86vmx_guestVMCS_INIT(VCPU *vcpu);
 
@@ -104,6 +104,7 @@ extern RPB *rpb;
 #include <stl/xmhfc-bitmap.h>
 #include <stl/xmhfc-dlist.h>
 #include <stl/xmhf-lru.h>
+#include <stl/xmhf-lru-hash.h>
 
 //----------------------------------------------------------------------
 // component headers
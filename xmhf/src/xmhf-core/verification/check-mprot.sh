@@ -32,12 +32,10 @@ echo -------------------------------------------------------------------
 
 vmx_pml4_success=$(objdump --syms ../xmhf-runtime/runtime.exe | awk '{print $4,$6}' | grep ".palign_data g_vmx_ept_pml4_table_buffers" | wc -l)
 vmx_pdpt_success=$(objdump --syms ../xmhf-runtime/runtime.exe | awk '{print $4,$6}' | grep ".palign_data g_vmx_ept_pdp_table_buffers" | wc -l)
-vmx_pdt_success=$(objdump --syms ../xmhf-runtime/runtime.exe | awk '{print $4,$6}' | grep ".palign_data g_vmx_ept_pd_table_buffers" | wc -l)
-vmx_pt_success=$(objdump --syms ../xmhf-runtime/runtime.exe | awk '{print $4,$6}' | grep ".palign_data g_vmx_ept_p_table_buffers" | wc -l)
 
 vmx_success=0;
 
-if [ $vmx_pml4_success -eq 1 ] && [ $vmx_pdpt_success -eq 1 ] && [ $vmx_pdt_success -eq 1 ] && [ $vmx_pt_success -eq 1 ]
+if [ $vmx_pml4_success -eq 1 ] && [ $vmx_pdpt_success -eq 1 ]
 then
 	vmx_success=1
 else
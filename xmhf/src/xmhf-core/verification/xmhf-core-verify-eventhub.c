@@ -98,7 +98,6 @@ void main() {
 		vcpu.vmx_vmcs_vaddr = 0xC7000000;								//VMCS address
 		vcpu.vmx_vaddr_ept_pml4_table = 0xC7F00000;						//EPT PML4 table
 		vcpu.vmx_guest_unrestricted = 1;								//VMX unrestricted guest support
-		vcpu.vmx_vaddr_ept_p_tables = 0xC8000000;						//EPT page tables
 #else
 		//AMD specific fields
 		vcpu.npt_vaddr_ptr = 0xC7F00000;								//NPT PDPT page
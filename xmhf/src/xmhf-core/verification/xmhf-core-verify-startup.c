@@ -83,7 +83,6 @@ void runtime_main(){
 		vcpu.vmx_vmcs_vaddr = 0xC7000000;								//VMCS address
 		vcpu.vmx_vaddr_ept_pml4_table = 0xC7F00000;						//EPT PML4 table
 		vcpu.vmx_guest_unrestricted = 1;								//VMX unrestricted guest support
-		vcpu.vmx_vaddr_ept_p_tables = 0xC8000000;						//EPT page tables
 #else
 		vcpu.cpu_vendor = CPU_VENDOR_AMD;
 		vcpu.vmcb_vaddr_ptr = &_xvmcb;									//set vcpu VMCB virtual address to something meaningful
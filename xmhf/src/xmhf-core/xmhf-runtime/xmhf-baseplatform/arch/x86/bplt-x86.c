@@ -282,6 +282,7 @@ void VCPU_gcr0_set(VCPU *vcpu, ulong_t cr0)
     vcpu->vmcs.guest_CR0 = cr0;
   } else if (vcpu->cpu_vendor == CPU_VENDOR_AMD) {
     vcpu->vmcb_vaddr_ptr->cr0 = cr0;
+    svm_vmcb_dirty(vcpu->vmcb_vaddr_ptr, VMCB_CLEAN_CRX);
   } else {
     HALT_ON_ERRORCOND(false);
   }
@@ -316,6 +317,7 @@ void VCPU_gcr3_set(VCPU *vcpu, u64 cr3)
     vcpu->vmcs.guest_CR3 = cr3;
   } else if (vcpu->cpu_vendor == CPU_VENDOR_AMD) {
     vcpu->vmcb_vaddr_ptr->cr3 = cr3;
+    svm_vmcb_dirty(vcpu->vmcb_vaddr_ptr, VMCB_CLEAN_CRX);
   } else {
     HALT_ON_ERRORCOND(false);
   }
@@ -350,6 +352,7 @@ void VCPU_gcr4_set(VCPU *vcpu, ulong_t cr4)
     vcpu->vmcs.guest_CR4 = cr4;
   } else if (vcpu->cpu_vendor == CPU_VENDOR_AMD) {
     vcpu->vmcb_vaddr_ptr->cr4 = cr4;
+    svm_vmcb_dirty(vcpu->vmcb_vaddr_ptr, VMCB_CLEAN_CRX);
   } else {
     HALT_ON_ERRORCOND(false);
   }
@@ -388,6 +391,7 @@ bool VCPU_g64(VCPU *vcpu) {
             return (__vmx_vmread32(VMCSENC_guest_CS_access_rights) >> 13) & 1U;
         }
 #endif /* __NESTED_VIRTUALIZATION__ */
+        VCPU_VMCS_FETCH(vcpu, guest_CS_access_rights);
         return (vcpu->vmcs.guest_CS_access_rights >> 13) & 1U;
     } else if (vcpu->cpu_vendor == CPU_VENDOR_AMD) {
         /* Not implemented */
@@ -449,12 +453,15 @@ void VCPU_exception_bitmap_set(VCPU *vcpu, u32 val) {
 #ifdef __NESTED_VIRTUALIZATION__
     if (vcpu->vmx_nested_operation_mode == NESTED_VMX_MODE_NONROOT) {
       __vmx_vmwrite32(VMCSENC_control_exception_bitmap, val);
+      xmhf_nested_arch_x86vmx_vmcs02_written(vcpu,
+                                             VMCSENC_control_exception_bitmap);
       return;
     }
 #endif /* __NESTED_VIRTUALIZATION__ */
     vcpu->vmcs.control_exception_bitmap = val;
   } else if (vcpu->cpu_vendor == CPU_VENDOR_AMD) {
     vcpu->vmcb_vaddr_ptr->exception_intercepts_bitmask = val;
+    svm_vmcb_dirty(vcpu->vmcb_vaddr_ptr, VMCB_CLEAN_I);
   } else {
     HALT_ON_ERRORCOND(false);
   }
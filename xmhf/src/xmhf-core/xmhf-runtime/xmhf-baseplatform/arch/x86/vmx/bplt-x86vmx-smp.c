@@ -113,10 +113,10 @@ void xmhf_baseplatform_arch_x86vmx_allocandsetupvcpus(u32 cpu_vendor){
 	//allocate EPT paging structures
 	#ifdef __NESTED_PAGING__
 	{
-		vcpu->vmx_vaddr_ept_pml4_table = ((hva_t)g_vmx_ept_pml4_table_buffers + (i * P4L_NPLM4T * PAGE_SIZE_4K));
-		vcpu->vmx_vaddr_ept_pdp_table = ((hva_t)g_vmx_ept_pdp_table_buffers + (i * P4L_NPDPT * PAGE_SIZE_4K));
-		vcpu->vmx_vaddr_ept_pd_tables = ((hva_t)g_vmx_ept_pd_table_buffers + (i * P4L_NPDT * PAGE_SIZE_4K));
-		vcpu->vmx_vaddr_ept_p_tables = ((hva_t)g_vmx_ept_p_table_buffers + (i * P4L_NPT * PAGE_SIZE_4K));
+		//when EPT01 is shared, all CPUs use the first copy
+		u32 ept_i = i % VMX_EPT01_NCOPIES;
+		vcpu->vmx_vaddr_ept_pml4_table = ((hva_t)g_vmx_ept_pml4_table_buffers + (ept_i * P4L_NPLM4T * PAGE_SIZE_4K));
+		vcpu->vmx_vaddr_ept_pdp_table = ((hva_t)g_vmx_ept_pdp_table_buffers + (ept_i * P4L_NPDPT * PAGE_SIZE_4K));
 	}
 	#endif
 
@@ -136,49 +136,126 @@ ulong_t __vmx_vmreadNW(u16 encoding) {
 	return value;
 }
 
-//---putVMCS--------------------------------------------------------------------
-// routine takes vcpu vmcsfields and stores it in the CPU VMCS
-void xmhf_baseplatform_arch_x86vmx_putVMCS(VCPU *vcpu){
+/*
+ * VMCS cache
+ *
+ * vcpu->vmcs is a cache of the hardware VMCS. Each field has 3 bits:
+ * * vmcs_cache_exist: the field is supported by the CPU. Fields that do not
+ *   exist are never VMREAD / VMWRITE'n.
+ * * vmcs_cache_valid: vcpu->vmcs.<field> is up to date. At the start of an
+ *   intercept all bits are cleared by xmhf_baseplatform_arch_x86vmx_vmcs_cache_reset()
+ *   because the hardware may have changed the VMCS. A field is VMREAD when it
+ *   is first needed (VCPU_VMCS_FETCH() or getVMCS).
+ * * vmcs_cache_dirty: vcpu->vmcs.<field> is modified using VCPU_VMCS_WRITE()
+ *   and needs to be VMWRITE'n by putVMCS.
+ *
+ * Most of the code modifies vcpu->vmcs directly instead of using
+ * VCPU_VMCS_WRITE(). So vcpu->vmcs_hw records the value in the hardware VMCS
+ * for all valid fields. putVMCS VMWRITEs a valid field if it is dirty or its
+ * value is different from vcpu->vmcs_hw.
+ */
+
+//---vmcs_cache_init------------------------------------------------------------
+// compute fields that exist, and mark all fields to be written by putVMCS
+void xmhf_baseplatform_arch_x86vmx_vmcs_cache_init(VCPU *vcpu){
+	memset(&vcpu->vmcs_cache_exist, 0, sizeof(vcpu->vmcs_cache_exist));
+	memset(&vcpu->vmcs_cache_valid, 0, sizeof(vcpu->vmcs_cache_valid));
+	memset(&vcpu->vmcs_cache_dirty, 0, sizeof(vcpu->vmcs_cache_dirty));
 #define FIELD_CTLS_ARG (&vcpu->vmx_caps)
-#define DECLARE_FIELD_16_RW(encoding, name, exist, ...) \
+#define DECLARE_FIELD_16_RO(encoding, name, exist, ...) \
     if (exist) { \
-        __vmx_vmwrite16(encoding, vcpu->vmcs.name); \
+        vmcs_bitmap_set(&vcpu->vmcs_cache_exist, VMCSIDX_##name); \
     }
-#define DECLARE_FIELD_64_RW(encoding, name, exist, ...) \
-    if (exist) { \
-        __vmx_vmwrite64(encoding, vcpu->vmcs.name); \
-    }
-#define DECLARE_FIELD_32_RW(encoding, name, exist, ...) \
+#define DECLARE_FIELD_16_RW(encoding, name, exist, ...) \
     if (exist) { \
-        __vmx_vmwrite32(encoding, vcpu->vmcs.name); \
+        vmcs_bitmap_set(&vcpu->vmcs_cache_exist, VMCSIDX_##name); \
+        vmcs_bitmap_set(&vcpu->vmcs_cache_dirty, VMCSIDX_##name); \
     }
-#define DECLARE_FIELD_NW_RW(encoding, name, exist, ...) \
-    if (exist) { \
-        __vmx_vmwriteNW(encoding, vcpu->vmcs.name); \
+#define DECLARE_FIELD_64_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_32_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_64_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#define DECLARE_FIELD_32_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#include <arch/x86/_vmx_vmcs_fields.h>
+	vcpu->vmcs_cache_valid = vcpu->vmcs_cache_exist;
+}
+
+//---vmcs_cache_reset-----------------------------------------------------------
+// called after VMEXIT, all fields need to be VMREAD again
+void xmhf_baseplatform_arch_x86vmx_vmcs_cache_reset(VCPU *vcpu){
+	u32 i;
+	for (i = 0; i < VMCS_BITMAP_WORDS; i++) {
+		/* All modifications should be written by putVMCS before VMENTRY */
+		HALT_ON_ERRORCOND(vcpu->vmcs_cache_dirty.bits[i] == 0);
+		vcpu->vmcs_cache_valid.bits[i] = 0;
+	}
+}
+
+//---vmcs_cache_fetch-----------------------------------------------------------
+// VMREAD a field that is not valid in vcpu vmcsfields
+void xmhf_baseplatform_arch_x86vmx_vmcs_cache_fetch(VCPU *vcpu, u32 index){
+	HALT_ON_ERRORCOND(index < VMCSIDX_COUNT);
+	if (vmcs_bitmap_test(&vcpu->vmcs_cache_valid, index)) {
+		return;
+	}
+	if (vmcs_bitmap_test(&vcpu->vmcs_cache_exist, index)) {
+		switch (index) {
+#define DECLARE_FIELD_16(encoding, name, ...) \
+		case VMCSIDX_##name: \
+			vcpu->vmcs.name = __vmx_vmread16(encoding); \
+			vcpu->vmcs_hw.name = vcpu->vmcs.name; \
+			break;
+#define DECLARE_FIELD_64(encoding, name, ...) \
+		case VMCSIDX_##name: \
+			vcpu->vmcs.name = __vmx_vmread64(encoding); \
+			vcpu->vmcs_hw.name = vcpu->vmcs.name; \
+			break;
+#define DECLARE_FIELD_32(encoding, name, ...) \
+		case VMCSIDX_##name: \
+			vcpu->vmcs.name = __vmx_vmread32(encoding); \
+			vcpu->vmcs_hw.name = vcpu->vmcs.name; \
+			break;
+#define DECLARE_FIELD_NW(encoding, name, ...) \
+		case VMCSIDX_##name: \
+			vcpu->vmcs.name = __vmx_vmreadNW(encoding); \
+			vcpu->vmcs_hw.name = vcpu->vmcs.name; \
+			break;
+#include <arch/x86/_vmx_vmcs_fields.h>
+		default:
+			HALT_ON_ERRORCOND(0 && "Unknown VMCS field index");
+		}
+	}
+	vmcs_bitmap_set(&vcpu->vmcs_cache_valid, index);
+}
+
+//---putVMCS--------------------------------------------------------------------
+// routine takes vcpu vmcsfields and stores it in the CPU VMCS
+// only fields that are modified are written
+void xmhf_baseplatform_arch_x86vmx_putVMCS(VCPU *vcpu){
+#define _PUT_FIELD(size, name) \
+    if (vmcs_bitmap_test(&vcpu->vmcs_cache_valid, VMCSIDX_##name) && \
+        vmcs_bitmap_test(&vcpu->vmcs_cache_exist, VMCSIDX_##name) && \
+        (vmcs_bitmap_test(&vcpu->vmcs_cache_dirty, VMCSIDX_##name) || \
+         vcpu->vmcs.name != vcpu->vmcs_hw.name)) { \
+        __vmx_vmwrite##size(VMCSENC_##name, vcpu->vmcs.name); \
+        vcpu->vmcs_hw.name = vcpu->vmcs.name; \
     }
+#define DECLARE_FIELD_16_RW(encoding, name, ...) _PUT_FIELD(16, name)
+#define DECLARE_FIELD_64_RW(encoding, name, ...) _PUT_FIELD(64, name)
+#define DECLARE_FIELD_32_RW(encoding, name, ...) _PUT_FIELD(32, name)
+#define DECLARE_FIELD_NW_RW(encoding, name, ...) _PUT_FIELD(NW, name)
 #include <arch/x86/_vmx_vmcs_fields.h>
+#undef _PUT_FIELD
+	memset(&vcpu->vmcs_cache_dirty, 0, sizeof(vcpu->vmcs_cache_dirty));
 }
 
 //---getVMCS--------------------------------------------------------------------
 // routine takes CPU VMCS and stores it in vcpu vmcsfields
+// fields that are already valid in the VMCS cache are not read again
 void xmhf_baseplatform_arch_x86vmx_getVMCS(VCPU *vcpu){
-#define FIELD_CTLS_ARG (&vcpu->vmx_caps)
-#define DECLARE_FIELD_16(encoding, name, exist, ...) \
-    if (exist) { \
-        vcpu->vmcs.name = __vmx_vmread16(encoding); \
-    }
-#define DECLARE_FIELD_64(encoding, name, exist, ...) \
-    if (exist) { \
-        vcpu->vmcs.name = __vmx_vmread64(encoding); \
-    }
-#define DECLARE_FIELD_32(encoding, name, exist, ...) \
-    if (exist) { \
-        vcpu->vmcs.name = __vmx_vmread32(encoding); \
-    }
-#define DECLARE_FIELD_NW(encoding, name, exist, ...) \
-    if (exist) { \
-        vcpu->vmcs.name = __vmx_vmreadNW(encoding); \
-    }
+#define DECLARE_FIELD_16(encoding, name, ...) \
+    VCPU_VMCS_FETCH(vcpu, name);
 #include <arch/x86/_vmx_vmcs_fields.h>
 }
 
@@ -243,8 +320,7 @@ void xmhf_baseplatform_arch_x86vmx_dump_vcpu(VCPU *vcpu){
     DUMP_VCPU_PRINT_INTNW(vcpu->vmx_vaddr_msrbitmaps);
     DUMP_VCPU_PRINT_INTNW(vcpu->vmx_vaddr_ept_pml4_table);
     DUMP_VCPU_PRINT_INTNW(vcpu->vmx_vaddr_ept_pdp_table);
-    DUMP_VCPU_PRINT_INTNW(vcpu->vmx_vaddr_ept_pd_tables);
-    DUMP_VCPU_PRINT_INTNW(vcpu->vmx_vaddr_ept_p_tables);
+    DUMP_VCPU_PRINT_INT32(vcpu->vmx_ept01_max_leaf_lvl);
     DUMP_VCPU_PRINT_INT32(vcpu->vmx_ept_defaulttype);
     DUMP_VCPU_PRINT_INT32(vcpu->vmx_ept_mtrr_enable);
     DUMP_VCPU_PRINT_INT32(vcpu->vmx_ept_fixmtrr_enable);
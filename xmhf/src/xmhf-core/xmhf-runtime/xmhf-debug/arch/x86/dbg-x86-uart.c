@@ -54,6 +54,10 @@
 // frequency of UART clock source
 #define UART_CLOCKFREQ   1843200
 
+// size of transmit FIFO, 1 if the UART has no FIFO (8250)
+#define UART_FIFO_SIZE   16
+static u32 g_uart_fifo_size = 1;
+
 // default config parameters for serial port
 uart_config_t g_uart_config = {
     115200,
@@ -92,6 +96,29 @@ void dbg_x86_uart_putstr(const char *s){
 }
 
 
+// write len bytes to serial port without translation, only if the transmit
+// FIFO is empty. Return false without waiting if the FIFO is not empty. When
+// len is not larger than the FIFO, this function never waits.
+bool dbg_x86_uart_try_write(const u8 *buf, u32 len){
+  u32 i;
+
+  if ( ! (inb(g_uart_config.comc_port+0x5) & 0x20) ) {
+    return false;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (i != 0 && i % g_uart_fifo_size == 0) {
+      while ( ! (inb(g_uart_config.comc_port+0x5) & 0x20) ) {
+        xmhf_cpu_relax();
+      }
+    }
+    outb(buf[i], g_uart_config.comc_port);
+  }
+
+  return true;
+}
+
+
 //initialize UART comms.
 void dbg_x86_uart_init(char *params){
 
@@ -122,5 +149,14 @@ void dbg_x86_uart_init(char *params){
   //modem control register
   outb((u8)0x3, g_uart_config.comc_port+0x4);
 
+  //enable and clear FIFOs. If the interrupt identification register does not
+  //report FIFOs enabled, this is an 8250 without FIFO
+  outb((u8)0x7, g_uart_config.comc_port+0x2);
+  if ((inb(g_uart_config.comc_port+0x2) & 0xc0) == 0xc0) {
+    g_uart_fifo_size = UART_FIFO_SIZE;
+  } else {
+    g_uart_fifo_size = 1;
+  }
+
   return;
 }
@@ -78,6 +78,9 @@ event_log_t global_event_log[MAX_VCPU_ENTRIES];
  * event is the event to be logged.
  * key is pointer to the key to be logged. The content of the pointer will be
  * copied.
+ *
+ * When __DEBUG_TRACE_RING__, the event is added to the trace ring of this CPU
+ * instead, and the rings are drained to the serial port a little at a time.
  */
 void xmhf_dbg_log_event(void *_vcpu, bool can_print, xmhf_dbg_eventlog_t event,
 						void *key) {
@@ -86,6 +89,28 @@ void xmhf_dbg_log_event(void *_vcpu, bool can_print, xmhf_dbg_eventlog_t event,
 	u64 tsc = 0;
 	/* Get event log */
 	event_log_t *event_log = &global_event_log[vcpu->idx];
+#ifdef __DEBUG_TRACE_RING__
+	{
+		u64 payload = 0;
+		switch (event) {
+#define DEFINE_EVENT_FIELD(name, count_type, count_fmt, lru_size, index_type, \
+						   key_type, key_fmt, ...) \
+		case XMHF_DBG_EVENTLOG_##name: \
+			payload = *(key_type *)key; \
+			break;
+#include <xmhf-debug-event-logger-fields.h>
+		default:
+			HALT_ON_ERRORCOND(0 && "Unknown event");
+		}
+		xmhf_dbg_trace(vcpu->idx, event, payload);
+		if (can_print) {
+			xmhf_dbg_trace_drain();
+		}
+		(void) print_flag;
+		(void) tsc;
+		return;
+	}
+#endif /* __DEBUG_TRACE_RING__ */
 	/* Increase count */
 	event_log->alive = 1;
 	event_log->total_count++;
@@ -155,6 +180,14 @@ void xmhf_dbg_log_event(void *_vcpu, bool can_print, xmhf_dbg_eventlog_t event,
 			} \
 		}
 #include <xmhf-debug-event-logger-fields.h>
+		if (vcpu->cpu_vendor == CPU_VENDOR_INTEL) {
+			guestmem_tlb_print_stats(vcpu);
+			x86_vmx_emulate_cache_print_stats(vcpu);
+		}
+		/* Allocator statistics are global, print them once per round */
+		if (vcpu->isbsp) {
+			xmhf_mm_print_stats();
+		}
 		printf("EL[%d]: ---\n", vcpu->idx);
 	}
 }
@@ -0,0 +1,177 @@
+/*
+ * @XMHF_LICENSE_HEADER_START@
+ *
+ * eXtensible, Modular Hypervisor Framework (XMHF)
+ * Copyright (c) 2009-2012 Carnegie Mellon University
+ * Copyright (c) 2010-2012 VDG Inc.
+ * All Rights Reserved.
+ *
+ * Developed by: XMHF Team
+ *               Carnegie Mellon University / CyLab
+ *               VDG Inc.
+ *               http://xmhf.org
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * Neither the names of Carnegie Mellon or VDG Inc, nor the names of
+ * its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @XMHF_LICENSE_HEADER_END@
+ */
+
+// dbg-trace-ring.c
+// Per-CPU binary trace rings for the event logger
+
+#include <xmhf.h>
+
+#ifdef __DEBUG_TRACE_RING__
+
+/*
+ * Each CPU writes records only to its own ring, so writing a record needs no
+ * lock. Records are read by the CPU draining the rings (any CPU calling
+ * xmhf_dbg_trace_drain() that gets the printf line lock). head is only
+ * written by the owner CPU, and tail is only written by the draining CPU.
+ * On x86 stores are not reordered with other stores, so a compiler barrier
+ * before publishing head / tail is enough.
+ */
+typedef struct xmhf_dbg_trace_ring_t {
+	volatile u32 head;
+	volatile u32 tail;
+	u32 seq;
+	u32 lost;
+	xmhf_dbg_trace_rec_t recs[XMHF_DBG_TRACE_RING_SIZE];
+} xmhf_dbg_trace_ring_t;
+
+static xmhf_dbg_trace_ring_t g_dbg_trace_rings[MAX_VCPU_ENTRIES];
+
+/* Next ring to drain, so that a busy CPU does not starve other CPUs */
+static u32 g_dbg_trace_next_ring;
+
+static inline void _trace_put(xmhf_dbg_trace_ring_t *ring, u32 head, u8 event,
+							  u64 payload)
+{
+	xmhf_dbg_trace_rec_t *rec =
+		&ring->recs[head & (XMHF_DBG_TRACE_RING_SIZE - 1)];
+	rec->tsc = rdtsc64();
+	rec->payload = payload;
+	rec->event = event;
+	rec->seq = (u8)ring->seq++;
+}
+
+/*
+ * Add a record to the trace ring of CPU cpu. Must be called on CPU cpu.
+ * Never waits and never prints.
+ */
+void xmhf_dbg_trace(u32 cpu, u8 event, u64 payload)
+{
+	xmhf_dbg_trace_ring_t *ring = &g_dbg_trace_rings[cpu];
+	u32 head = ring->head;
+	u32 used = head - ring->tail;
+
+	HALT_ON_ERRORCOND(cpu < MAX_VCPU_ENTRIES);
+
+	/* Report lost records first, this needs one more slot */
+	if (ring->lost) {
+		if (used + 2 > XMHF_DBG_TRACE_RING_SIZE) {
+			ring->lost++;
+			return;
+		}
+		_trace_put(ring, head, XMHF_DBG_TRACE_LOST, ring->lost);
+		ring->lost = 0;
+		head++;
+	} else if (used + 1 > XMHF_DBG_TRACE_RING_SIZE) {
+		ring->lost++;
+		return;
+	}
+
+	_trace_put(ring, head, event, payload);
+	asm volatile ("" ::: "memory");
+	ring->head = head + 1;
+}
+
+/*
+ * Send at most one record to the serial port if the UART transmit FIFO is
+ * empty. Return immediately if there is nothing to send, if another CPU is
+ * printing or draining, or if the UART is busy. Each frame fits in the
+ * 16550 FIFO, so this function does not wait for the UART.
+ */
+void xmhf_dbg_trace_drain(void)
+{
+	u32 i;
+
+	/* Quick check without the lock */
+	for (i = 0; i < MAX_VCPU_ENTRIES; i++) {
+		if (g_dbg_trace_rings[i].head != g_dbg_trace_rings[i].tail) {
+			break;
+		}
+	}
+	if (i == MAX_VCPU_ENTRIES) {
+		return;
+	}
+
+	/* Use printf's line lock so that frames are not mixed with text */
+	if (!emhfc_putchar_linetrylock(emhfc_putchar_linelock_arg)) {
+		return;
+	}
+
+	for (i = 0; i < MAX_VCPU_ENTRIES; i++) {
+		u32 cpu = (g_dbg_trace_next_ring + i) % MAX_VCPU_ENTRIES;
+		xmhf_dbg_trace_ring_t *ring = &g_dbg_trace_rings[cpu];
+		u32 tail = ring->tail;
+		xmhf_dbg_trace_rec_t *rec;
+		u8 frame[XMHF_DBG_TRACE_FRAME_SIZE];
+		u32 j;
+
+		if (ring->head == tail) {
+			continue;
+		}
+		asm volatile ("" ::: "memory");
+		rec = &ring->recs[tail & (XMHF_DBG_TRACE_RING_SIZE - 1)];
+		frame[0] = XMHF_DBG_TRACE_SYNC;
+		frame[1] = (u8)cpu;
+		frame[2] = rec->event;
+		frame[3] = rec->seq;
+		for (j = 0; j < 6; j++) {
+			frame[4 + j] = (u8)(rec->tsc >> (j * 8));
+			frame[10 + j] = (u8)(rec->payload >> (j * 8));
+		}
+#ifdef __DEBUG_SERIAL__
+		if (!dbg_x86_uart_try_write(frame, sizeof(frame))) {
+			break;
+		}
+#endif /* __DEBUG_SERIAL__ */
+		asm volatile ("" ::: "memory");
+		ring->tail = tail + 1;
+		g_dbg_trace_next_ring = (cpu + 1) % MAX_VCPU_ENTRIES;
+		break;
+	}
+
+	emhfc_putchar_lineunlock(emhfc_putchar_linelock_arg);
+}
+
+#endif // __DEBUG_TRACE_RING__
@@ -139,3 +139,15 @@ void xmhf_dmaprot_arch_invalidate_cache(void)
 	  return xmhf_dmaprot_arch_x86_vmx_invalidate_cache();
 	}
 }
+
+void xmhf_dmaprot_arch_invalidate_range(spa_t start_paddr, size_t size)
+{
+	u32 cpu_vendor = get_cpu_vendor_or_die();	//determine CPU vendor
+
+	if(cpu_vendor == CPU_VENDOR_AMD){
+	  //no range invalidation for DEV, flush everything
+	  return xmhf_dmaprot_arch_x86_svm_invalidate_cache();
+	}else{	//CPU_VENDOR_INTEL
+	  return xmhf_dmaprot_arch_x86_vmx_invalidate_range(start_paddr, size);
+	}
+}
@@ -68,6 +68,7 @@ void _vtd_reg(VTD_DRHD *dmardevice, u32 access, u32 reg, void *value)
     case VTD_FSTS_REG_OFF:
     case VTD_FECTL_REG_OFF:
     case VTD_PMEN_REG_OFF:
+    case VTD_ICS_REG_OFF:
         regtype = VTD_REG_32BITS;
         regaddr = dmardevice->regbaseaddr + reg;
         break;
@@ -77,6 +78,9 @@ void _vtd_reg(VTD_DRHD *dmardevice, u32 access, u32 reg, void *value)
     case VTD_ECAP_REG_OFF:
     case VTD_RTADDR_REG_OFF:
     case VTD_CCMD_REG_OFF:
+    case VTD_IQH_REG_OFF:
+    case VTD_IQT_REG_OFF:
+    case VTD_IQA_REG_OFF:
         regtype = VTD_REG_64BITS;
         regaddr = dmardevice->regbaseaddr + reg;
         break;
@@ -254,6 +258,12 @@ bool _vtd_verify_cap(VTD_DRHD *vtd_drhd, u32 vtd_num_drhd, struct dmap_vmx_cap *
         {
             out_cap->nd = cap.bits.nd;
         }
+
+        // Only use super-page sizes supported by all VT-d units
+        if (i == 0)
+            out_cap->sps = cap.bits.sps;
+        else
+            out_cap->sps &= cap.bits.sps;
     }
 
     printf("Verify all Vt-d units success\n");
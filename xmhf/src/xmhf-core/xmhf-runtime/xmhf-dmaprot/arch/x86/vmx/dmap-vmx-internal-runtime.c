@@ -258,6 +258,15 @@ void _vtd_drhd_initialize_runtime(VTD_DRHD *drhd, u32 vtd_ret_paddr)
         }
     }
     printf("Done.\n");
+
+    // 10. switch to queued invalidation if available. Register based
+    // invalidation must not be used after this.
+#ifndef __XMHF_VERIFICATION__
+    if (_vtd_qi_enable(drhd))
+        printf("	VT-d queued invalidation enabled\n");
+    else
+        printf("	VT-d queued invalidation unavailable\n");
+#endif
 }
 
 // vt-d invalidate cachess note: we do global invalidation currently
@@ -270,6 +279,7 @@ void _vtd_invalidate_caches_single_iommu(VTD_DRHD *drhd, VTD_DRHD *drhd0)
     // sanity check
     HALT_ON_ERRORCOND(drhd != NULL);
     HALT_ON_ERRORCOND(drhd0 != NULL);
+    HALT_ON_ERRORCOND(drhd->qi == NULL);
 
     // 0. If IOMMU needs mHV to issue WBF, then mHV needs to do so before invalidate caches.
     if (vtd_cap_require_wbf(drhd))
@@ -334,6 +344,79 @@ void _vtd_invalidate_caches_single_iommu(VTD_DRHD *drhd, VTD_DRHD *drhd0)
 }
 
 
+// vt-d invalidate the IOTLB entries of [start_paddr, end_paddr) in domain 1.
+// Use page-selective invalidation with the smallest naturally aligned block
+// covering the range when the IOMMU supports it, else invalidate domain 1.
+// The context cache is not invalidated.
+// [NOTE] <drhd0> refers to &vtd_drhd[0] and is used for __XMHF_VERIFICATION__ only.
+void _vtd_invalidate_iotlb_range_single_iommu(VTD_DRHD *drhd, VTD_DRHD *drhd0,
+                                              spa_t start_paddr, spa_t end_paddr)
+{
+    VTD_IOTLB_REG iotlb;
+    VTD_IVA_REG iva;
+    u64 pfn;
+    u32 am;
+
+    // sanity check
+    HALT_ON_ERRORCOND(drhd != NULL);
+    HALT_ON_ERRORCOND(drhd0 != NULL);
+    HALT_ON_ERRORCOND(drhd->qi == NULL);
+    HALT_ON_ERRORCOND(start_paddr < end_paddr);
+
+    // compute the address mask of the block covering the range
+    am = _vtd_addr_mask(start_paddr, end_paddr, &pfn);
+
+    // 0. If IOMMU needs mHV to issue WBF, then mHV needs to do so before invalidate caches.
+    if (vtd_cap_require_wbf(drhd))
+        _vtd_drhd_issue_wbf(drhd);
+
+    // 1. wait for the IOTLB invalidation is available
+#ifndef __XMHF_VERIFICATION__
+    IOMMU_WAIT_OP(drhd, VTD_IOTLB_REG_OFF, !iotlb.bits.ivt, (void *)&iotlb.value, "IOMMU is not ready to invalidate IOTLB");
+#else
+    _vtd_reg(drhd0, VTD_REG_READ, VTD_IOTLB_REG_OFF, (void *)&iotlb.value);
+#endif
+
+    iotlb.value = 0;
+    iotlb.bits.did = 1; // domain 1, see _vtd_setupRETCET()
+    iotlb.bits.ivt = 1; // invalidate
+
+    if (vtd_cap_psi(drhd) && am <= vtd_cap_mamv(drhd))
+    {
+        // 2a. page-selective invalidation, also invalidating paging-structure
+        // caches (ih = 0) because upper level entries may have changed
+        iva.value = 0;
+        iva.bits.am = am;
+        iva.bits.addr = pfn;
+        _vtd_reg(drhd, VTD_REG_WRITE, VTD_IVA_REG_OFF, (void *)&iva.value);
+        iotlb.bits.iirg = 3;
+    }
+    else
+    {
+        // 2b. domain-selective invalidation
+        iotlb.bits.iirg = 2;
+    }
+
+    // perform the invalidation
+    _vtd_reg(drhd, VTD_REG_WRITE, VTD_IOTLB_REG_OFF, (void *)&iotlb.value);
+
+#ifndef __XMHF_VERIFICATION__
+    // wait for the invalidation to complete
+    IOMMU_WAIT_OP(drhd, VTD_IOTLB_REG_OFF, !iotlb.bits.ivt, (void *)&iotlb.value, "Failed to invalidate IOTLB");
+#else
+    _vtd_reg(drhd0, VTD_REG_READ, VTD_IOTLB_REG_OFF, (void *)&iotlb.value);
+#endif
+
+    // the hardware may perform the invalidation at a coarser granularity
+    // (IAIG < IIRG), but IAIG = 0 means the request is not performed
+    if (iotlb.bits.iaig == 0)
+    {
+        printf("	Invalidation of IOTLB failed. Halting! (%u)\n", iotlb.bits.iaig);
+        HALT();
+    }
+}
+
+
 
 
 /********* Other util functions *********/
@@ -63,6 +63,21 @@ extern struct dmap_vmx_cap g_vtd_cap_sagaw_mgaw_nd;
 
 #define DMAR_OPERATION_TIMEOUT  SEC_TO_CYCLES(1)
 
+// Return the address mask (in pages) of the smallest naturally aligned block
+// covering [start_paddr, end_paddr), and put the page number of the block in
+// <out_pfn>. Used for page-selective IOTLB invalidation.
+static inline u32 _vtd_addr_mask(spa_t start_paddr, spa_t end_paddr, u64 *out_pfn)
+{
+    u64 first_pfn = start_paddr >> PAGE_SHIFT_4K;
+    u64 last_pfn = (end_paddr - 1) >> PAGE_SHIFT_4K;
+    u32 am = 0;
+
+    while ((first_pfn >> am) != (last_pfn >> am))
+        am++;
+    *out_pfn = (first_pfn >> am) << am;
+    return am;
+}
+
 #define IOMMU_WAIT_OP(drhd, reg, cond, sts, msg_for_false_cond)                 \
     do                                                                          \
     {                                                                           \
@@ -109,6 +124,32 @@ extern void _vtd_drhd_initialize_runtime(VTD_DRHD *drhd, u32 vtd_ret_paddr);
 // [NOTE] <drhd0> refers to &vtd_drhd[0] and is used for __XMHF_VERIFICATION__ only.
 extern void _vtd_invalidate_caches_single_iommu(VTD_DRHD *drhd, VTD_DRHD *drhd0);
 
+// vt-d invalidate the IOTLB entries of [start_paddr, end_paddr) only, using
+// page-selective invalidation if supported and domain-selective otherwise.
+// [NOTE] <drhd0> refers to &vtd_drhd[0] and is used for __XMHF_VERIFICATION__ only.
+extern void _vtd_invalidate_iotlb_range_single_iommu(VTD_DRHD *drhd, VTD_DRHD *drhd0,
+                                                     spa_t start_paddr, spa_t end_paddr);
+
+
+/********* Queued invalidation (dmap-vmx-qi.c) *********/
+// Set up the invalidation queue of <drhd> and enable queued invalidation.
+// Return false if the DRHD does not support it.
+extern bool _vtd_qi_enable(VTD_DRHD *drhd);
+
+// Append invalidation descriptors to the invalidation queue of <drhd>. They
+// are submitted to hardware by _vtd_qi_sync().
+extern void _vtd_qi_queue_cc_global(VTD_DRHD *drhd);
+extern void _vtd_qi_queue_iotlb_global(VTD_DRHD *drhd);
+extern void _vtd_qi_queue_iotlb_range(VTD_DRHD *drhd, u16 did, spa_t start_paddr, spa_t end_paddr);
+
+// Submit the descriptors queued on all DRHDs using QI, then wait for all of
+// them to complete
+extern void _vtd_qi_sync(VTD_DRHD *vtd_drhd, u32 vtd_num_drhd);
+
+// Queue IOTLB invalidations of [start_paddr, end_paddr) in domain <did> on all
+// DRHDs using queued invalidation (defined in dmap-vmx-runtime.c)
+extern void xmhf_dmaprot_arch_x86_vmx_queue_invalidate_range(u16 did, spa_t start_paddr, spa_t end_paddr);
+
 
 
 
@@ -0,0 +1,291 @@
+/*
+ * @XMHF_LICENSE_HEADER_START@
+ *
+ * eXtensible, Modular Hypervisor Framework (XMHF)
+ * Copyright (c) 2009-2012 Carnegie Mellon University
+ * Copyright (c) 2010-2012 VDG Inc.
+ * All Rights Reserved.
+ *
+ * Developed by: XMHF Team
+ *               Carnegie Mellon University / CyLab
+ *               VDG Inc.
+ *               http://xmhf.org
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * Neither the names of Carnegie Mellon or VDG Inc, nor the names of
+ * its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @XMHF_LICENSE_HEADER_END@
+ */
+
+// VT-d queued invalidation (QI)
+// Invalidation requests are appended to a per-DRHD invalidation queue and
+// are only made visible to the hardware (by updating IQT_REG) when a batch
+// is submitted with an invalidation wait descriptor. The wait descriptors of
+// all DRHDs are submitted first and then polled together, so the DRHDs
+// perform their invalidations in parallel.
+
+#include <xmhf.h>
+#include "dmap-vmx-internal.h"
+
+//! @brief Modify an individual bit of Global Command Register.
+extern void _vtd_drhd_issue_gcmd(VTD_DRHD *drhd, u32 offset, u32 val);
+
+// Issue Write Buffer Flusing (WBF) if the IOMMU requires it.
+extern void _vtd_drhd_issue_wbf(VTD_DRHD *drhd);
+
+// Number of descriptors in an invalidation queue of one 4K page (IQA.QS = 0)
+#define VTD_QI_NDESC (PAGE_SIZE_4K / sizeof(VTD_QI_DESC))
+
+// Invalidation request granularity in context-cache and IOTLB descriptors
+#define VTD_QI_GRAN_GLOBAL  (1ULL << 4)
+#define VTD_QI_GRAN_DOMAIN  (2ULL << 4)
+#define VTD_QI_GRAN_PAGE    (3ULL << 4)
+#define VTD_QI_DID(did)     ((u64)(did) << 16)
+
+// Invalidation wait descriptor flags
+#define VTD_QI_WAIT_SW      (1ULL << 5) // write status data to status address
+#define VTD_QI_WAIT_FN      (1ULL << 6) // fence: wait for preceding descriptors
+
+struct vtd_qi
+{
+    VTD_QI_DESC *queue;     // invalidation queue
+    u32 head;               // last IQH_REG value read
+    u32 tail;               // index of the next descriptor to write
+    u32 hw_tail;            // last value written to IQT_REG
+    u32 pending;            // descriptors appended after the last wait descriptor
+    u32 seq;                // status data of the last wait descriptor
+    volatile u32 status;    // written by hardware when a wait descriptor completes
+};
+
+static VTD_QI_DESC vtd_qi_queues[VTD_MAX_DRHD][VTD_QI_NDESC] __attribute__((aligned(PAGE_SIZE_4K)));
+static struct vtd_qi vtd_qi[VTD_MAX_DRHD];
+static u32 vtd_qi_num = 0;
+
+static inline u32 _vtd_qi_next(u32 index)
+{
+    return (index + 1) % VTD_QI_NDESC;
+}
+
+// Make the appended descriptors visible to the hardware
+static void _vtd_qi_publish(VTD_DRHD *drhd)
+{
+    struct vtd_qi *qi = drhd->qi;
+    VTD_IQT_REG iqt;
+
+    if (qi->hw_tail == qi->tail)
+        return;
+
+    // Page table updates must reach memory before they are invalidated.
+    if (vtd_cap_require_wbf(drhd))
+        _vtd_drhd_issue_wbf(drhd);
+    if (!vtd_ecap_c(drhd))
+        xmhf_cpu_flush_cache_range((void *)qi->queue, PAGE_SIZE_4K);
+
+    iqt.value = 0;
+    iqt.bits.qt = qi->tail;
+    _vtd_reg(drhd, VTD_REG_WRITE, VTD_IQT_REG_OFF, (void *)&iqt.value);
+    qi->hw_tail = qi->tail;
+}
+
+// Append a descriptor to the invalidation queue of <drhd>. When the queue is
+// full, the appended descriptors are published and we wait for the hardware to
+// fetch some of them.
+static void _vtd_qi_append(VTD_DRHD *drhd, u64 lo, u64 hi)
+{
+    struct vtd_qi *qi = drhd->qi;
+
+    // One slot always stays empty to tell a full queue from an empty one
+    if (_vtd_qi_next(qi->tail) == qi->head)
+    {
+        VTD_IQH_REG iqh;
+
+        _vtd_qi_publish(drhd);
+        IOMMU_WAIT_OP(drhd, VTD_IQH_REG_OFF, iqh.bits.qh != _vtd_qi_next(qi->tail), (void *)&iqh.value,
+                      "Invalidation queue is not making progress");
+        qi->head = iqh.bits.qh;
+    }
+
+    qi->queue[qi->tail].lo = lo;
+    qi->queue[qi->tail].hi = hi;
+    qi->tail = _vtd_qi_next(qi->tail);
+}
+
+// Set up the invalidation queue of <drhd> and enable queued invalidation.
+// Return false if the DRHD does not support it.
+bool _vtd_qi_enable(VTD_DRHD *drhd)
+{
+    struct vtd_qi *qi;
+    VTD_IQT_REG iqt;
+    VTD_IQA_REG iqa;
+    VTD_GSTS_REG gsts;
+
+    // sanity check
+    HALT_ON_ERRORCOND(drhd != NULL);
+
+    if (!vtd_ecap_qi(drhd))
+        return false;
+
+    qi = drhd->qi;
+    if (!qi)
+    {
+        HALT_ON_ERRORCOND(vtd_qi_num < VTD_MAX_DRHD);
+        qi = &vtd_qi[vtd_qi_num];
+        qi->queue = vtd_qi_queues[vtd_qi_num];
+        vtd_qi_num++;
+    }
+    memset(qi->queue, 0, PAGE_SIZE_4K);
+    qi->head = qi->tail = qi->hw_tail = 0;
+    qi->pending = 0;
+    qi->seq = qi->status = 0;
+
+    // The hardware resets IQH_REG when QI is enabled, so IQT_REG must be 0
+    iqt.value = 0;
+    _vtd_reg(drhd, VTD_REG_WRITE, VTD_IQT_REG_OFF, (void *)&iqt.value);
+
+    // 128-bit descriptors, one 4K page
+    iqa.value = 0;
+    iqa.bits.iqa = hva2spa(qi->queue) >> PAGE_SHIFT_4K;
+    _vtd_reg(drhd, VTD_REG_WRITE, VTD_IQA_REG_OFF, (void *)&iqa.value);
+
+    _vtd_drhd_issue_gcmd(drhd, VTD_GCMD_BIT_QIE, 1);
+    IOMMU_WAIT_OP(drhd, VTD_GSTS_REG_OFF, gsts.bits.qies, (void *)&gsts.value, "	Could not enable QI. Halting!");
+
+    drhd->qi = qi;
+    return true;
+}
+
+// Queue a global context-cache invalidation
+void _vtd_qi_queue_cc_global(VTD_DRHD *drhd)
+{
+    _vtd_qi_append(drhd, VTD_QI_TYPE_CC | VTD_QI_GRAN_GLOBAL, 0);
+    drhd->qi->pending++;
+}
+
+// Queue a global IOTLB invalidation
+void _vtd_qi_queue_iotlb_global(VTD_DRHD *drhd)
+{
+    _vtd_qi_append(drhd, VTD_QI_TYPE_IOTLB | VTD_QI_GRAN_GLOBAL, 0);
+    drhd->qi->pending++;
+}
+
+// Queue an IOTLB invalidation of [start_paddr, end_paddr) in domain <did>,
+// page-selective if supported and domain-selective otherwise. Paging-structure
+// caches are also invalidated (IH = 0).
+void _vtd_qi_queue_iotlb_range(VTD_DRHD *drhd, u16 did, spa_t start_paddr, spa_t end_paddr)
+{
+    u64 addr;
+    u32 am = _vtd_addr_mask(start_paddr, end_paddr, &addr);
+
+    if (vtd_cap_psi(drhd) && am <= vtd_cap_mamv(drhd))
+    {
+        _vtd_qi_append(drhd, VTD_QI_TYPE_IOTLB | VTD_QI_GRAN_PAGE | VTD_QI_DID(did),
+                       (addr << PAGE_SHIFT_4K) | am);
+    }
+    else
+    {
+        _vtd_qi_append(drhd, VTD_QI_TYPE_IOTLB | VTD_QI_GRAN_DOMAIN | VTD_QI_DID(did), 0);
+    }
+    drhd->qi->pending++;
+}
+
+// Submit the pending descriptors of <drhd> followed by an invalidation wait
+// descriptor. Return false if there is nothing to wait for.
+static bool _vtd_qi_submit(VTD_DRHD *drhd)
+{
+    struct vtd_qi *qi = drhd->qi;
+
+    if (!qi->pending)
+        return false;
+
+    qi->seq++;
+    _vtd_qi_append(drhd, VTD_QI_TYPE_WAIT | VTD_QI_WAIT_SW | VTD_QI_WAIT_FN | ((u64)qi->seq << 32),
+                   hva2spa((void *)&qi->status));
+    qi->pending = 0;
+    _vtd_qi_publish(drhd);
+    return true;
+}
+
+// Return whether the last wait descriptor of <drhd> has completed
+static bool _vtd_qi_done(VTD_DRHD *drhd)
+{
+    struct vtd_qi *qi = drhd->qi;
+    VTD_FSTS_REG fsts;
+
+    if (!vtd_ecap_c(drhd))
+        xmhf_cpu_flush_cache_range((void *)&qi->status, sizeof(qi->status));
+    if (qi->status == qi->seq)
+        return true;
+
+    _vtd_reg(drhd, VTD_REG_READ, VTD_FSTS_REG_OFF, (void *)&fsts.value);
+    if (fsts.bits.iqe || fsts.bits.ice || fsts.bits.ite)
+    {
+        printf("VT-d queued invalidation error, fsts:0x%08x. Halting!\n", fsts.value);
+        HALT();
+    }
+    return false;
+}
+
+// Submit the descriptors queued on all DRHDs using QI, then wait for all of
+// them to complete
+void _vtd_qi_sync(VTD_DRHD *vtd_drhd, u32 vtd_num_drhd)
+{
+    bool waiting[VTD_MAX_DRHD];
+    bool any = false;
+    uint64_t start_time;
+    u32 i = 0;
+
+    FOREACH_S(i, vtd_num_drhd, VTD_MAX_DRHD, 0, 1)
+    {
+        waiting[i] = vtd_drhd[i].qi && _vtd_qi_submit(&vtd_drhd[i]);
+        any = any || waiting[i];
+    }
+
+    start_time = rdtsc64();
+    while (any)
+    {
+        any = false;
+        FOREACH_S(i, vtd_num_drhd, VTD_MAX_DRHD, 0, 1)
+        {
+            if (waiting[i])
+            {
+                waiting[i] = !_vtd_qi_done(&vtd_drhd[i]);
+                any = any || waiting[i];
+            }
+        }
+        if (!any)
+            break;
+        if (rdtsc64() > start_time + DMAR_OPERATION_TIMEOUT)
+        {
+            printf("DMAR hardware malfunction:%s\n", "Queued invalidation timed out");
+            HALT();
+        }
+        xmhf_cpu_relax();
+    }
+}
@@ -61,6 +61,9 @@ void *vtd_cet = NULL; // cet holds all its structures in the memory linearly
 static VTD_DRHD vtd_drhd[VTD_MAX_DRHD];
 static u32 vtd_num_drhd = 0; // total number of DMAR h/w units
 
+// Serializes appending to and syncing the invalidation queues
+static volatile u32 vtd_qi_lock = 1;
+
 // VT-d 3-level/4-level DMA protection page table data structure addresses
 static spa_t l_vtd_pml4t_paddr = 0;
 static hva_t l_vtd_pml4t_vaddr = 0;
@@ -400,6 +403,136 @@ spa_t xmhf_dmaprot_arch_x86_vmx_get_eap_vtd_pt_root(void)
 
 
 
+//------------------------------------------------------------------------------
+// DMA protection page table updates
+// The page tables set up by _vtd_setuppagetables() identity map physical
+// memory and all PDTs and PTs stay allocated. So a PDPT entry or a PDT entry
+// can be turned into a super-page whenever a range covers it, and split back
+// by rewriting the preallocated lower level table without allocating memory.
+
+#define VTD_PROT_RWX ((u64)VTD_READ | (u64)VTD_WRITE | (u64)VTD_EXECUTE)
+
+static inline pdt_t _vtd_get_pdt(u32 pdptindex)
+{
+    return (pdt_t)(l_vtd_pdts_vaddr + (pdptindex * PAGE_SIZE_4K));
+}
+
+static inline pt_t _vtd_get_pt(u32 pdptindex, u32 pdtindex)
+{
+    return (pt_t)(l_vtd_pts_vaddr + (pdptindex * PAGE_SIZE_4K * PAE_PTRS_PER_PDT) + (pdtindex * PAGE_SIZE_4K));
+}
+
+// 1G pages are only used when 2M pages are also supported, so that a 1G page
+// is always split into 2M pages
+static inline bool _vtd_use_1G(void)
+{
+    return (g_vtd_cap_sagaw_mgaw_nd.sps & (VTD_SPS_1G | VTD_SPS_2M)) == (VTD_SPS_1G | VTD_SPS_2M);
+}
+
+static inline bool _vtd_use_2M(void)
+{
+    return (g_vtd_cap_sagaw_mgaw_nd.sps & VTD_SPS_2M) != 0;
+}
+
+// Replace the 2M page at PDT entry (pdptindex, pdtindex) with its PT, which
+// maps the same 2M region with 4K pages of the same permissions
+static void _vtd_split_2M(u32 pdptindex, u32 pdtindex)
+{
+    pdt_t pdt = _vtd_get_pdt(pdptindex);
+    pt_t pt = _vtd_get_pt(pdptindex, pdtindex);
+    spa_t paddr = ((spa_t)pdptindex << PAGE_SHIFT_1G) | ((spa_t)pdtindex << PAGE_SHIFT_2M);
+    u64 prot = pdt[pdtindex] & VTD_PROT_RWX;
+    u32 k;
+
+    for (k = 0; k < PAE_PTRS_PER_PT; k++)
+    {
+        pt[k] = (u64)(paddr + (k * PAGE_SIZE_4K)) | prot;
+    }
+
+    pdt[pdtindex] = (u64)(l_vtd_pts_paddr + (pdptindex * PAGE_SIZE_4K * PAE_PTRS_PER_PDT) + (pdtindex * PAGE_SIZE_4K));
+    pdt[pdtindex] |= VTD_PROT_RWX;
+}
+
+// Replace the 1G page at PDPT entry pdptindex with its PDT, which maps the
+// same 1G region with 2M pages of the same permissions
+static void _vtd_split_1G(u32 pdptindex)
+{
+    pdpt_t pdpt = (pdpt_t)l_vtd_pdpt_vaddr;
+    pdt_t pdt = _vtd_get_pdt(pdptindex);
+    spa_t paddr = (spa_t)pdptindex << PAGE_SHIFT_1G;
+    u64 prot = pdpt[pdptindex] & VTD_PROT_RWX;
+    u32 j;
+
+    for (j = 0; j < PAE_PTRS_PER_PDT; j++)
+    {
+        pdt[j] = (u64)(paddr + (j * PAGE_SIZE_2M)) | prot | (u64)VTD_SUPERPAGE;
+    }
+
+    pdpt[pdptindex] = (u64)(l_vtd_pdts_paddr + (pdptindex * PAGE_SIZE_4K));
+    pdpt[pdptindex] |= VTD_PROT_RWX;
+}
+
+// Set the DMA permissions of [start_paddr, end_paddr) (4K aligned) to <prot>,
+// using the largest page that fits in the range and is supported by VT-d
+static void _vtd_set_range_prot(spa_t start_paddr, spa_t end_paddr, u64 prot)
+{
+    pdpt_t pdpt = (pdpt_t)l_vtd_pdpt_vaddr;
+    spa_t cur_spaddr = start_paddr;
+
+    // sanity check
+    HALT_ON_ERRORCOND((l_vtd_pdpt_paddr != 0) && (l_vtd_pdpt_vaddr != 0));
+    HALT_ON_ERRORCOND((l_vtd_pdts_paddr != 0) && (l_vtd_pdts_vaddr != 0));
+    HALT_ON_ERRORCOND((l_vtd_pts_paddr != 0) && (l_vtd_pts_vaddr != 0));
+    HALT_ON_ERRORCOND(end_paddr <= DMAPROT_PHY_ADDR_SPACE_SIZE);
+
+    while (cur_spaddr < end_paddr)
+    {
+        // compute pdpt, pdt and pt indices
+        u32 pdptindex = PAE_get_pdptindex(cur_spaddr);
+        u32 pdtindex = PAE_get_pdtindex(cur_spaddr);
+        u32 ptindex = PAE_get_ptindex(cur_spaddr);
+        pdt_t pdt;
+        pt_t pt;
+
+        // memory outside the machine physical address range is not mapped
+        if (pdpt[pdptindex] == 0)
+        {
+            cur_spaddr = PA_PAGE_ALIGN_1G(cur_spaddr) + PAGE_SIZE_1G;
+            continue;
+        }
+
+        // 1G page
+        if (_vtd_use_1G() && PA_PAGE_ALIGNED_1G(cur_spaddr) && end_paddr - cur_spaddr >= PAGE_SIZE_1G)
+        {
+            pdpt[pdptindex] = (u64)cur_spaddr | prot | (u64)VTD_SUPERPAGE;
+            cur_spaddr += PAGE_SIZE_1G;
+            continue;
+        }
+        if (pdpt[pdptindex] & VTD_SUPERPAGE)
+        {
+            _vtd_split_1G(pdptindex);
+        }
+
+        // 2M page
+        pdt = _vtd_get_pdt(pdptindex);
+        if (_vtd_use_2M() && PA_PAGE_ALIGNED_2M(cur_spaddr) && end_paddr - cur_spaddr >= PAGE_SIZE_2M)
+        {
+            pdt[pdtindex] = (u64)cur_spaddr | prot | (u64)VTD_SUPERPAGE;
+            cur_spaddr += PAGE_SIZE_2M;
+            continue;
+        }
+        if (pdt[pdtindex] & VTD_SUPERPAGE)
+        {
+            _vtd_split_2M(pdptindex, pdtindex);
+        }
+
+        // 4K page
+        pt = _vtd_get_pt(pdptindex, pdtindex);
+        pt[ptindex] = (u64)cur_spaddr | prot;
+        cur_spaddr += PAGE_SIZE_4K;
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////
 // GLOBALS
 
@@ -506,85 +639,115 @@ void xmhf_dmaprot_arch_x86_vmx_protect_drhd(VCPU *vcpu)
 // DMA protect a given region of memory
 void xmhf_dmaprot_arch_x86_vmx_protect(spa_t start_paddr, size_t size)
 {
-    pt_t pt;
-    spa_t cur_spaddr, end_paddr;
-    u32 pdptindex, pdtindex, ptindex;
+    spa_t end_paddr;
 
     // compute page aligned end
     end_paddr = PA_PAGE_ALIGN_UP_4K(start_paddr + size);
     start_paddr = PA_PAGE_ALIGN_4K(start_paddr);
 
-    // sanity check
-    HALT_ON_ERRORCOND((l_vtd_pdpt_paddr != 0) && (l_vtd_pdpt_vaddr != 0));
-    HALT_ON_ERRORCOND((l_vtd_pdts_paddr != 0) && (l_vtd_pdts_vaddr != 0));
-    HALT_ON_ERRORCOND((l_vtd_pts_paddr != 0) && (l_vtd_pts_vaddr != 0));
-
 #ifndef __XMHF_VERIFICATION__
-    for (cur_spaddr = start_paddr; cur_spaddr < end_paddr; cur_spaddr += PAGE_SIZE_4K)
-    {
-        // compute pdpt, pdt and pt indices
-        pdptindex = PAE_get_pdptindex(cur_spaddr);
-        pdtindex = PAE_get_pdtindex(cur_spaddr);
-        ptindex = PAE_get_ptindex(cur_spaddr);
-
-        // get the page-table for this physical page
-        pt = (pt_t)(l_vtd_pts_vaddr + (pdptindex * PAGE_SIZE_4K * PAE_PTRS_PER_PDT) + (pdtindex * PAGE_SIZE_4K));
-
-        // protect the physical page
-        // pt[ptindex] &= 0xFFFFFFFFFFFFFFFCULL;
-        pt[ptindex] &= (~((u64)VTD_READ | (u64)VTD_WRITE) | (u64)VTD_EXECUTE);
-    }
+    // protect the physical pages
+    _vtd_set_range_prot(start_paddr, end_paddr, (u64)VTD_EXECUTE);
+    xmhf_dmaprot_arch_x86_vmx_queue_invalidate_range(UNTRUSTED_OS_IOMMU_PT_ID, start_paddr, end_paddr);
 #endif
 }
 
 // DMA unprotect a given region of memory
 void xmhf_dmaprot_arch_x86_vmx_unprotect(spa_t start_paddr, size_t size)
 {
-    pt_t pt;
-    spa_t cur_spaddr, end_paddr;
-    u32 pdptindex, pdtindex, ptindex;
+    spa_t end_paddr;
 
     // compute page aligned end
     end_paddr = PA_PAGE_ALIGN_UP_4K(start_paddr + size);
     start_paddr = PA_PAGE_ALIGN_4K(start_paddr);
 
-    // sanity check
-    HALT_ON_ERRORCOND((l_vtd_pdpt_paddr != 0) && (l_vtd_pdpt_vaddr != 0));
-    HALT_ON_ERRORCOND((l_vtd_pdts_paddr != 0) && (l_vtd_pdts_vaddr != 0));
-    HALT_ON_ERRORCOND((l_vtd_pts_paddr != 0) && (l_vtd_pts_vaddr != 0));
-
 #ifndef __XMHF_VERIFICATION__
-    for (cur_spaddr = start_paddr; cur_spaddr < end_paddr; cur_spaddr += PAGE_SIZE_4K)
-    {
-        // compute pdpt, pdt and pt indices
-        pdptindex = PAE_get_pdptindex(cur_spaddr);
-        pdtindex = PAE_get_pdtindex(cur_spaddr);
-        ptindex = PAE_get_ptindex(cur_spaddr);
-
-        // get the page-table for this physical page
-        pt = (pt_t)(l_vtd_pts_vaddr + (pdptindex * PAGE_SIZE_4K * PAE_PTRS_PER_PDT) + (pdtindex * PAGE_SIZE_4K));
-
-        // protect the physical page
-        // pt[ptindex] &= 0xFFFFFFFFFFFFFFFCULL;
-        pt[ptindex] |= ((u64)VTD_READ | (u64)VTD_WRITE | (u64)VTD_EXECUTE);
-    }
+    // unprotect the physical pages
+    _vtd_set_range_prot(start_paddr, end_paddr, VTD_PROT_RWX);
+    xmhf_dmaprot_arch_x86_vmx_queue_invalidate_range(UNTRUSTED_OS_IOMMU_PT_ID, start_paddr, end_paddr);
 #endif
 }
 
 // flush the caches
+// DRHDs using queued invalidation get global context-cache and IOTLB
+// invalidation descriptors, which are waited for together with any
+// descriptors queued before.
 void xmhf_dmaprot_arch_x86_vmx_invalidate_cache(void)
 {
     u32 i = 0;
 
+    spin_lock(&vtd_qi_lock);
 #ifndef __XMHF_VERIFICATION__
     // initialize all DRHD units
     FOREACH_S(i, vtd_num_drhd, VTD_MAX_DRHD, 0, 1)
     {
-        _vtd_invalidate_caches_single_iommu(&vtd_drhd[i], &vtd_drhd[0]);
+        if (vtd_drhd[i].qi)
+        {
+            _vtd_qi_queue_cc_global(&vtd_drhd[i]);
+            _vtd_qi_queue_iotlb_global(&vtd_drhd[i]);
+        }
+        else
+        {
+            _vtd_invalidate_caches_single_iommu(&vtd_drhd[i], &vtd_drhd[0]);
+        }
     }
+    _vtd_qi_sync(vtd_drhd, vtd_num_drhd);
 #else
     _vtd_invalidate_caches_single_iommu(&vtd_drhd[0], &vtd_drhd[0]);
 #endif
+    spin_unlock(&vtd_qi_lock);
+}
+
+// flush the IOTLB entries of a given region of memory after protecting or
+// unprotecting it
+// On DRHDs using queued invalidation, xmhf_dmaprot_arch_x86_vmx_protect() and
+// unprotect() already queued the IOTLB invalidations, so only the wait for
+// the batch is submitted.
+void xmhf_dmaprot_arch_x86_vmx_invalidate_range(spa_t start_paddr, size_t size)
+{
+    u32 i = 0;
+    spa_t end_paddr;
+
+    // compute page aligned end
+    end_paddr = PA_PAGE_ALIGN_UP_4K(start_paddr + size);
+    start_paddr = PA_PAGE_ALIGN_4K(start_paddr);
+    if (start_paddr >= end_paddr)
+        return;
+
+    spin_lock(&vtd_qi_lock);
+#ifndef __XMHF_VERIFICATION__
+    FOREACH_S(i, vtd_num_drhd, VTD_MAX_DRHD, 0, 1)
+    {
+        if (!vtd_drhd[i].qi)
+        {
+            _vtd_invalidate_iotlb_range_single_iommu(&vtd_drhd[i], &vtd_drhd[0], start_paddr, end_paddr);
+        }
+    }
+    _vtd_qi_sync(vtd_drhd, vtd_num_drhd);
+#else
+    _vtd_invalidate_iotlb_range_single_iommu(&vtd_drhd[0], &vtd_drhd[0], start_paddr, end_paddr);
+#endif
+    spin_unlock(&vtd_qi_lock);
+}
+
+//! Queue IOTLB invalidations of [start_paddr, end_paddr) in domain <did> on
+//! DRHDs using queued invalidation. They are submitted by the next
+//! xmhf_dmaprot_arch_x86_vmx_invalidate_cache() / invalidate_range(). DRHDs
+//! using register based invalidation are not affected.
+//! [NOTE] This function is used by dmap module only, and hence is not exported.
+void xmhf_dmaprot_arch_x86_vmx_queue_invalidate_range(u16 did, spa_t start_paddr, spa_t end_paddr)
+{
+    u32 i = 0;
+
+    spin_lock(&vtd_qi_lock);
+    FOREACH_S(i, vtd_num_drhd, VTD_MAX_DRHD, 0, 1)
+    {
+        if (vtd_drhd[i].qi)
+        {
+            _vtd_qi_queue_iotlb_range(&vtd_drhd[i], did, start_paddr, end_paddr);
+        }
+    }
+    spin_unlock(&vtd_qi_lock);
 }
 
 
@@ -230,6 +230,10 @@ bool iommu_vmx_map(IOMMU_PT_INFO *pt_info, gpa_t gpa, spa_t spa, uint32_t flags)
 		// xmhf_cpu_flush_cache_range(ptr, sizeof(*ptr));
 	}
 
+	// Queue the IOTLB invalidation of <gpa>. The caller submits the batch with
+	// iommu_vmx_invalidate_pt() or by binding the IOMMU PT to a device.
+	xmhf_dmaprot_arch_x86_vmx_queue_invalidate_range((u16)pt_info->iommu_pt_id, gpa, gpa + PAGE_SIZE_4K);
+
 	return true;
 }
 
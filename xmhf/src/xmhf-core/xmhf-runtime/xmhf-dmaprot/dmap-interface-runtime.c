@@ -95,3 +95,9 @@ void xmhf_dmaprot_invalidate_cache(void)
 {
 	xmhf_dmaprot_arch_invalidate_cache();
 }
+
+//flush the cached DMA translations of a given region of memory
+void xmhf_dmaprot_invalidate_range(spa_t start_paddr, size_t size)
+{
+	xmhf_dmaprot_arch_invalidate_range(start_paddr, size);
+}
@@ -50,6 +50,17 @@
 #include <xmhf.h>
 
 
+//---length of the intercepted instruction--------------------------------------
+//uses the next RIP saved by the CPU on the #VMEXIT when supported, else the
+//architectural length of the instruction given by the caller
+static u32 _svm_insn_len(VCPU *vcpu, struct _svm_vmcbfields *vmcb, u32 default_len){
+  if(vcpu->svm_features & SVM_FEATURE_NRIPS){
+    return (u32)(vmcb->nrip - vmcb->rip);
+  }
+  return default_len;
+}
+
+
 //---IO Intercept handling------------------------------------------------------
 static void _svm_handle_ioio(VCPU *vcpu, struct _svm_vmcbfields *vmcb, struct regs __attribute__((unused)) *r){
   union svmioiointerceptinfo ioinfo;
@@ -141,7 +152,7 @@ static void _svm_handle_msr(VCPU *vcpu, struct _svm_vmcbfields *vmcb, struct reg
     break;
   }
 
-  vmcb->rip += 2;
+  vmcb->rip += _svm_insn_len(vcpu, vmcb, 2);
 }
 
 
@@ -337,7 +348,7 @@ static void _svm_int15_handleintercept(VCPU *vcpu, struct regs *r){
 
 		//update RIP to execute the IRET following the VMCALL instruction
 		//effectively returning from the INT 15 call made by the guest
-		vmcb->rip += 3;
+		vmcb->rip += _svm_insn_len(vcpu, vmcb, 3);
 
 		return;
 	} //E820 service
@@ -359,6 +370,7 @@ static void _svm_int15_handleintercept(VCPU *vcpu, struct regs *r){
 	vmcb->rip = ip;
 	vmcb->cs.base = cs * 16;
 	vmcb->cs.selector = cs;
+	svm_vmcb_dirty(vmcb, VMCB_CLEAN_SEG);
 }
 
 
@@ -369,6 +381,13 @@ u32 xmhf_parteventhub_arch_x86svm_intercept_handler(VCPU *vcpu, struct regs *r){
 
   vmcb->tlb_control = VMCB_TLB_CONTROL_NOTHING;
 
+  //the CPU may keep the VMCB state from this #VMEXIT cached for the next
+  //VMRUN; code below that writes a cached field marks its group dirty with
+  //svm_vmcb_dirty()
+  if(vcpu->svm_features & SVM_FEATURE_VMCBCLEAN){
+    vmcb->vmcb_clean = VMCB_CLEAN_ALL;
+  }
+
 	//handle intercepts
 	switch(vmcb->exitcode){
 
@@ -392,13 +411,14 @@ u32 xmhf_parteventhub_arch_x86svm_intercept_handler(VCPU *vcpu, struct regs *r){
 						HALT();
 				}
 			}else{	//if not E820 hook, give app a chance to handle the hypercall
+				u32 insn_len = _svm_insn_len(vcpu, vmcb, 3);
 				xmhf_smpguest_arch_x86svm_quiesce(vcpu);
 				if( xmhf_app_handlehypercall(vcpu, r) != APP_SUCCESS){
 					printf("CPU(0x%02x): error(halt), unhandled hypercall 0x%08x!\n", vcpu->id, r->eax);
 					HALT();
 				}
 				xmhf_smpguest_arch_x86svm_endquiesce(vcpu);
-				vmcb->rip += 3;
+				vmcb->rip += insn_len;
 			}
 		}
 		break;
@@ -163,6 +163,9 @@ void _vmx_set_guest_efer(VCPU *vcpu, u64 val)
 /* Return the CR4 register value perceived by the guest. */
 static ulong_t get_guest_cr4(VCPU *vcpu)
 {
+	VCPU_VMCS_FETCH(vcpu, control_CR4_shadow);
+	VCPU_VMCS_FETCH(vcpu, control_CR4_mask);
+	VCPU_VMCS_FETCH(vcpu, guest_CR4);
 	return ((vcpu->vmcs.control_CR4_shadow & vcpu->vmcs.control_CR4_mask) |
 			(vcpu->vmcs.guest_CR4 & ~vcpu->vmcs.control_CR4_mask));
 }
@@ -1139,175 +1142,562 @@ static void _vmx_handle_intercept_xsetbv(VCPU *vcpu, struct regs *r){
 }
 
 
+//---NMI window intercept handler--------------------------------------
+static void _vmx_handle_intercept_nmi_window(VCPU *vcpu){
+	/* Inject NMI to guest */
+	vcpu->vmcs.control_VM_entry_exception_errorcode = 0;
+	vcpu->vmcs.control_VM_entry_interruption_information = NMI_VECTOR |
+		INTR_TYPE_NMI |
+		INTR_INFO_VALID_MASK;
+	/* Clear NMI windowing if needed */
+	HALT_ON_ERRORCOND(vcpu->vmx_guest_nmi_cfg.guest_nmi_pending > 0);
+	HALT_ON_ERRORCOND(vcpu->vmcs.control_VMX_cpu_based &
+					  (1U << VMX_PROCBASED_NMI_WINDOW_EXITING));
+	vcpu->vmx_guest_nmi_cfg.guest_nmi_pending--;
+	xmhf_smpguest_arch_x86vmx_update_nmi_window_exiting(
+		vcpu, &vcpu->vmcs.control_VMX_cpu_based);
+#ifdef __DEBUG_EVENT_LOGGER__
+	{
+		u8 key = 0;
+		xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_inject_nmi, &key);
+	}
+#endif /* __DEBUG_EVENT_LOGGER__ */
+}
+
 #ifdef __OPTIMIZE_NESTED_VIRT__
 
 /*
- * Optimize xmhf_parteventhub_arch_x86vmx_intercept_handler for some frequently
- * used intercepts observed in real operating systems. This reduces number of
- * VMREAD / VMWRITE during the intercepts and speeds up when XMHF is running in
- * a hypervisor.
+ * Fast paths of xmhf_parteventhub_arch_x86vmx_intercept_handler for some
+ * frequently used intercepts observed in real operating systems. This reduces
+ * number of VMREAD / VMWRITE during the intercepts and speeds up when XMHF is
+ * running in a hypervisor.
  *
- * The optimizations depend on the logic in the specific handlers. For example,
- * if _vmx_handle_intercept_cpuid() accesses more VMCS fields, then the
- * optimization may become incorrect.
+ * Each fast path declares the VMCS fields it reads and writes (its
+ * "footprint"). Before the fast path is called, only these fields are fetched
+ * into the VMCS cache, instead of calling getVMCS. After the fast path
+ * handles the intercept, putVMCS writes the modified fields back.
+ *
+ * A fast path returns 1 if the intercept is handled, or 0 to fall back to the
+ * full intercept handler. Fields fetched by the fast path are not read again
+ * by getVMCS.
+ *
+ * Every intercept handled by the full intercept handler has an entry. Entries
+ * without a fast path are marked full_only, with the reason in a comment
+ * (usually hypapp callbacks or halting paths, which may access any field).
  *
- * Return 1 if optimized, or 0 if not optimized.
+ * The footprints depend on the logic in the specific handlers. For example,
+ * if _vmx_handle_intercept_cpuid() accesses more VMCS fields, then the
+ * footprint of CPUID needs to be updated. Configure with
+ * --enable-debug-vmcs-footprint to check the footprints at runtime.
  */
-static u32 _optimize_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
-
-#define _OPT_VMWRITE(size, name) \
-	do { \
-		__vmx_vmwrite##size(VMCSENC_##name, vcpu->vmcs.name); \
-	} while (0)
-#define _OPT_VMREAD(size, name) \
-	do { \
-		vcpu->vmcs.name = __vmx_vmread##size(VMCSENC_##name); \
-	} while (0)
 
-	_OPT_VMREAD(32, info_vmexit_reason);
-
-	xmhf_event_counter_inc(vcpu, (u32)vcpu->vmcs.info_vmexit_reason);
-	switch ((u32)vcpu->vmcs.info_vmexit_reason) {
-	case VMX_VMEXIT_WRMSR:
-		/* Only optimize WRMSR for some MSRs */
-		switch (r->ecx) {
-		case 0x6e0:	/* IA32_TSC_DEADLINE */
-			/* fallthrough */
-		case 0x80b:	/* IA32_X2APIC_EOI */
+/* Fast path of an intercept, see above */
+typedef struct {
+	u32 (*handler)(VCPU *vcpu, struct regs *r);
+	/* Fields read by handler, VMCSIDX_*, terminated by VMCSIDX_COUNT */
+	const u16 *read_set;
+	/* Fields written by handler, VMCSIDX_*, terminated by VMCSIDX_COUNT */
+	const u16 *write_set;
+	/* No fast path, the intercept is always handled after getVMCS */
+	bool full_only;
+} vmx_fast_path_t;
+
+/* Entry of an intercept that is always handled by the full handler */
+#define _VMX_FULL_PATH_ONLY { .handler = NULL, .full_only = true }
+
+/* Construct a footprint, e.g. _VMCS_SET(VMCSIDX_guest_RIP) */
+#define _VMCS_SET(...) ((const u16 []){ __VA_ARGS__, VMCSIDX_COUNT })
+
+static u32 _vmx_fast_path_wrmsr(VCPU *vcpu, struct regs *r){
+	/* Only optimize WRMSR for some MSRs */
+	switch (r->ecx) {
+	case 0x6e0:	/* IA32_TSC_DEADLINE */
+		/* fallthrough */
+	case 0x80b:	/* IA32_X2APIC_EOI */
 #ifdef __DEBUG_EVENT_LOGGER__
-			xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_wrmsr,
-							   &r->ecx);
+		xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_wrmsr, &r->ecx);
 #endif /* __DEBUG_EVENT_LOGGER__ */
-			_OPT_VMREAD(NW, guest_RIP);
-			_OPT_VMREAD(32, info_vmexit_instruction_length);
-			_vmx_handle_intercept_wrmsr(vcpu, r);
-			_OPT_VMWRITE(NW, guest_RIP);
-			return 1;
-		default:
+		_vmx_handle_intercept_wrmsr(vcpu, r);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static u32 _vmx_fast_path_rdmsr(VCPU *vcpu, struct regs *r){
+	u32 index;
+	/* Only optimize RDMSR for MSRs that do not need hypapp */
+	switch (r->ecx) {
+	case IA32_SYSENTER_CS_MSR:	/* fallthrough */
+	case IA32_SYSENTER_EIP_MSR:	/* fallthrough */
+	case IA32_SYSENTER_ESP_MSR:	/* fallthrough */
+	case IA32_MSR_FS_BASE:	/* fallthrough */
+	case IA32_MSR_GS_BASE:
+		break;
+	default:
+		if (!xmhf_partition_arch_x86vmx_get_xmhf_msr(r->ecx, &index)) {
 			return 0;
 		}
-	case VMX_VMEXIT_CPUID:
-		/* Always optimize CPUID */
+		break;
+	}
 #ifdef __DEBUG_EVENT_LOGGER__
-		xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_cpuid, &r->eax);
+	xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_rdmsr, &r->ecx);
 #endif /* __DEBUG_EVENT_LOGGER__ */
-		_OPT_VMREAD(NW, guest_RIP);
-		_OPT_VMREAD(32, info_vmexit_instruction_length);
-		_vmx_handle_intercept_cpuid(vcpu, r);
-		_OPT_VMWRITE(NW, guest_RIP);
-		return 1;
-	case VMX_VMEXIT_EPT_VIOLATION: {
-		/* Optimize EPT violation due to LAPIC */
-		u64 gpa;
-		_OPT_VMREAD(64, guest_paddr);
-		gpa = vcpu->vmcs.guest_paddr;
-		if(vcpu->isbsp && (gpa >= g_vmx_lapic_base) && (gpa < (g_vmx_lapic_base + PAGE_SIZE_4K)) ){
+	_vmx_handle_intercept_rdmsr(vcpu, r);
+	return 1;
+}
+
+static u32 _vmx_fast_path_cpuid(VCPU *vcpu, struct regs *r){
+	/* Always optimize CPUID */
 #ifdef __DEBUG_EVENT_LOGGER__
-			xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_other,
-							   &vcpu->vmcs.info_vmexit_reason);
+	xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_cpuid, &r->eax);
 #endif /* __DEBUG_EVENT_LOGGER__ */
-			_OPT_VMREAD(NW, info_exit_qualification);
-			_OPT_VMREAD(32, control_exception_bitmap);
-			_OPT_VMREAD(32, guest_interruptibility);
-			_OPT_VMREAD(NW, guest_RFLAGS);
-			_OPT_VMREAD(64, control_EPT_pointer);
-			_vmx_handle_intercept_eptviolation(vcpu, r);
-			_OPT_VMWRITE(32, control_exception_bitmap);
-			_OPT_VMWRITE(32, guest_interruptibility);
-			_OPT_VMWRITE(NW, guest_RFLAGS);
-			return 1;
-		}
-		return 0;
+	_vmx_handle_intercept_cpuid(vcpu, r);
+	return 1;
+}
+
+static u32 _vmx_fast_path_eptviolation(VCPU *vcpu, struct regs *r){
+	/* Optimize EPT violation due to LAPIC */
+	u64 gpa = vcpu->vmcs.guest_paddr;
+	if (vcpu->isbsp && (gpa >= g_vmx_lapic_base) &&
+		(gpa < (g_vmx_lapic_base + PAGE_SIZE_4K))) {
+#ifdef __DEBUG_EVENT_LOGGER__
+		xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_other,
+						   &vcpu->vmcs.info_vmexit_reason);
+#endif /* __DEBUG_EVENT_LOGGER__ */
+		_vmx_handle_intercept_eptviolation(vcpu, r);
+		return 1;
 	}
-	case VMX_VMEXIT_EXCEPTION:
+	return 0;
+}
+
+static u32 _vmx_fast_path_exception(VCPU *vcpu, struct regs *r){
+	u8 vector = vcpu->vmcs.info_vmexit_interrupt_information &
+				INTR_INFO_VECTOR_MASK;
+	switch (vector) {
+	case INT1_VECTOR:
 		/* Optimize debug exception (#DB) for LAPIC operation */
-		_OPT_VMREAD(32, info_vmexit_interrupt_information);
-		if (((u32)vcpu->vmcs.info_vmexit_interrupt_information &
-			 INTR_INFO_VECTOR_MASK) == INT1_VECTOR) {
 #ifdef __DEBUG_EVENT_LOGGER__
-			u8 key = vcpu->vmcs.info_vmexit_interrupt_information &
-				 INTR_INFO_VECTOR_MASK;
-			xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_xcph, &key);
+		xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_xcph, &vector);
 #endif /* __DEBUG_EVENT_LOGGER__ */
-			_OPT_VMREAD(16, guest_CS_selector);
-			_OPT_VMREAD(NW, guest_RIP);
-			_OPT_VMREAD(32, control_exception_bitmap);
-			_OPT_VMREAD(32, guest_interruptibility);
-			_OPT_VMREAD(NW, guest_RFLAGS);
-			_OPT_VMREAD(64, control_EPT_pointer);
-			HALT_ON_ERRORCOND((vcpu->vmcs.info_vmexit_interrupt_information &
-							   INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_HW_EXCEPTION);
-			xmhf_smpguest_arch_x86_eventhandler_dbexception(vcpu, r);
-			_OPT_VMWRITE(32, control_exception_bitmap);
-			_OPT_VMWRITE(32, guest_interruptibility);
-			_OPT_VMWRITE(NW, guest_RFLAGS);
-			return 1;
-		}
+		HALT_ON_ERRORCOND((vcpu->vmcs.info_vmexit_interrupt_information &
+						   INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_HW_EXCEPTION);
+		xmhf_smpguest_arch_x86_eventhandler_dbexception(vcpu, r);
+		return 1;
+	case NMI_VECTOR:
+		/* Optimize NMI for quiesce and TLB shootdown, cannot print */
+#ifdef __DEBUG_EVENT_LOGGER__
+		xmhf_dbg_log_event(vcpu, 0, XMHF_DBG_EVENTLOG_vmexit_xcph, &vector);
+#endif /* __DEBUG_EVENT_LOGGER__ */
+		HALT_ON_ERRORCOND((vcpu->vmcs.info_vmexit_interrupt_information &
+						   INTR_INFO_INTR_TYPE_MASK) == INTR_TYPE_NMI);
+		xmhf_smpguest_arch_x86vmx_eventhandler_nmiexception(vcpu, r, 1);
+		return 1;
+	default:
 		return 0;
+	}
+}
+
+static u32 _vmx_fast_path_nmi_window(VCPU *vcpu, struct regs *r){
+	(void)r;
+#ifdef __DEBUG_EVENT_LOGGER__
+	xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_other,
+					   &vcpu->vmcs.info_vmexit_reason);
+#endif /* __DEBUG_EVENT_LOGGER__ */
+	_vmx_handle_intercept_nmi_window(vcpu);
+	return 1;
+}
+
+static u32 _vmx_fast_path_xsetbv(VCPU *vcpu, struct regs *r){
+	/* Always optimize XSETBV */
+#ifdef __DEBUG_EVENT_LOGGER__
+	xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_other,
+					   &vcpu->vmcs.info_vmexit_reason);
+#endif /* __DEBUG_EVENT_LOGGER__ */
+	_vmx_handle_intercept_xsetbv(vcpu, r);
+	return 1;
+}
+
 #ifdef __NESTED_VIRTUALIZATION__
-	case VMX_VMEXIT_VMREAD:	/* fallthrough */
-	case VMX_VMEXIT_VMWRITE:
+static u32 _vmx_fast_path_vmx_instruction(VCPU *vcpu, struct regs *r){
 #ifdef __DEBUG_EVENT_LOGGER__
-		xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_other,
-						   &vcpu->vmcs.info_vmexit_reason);
+	xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vmexit_other,
+					   &vcpu->vmcs.info_vmexit_reason);
 #endif /* __DEBUG_EVENT_LOGGER__ */
-		_OPT_VMREAD(16, guest_CS_selector);
-		_OPT_VMREAD(64, control_EPT_pointer);
-		_OPT_VMREAD(32, control_VM_entry_controls);
-		_OPT_VMREAD(32, info_vmexit_instruction_length);
-		_OPT_VMREAD(32, info_vmx_instruction_information);
-		_OPT_VMREAD(32, guest_CS_access_rights);
-		_OPT_VMREAD(NW, control_CR0_mask);
-		_OPT_VMREAD(NW, control_CR0_shadow);
-		_OPT_VMREAD(NW, info_exit_qualification);
-		_OPT_VMREAD(NW, guest_CR0);
-		_OPT_VMREAD(NW, guest_CR3);
-		_OPT_VMREAD(NW, guest_ES_base);
-		_OPT_VMREAD(NW, guest_CS_base);
-		_OPT_VMREAD(NW, guest_SS_base);
-		_OPT_VMREAD(NW, guest_DS_base);
-		_OPT_VMREAD(NW, guest_FS_base);
-		_OPT_VMREAD(NW, guest_GS_base);
-		_OPT_VMREAD(32, guest_ES_limit);
-		_OPT_VMREAD(32, guest_CS_limit);
-		_OPT_VMREAD(32, guest_SS_limit);
-		_OPT_VMREAD(32, guest_DS_limit);
-		_OPT_VMREAD(32, guest_FS_limit);
-		_OPT_VMREAD(32, guest_GS_limit);
-		_OPT_VMREAD(32, guest_ES_access_rights);
-		_OPT_VMREAD(32, guest_CS_access_rights);
-		_OPT_VMREAD(32, guest_SS_access_rights);
-		_OPT_VMREAD(32, guest_DS_access_rights);
-		_OPT_VMREAD(32, guest_FS_access_rights);
-		_OPT_VMREAD(32, guest_GS_access_rights);
-		_OPT_VMREAD(NW, guest_RSP);
-		_OPT_VMREAD(NW, guest_RIP);
-		_OPT_VMREAD(NW, guest_RFLAGS);
-		_OPT_VMREAD(32, control_VM_entry_interruption_information);
-		switch ((u32)vcpu->vmcs.info_vmexit_reason) {
-		case VMX_VMEXIT_VMREAD:
-			xmhf_nested_arch_x86vmx_handle_vmread(vcpu, r);
-			break;
-		case VMX_VMEXIT_VMWRITE:
-			xmhf_nested_arch_x86vmx_handle_vmwrite(vcpu, r);
-			break;
-		default:
-			HALT_ON_ERRORCOND(0);
-		}
-		_OPT_VMWRITE(32, control_VM_entry_interruption_information);
-		_OPT_VMWRITE(32, control_VM_entry_exception_errorcode);
-		_OPT_VMWRITE(NW, guest_RSP);
-		_OPT_VMWRITE(NW, guest_RIP);
-		_OPT_VMWRITE(NW, guest_RFLAGS);
-		return 1;
-#endif /* __NESTED_VIRTUALIZATION__ */
+	switch ((u32)vcpu->vmcs.info_vmexit_reason) {
+	case VMX_VMEXIT_INVEPT:
+		xmhf_nested_arch_x86vmx_handle_invept(vcpu, r);
+		break;
+	case VMX_VMEXIT_INVVPID:
+		xmhf_nested_arch_x86vmx_handle_invvpid(vcpu, r);
+		break;
+	case VMX_VMEXIT_VMREAD:
+		xmhf_nested_arch_x86vmx_handle_vmread(vcpu, r);
+		break;
+	case VMX_VMEXIT_VMWRITE:
+		xmhf_nested_arch_x86vmx_handle_vmwrite(vcpu, r);
+		break;
 	default:
+		HALT_ON_ERRORCOND(0);
+	}
+	return 1;
+}
+
+/*
+ * INVEPT, INVVPID, VMREAD and VMWRITE decode the instruction, may inject
+ * exceptions and do not switch between L1 and L2.
+ */
+#define _VMX_FAST_PATH_VMX_INSTRUCTION { \
+	.handler = _vmx_fast_path_vmx_instruction, \
+	.read_set = _VMCS_SET( \
+		VMCSIDX_guest_CS_selector, VMCSIDX_control_EPT_pointer, \
+		VMCSIDX_control_VM_entry_controls, \
+		VMCSIDX_info_vmexit_instruction_length, \
+		VMCSIDX_info_vmx_instruction_information, \
+		VMCSIDX_control_CR0_mask, VMCSIDX_control_CR0_shadow, \
+		VMCSIDX_info_exit_qualification, VMCSIDX_guest_CR0, \
+		VMCSIDX_guest_CR3, VMCSIDX_guest_ES_base, VMCSIDX_guest_CS_base, \
+		VMCSIDX_guest_SS_base, VMCSIDX_guest_DS_base, \
+		VMCSIDX_guest_FS_base, VMCSIDX_guest_GS_base, \
+		VMCSIDX_guest_ES_limit, VMCSIDX_guest_CS_limit, \
+		VMCSIDX_guest_SS_limit, VMCSIDX_guest_DS_limit, \
+		VMCSIDX_guest_FS_limit, VMCSIDX_guest_GS_limit, \
+		VMCSIDX_guest_ES_access_rights, VMCSIDX_guest_CS_access_rights, \
+		VMCSIDX_guest_SS_access_rights, VMCSIDX_guest_DS_access_rights, \
+		VMCSIDX_guest_FS_access_rights, VMCSIDX_guest_GS_access_rights, \
+		VMCSIDX_guest_RSP, VMCSIDX_guest_RIP, VMCSIDX_guest_RFLAGS, \
+		VMCSIDX_control_VM_entry_interruption_information), \
+	.write_set = _VMCS_SET( \
+		VMCSIDX_control_VM_entry_interruption_information, \
+		VMCSIDX_control_VM_entry_exception_errorcode, \
+		VMCSIDX_guest_RSP, VMCSIDX_guest_RIP, VMCSIDX_guest_RFLAGS), \
+}
+#endif /* __NESTED_VIRTUALIZATION__ */
+
+/* Fast paths indexed by VMEXIT reason */
+static const vmx_fast_path_t _vmx_fast_paths[] = {
+	/* Hypapp callbacks */
+	[VMX_VMEXIT_VMCALL] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_IOIO] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_EXT_INTERRUPT] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_INTERRUPT_WINDOW] = _VMX_FULL_PATH_ONLY,
+	/* Rare, or halt after printing the guest state */
+	[VMX_VMEXIT_APIC_ACCESS] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_INIT] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_HLT] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_TASKSWITCH] = _VMX_FULL_PATH_ONLY,
+	/* Guest mode changes may access most guest state fields */
+	[VMX_VMEXIT_CRX_ACCESS] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_WRMSR] = {
+		.handler = _vmx_fast_path_wrmsr,
+		.read_set = _VMCS_SET(VMCSIDX_guest_RIP,
+							  VMCSIDX_info_vmexit_instruction_length),
+		.write_set = _VMCS_SET(VMCSIDX_guest_RIP),
+	},
+	[VMX_VMEXIT_RDMSR] = {
+		.handler = _vmx_fast_path_rdmsr,
+		.read_set = _VMCS_SET(VMCSIDX_guest_RIP,
+							  VMCSIDX_info_vmexit_instruction_length,
+							  VMCSIDX_guest_SYSENTER_CS,
+							  VMCSIDX_guest_SYSENTER_EIP,
+							  VMCSIDX_guest_SYSENTER_ESP,
+							  VMCSIDX_guest_FS_base, VMCSIDX_guest_GS_base),
+		.write_set = _VMCS_SET(VMCSIDX_guest_RIP),
+	},
+	[VMX_VMEXIT_CPUID] = {
+		.handler = _vmx_fast_path_cpuid,
+		.read_set = _VMCS_SET(VMCSIDX_guest_RIP,
+							  VMCSIDX_info_vmexit_instruction_length,
+							  VMCSIDX_control_CR4_shadow,
+							  VMCSIDX_control_CR4_mask,
+							  VMCSIDX_guest_CR4,
+							  VMCSIDX_guest_CS_access_rights),
+		.write_set = _VMCS_SET(VMCSIDX_guest_RIP),
+	},
+	[VMX_VMEXIT_EPT_VIOLATION] = {
+		.handler = _vmx_fast_path_eptviolation,
+		.read_set = _VMCS_SET(VMCSIDX_guest_paddr,
+							  VMCSIDX_info_exit_qualification,
+							  VMCSIDX_info_guest_linear_address,
+							  VMCSIDX_control_exception_bitmap,
+							  VMCSIDX_guest_interruptibility,
+							  VMCSIDX_guest_RFLAGS,
+							  VMCSIDX_control_EPT_pointer),
+		.write_set = _VMCS_SET(VMCSIDX_control_exception_bitmap,
+							   VMCSIDX_guest_interruptibility,
+							   VMCSIDX_guest_RFLAGS),
+	},
+	[VMX_VMEXIT_EXCEPTION] = {
+		.handler = _vmx_fast_path_exception,
+		.read_set = _VMCS_SET(VMCSIDX_info_vmexit_interrupt_information,
+							  VMCSIDX_guest_CS_selector, VMCSIDX_guest_RIP,
+							  VMCSIDX_control_exception_bitmap,
+							  VMCSIDX_guest_interruptibility,
+							  VMCSIDX_guest_RFLAGS,
+							  VMCSIDX_control_EPT_pointer,
+							  VMCSIDX_control_VMX_seccpu_based),
+		.write_set = _VMCS_SET(VMCSIDX_control_exception_bitmap,
+							   VMCSIDX_guest_interruptibility,
+							   VMCSIDX_guest_RFLAGS,
+							   VMCSIDX_control_APIC_access_address,
+							   VMCSIDX_control_VMX_seccpu_based),
+	},
+	[VMX_VMEXIT_NMI_WINDOW] = {
+		.handler = _vmx_fast_path_nmi_window,
+		.read_set = _VMCS_SET(VMCSIDX_control_VMX_cpu_based),
+		.write_set = _VMCS_SET(VMCSIDX_control_VM_entry_exception_errorcode,
+							   VMCSIDX_control_VM_entry_interruption_information,
+							   VMCSIDX_control_VMX_cpu_based),
+	},
+	[VMX_VMEXIT_XSETBV] = {
+		.handler = _vmx_fast_path_xsetbv,
+		.read_set = _VMCS_SET(VMCSIDX_guest_RIP,
+							  VMCSIDX_info_vmexit_instruction_length,
+							  VMCSIDX_control_CR4_shadow,
+							  VMCSIDX_control_CR4_mask,
+							  VMCSIDX_guest_CR4,
+							  VMCSIDX_guest_CS_access_rights),
+		.write_set = _VMCS_SET(VMCSIDX_guest_RIP),
+	},
+#ifdef __NESTED_VIRTUALIZATION__
+	[VMX_VMEXIT_INVEPT] = _VMX_FAST_PATH_VMX_INSTRUCTION,
+	[VMX_VMEXIT_INVVPID] = _VMX_FAST_PATH_VMX_INSTRUCTION,
+	[VMX_VMEXIT_VMREAD] = _VMX_FAST_PATH_VMX_INSTRUCTION,
+	[VMX_VMEXIT_VMWRITE] = _VMX_FAST_PATH_VMX_INSTRUCTION,
+	/* Switch between L1 and L2, or access the current VMCS12 pointer */
+	[VMX_VMEXIT_VMCLEAR] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_VMLAUNCH] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_VMPTRLD] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_VMPTRST] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_VMRESUME] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_VMXOFF] = _VMX_FULL_PATH_ONLY,
+	[VMX_VMEXIT_VMXON] = _VMX_FULL_PATH_ONLY,
+#endif /* __NESTED_VIRTUALIZATION__ */
+};
+
+#undef _VMX_FULL_PATH_ONLY
+#undef _VMCS_SET
+
+/* Fetch all fields in a footprint into the VMCS cache */
+static void _vmx_fast_path_fetch(VCPU *vcpu, const u16 *set){
+	for (; *set != VMCSIDX_COUNT; set++) {
+		if (!vmcs_bitmap_test(&vcpu->vmcs_cache_valid, *set)) {
+			xmhf_baseplatform_arch_x86vmx_vmcs_cache_fetch(vcpu, *set);
+		}
+	}
+}
+
+#ifdef __DEBUG_VMCS_FOOTPRINT__
+/*
+ * Check that a fast path only accesses VMCS fields in its footprint.
+ *
+ * Before the fast path runs, fields that are not fetched are filled with a
+ * poison value and vcpu->vmcs is saved. Fields only in the write set are also
+ * poisoned after saving, and restored after the fast path if not written.
+ * After the fast path returns, halt if
+ * (1) a field is fetched (VCPU_VMCS_FETCH) but not in the read set,
+ * (2) a field is modified but not in the write set, or
+ * (3) a written field or a GPR looks poisoned (most of its bytes are the
+ *     poison byte), i.e. the fast path copies from an unfetched field.
+ * (3) is a heuristic: reads of poisoned fields that only affect control flow
+ * or are mixed with arithmetic are not detected, but usually crash the guest.
+ */
+#define _VMX_FOOTPRINT_POISON 0xa5
+
+/* Build the bitmaps of a footprint */
+static void _vmx_fast_path_footprint(const vmx_fast_path_t *fp,
+									 vmcs_bitmap_t *read_set,
+									 vmcs_bitmap_t *write_set){
+	const u16 *i;
+	memset(read_set, 0, sizeof(*read_set));
+	memset(write_set, 0, sizeof(*write_set));
+	for (i = fp->read_set; *i != VMCSIDX_COUNT; i++) {
+		vmcs_bitmap_set(read_set, *i);
+	}
+	for (i = fp->write_set; *i != VMCSIDX_COUNT; i++) {
+		vmcs_bitmap_set(write_set, *i);
+	}
+}
+
+/* Return number of poison bytes in a field or GPR */
+static size_t _vmx_fast_path_poison_count(const void *ptr, size_t size){
+	const u8 *p = (const u8 *)ptr;
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		if (p[i] == _VMX_FOOTPRINT_POISON) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/* Return whether a field or GPR looks poisoned */
+#define _VMX_POISONED(x) (_vmx_fast_path_poison_count(&(x), sizeof(x)) * 2 > \
+						  sizeof(x))
+
+static void _vmx_fast_path_check_begin(VCPU *vcpu, const vmx_fast_path_t *fp){
+	vmcs_bitmap_t read_set;
+	vmcs_bitmap_t write_set;
+	_vmx_fast_path_footprint(fp, &read_set, &write_set);
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	if (!vmcs_bitmap_test(&vcpu->vmcs_cache_valid, VMCSIDX_##name)) { \
+		memset(&vcpu->vmcs.name, _VMX_FOOTPRINT_POISON, \
+			   sizeof(vcpu->vmcs.name)); \
+	}
+#define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include <arch/x86/_vmx_vmcs_fields.h>
+	vcpu->vmcs_footprint = vcpu->vmcs;
+	vcpu->vmcs_footprint_valid = vcpu->vmcs_cache_valid;
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	if (vmcs_bitmap_test(&write_set, VMCSIDX_##name) && \
+		!vmcs_bitmap_test(&read_set, VMCSIDX_##name)) { \
+		memset(&vcpu->vmcs.name, _VMX_FOOTPRINT_POISON, \
+			   sizeof(vcpu->vmcs.name)); \
+	}
+#define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include <arch/x86/_vmx_vmcs_fields.h>
+}
+
+/*
+ * Restore write-only fields not written by the fast path, then check the
+ * footprint. handled is the return value of the fast path. r_old is the GPRs
+ * before the fast path.
+ */
+static void _vmx_fast_path_check_end(VCPU *vcpu, const vmx_fast_path_t *fp,
+									 u32 handled, struct regs *r,
+									 struct regs *r_old){
+	vmcs_bitmap_t read_set;
+	vmcs_bitmap_t write_set;
+	const ulong_t *gprs = (const ulong_t *)r;
+	const ulong_t *gprs_old = (const ulong_t *)r_old;
+	u32 i;
+	_vmx_fast_path_footprint(fp, &read_set, &write_set);
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	if (vmcs_bitmap_test(&write_set, VMCSIDX_##name) && \
+		!vmcs_bitmap_test(&read_set, VMCSIDX_##name) && \
+		_vmx_fast_path_poison_count(&vcpu->vmcs.name, \
+									sizeof(vcpu->vmcs.name)) == \
+		sizeof(vcpu->vmcs.name)) { \
+		vcpu->vmcs.name = vcpu->vmcs_footprint.name; \
+	}
+#define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include <arch/x86/_vmx_vmcs_fields.h>
+
+	if (!handled) {
+		/*
+		 * The fast path decides not to handle the intercept. It should not
+		 * modify anything. Fields fetched are reused by the full handler.
+		 */
+		HALT_ON_ERRORCOND(memcmp(&vcpu->vmcs, &vcpu->vmcs_footprint,
+								 sizeof(vcpu->vmcs)) == 0);
+		HALT_ON_ERRORCOND(memcmp(r, r_old, sizeof(*r)) == 0);
+		return;
+	}
+
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	if (vmcs_bitmap_test(&vcpu->vmcs_cache_valid, VMCSIDX_##name) && \
+		!vmcs_bitmap_test(&vcpu->vmcs_footprint_valid, VMCSIDX_##name) && \
+		!vmcs_bitmap_test(&read_set, VMCSIDX_##name)) { \
+		printf("CPU(0x%02x): VMEXIT %d reads %s outside footprint\n", \
+			   vcpu->id, (u32)vcpu->vmcs.info_vmexit_reason, #name); \
+		HALT(); \
+	} \
+	if (vcpu->vmcs.name != vcpu->vmcs_footprint.name) { \
+		if (!vmcs_bitmap_test(&write_set, VMCSIDX_##name)) { \
+			printf("CPU(0x%02x): VMEXIT %d writes %s outside footprint\n", \
+				   vcpu->id, (u32)vcpu->vmcs.info_vmexit_reason, #name); \
+			HALT(); \
+		} \
+		if (_VMX_POISONED(vcpu->vmcs.name)) { \
+			printf("CPU(0x%02x): VMEXIT %d writes poison to %s\n", \
+				   vcpu->id, (u32)vcpu->vmcs.info_vmexit_reason, #name); \
+			HALT(); \
+		} \
+	}
+#define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include <arch/x86/_vmx_vmcs_fields.h>
+
+	for (i = 0; i < sizeof(*r) / sizeof(ulong_t); i++) {
+		if (gprs[i] != gprs_old[i] && _VMX_POISONED(gprs[i])) {
+			printf("CPU(0x%02x): VMEXIT %d writes poison to GPR %d\n",
+				   vcpu->id, (u32)vcpu->vmcs.info_vmexit_reason, i);
+			HALT();
+		}
+	}
+}
+
+/*
+ * Check that an intercept handled by the full handler has an entry in
+ * _vmx_fast_paths[], so that the entries cover all intercepts.
+ */
+static void _vmx_fast_path_check_entry(VCPU *vcpu){
+	u32 reason = (u32)vcpu->vmcs.info_vmexit_reason;
+	if (reason >= sizeof(_vmx_fast_paths) / sizeof(_vmx_fast_paths[0]) ||
+		(_vmx_fast_paths[reason].handler == NULL &&
+		 !_vmx_fast_paths[reason].full_only)) {
+		printf("CPU(0x%02x): VMEXIT %d missing in _vmx_fast_paths\n",
+			   vcpu->id, reason);
+		HALT();
+	}
+}
+
+#undef _VMX_POISONED
+#undef _VMX_FOOTPRINT_POISON
+#endif /* __DEBUG_VMCS_FOOTPRINT__ */
+
+/*
+ * Dispatch an intercept to its fast path.
+ * Return 1 if handled (VMCS is written back), or 0 if not handled.
+ */
+static u32 _vmx_fast_path_dispatch(VCPU *vcpu, struct regs *r){
+	const vmx_fast_path_t *fp;
+	u32 reason;
+	u32 handled;
+#ifdef __DEBUG_VMCS_FOOTPRINT__
+	struct regs r_old;
+#endif /* __DEBUG_VMCS_FOOTPRINT__ */
+
+	VCPU_VMCS_FETCH(vcpu, info_vmexit_reason);
+	reason = (u32)vcpu->vmcs.info_vmexit_reason;
+	if (reason >= sizeof(_vmx_fast_paths) / sizeof(_vmx_fast_paths[0])) {
+		return 0;
+	}
+	fp = &_vmx_fast_paths[reason];
+	if (fp->handler == NULL) {
 		return 0;
 	}
 
-#undef _OPT_VMREAD
-#undef _OPT_VMWRITE
+	/*
+	 * Written fields are also fetched, because putVMCS only writes fields
+	 * that are valid in the VMCS cache.
+	 */
+	_vmx_fast_path_fetch(vcpu, fp->read_set);
+	_vmx_fast_path_fetch(vcpu, fp->write_set);
+
+#ifdef __DEBUG_VMCS_FOOTPRINT__
+	r_old = *r;
+	_vmx_fast_path_check_begin(vcpu, fp);
+#endif /* __DEBUG_VMCS_FOOTPRINT__ */
+	handled = fp->handler(vcpu, r);
+#ifdef __DEBUG_VMCS_FOOTPRINT__
+	_vmx_fast_path_check_end(vcpu, fp, handled, r, &r_old);
+#endif /* __DEBUG_VMCS_FOOTPRINT__ */
+	if (!handled) {
+		return 0;
+	}
 
+	xmhf_event_counter_inc(vcpu, reason);
+	xmhf_baseplatform_arch_x86vmx_putVMCS(vcpu);
+	return 1;
 }
 
 #endif /* __OPTIMIZE_NESTED_VIRT__ */
@@ -1368,6 +1758,11 @@ u32 xmhf_parteventhub_arch_x86vmx_print_guest(VCPU *vcpu, struct regs *r)
 
 //---hvm_intercept_handler------------------------------------------------------
 u32 xmhf_parteventhub_arch_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
+	/*
+	 * The guest may have changed its page tables or TLB since the last
+	 * intercept, so cached guest address translations are stale.
+	 */
+	guestmem_tlb_invalidate(vcpu);
 #ifdef __NESTED_VIRTUALIZATION__
 	if (vcpu->vmx_nested_operation_mode == NESTED_VMX_MODE_NONROOT) {
 		xmhf_nested_arch_x86vmx_handle_vmexit(vcpu, r);
@@ -1380,8 +1775,10 @@ u32 xmhf_parteventhub_arch_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
 	 * So we disable NMI during the entire intercept handler.
 	 */
 	xmhf_smpguest_arch_x86vmx_mhv_nmi_disable(vcpu);
+	//VMCS fields in vcpu->vmcs are stale after VMEXIT
+	xmhf_baseplatform_arch_x86vmx_vmcs_cache_reset(vcpu);
 #ifdef __OPTIMIZE_NESTED_VIRT__
-	if (_optimize_x86vmx_intercept_handler(vcpu, r)) {
+	if (_vmx_fast_path_dispatch(vcpu, r)) {
 		xmhf_smpguest_arch_x86vmx_mhv_nmi_enable(vcpu);
 		return 1;
 	}
@@ -1447,12 +1844,16 @@ u32 xmhf_parteventhub_arch_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
 #endif /* !__UEFI__ */
 			//if not E820 hook, give hypapp a chance to handle the hypercall
 			{
+#ifdef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
 				xmhf_smpguest_arch_x86vmx_quiesce(vcpu);
+#endif /* __XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
 				if( xmhf_app_handlehypercall(vcpu, r) != APP_SUCCESS){
 					printf("CPU(0x%02x): error(halt), unhandled hypercall 0x%08x!\n", vcpu->id, r->eax);
 					HALT();
 				}
+#ifdef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
 				xmhf_smpguest_arch_x86vmx_endquiesce(vcpu);
+#endif /* __XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
 				vcpu->vmcs.guest_RIP += vcpu->vmcs.info_vmexit_instruction_length;
 			}
 		}
@@ -1514,6 +1915,13 @@ u32 xmhf_parteventhub_arch_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
 		}
 		break;
 
+		case VMX_VMEXIT_APIC_ACCESS:{
+			//LAPIC interception when "virtualize APIC accesses" is used
+			HALT_ON_ERRORCOND(vcpu->isbsp && !g_all_cores_booted_up);
+			xmhf_smpguest_arch_x86vmx_eventhandler_apicaccess(vcpu, r);
+		}
+		break;
+
 		case VMX_VMEXIT_INIT:{
 #ifdef __EXTRA_AP_INIT_COUNT__
 			if (vcpu->extra_init_count) {
@@ -1619,27 +2027,9 @@ u32 xmhf_parteventhub_arch_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
 		}
 		break;
 
-		case VMX_VMEXIT_NMI_WINDOW: {
-			/* Inject NMI to guest */
-			vcpu->vmcs.control_VM_entry_exception_errorcode = 0;
-			vcpu->vmcs.control_VM_entry_interruption_information = NMI_VECTOR |
-				INTR_TYPE_NMI |
-				INTR_INFO_VALID_MASK;
-			/* Clear NMI windowing if needed */
-			HALT_ON_ERRORCOND(vcpu->vmx_guest_nmi_cfg.guest_nmi_pending > 0);
-			HALT_ON_ERRORCOND(vcpu->vmcs.control_VMX_cpu_based &
-							  (1U << VMX_PROCBASED_NMI_WINDOW_EXITING));
-			vcpu->vmx_guest_nmi_cfg.guest_nmi_pending--;
-			xmhf_smpguest_arch_x86vmx_update_nmi_window_exiting(
-				vcpu, &vcpu->vmcs.control_VMX_cpu_based);
-#ifdef __DEBUG_EVENT_LOGGER__
-			{
-				u8 key = 0;
-				xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_inject_nmi, &key);
-			}
-#endif /* __DEBUG_EVENT_LOGGER__ */
-		}
-		break;
+		case VMX_VMEXIT_NMI_WINDOW:
+			_vmx_handle_intercept_nmi_window(vcpu);
+			break;
 
  		case VMX_VMEXIT_CRX_ACCESS:{
 			u32 tofrom, gpr, crx;
@@ -1727,6 +2117,10 @@ u32 xmhf_parteventhub_arch_x86vmx_intercept_handler(VCPU *vcpu, struct regs *r){
 		}
 	} //end switch((u32)vcpu->vmcs.info_vmexit_reason)
 
+#if defined(__OPTIMIZE_NESTED_VIRT__) && defined(__DEBUG_VMCS_FOOTPRINT__)
+	_vmx_fast_path_check_entry(vcpu);
+#endif /* __OPTIMIZE_NESTED_VIRT__ && __DEBUG_VMCS_FOOTPRINT__ */
+
 	//make sure we have no nested events
 	if(vcpu->vmcs.info_IDT_vectoring_information & 0x80000000){
 		printf("CPU(0x%02x): HALT; Nested events unhandled with hwp:0x%08x\n",
@@ -64,22 +64,18 @@ void xmhf_memprot_arch_initialize(VCPU *vcpu){
 
 // get level-1 page map address
 u64 * xmhf_memprot_arch_get_lvl1_pagemap_address(VCPU *vcpu){
-	HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD || vcpu->cpu_vendor == CPU_VENDOR_INTEL);
+	//EPT P tables are allocated on demand, so there is no flat array on Intel
+	HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD);
 
-	if (vcpu->cpu_vendor == CPU_VENDOR_AMD)
-		return (u64 *)vcpu->npt_vaddr_pts;
-	else //CPU_VENDOR_INTEL
-		return (u64 *)vcpu->vmx_vaddr_ept_p_tables;
+	return (u64 *)vcpu->npt_vaddr_pts;
 }
 
 //get level-2 page map address
 u64 * xmhf_memprot_arch_get_lvl2_pagemap_address(VCPU *vcpu){
-	HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD || vcpu->cpu_vendor == CPU_VENDOR_INTEL);
+	//EPT PD tables are allocated on demand, so there is no flat array on Intel
+	HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD);
 
-	if (vcpu->cpu_vendor == CPU_VENDOR_AMD)
-		return (u64 *)vcpu->npt_vaddr_pdts;
-	else //CPU_VENDOR_INTEL
-		return (u64 *)vcpu->vmx_vaddr_ept_pd_tables;
+	return (u64 *)vcpu->npt_vaddr_pdts;
 }
 
 //get level-3 page map address
@@ -112,13 +108,38 @@ u64 * xmhf_memprot_arch_get_default_root_pagemap_address(VCPU *vcpu){
 
 //flush the TLB of all nested page tables in the current core
 void xmhf_memprot_arch_flushmappings_localtlb(VCPU *vcpu, u32 flags){
+	xmhf_memprot_arch_flushmappings_localtlb_range(vcpu, flags,
+												   MEMP_FLUSHTLB_GPA_LO_ALL,
+												   MEMP_FLUSHTLB_GPA_HI_ALL);
+}
+
+//flush the TLB of all nested page tables in the current core, only entries for
+//guest physical addresses in [gpa_lo, gpa_hi) changed
+void xmhf_memprot_arch_flushmappings_localtlb_range(VCPU *vcpu, u32 flags,
+													u64 gpa_lo, u64 gpa_hi){
 	HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD || vcpu->cpu_vendor == CPU_VENDOR_INTEL);
 
 	if(vcpu->cpu_vendor == CPU_VENDOR_AMD)
 		//xmhf_memprot_arch_x86svm_flushmappings(vcpu);
 		HALT_ON_ERRORCOND(0 && "flags not implemented");
 	else //CPU_VENDOR_INTEL
-		xmhf_memprot_arch_x86vmx_flushmappings_localtlb(vcpu, flags);
+		xmhf_memprot_arch_x86vmx_flushmappings_localtlb_range(vcpu, flags,
+															  gpa_lo, gpa_hi);
+}
+
+//flush the TLB of nested page tables in CPUs in cpus without quiesce. Not
+//implemented on AMD, configure rejects hypapps that need it on x86-svm.
+void xmhf_memprot_arch_flushmappings_shootdown(VCPU *vcpu,
+											   const memp_cpuset_t *cpus,
+											   u32 flags, u64 gpa_lo,
+											   u64 gpa_hi){
+	HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD || vcpu->cpu_vendor == CPU_VENDOR_INTEL);
+
+	if(vcpu->cpu_vendor == CPU_VENDOR_AMD)
+		HALT_ON_ERRORCOND(0 && "TLB shootdown not implemented");
+	else //CPU_VENDOR_INTEL
+		xmhf_smpguest_arch_x86vmx_tlb_shootdown(vcpu, cpus, flags, gpa_lo,
+												gpa_hi);
 }
 
 //set protection for a given physical memory address
@@ -156,6 +177,36 @@ u32 xmhf_memprot_arch_getprot(VCPU *vcpu, u64 gpa){
 		return xmhf_memprot_arch_x86vmx_getprot(vcpu, gpa);
 }
 
+//split large pages so that gpa is mapped by a 4K page
+void xmhf_memprot_arch_split_page(VCPU *vcpu, u64 gpa){
+	//invoke appropriate sub arch. backend
+	if(vcpu->cpu_vendor == CPU_VENDOR_AMD)
+		xmhf_memprot_arch_x86svm_split_page(vcpu, gpa);
+	else //CPU_VENDOR_INTEL
+		xmhf_memprot_arch_x86vmx_split_page(vcpu, gpa);
+}
+
+//merge page tables mapping [gpa_lo, gpa_hi) into large pages when possible
+void xmhf_memprot_arch_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi){
+	//invoke appropriate sub arch. backend
+	if(vcpu->cpu_vendor == CPU_VENDOR_AMD)
+		xmhf_memprot_arch_x86svm_coalesce_range(vcpu, gpa_lo, gpa_hi);
+	else //CPU_VENDOR_INTEL
+		xmhf_memprot_arch_x86vmx_coalesce_range(vcpu, gpa_lo, gpa_hi);
+}
+
+//bracket direct modifications to the nested page table. The NPT is not
+//shared between CPUs, so nothing needs to be done on AMD.
+void xmhf_memprot_arch_write_begin(VCPU *vcpu, bool lock){
+	if(vcpu->cpu_vendor == CPU_VENDOR_INTEL)
+		xmhf_memprot_arch_x86vmx_write_begin(vcpu, lock);
+}
+
+void xmhf_memprot_arch_write_end(VCPU *vcpu){
+	if(vcpu->cpu_vendor == CPU_VENDOR_INTEL)
+		xmhf_memprot_arch_x86vmx_write_end(vcpu);
+}
+
 // On 32bit machine, we always return 0 - 4G as the machine physical address range, no matter how many memory is installed
 // On 64-bit machine, the function queries the E820 map for the used memory region.
 bool xmhf_arch_get_machine_paddr_range(spa_t* machine_base_spa, spa_t* machine_limit_spa)
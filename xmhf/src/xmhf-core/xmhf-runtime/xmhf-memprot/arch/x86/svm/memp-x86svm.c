@@ -50,9 +50,24 @@
 
 #include <xmhf.h>
 
+//NPT uses PAE paging. All page tables are preallocated (npt_vaddr_pdts and
+//npt_vaddr_pts are flat arrays indexed by gpa >> 21 and gpa >> 12), but 2M
+//regions that map contiguous addresses with the same flags use 2M pages.
+//When the protection of a 4K page in such a region changes, the 2M page is
+//split back into its page table, and merged again when possible.
+
+//bits of a 4K NPT entry other than the address
+#define NPT_FLAGS_MASK	(((u64)PAGE_SIZE_4K - 1) | _PAGE_NX)
+
+//bits set by hardware, ignored when merging 4K pages into a 2M page
+#define NPT_AD_MASK		((u64)(_PAGE_ACCESSED | _PAGE_DIRTY))
+
 //----------------------------------------------------------------------
 // local (static) support function forward declarations
 static void _svm_nptinitialize(hva_t npt_pdpt_base, hva_t npt_pdts_base, hva_t npt_pts_base);
+static u64 *_svm_npt_get_pte(VCPU *vcpu, u64 gpa);
+static u64 _svm_npt_get_leaf(VCPU *vcpu, u64 gpa);
+static void _svm_npt_coalesce(VCPU *vcpu, u64 gpa);
 
 //======================================================================
 // global interfaces (functions) exported by this component
@@ -65,10 +80,18 @@ void xmhf_memprot_arch_x86svm_initialize(VCPU *vcpu){
 
 #ifndef __XMHF_VERIFICATION__
 	_svm_nptinitialize(vcpu->npt_vaddr_ptr, vcpu->npt_vaddr_pdts, vcpu->npt_vaddr_pts);
+	{
+		u64 gpa;
+		//use 2M pages where possible
+		for (gpa = 0; gpa < ADDR_4GB; gpa += PA_PAGE_SIZE_2M) {
+			_svm_npt_coalesce(vcpu, gpa);
+		}
+	}
 #endif
 	vmcb->n_cr3 = hva2spa((void*)vcpu->npt_vaddr_ptr);
 	vmcb->np_enable |= 1ULL;
 	vmcb->guest_asid = vcpu->npt_asid;
+	svm_vmcb_dirty(vmcb, VMCB_CLEAN_NP | VMCB_CLEAN_ASID);
 }
 
 //----------------------------------------------------------------------
@@ -117,6 +140,68 @@ static void _svm_nptinitialize(hva_t npt_pdpt_base, hva_t npt_pdts_base, hva_t n
 
 }
 
+//return the 4K NPT entry mapping gpa, splitting the 2M page containing gpa
+//into its page table if needed. Splitting does not change the translation,
+//so no TLB flush is needed.
+static u64 *_svm_npt_get_pte(VCPU *vcpu, u64 gpa){
+	u32 pfn = (u32)gpa / PAGE_SIZE_4K;
+	u32 pdi = pfn / PAE_PTRS_PER_PT;
+	u64 *pde = (u64 *)vcpu->npt_vaddr_pdts + pdi;
+	u64 *pt = (u64 *)vcpu->npt_vaddr_pts + pdi * PAE_PTRS_PER_PT;
+
+	if (*pde & _PAGE_PSE) {
+		u64 paddr = pae_get_addr_from_pde_big(*pde);
+		u64 flags = *pde & NPT_FLAGS_MASK & ~(_PAGE_PSE | NPT_AD_MASK);
+		u32 k;
+		for (k = 0; k < PAE_PTRS_PER_PT; k++) {
+			pt[k] = pae_make_pte(paddr + k * PA_PAGE_SIZE_4K, flags);
+		}
+		*pde = pae_make_pde(hva2spa(pt), (u64)(_PAGE_PRESENT | _PAGE_RW | _PAGE_USER));
+	}
+	return &pt[pfn % PAE_PTRS_PER_PT];
+}
+
+//return the NPT leaf mapping gpa (2M or 4K), as a 4K entry
+static u64 _svm_npt_get_leaf(VCPU *vcpu, u64 gpa){
+	u32 pfn = (u32)gpa / PAGE_SIZE_4K;
+	u32 pdi = pfn / PAE_PTRS_PER_PT;
+	u64 pde = ((u64 *)vcpu->npt_vaddr_pdts)[pdi];
+
+	if (pde & _PAGE_PSE) {
+		return pae_make_pte(pae_get_addr_from_pde_big(pde) +
+							(pfn % PAE_PTRS_PER_PT) * PA_PAGE_SIZE_4K,
+							pde & NPT_FLAGS_MASK & ~_PAGE_PSE);
+	}
+	return ((u64 *)vcpu->npt_vaddr_pts)[pfn];
+}
+
+//merge the page table of the 2M region containing gpa into a 2M page if its
+//entries map contiguous addresses with the same flags. The page table is
+//kept, so no TLB flush is needed.
+static void _svm_npt_coalesce(VCPU *vcpu, u64 gpa){
+	u32 pdi = (u32)gpa / PAGE_SIZE_2M;
+	u64 *pde = (u64 *)vcpu->npt_vaddr_pdts + pdi;
+	u64 *pt = (u64 *)vcpu->npt_vaddr_pts + pdi * PAE_PTRS_PER_PT;
+	u64 first = pt[0] & ~NPT_AD_MASK;
+	u32 k;
+
+	if (*pde & _PAGE_PSE) {
+		return;
+	}
+	//_PAGE_PSE in a PTE is the PAT bit, which moves to bit 12 in a 2M page
+	if ((pae_get_addr_from_pte(first) & (PA_PAGE_SIZE_2M - 1)) ||
+		(first & _PAGE_PSE)) {
+		return;
+	}
+	for (k = 1; k < PAE_PTRS_PER_PT; k++) {
+		if ((pt[k] & ~NPT_AD_MASK) != first + k * PA_PAGE_SIZE_4K) {
+			return;
+		}
+	}
+	*pde = pae_make_pde_big(pae_get_addr_from_pte(first),
+							pae_get_flags_from_pte(first) | _PAGE_PSE);
+}
+
 //flush hardware page table mappings (TLB)
 void xmhf_memprot_arch_x86svm_flushmappings(VCPU *vcpu){
 	((struct _svm_vmcbfields *)(vcpu->vmcb_vaddr_ptr))->tlb_control=VMCB_TLB_CONTROL_FLUSHALL;
@@ -124,7 +209,6 @@ void xmhf_memprot_arch_x86svm_flushmappings(VCPU *vcpu){
 
 //set protection for a given physical memory address
 void xmhf_memprot_arch_x86svm_setprot(VCPU *vcpu, u64 gpa, u32 prottype){
-  u32 pfn;
   u64 *pt;
   u64 flags=0;
 
@@ -145,9 +229,6 @@ void xmhf_memprot_arch_x86svm_setprot(VCPU *vcpu, u64 gpa, u32 prottype){
 	);
 #endif
 
-  pfn = (u32)gpa / PAGE_SIZE_4K;	//grab page frame number
-  pt = (u64 *)vcpu->npt_vaddr_pts;
-
   //default is not-present, read-only, no-execute
   flags = (u64)0x8000000000000000ULL;
 
@@ -162,16 +243,20 @@ void xmhf_memprot_arch_x86svm_setprot(VCPU *vcpu, u64 gpa, u32 prottype){
 		flags &= ~(u64)0x8000000000000000ULL; //execute
   }
 
-  pt[pfn] &= ~(u64)0x8000000000000003ULL; //clear all previous flags
-  pt[pfn] |= flags; 					  //set new flags
+  //nothing to do if already mapped with these flags, possibly by a 2M page
+  if((_svm_npt_get_leaf(vcpu, gpa) & 0x8000000000000003ULL) == flags)
+	return;
+
+  //split 2M page, set new flags, then merge back if possible
+  pt = _svm_npt_get_pte(vcpu, gpa);
+  *pt &= ~(u64)0x8000000000000003ULL; //clear all previous flags
+  *pt |= flags; 					  //set new flags
+  _svm_npt_coalesce(vcpu, gpa);
 }
 
 //get protection for a given physical memory address
 u32 xmhf_memprot_arch_x86svm_getprot(VCPU *vcpu, u64 gpa){
-  u32 pfn = (u32)gpa / PAGE_SIZE_4K;	//grab page frame number
-  u64 *pt = (u64 *)vcpu->npt_vaddr_pts;
-
-  u64 entry = pt[pfn];
+  u64 entry = _svm_npt_get_leaf(vcpu, gpa);
   u32 prottype;
 
   if(! (entry & 0x1) ){
@@ -194,6 +279,24 @@ u32 xmhf_memprot_arch_x86svm_getprot(VCPU *vcpu, u64 gpa){
   return prottype;
 }
 
+//split the NPT 2M page containing gpa so that gpa is mapped by a 4K page in
+//npt_vaddr_pts
+void xmhf_memprot_arch_x86svm_split_page(VCPU *vcpu, u64 gpa){
+  _svm_npt_get_pte(vcpu, gpa);
+}
+
+//merge NPT page tables mapping [gpa_lo, gpa_hi) into 2M pages when possible
+void xmhf_memprot_arch_x86svm_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi){
+  u64 gpa = gpa_lo & ~(PA_PAGE_SIZE_2M - 1);
+
+  if (gpa_hi > ADDR_4GB) {
+    gpa_hi = ADDR_4GB;
+  }
+  for (; gpa < gpa_hi; gpa += PA_PAGE_SIZE_2M) {
+    _svm_npt_coalesce(vcpu, gpa);
+  }
+}
+
 u64 xmhf_memprot_arch_x86svm_get_h_cr3(VCPU *vcpu)
 {
   HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD);
@@ -203,4 +306,5 @@ void xmhf_memprot_arch_x86svm_set_h_cr3(VCPU *vcpu, u64 n_cr3)
 {
   HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_AMD);
   ((struct _svm_vmcbfields*)vcpu->vmcb_vaddr_ptr)->n_cr3 = n_cr3;
+  svm_vmcb_dirty(vcpu->vmcb_vaddr_ptr, VMCB_CLEAN_NP);
 }
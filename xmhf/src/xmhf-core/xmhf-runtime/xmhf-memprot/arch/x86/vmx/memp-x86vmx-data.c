@@ -54,16 +54,9 @@
 
 //VMX EPT PML4 table buffers
 //memprot
-u8 g_vmx_ept_pml4_table_buffers[PAGE_SIZE_4K * P4L_NPLM4T * MAX_VCPU_ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
+u8 g_vmx_ept_pml4_table_buffers[PAGE_SIZE_4K * P4L_NPLM4T * VMX_EPT01_NCOPIES] __attribute__((aligned(PAGE_SIZE_4K)));
 
 //VMX EPT PDP table buffers
 //memprot
-u8 g_vmx_ept_pdp_table_buffers[PAGE_SIZE_4K * P4L_NPDPT * MAX_VCPU_ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
+u8 g_vmx_ept_pdp_table_buffers[PAGE_SIZE_4K * P4L_NPDPT * VMX_EPT01_NCOPIES] __attribute__((aligned(PAGE_SIZE_4K)));
 
-//VMX EPT PD table buffers
-//memprot
-u8 g_vmx_ept_pd_table_buffers[PAGE_SIZE_4K * P4L_NPDT * MAX_VCPU_ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
-
-//VMX EPT P table buffers
-//memprot
-u8 g_vmx_ept_p_table_buffers[PAGE_SIZE_4K * P4L_NPT * MAX_VCPU_ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
@@ -97,6 +97,40 @@
  *   lock.
  * * Bounded waiting: when there are too many writers, readers may starve.
  *   However this problem also exists if the writer quiesces the readers.
+ *
+ * Sequence lock mode (--enable-vmx-eptlock-seqlock):
+ *
+ * g_eptlock_write_pending is replaced by a sequence number g_eptlock_seq,
+ * which is odd when a writer is waiting / writing. The protocol between
+ * writers and memprot_x86vmx_eptlock_read_lock() is the same as above, but
+ * only the fences required by x86's memory ordering (store followed by load
+ * of another variable) are kept.
+ *
+ * In addition, a reader whose critical section only reads memory (e.g.
+ * translating an address using EPT) can use the lock-free fast path
+ * memprot_x86vmx_eptlock_read_begin() and memprot_x86vmx_eptlock_read_retry():
+ *
+ *   do {
+ *     seq = memprot_x86vmx_eptlock_read_begin(vcpu);
+ *     ... read EPT ...
+ *   } while (memprot_x86vmx_eptlock_read_retry(vcpu, seq));
+ *
+ * The fast path does not write shared memory, so writers never wait for it.
+ * If a writer starts or finishes during the critical section, the sequence
+ * number changes and the reader retries. The result of the last try is
+ * computed while no writer is active. Critical sections that write guest
+ * memory cannot be retried and must use memprot_x86vmx_eptlock_read_lock().
+ *
+ * In the default mode, the fast path is implemented using
+ * memprot_x86vmx_eptlock_read_lock() and never retries.
+ *
+ * Generation number:
+ *
+ * g_eptlock_generation is incremented by every writer before releasing the
+ * lock, and by memprot_x86vmx_eptlock_invalidate() after EPT01 changes made
+ * without the lock. Software caches of EPT translations (e.g. the guestmem TLB) record
+ * memprot_x86vmx_eptlock_generation() when filled, and are only used while
+ * holding the reader lock and the generation is unchanged.
  */
 
 /*
@@ -107,6 +141,111 @@
 /* Spin lock to make sure there are only 1 writer */
 static volatile u32 g_eptlock_write_lock = 1;
 
+/* Incremented after each write, see memprot_x86vmx_eptlock_generation() */
+static volatile u32 g_eptlock_generation = 0;
+
+#ifdef __VMX_EPTLOCK_SEQLOCK__
+
+/* Prevent the compiler from reordering memory accesses */
+#define eptlock_barrier() asm volatile("" ::: "memory")
+
+/* Sequence number, odd when a write is waiting / writing */
+static volatile u32 g_eptlock_seq = 0;
+
+/* Acquire writer lock (modify EPT entries) */
+void memprot_x86vmx_eptlock_write_lock(VCPU *vcpu)
+{
+	(void)vcpu;
+
+	/* Acquire spin lock to make sure there is only 1 writer */
+	spin_lock(&g_eptlock_write_lock);
+
+	/* Stop new readers from reading, make fast path readers retry */
+	HALT_ON_ERRORCOND(!(g_eptlock_seq & 1));
+	g_eptlock_seq++;
+	mb();
+
+	/* Wait for existing readers to complete */
+	for (u32 i = 0; i < g_midtable_numentries; i++) {
+		VCPU *other_vcpu = (VCPU *)g_midtable[i].vcpu_vaddr_ptr;
+		while (other_vcpu->vmx_eptlock_reading) {
+			xmhf_cpu_relax();
+		}
+	}
+	vcpu->vmx_eptlock_writing = true;
+	eptlock_barrier();
+}
+
+/* Release writer lock */
+void memprot_x86vmx_eptlock_write_unlock(VCPU *vcpu)
+{
+	eptlock_barrier();
+
+	/* Invalidate software caches of EPT, then allow new readers to start */
+	vcpu->vmx_eptlock_writing = false;
+	memprot_x86vmx_eptlock_invalidate();
+	HALT_ON_ERRORCOND(g_eptlock_seq & 1);
+	g_eptlock_seq++;
+
+	spin_unlock(&g_eptlock_write_lock);
+}
+
+/* Acquire reader lock (access EPT entries) */
+void memprot_x86vmx_eptlock_read_lock(VCPU *vcpu)
+{
+	HALT_ON_ERRORCOND(!vcpu->vmx_eptlock_reading);
+	while (1) {
+		/* When write in progress, wait without setting the flag */
+		while (g_eptlock_seq & 1) {
+			xmhf_cpu_relax();
+		}
+
+		/*
+		 * Set the current CPU as reading, then check for writers. The store
+		 * must be visible before the load, which needs a full fence.
+		 */
+		vcpu->vmx_eptlock_reading = true;
+		mb();
+		if (!(g_eptlock_seq & 1)) {
+			break;
+		}
+
+		/* Set the current CPU as not reading and retry */
+		vcpu->vmx_eptlock_reading = false;
+	}
+	eptlock_barrier();
+}
+
+/* Release reader lock */
+void memprot_x86vmx_eptlock_read_unlock(VCPU *vcpu)
+{
+	eptlock_barrier();
+	HALT_ON_ERRORCOND(vcpu->vmx_eptlock_reading);
+	vcpu->vmx_eptlock_reading = false;
+}
+
+/* Start a read-only critical section, return value is passed to retry */
+u32 memprot_x86vmx_eptlock_read_begin(VCPU *vcpu)
+{
+	u32 seq;
+	(void)vcpu;
+	while ((seq = g_eptlock_seq) & 1) {
+		xmhf_cpu_relax();
+	}
+	eptlock_barrier();
+	return seq;
+}
+
+/* End a read-only critical section, return true if it needs to be retried */
+bool memprot_x86vmx_eptlock_read_retry(VCPU *vcpu, u32 seq)
+{
+	(void)vcpu;
+	eptlock_barrier();
+	return g_eptlock_seq != seq;
+}
+
+#else							/* !__VMX_EPTLOCK_SEQLOCK__ */
+
 /* Global flag to indicate a write is waiting / writing */
 static volatile bool g_eptlock_write_pending = false;
 
@@ -130,16 +269,18 @@ void memprot_x86vmx_eptlock_write_lock(VCPU *vcpu)
 			xmhf_cpu_relax();
 		}
 	}
+	vcpu->vmx_eptlock_writing = true;
 	mb();
 }
 
 /* Release writer lock */
 void memprot_x86vmx_eptlock_write_unlock(VCPU *vcpu)
 {
-	(void)vcpu;
 	mb();
 
-	/* Allow new readers to start reading */
+	/* Invalidate software caches of EPT, then allow new readers to start */
+	vcpu->vmx_eptlock_writing = false;
+	memprot_x86vmx_eptlock_invalidate();
 	HALT_ON_ERRORCOND(g_eptlock_write_pending);
 	g_eptlock_write_pending = false;
 
@@ -188,3 +329,39 @@ void memprot_x86vmx_eptlock_read_unlock(VCPU *vcpu)
 	vcpu->vmx_eptlock_reading = false;
 	mb();
 }
+
+/* Start a read-only critical section, return value is passed to retry */
+u32 memprot_x86vmx_eptlock_read_begin(VCPU *vcpu)
+{
+	memprot_x86vmx_eptlock_read_lock(vcpu);
+	return 0;
+}
+
+/* End a read-only critical section, return true if it needs to be retried */
+bool memprot_x86vmx_eptlock_read_retry(VCPU *vcpu, u32 seq)
+{
+	(void)seq;
+	memprot_x86vmx_eptlock_read_unlock(vcpu);
+	return false;
+}
+
+#endif							/* __VMX_EPTLOCK_SEQLOCK__ */
+
+/*
+ * Return the number of writes to EPT so far. Caches of EPT translations
+ * filled in a reader critical section with the same generation are valid.
+ */
+u32 memprot_x86vmx_eptlock_generation(void)
+{
+	return g_eptlock_generation;
+}
+
+/*
+ * Invalidate software caches of EPT translations. Called by writers, and
+ * after changing EPT01 without the writer lock (e.g. while quiescing, or
+ * when EPT01 is not shared).
+ */
+void memprot_x86vmx_eptlock_invalidate(void)
+{
+	__sync_add_and_fetch(&g_eptlock_generation, 1);
+}
@@ -55,6 +55,7 @@
  * space:
  * * guestmem_init: initialize structures, call whenever CR3 / EPTP changes
  * * guestmem_copy_gv2h: copy from guest virtual to hypervisor
+ * * guestmem_checked_copy_gv2h: same as above, but return error if failed
  * * guestmem_copy_gp2h: copy from guest physical to hypervisor
  * * guestmem_copy_h2gv: copy from hypervisor to guest virtual
  * * guestmem_copy_h2gp: copy from hypervisor to guest physical
@@ -69,6 +70,8 @@
  * * guestmem_copy_gp2h: copy from guest physical to hypervisor
  * * guestmem_copy_h2gv: copy from hypervisor to guest virtual
  * * guestmem_copy_h2gp: copy from hypervisor to guest physical
+ * A CPU holding the writer lock (e.g. TrustVisor hypercalls while quiescing)
+ * does not take the reader lock, because other writers are already excluded.
  *
  * Currently the following functions have NOT implemented the locking logic
  * (their use callers have other ways to prevent this race condition):
@@ -76,6 +79,19 @@
  * * guestmem_gpa2spa_size: translate gpa to spa for some custom size
  *
  * See memp-x86vmx-eptlock.c for details about the race condition.
+ *
+ * The guestmem_copy_* functions translate addresses through a small per-VCPU
+ * software TLB (vcpu->vmx_guestmem_tlb). An entry is keyed by the page table
+ * walked (type and root, e.g. guest CR3), the EPT root, the 4K page, CPL and
+ * access type. An entry is valid only if both of the following are unchanged
+ * since it is filled:
+ * * vcpu->vmx_guestmem_tlb_gen, incremented by guestmem_tlb_invalidate().
+ * * memprot_x86vmx_eptlock_generation(), incremented by EPT01 changes.
+ *
+ * The guest can modify its page tables, write CR3 and execute INVLPG without
+ * a VMEXIT, so guestmem_tlb_invalidate() is called at every intercept. It is
+ * also called after INVEPT / INVVPID emulation and after XMHF writes to guest
+ * memory (which may contain page tables).
  */
 
 static hpt_pa_t guestmem_host_ctx_ptr2pa(void *vctx, void *ptr)
@@ -84,15 +100,6 @@ static hpt_pa_t guestmem_host_ctx_ptr2pa(void *vctx, void *ptr)
 	return hva2spa(ptr);
 }
 
-static void* guestmem_host_ctx_pa2ptr(void *vctx, hpt_pa_t spa, size_t sz, hpt_prot_t access_type, hptw_cpl_t cpl, size_t *avail_sz)
-{
-	(void)vctx;
-	(void)access_type;
-	(void)cpl;
-	*avail_sz = sz;
-	return spa2hva(spa);
-}
-
 static hpt_pa_t guestmem_guest_ctx_ptr2pa(void __attribute__((unused)) *ctx, void *ptr)
 {
 	return hva2gpa(ptr);
@@ -135,7 +142,7 @@ void guestmem_init(VCPU *vcpu, guestmem_hptw_ctx_pair_t *ctx_pair)
 		hpt_cr3_get_address(guest_t, vcpu->vmcs.guest_CR3);
 	ctx_pair->guest_ctx.t = guest_t;
 	ctx_pair->host_ctx.ptr2pa = guestmem_host_ctx_ptr2pa;
-	ctx_pair->host_ctx.pa2ptr = guestmem_host_ctx_pa2ptr;
+	ctx_pair->host_ctx.pa2ptr = hptw_identity_pa2ptr;
 	ctx_pair->host_ctx.gzp = guestmem_ctx_unimplemented;
 	ctx_pair->host_ctx.root_pa =
 		hpt_eptp_get_address(HPT_TYPE_EPT, vcpu->vmcs.control_EPT_pointer);
@@ -143,6 +150,139 @@ void guestmem_init(VCPU *vcpu, guestmem_hptw_ctx_pair_t *ctx_pair)
 	ctx_pair->vcpu = vcpu;
 }
 
+/* Invalidate all entries in the guestmem software TLB of vcpu */
+void guestmem_tlb_invalidate(VCPU *vcpu)
+{
+	vcpu->vmx_guestmem_tlb_gen++;
+	vcpu->vmx_guestmem_tlb_invalidations++;
+}
+
+/* Print statistics of the guestmem software TLB of vcpu */
+void guestmem_tlb_print_stats(VCPU *vcpu)
+{
+	printf("CPU(0x%02x): guestmem TLB: hit=%llu miss=%llu invalidate=%llu\n",
+		   vcpu->id, vcpu->vmx_guestmem_tlb_hits,
+		   vcpu->vmx_guestmem_tlb_misses,
+		   vcpu->vmx_guestmem_tlb_invalidations);
+}
+
+/*
+ * Same as hptw_checked_access_va(), but look up the guestmem software TLB
+ * first. ctx is a member of ctx_pair. Must hold the EPT reader lock.
+ */
+static void *guestmem_tlb_access_va(guestmem_hptw_ctx_pair_t *ctx_pair,
+									hptw_ctx_t *ctx, hpt_prot_t access_type,
+									hptw_cpl_t cpl, hpt_va_t va,
+									size_t requested_sz, size_t *avail_sz)
+{
+	VCPU *vcpu = ctx_pair->vcpu;
+	hpt_va_t page = va & ~((hpt_va_t)PAGE_SIZE_4K - 1);
+	size_t offset = va - page;
+	u32 ept_gen = memprot_x86vmx_eptlock_generation();
+	guestmem_tlb_entry_t *entry;
+	size_t page_sz;
+	void *ptr;
+
+	entry = &vcpu->vmx_guestmem_tlb[(page >> PAGE_SHIFT_4K) &
+									(VMX_GUESTMEM_TLB_SIZE - 1)];
+	if (entry->valid && entry->vcpu_gen == vcpu->vmx_guestmem_tlb_gen &&
+		entry->ept_gen == ept_gen && entry->va == page &&
+		entry->root_pa == ctx->root_pa &&
+		entry->eptp_pa == ctx_pair->host_ctx.root_pa &&
+		entry->t == ctx->t && entry->cpl == cpl &&
+		entry->access_type == access_type) {
+		vcpu->vmx_guestmem_tlb_hits++;
+		*avail_sz = MIN(requested_sz, PAGE_SIZE_4K - offset);
+		return (void *)(entry->hva + offset);
+	}
+
+	vcpu->vmx_guestmem_tlb_misses++;
+	ptr = hptw_checked_access_va(ctx, access_type, cpl, page, PAGE_SIZE_4K,
+								 &page_sz);
+	if (ptr == NULL || page_sz != PAGE_SIZE_4K) {
+		/* Not cacheable (e.g. invalid access), let hptw handle it */
+		return hptw_checked_access_va(ctx, access_type, cpl, va, requested_sz,
+									  avail_sz);
+	}
+	entry->valid = true;
+	entry->t = ctx->t;
+	entry->cpl = cpl;
+	entry->access_type = access_type;
+	entry->ept_gen = ept_gen;
+	entry->vcpu_gen = vcpu->vmx_guestmem_tlb_gen;
+	entry->root_pa = ctx->root_pa;
+	entry->eptp_pa = ctx_pair->host_ctx.root_pa;
+	entry->va = page;
+	entry->hva = (hva_t)ptr;
+	*avail_sz = MIN(requested_sz, PAGE_SIZE_4K - offset);
+	return ptr + offset;
+}
+
+/*
+ * Same as hptw_checked_copy_from_va(), but use the guestmem software TLB.
+ * Return 0 if successful, 1 if failed.
+ */
+static int guestmem_tlb_copy_from_va(guestmem_hptw_ctx_pair_t *ctx_pair,
+									 hptw_ctx_t *ctx, hptw_cpl_t cpl,
+									 void *dst, hpt_va_t src_va_base,
+									 size_t len)
+{
+	size_t copied = 0;
+	while (copied < len) {
+		size_t to_copy;
+		void *src = guestmem_tlb_access_va(ctx_pair, ctx, HPT_PROTS_R, cpl,
+										   src_va_base + copied, len - copied,
+										   &to_copy);
+		if (!src) {
+			return 1;
+		}
+		memcpy(dst + copied, src, to_copy);
+		copied += to_copy;
+	}
+	return 0;
+}
+
+/*
+ * Same as hptw_checked_copy_to_va(), but use the guestmem software TLB. The
+ * TLB is invalidated afterwards because the guest memory written may contain
+ * page tables. Return 0 if successful, 1 if failed.
+ */
+static int guestmem_tlb_copy_to_va(guestmem_hptw_ctx_pair_t *ctx_pair,
+								   hptw_ctx_t *ctx, hptw_cpl_t cpl,
+								   hpt_va_t dst_va_base, void *src, size_t len)
+{
+	size_t copied = 0;
+	while (copied < len) {
+		size_t to_copy;
+		void *dst = guestmem_tlb_access_va(ctx_pair, ctx, HPT_PROTS_W, cpl,
+										   dst_va_base + copied, len - copied,
+										   &to_copy);
+		if (!dst) {
+			return 1;
+		}
+		memcpy(dst, src + copied, to_copy);
+		copied += to_copy;
+	}
+	guestmem_tlb_invalidate(ctx_pair->vcpu);
+	return 0;
+}
+
+/* Acquire the EPT reader lock, unless the current CPU is the writer */
+static void guestmem_read_lock(VCPU *vcpu)
+{
+	if (!vcpu->vmx_eptlock_writing) {
+		memprot_x86vmx_eptlock_read_lock(vcpu);
+	}
+}
+
+/* Release the lock acquired by guestmem_read_lock() */
+static void guestmem_read_unlock(VCPU *vcpu)
+{
+	if (!vcpu->vmx_eptlock_writing) {
+		memprot_x86vmx_eptlock_read_unlock(vcpu);
+	}
+}
+
 /*
  * Copy from dst (guest virtual address) to src (hypervisor address).
  * This function uses memprot_x86vmx_eptlock_read_lock() to prevent race
@@ -150,11 +290,25 @@ void guestmem_init(VCPU *vcpu, guestmem_hptw_ctx_pair_t *ctx_pair)
  */
 void guestmem_copy_gv2h(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
 						void *dst, hpt_va_t src, size_t len)
+{
+	HALT_ON_ERRORCOND(guestmem_checked_copy_gv2h(ctx_pair, cpl, dst, src,
+												 len) == 0);
+}
+
+/*
+ * Same as guestmem_copy_gv2h(), but return 1 instead of halting if the guest
+ * address is invalid (e.g. not mapped). Return 0 if successful.
+ */
+int guestmem_checked_copy_gv2h(guestmem_hptw_ctx_pair_t *ctx_pair,
+							   hptw_cpl_t cpl, void *dst, hpt_va_t src,
+							   size_t len)
 {
 	hptw_ctx_t *ctx = &ctx_pair->guest_ctx;
-	memprot_x86vmx_eptlock_read_lock(ctx_pair->vcpu);
-	HALT_ON_ERRORCOND(hptw_checked_copy_from_va(ctx, cpl, dst, src, len) == 0);
-	memprot_x86vmx_eptlock_read_unlock(ctx_pair->vcpu);
+	int ret;
+	guestmem_read_lock(ctx_pair->vcpu);
+	ret = guestmem_tlb_copy_from_va(ctx_pair, ctx, cpl, dst, src, len);
+	guestmem_read_unlock(ctx_pair->vcpu);
+	return ret;
 }
 
 /*
@@ -166,9 +320,10 @@ void guestmem_copy_gp2h(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
 						void *dst, hpt_va_t src, size_t len)
 {
 	hptw_ctx_t *ctx = &ctx_pair->host_ctx;
-	memprot_x86vmx_eptlock_read_lock(ctx_pair->vcpu);
-	HALT_ON_ERRORCOND(hptw_checked_copy_from_va(ctx, cpl, dst, src, len) == 0);
-	memprot_x86vmx_eptlock_read_unlock(ctx_pair->vcpu);
+	guestmem_read_lock(ctx_pair->vcpu);
+	HALT_ON_ERRORCOND(guestmem_tlb_copy_from_va(ctx_pair, ctx, cpl, dst, src,
+												len) == 0);
+	guestmem_read_unlock(ctx_pair->vcpu);
 }
 
 /*
@@ -180,9 +335,10 @@ void guestmem_copy_h2gv(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
 						hpt_va_t dst, void *src, size_t len)
 {
 	hptw_ctx_t *ctx = &ctx_pair->guest_ctx;
-	memprot_x86vmx_eptlock_read_lock(ctx_pair->vcpu);
-	HALT_ON_ERRORCOND(hptw_checked_copy_to_va(ctx, cpl, dst, src, len) == 0);
-	memprot_x86vmx_eptlock_read_unlock(ctx_pair->vcpu);
+	guestmem_read_lock(ctx_pair->vcpu);
+	HALT_ON_ERRORCOND(guestmem_tlb_copy_to_va(ctx_pair, ctx, cpl, dst, src,
+											  len) == 0);
+	guestmem_read_unlock(ctx_pair->vcpu);
 }
 
 /*
@@ -194,9 +350,10 @@ void guestmem_copy_h2gp(guestmem_hptw_ctx_pair_t *ctx_pair, hptw_cpl_t cpl,
 						hpt_va_t dst, void *src, size_t len)
 {
 	hptw_ctx_t *ctx = &ctx_pair->host_ctx;
-	memprot_x86vmx_eptlock_read_lock(ctx_pair->vcpu);
-	HALT_ON_ERRORCOND(hptw_checked_copy_to_va(ctx, cpl, dst, src, len) == 0);
-	memprot_x86vmx_eptlock_read_unlock(ctx_pair->vcpu);
+	guestmem_read_lock(ctx_pair->vcpu);
+	HALT_ON_ERRORCOND(guestmem_tlb_copy_to_va(ctx_pair, ctx, cpl, dst, src,
+											  len) == 0);
+	guestmem_read_unlock(ctx_pair->vcpu);
 }
 
 /*
@@ -71,10 +71,45 @@ struct _fixed_mtrr_prop_t {
 	{IA32_MTRR_FIX4K_F8000, 0x000F8000, 0x00001000, 0x00100000},
 };
 
+//----------------------------------------------------------------------
+// EPT01 entry format
+//
+// PML4 and PDP tables are static (g_vmx_ept_*_buffers). PD and P tables are
+// allocated on demand from the page cache of the CPU. Leaves are 1G (level 3),
+// 2M (level 2) or 4K (level 1), and always identity map their range. Large
+// page leaves keep the address, memory type and large page bit even when not
+// present, so that they can be split without losing information.
+#define EPT01_PROT_MASK		0x7ULL		/* read, write, execute */
+#define EPT01_MEMTYPE_MASK	0x38ULL		/* memory type of leaf */
+#define EPT01_LARGE			0x80ULL		/* leaf at level 2 or 3 */
+#define EPT01_TABLE_FLAGS	0x7ULL		/* flags of non-leaf entries */
+#define EPT01_NENTRIES		512
+
+/* Size of the range mapped by an entry at level lvl */
+#define EPT01_LVL_SPAN(lvl)	(1ULL << (PAGE_SHIFT_4K + 9 * ((lvl) - 1)))
+/* Index of the entry at level lvl for gpa */
+#define EPT01_LVL_INDEX(gpa, lvl) \
+	((u32)((gpa) >> (PAGE_SHIFT_4K + 9 * ((lvl) - 1))) & (EPT01_NENTRIES - 1))
+
+/*
+ * Incremented after a PD or P table is removed from EPT01. A CPU saves the
+ * value read before each INVEPT in vcpu->vmx_ept01_flushed_epoch, so a table
+ * retired at epoch E can be freed once every CPU's flushed epoch reaches E.
+ */
+static volatile u32 g_vmx_ept01_epoch;
+
+#ifdef __VMX_SHARED_EPT__
+/* Largest page size in the shared EPT01, 0 if not built yet */
+static u32 g_vmx_ept01_shared_lvl;
+
+/* Number of CPUs with vcpu->vmx_ept01_overlay_count != 0 */
+static volatile u32 g_vmx_ept01_overlays;
+#endif /* __VMX_SHARED_EPT__ */
+
 //----------------------------------------------------------------------
 // local (static) support function forward declarations
 static void _vmx_gathermemorytypes(VCPU *vcpu);
-static u32 _vmx_getmemorytypeforphysicalpage(VCPU *vcpu, u64 pagebaseaddr);
+static u32 _vmx_getmemorytypeforrange(VCPU *vcpu, u64 base, u64 size);
 static void _vmx_setupEPT(VCPU *vcpu);
 
 //======================================================================
@@ -236,7 +271,7 @@ static void _vmx_gathermemorytypes(VCPU *vcpu){
 	}
 }
 
-//---get memory type for a given physical page address--------------------------
+//---get memory type for a given physical address range-------------------------
 //
 //11.11.4.1 MTRR Precedences
 //  0. if MTRRs are not enabled --> MTRR_TYPE_UC
@@ -250,20 +285,31 @@ static void _vmx_gathermemorytypes(VCPU *vcpu){
      //else
        // return default memory type
 //
-static u32 _vmx_getmemorytypeforphysicalpage(VCPU *vcpu, u64 pagebaseaddr){
+// The range [base, base + size) must be naturally aligned, and size must be
+// a power of 2 and at least 4K. If pages in the range have different memory
+// types, MTRR_TYPE_RESV is returned.
+//
+static u32 _vmx_getmemorytypeforrange(VCPU *vcpu, u64 base, u64 size){
 	u32 prev_type = MTRR_TYPE_RESV;
     u32 i = 0;
 
+	HALT_ON_ERRORCOND(size >= PA_PAGE_SIZE_4K && (size & (size - 1)) == 0);
+	HALT_ON_ERRORCOND((base & (size - 1)) == 0);
+
 	/* If MTRRs not enabled, return UC */
 	if (!vcpu->vmx_ept_mtrr_enable) {
 		return MTRR_TYPE_UC;
 	}
 	/* If fixed MTRRs are enabled, and addr < 1M, use them */
-	if (pagebaseaddr < 0x100000ULL && vcpu->vmx_ept_fixmtrr_enable) {
+	if (base < 0x100000ULL && vcpu->vmx_ept_fixmtrr_enable) {
+		/* Fixed MTRRs can have a different type for each 4K page */
+		if (size != PA_PAGE_SIZE_4K) {
+			return MTRR_TYPE_RESV;
+		}
 		for (i = 0; i < NUM_FIXED_MTRRS; i++) {
 			struct _fixed_mtrr_prop_t *prop = &fixed_mtrr_prop[i];
-			if (pagebaseaddr < prop->end) {
-				u32 index = (prop->start - pagebaseaddr) / prop->step;
+			if (base < prop->end) {
+				u32 index = (base - prop->start) / prop->step;
 				u64 msrval = vcpu->vmx_guestmtrrmsrs.fix_mtrrs[i];
 				return (u8) (msrval >> (index * 8));
 			}
@@ -275,19 +321,23 @@ static u32 _vmx_getmemorytypeforphysicalpage(VCPU *vcpu, u64 pagebaseaddr){
 	}
 	/* Compute variable MTRRs */
 	for (i = 0; i < vcpu->vmx_guestmtrrmsrs.var_count; i++) {
-		u64 base = vcpu->vmx_guestmtrrmsrs.var_mtrrs[i].base;
-		u64 mask = vcpu->vmx_guestmtrrmsrs.var_mtrrs[i].mask;
-		u32 cur_type = base & 0xFFU;
+		u64 mtrr_base = vcpu->vmx_guestmtrrmsrs.var_mtrrs[i].base;
+		u64 mtrr_mask = vcpu->vmx_guestmtrrmsrs.var_mtrrs[i].mask;
+		u32 cur_type = mtrr_base & 0xFFU;
 		/* Check valid bit */
-		if (!(mask & (1ULL << 11))) {
+		if (!(mtrr_mask & (1ULL << 11))) {
 			continue;
 		}
-		/* Clear lower bits, test whether address in range */
-		base &= ~0xFFFULL;
-		mask &= ~0xFFFULL;
-		if ((pagebaseaddr & mask) != (base & mask)) {
+		/* Clear lower bits, test whether range overlaps with MTRR */
+		mtrr_base &= ~0xFFFULL;
+		mtrr_mask &= ~0xFFFULL;
+		if (((base ^ mtrr_base) & mtrr_mask & ~(size - 1)) != 0) {
 			continue;
 		}
+		/* MTRR only covers part of the range */
+		if ((mtrr_mask & (size - 1)) != 0) {
+			return MTRR_TYPE_RESV;
+		}
 		/* Check for conflict resolutions: UC + * = UC; WB + WT = WT */
 		if (prev_type == MTRR_TYPE_RESV || prev_type == cur_type) {
 			prev_type = cur_type;
@@ -309,59 +359,480 @@ static u32 _vmx_getmemorytypeforphysicalpage(VCPU *vcpu, u64 pagebaseaddr){
 	return prev_type;
 }
 
+//---EPT01 page table management-----------------------------------------------
+
+/* Allocate a page for an EPT01 PD or P table, contents not initialized */
+static u64 *_vmx_ept01_alloc_table(VCPU *vcpu){
+	u64 *table = (u64 *)xmhf_mm_pcpu_alloc_page(vcpu->idx);
+	if (table == NULL) {
+		printf("CPU(0x%02x): Out of memory for EPT page tables, HALT!\n",
+				vcpu->id);
+		HALT();
+	}
+	return table;
+}
+
+/* Return the table pointed to by a non-leaf EPT01 entry */
+static u64 *_vmx_ept01_entry_table(VCPU *vcpu, u64 entry){
+	return (u64 *)spa2hva(entry & vcpu->vmx_ept_paddrmask);
+}
+
+/*
+ * Free PD and P tables retired by this CPU if all CPUs have executed INVEPT
+ * after they are retired (i.e. no paging-structure cache refers to them).
+ * Return whether there is room to retire another table.
+ */
+static bool _vmx_ept01_reclaim(VCPU *vcpu){
+	u32 i;
+
+	if (vcpu->vmx_ept01_retired_count == 0) {
+		return true;
+	}
+	for (i = 0; i < g_midtable_numentries; i++) {
+		VCPU *v = (VCPU *)g_midtable[i].vcpu_vaddr_ptr;
+		if ((s32)(v->vmx_ept01_flushed_epoch -
+				  vcpu->vmx_ept01_retired_epoch) < 0) {
+			return vcpu->vmx_ept01_retired_count < VMX_EPT01_RETIRED_MAX;
+		}
+	}
+	for (i = 0; i < vcpu->vmx_ept01_retired_count; i++) {
+		xmhf_mm_pcpu_free_page(vcpu->idx, (void *)vcpu->vmx_ept01_retired[i]);
+	}
+	vcpu->vmx_ept01_retired_count = 0;
+	return true;
+}
+
+/* Retire a PD or P table that has just been removed from EPT01 */
+static void _vmx_ept01_retire(VCPU *vcpu, u64 *table){
+	HALT_ON_ERRORCOND(vcpu->vmx_ept01_retired_count < VMX_EPT01_RETIRED_MAX);
+	vcpu->vmx_ept01_retired[vcpu->vmx_ept01_retired_count++] = (hva_t)table;
+	vcpu->vmx_ept01_retired_epoch = __sync_add_and_fetch(&g_vmx_ept01_epoch, 1);
+}
+
+/*
+ * Compute the identity mapped leaf at level lvl for [addr, addr + span). Return
+ * false if the range cannot be mapped by one leaf, because the page size is
+ * not supported, or the memory type or the presence is not uniform.
+ */
+static bool _vmx_ept01_make_leaf(VCPU *vcpu, u64 addr, u32 lvl, u64 *leaf){
+	u64 span = EPT01_LVL_SPAN(lvl);
+	u64 hole_lo = (u64)rpb->XtVmmRuntimePhysBase - PA_PAGE_SIZE_2M;
+	u64 hole_hi = (u64)rpb->XtVmmRuntimePhysBase + rpb->XtVmmRuntimeSize;
+	u64 memorytype;
+	u64 lower;
+
+	if (lvl > vcpu->vmx_ept01_max_leaf_lvl || addr + span > MAX_PHYS_ADDR) {
+		return false;
+	}
+	if (addr >= hole_lo && addr + span <= hole_hi) {
+		lower = 0x0;	/* not present */
+	} else if (addr + span <= hole_lo || addr >= hole_hi) {
+		lower = 0x7;	/* present */
+	} else {
+		return false;
+	}
+	memorytype = _vmx_getmemorytypeforrange(vcpu, addr, span);
+	if (memorytype == MTRR_TYPE_RESV) {
+		return false;
+	}
+	/*
+	 * For memorytype equal to 0 (UC), 1 (WC), 4 (WT), 5 (WP), 6 (WB),
+	 * MTRR memory type and EPT memory type are the same encoding.
+	 * Currently other encodings are reserved.
+	 */
+	HALT_ON_ERRORCOND(memorytype == 0 || memorytype == 1 ||
+						memorytype == 4 || memorytype == 5 ||
+						memorytype == 6);
+	*leaf = addr | (memorytype << 3) | lower;
+	if (lvl > 1) {
+		*leaf |= EPT01_LARGE;
+	}
+	return true;
+}
+
+/*
+ * Fill table at level lvl mapping [base, base + 512 * span), using the
+ * largest pages possible. Entries at or above MAX_PHYS_ADDR are not present.
+ */
+static void _vmx_ept01_fill(VCPU *vcpu, u64 *table, u32 lvl, u64 base){
+	u64 span = EPT01_LVL_SPAN(lvl);
+	u32 i;
+
+	for (i = 0; i < EPT01_NENTRIES; i++) {
+		u64 addr = base + i * span;
+		u64 leaf;
+		if (addr >= MAX_PHYS_ADDR) {
+			table[i] = 0;
+		} else if (_vmx_ept01_make_leaf(vcpu, addr, lvl, &leaf)) {
+			table[i] = leaf;
+		} else {
+			u64 *child = _vmx_ept01_alloc_table(vcpu);
+			HALT_ON_ERRORCOND(lvl > 1);
+			_vmx_ept01_fill(vcpu, child, lvl - 1, addr);
+			table[i] = hva2spa(child) | EPT01_TABLE_FLAGS;
+		}
+	}
+}
+
+/*
+ * Walk EPT01 for gpa. Return the leaf entry or the first non-present entry,
+ * and its level in *lvl. If path is not NULL, path[l] is set to the entry at
+ * each level l visited.
+ */
+static u64 *_vmx_ept01_walk(VCPU *vcpu, u64 gpa, u32 *lvl, u64 **path){
+	u64 *table = (u64 *)vcpu->vmx_vaddr_ept_pml4_table;
+	u32 l;
+
+	for (l = 4; ; l--) {
+		u64 *entry = &table[EPT01_LVL_INDEX(gpa, l)];
+		if (path != NULL) {
+			path[l] = entry;
+		}
+		if (l == 1 || (*entry & EPT01_LARGE) ||
+			(*entry & EPT01_PROT_MASK) == 0) {
+			*lvl = l;
+			return entry;
+		}
+		table = _vmx_ept01_entry_table(vcpu, *entry);
+	}
+}
+
+/*
+ * Replace large page leaf *entry at level lvl with a table mapping the same
+ * range with the same attributes. Translations do not change, so no TLB flush
+ * is needed.
+ */
+static void _vmx_ept01_split(VCPU *vcpu, u64 *entry, u32 lvl){
+	u64 span = EPT01_LVL_SPAN(lvl - 1);
+	u64 leaf = *entry;
+	u64 *table;
+	u32 i;
+
+	HALT_ON_ERRORCOND(lvl > 1 && (leaf & EPT01_LARGE));
+	table = _vmx_ept01_alloc_table(vcpu);
+	if (lvl == 2) {
+		leaf &= ~EPT01_LARGE;
+	}
+	for (i = 0; i < EPT01_NENTRIES; i++) {
+		table[i] = leaf + i * span;
+	}
+	*entry = hva2spa(table) | EPT01_TABLE_FLAGS;
+}
+
+/* Return the 4K EPT01 leaf for gpa, splitting large pages as needed */
+static u64 *_vmx_ept01_get_pte(VCPU *vcpu, u64 gpa){
+	HALT_ON_ERRORCOND(gpa < MAX_PHYS_ADDR);
+	while (1) {
+		u32 lvl;
+		u64 *entry = _vmx_ept01_walk(vcpu, gpa, &lvl, NULL);
+		if (lvl == 1) {
+			return entry;
+		}
+		_vmx_ept01_split(vcpu, entry, lvl);
+	}
+}
+
+/*
+ * If the table at level lvl pointed to by *entry maps a contiguous, aligned
+ * range with identical attributes, replace it with a large page leaf and
+ * retire it. Comparison starts at index hint, which is most likely to differ.
+ * Return whether the table is merged.
+ */
+static bool _vmx_ept01_merge(VCPU *vcpu, u64 *entry, u32 lvl, u32 hint){
+	u64 *table = _vmx_ept01_entry_table(vcpu, *entry);
+	u64 span = EPT01_LVL_SPAN(lvl);
+	u64 first = table[0];
+	u32 i, n;
+
+	if (lvl + 1 > vcpu->vmx_ept01_max_leaf_lvl) {
+		return false;
+	}
+	if (lvl > 1 && !(first & EPT01_LARGE)) {
+		return false;
+	}
+	if ((first & vcpu->vmx_ept_paddrmask & (EPT01_LVL_SPAN(lvl + 1) - 1)) != 0) {
+		return false;
+	}
+	for (n = 0, i = hint; n < EPT01_NENTRIES; n++, i = (i + 1) % EPT01_NENTRIES) {
+		if (table[i] != first + i * span) {
+			return false;
+		}
+	}
+	/* If too many tables are waiting to be freed, keep the table */
+	if (!_vmx_ept01_reclaim(vcpu)) {
+		return false;
+	}
+	*entry = first | EPT01_LARGE;
+	_vmx_ept01_retire(vcpu, table);
+	return true;
+}
+
+/*
+ * Merge the tables containing gpa into large pages, bottom up. Return the
+ * level of the leaf mapping gpa afterwards.
+ */
+static u32 _vmx_ept01_coalesce(VCPU *vcpu, u64 gpa){
+	u64 *path[5];
+	u32 lvl;
+
+	_vmx_ept01_walk(vcpu, gpa, &lvl, path);
+	while (lvl < 3 &&
+		   _vmx_ept01_merge(vcpu, path[lvl + 1], lvl, EPT01_LVL_INDEX(gpa, lvl))) {
+		lvl++;
+	}
+	return lvl;
+}
+
+//---shared EPT01---------------------------------------------------------------
+//
+// With --enable-vmx-shared-ept, all CPUs point EPTP to the same EPT01, so
+// protection changes are made once. Changes are serialized by
+// memprot_x86vmx_eptlock_write_lock() (also excluding software EPT walks), and
+// the caller needs to flush EPT TLB on all CPUs instead of only the current
+// CPU. A CPU that needs to map a few 4K pages differently (LAPIC during SIPI
+// interception) uses a private copy of the path to these pages (overlay),
+// which is rebuilt whenever the shared EPT01 changes.
+
+#ifdef __VMX_SHARED_EPT__
+/*
+ * Rebuild the overlay of v from the shared EPT01: copy the tables on the path
+ * to the 2M page containing the overridden entries (or split the large page
+ * mapping it), link the private tables and apply the overrides. Entries are
+ * written one at a time because v may be running the guest.
+ */
+static void _vmx_ept01_overlay_build(VCPU *v){
+	u64 gpa = v->vmx_ept01_overlay_gpa[0];
+	u64 *src = (u64 *)v->vmx_vaddr_ept_pml4_table;
+	u64 large = 0;
+	u32 lvl, i, j;
+
+	for (lvl = 4; lvl > 0; lvl--) {
+		u64 *dst = (u64 *)v->vmx_ept01_overlay[lvl];
+		u32 index = EPT01_LVL_INDEX(gpa, lvl);
+		u64 next = 0;
+		for (i = 0; i < EPT01_NENTRIES; i++) {
+			u64 entry = src ? src[i] : large + i * EPT01_LVL_SPAN(lvl);
+			if (lvl > 1 && i == index) {
+				next = entry;
+				entry = hva2spa((void *)v->vmx_ept01_overlay[lvl - 1]) |
+						EPT01_TABLE_FLAGS;
+			}
+			for (j = 0; lvl == 1 && j < v->vmx_ept01_overlay_count; j++) {
+				if (EPT01_LVL_INDEX(v->vmx_ept01_overlay_gpa[j], 1) == i) {
+					entry = v->vmx_ept01_overlay_value[j];
+				}
+			}
+			dst[i] = entry;
+		}
+		if (lvl > 1 && (next & EPT01_LARGE)) {
+			src = NULL;
+			large = (lvl == 2) ? (next & ~EPT01_LARGE) : next;
+		} else if (lvl > 1) {
+			src = _vmx_ept01_entry_table(v, next);
+		}
+	}
+}
+
+/* Override the 4K EPT01 entry of gpa with value for the current CPU only */
+static void _vmx_ept01_overlay_set(VCPU *vcpu, u64 gpa, u64 value){
+	u32 n = vcpu->vmx_ept01_overlay_count;
+	u32 i;
+
+	HALT_ON_ERRORCOND(gpa < MAX_PHYS_ADDR && PA_PAGE_ALIGNED_4K(gpa));
+	for (i = 0; i < n; i++) {
+		if (vcpu->vmx_ept01_overlay_gpa[i] == gpa) {
+			vcpu->vmx_ept01_overlay_value[i] = value;
+			return;
+		}
+	}
+	if (n == 0) {
+		for (i = 1; i <= 4; i++) {
+			if (vcpu->vmx_ept01_overlay[i] == 0) {
+				vcpu->vmx_ept01_overlay[i] = (hva_t)_vmx_ept01_alloc_table(vcpu);
+			}
+		}
+		g_vmx_ept01_overlays++;
+		vcpu->vmcs.control_EPT_pointer =
+			(vcpu->vmcs.control_EPT_pointer & 0xFFFULL) |
+			hva2spa((void *)vcpu->vmx_ept01_overlay[4]);
+	} else {
+		/* All overridden entries must be in the same P table */
+		HALT_ON_ERRORCOND(((gpa ^ vcpu->vmx_ept01_overlay_gpa[0]) &
+						   ~(PA_PAGE_SIZE_2M - 1)) == 0);
+		HALT_ON_ERRORCOND(n < VMX_EPT01_OVERLAY_MAX);
+	}
+	vcpu->vmx_ept01_overlay_gpa[n] = gpa;
+	vcpu->vmx_ept01_overlay_value[n] = value;
+	vcpu->vmx_ept01_overlay_count = n + 1;
+}
+
+/* Remove the override of gpa, switch back to the shared EPT01 if none left */
+static void _vmx_ept01_overlay_reset(VCPU *vcpu, u64 gpa){
+	u32 n = vcpu->vmx_ept01_overlay_count;
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		if (vcpu->vmx_ept01_overlay_gpa[i] == gpa) {
+			break;
+		}
+	}
+	if (i == n) {
+		return;
+	}
+	vcpu->vmx_ept01_overlay_gpa[i] = vcpu->vmx_ept01_overlay_gpa[n - 1];
+	vcpu->vmx_ept01_overlay_value[i] = vcpu->vmx_ept01_overlay_value[n - 1];
+	vcpu->vmx_ept01_overlay_count = n - 1;
+	if (n == 1) {
+		g_vmx_ept01_overlays--;
+		vcpu->vmcs.control_EPT_pointer =
+			(vcpu->vmcs.control_EPT_pointer & 0xFFFULL) |
+			hva2spa((void *)vcpu->vmx_vaddr_ept_pml4_table);
+	}
+}
+
+/* Compute the set of CPUs that have started running the guest */
+static void _vmx_ept01_running_cpus(memp_cpuset_t *cpus){
+	u32 i;
+
+	memset(cpus, 0, sizeof(*cpus));
+	for (i = 0; i < g_midtable_numentries; i++) {
+		VCPU *v = (VCPU *)g_midtable[i].vcpu_vaddr_ptr;
+		if (v->isbsp || v->sipireceived) {
+			MEMP_CPUSET_ADD(cpus, v->idx);
+		}
+	}
+}
+#endif /* __VMX_SHARED_EPT__ */
+
+/*
+ * Start modifying EPT01. Brackets may nest (e.g. a hypapp modifying EPT01
+ * directly calls xmhf_memprot_split_page()), only the outermost one takes
+ * the EPT lock, if lock is true.
+ */
+static void _vmx_ept01_begin(VCPU *vcpu, bool lock){
+	if (vcpu->vmx_ept01_write_depth++ == 0) {
+		vcpu->vmx_ept01_write_locked = lock;
+		if (lock) {
+			memprot_x86vmx_eptlock_write_lock(vcpu);
+		}
+	}
+}
+
+/* Start modifying EPT01 (only needs locking when EPT01 is shared) */
+static void _vmx_ept01_lock(VCPU *vcpu){
+#ifdef __VMX_SHARED_EPT__
+	_vmx_ept01_begin(vcpu, true);
+#else /* !__VMX_SHARED_EPT__ */
+	_vmx_ept01_begin(vcpu, false);
+#endif /* __VMX_SHARED_EPT__ */
+}
+
+/*
+ * Finish modifying EPT01. When EPT01 is shared, overlays are rebuilt to pick
+ * up the changes. Tables retired above may be referenced by overlays until
+ * now, so their retire epoch is advanced.
+ */
+static void _vmx_ept01_unlock(VCPU *vcpu){
+	HALT_ON_ERRORCOND(vcpu->vmx_ept01_write_depth != 0);
+	if (--vcpu->vmx_ept01_write_depth != 0) {
+		return;
+	}
+#ifdef __VMX_SHARED_EPT__
+	if (g_vmx_ept01_overlays != 0) {
+		u32 i;
+		for (i = 0; i < g_midtable_numentries; i++) {
+			VCPU *v = (VCPU *)g_midtable[i].vcpu_vaddr_ptr;
+			if (v->vmx_ept01_overlay_count != 0) {
+				_vmx_ept01_overlay_build(v);
+			}
+		}
+		if (vcpu->vmx_ept01_retired_count != 0) {
+			vcpu->vmx_ept01_retired_epoch =
+				__sync_add_and_fetch(&g_vmx_ept01_epoch, 1);
+		}
+	}
+#endif /* __VMX_SHARED_EPT__ */
+	if (vcpu->vmx_ept01_write_locked) {
+		vcpu->vmx_ept01_write_locked = false;
+		memprot_x86vmx_eptlock_write_unlock(vcpu);
+	} else {
+		/* Software caches (guestmem TLB) may hold the old translations */
+		memprot_x86vmx_eptlock_invalidate();
+	}
+}
 
 //---setup EPT for VMX----------------------------------------------------------
 static void _vmx_setupEPT(VCPU *vcpu){
-	//step-1: tie in EPT PML4 structures
 	u64 *pml4_entry = (u64 *)vcpu->vmx_vaddr_ept_pml4_table;
 	u64 *pdp_entry = (u64 *)vcpu->vmx_vaddr_ept_pdp_table;
-	u64 *pd_entry = (u64 *)vcpu->vmx_vaddr_ept_pd_tables;
-	u64 *p_entry = (u64 *)vcpu->vmx_vaddr_ept_p_tables;
-	u64 pdp_table = hva2spa((void*)vcpu->vmx_vaddr_ept_pdp_table);
-	u64 pd_table = hva2spa((void*)vcpu->vmx_vaddr_ept_pd_tables);
-	u64 p_table = hva2spa((void*)vcpu->vmx_vaddr_ept_p_tables);
-	// TODO: for amd64, likely can use 1G / 2M pages.
-	// If so, also need to change _vmx_getmemorytypeforphysicalpage()
-    gpa_t paddr = 0;
-
-	for (paddr = 0; paddr < MAX_PHYS_ADDR; paddr += PA_PAGE_SIZE_4K) {
-		if (PA_PAGE_ALIGNED_512G(paddr)) {
-			/* Create PML4E */
-			gpa_t i = paddr >> PAGE_SHIFT_512G;
-			pml4_entry[i] = (pdp_table + (i << PAGE_SHIFT_4K)) | 0x7;
-		}
-		if (PA_PAGE_ALIGNED_1G(paddr)) {
-			/* Create PDPE */
-			gpa_t i = paddr >> PAGE_SHIFT_1G;
-			pdp_entry[i] = (pd_table + (i << PAGE_SHIFT_4K)) | 0x7;
-		}
-		if (PA_PAGE_ALIGNED_2M(paddr)) {
-			/* Create PDE */
-			gpa_t i = paddr >> PAGE_SHIFT_2M;
-			pd_entry[i] = (p_table + (i << PAGE_SHIFT_4K)) | 0x7;
-		}
-		/* PA_PAGE_ALIGNED_4K */
-		{
-			/* Create PE */
-			gpa_t i = paddr >> PAGE_SHIFT_4K;
-			u64 memorytype = _vmx_getmemorytypeforphysicalpage(vcpu, paddr);
-			u64 lower;
-			/*
-			 * For memorytype equal to 0 (UC), 1 (WC), 4 (WT), 5 (WP), 6 (WB),
-			 * MTRR memory type and EPT memory type are the same encoding.
-			 * Currently other encodings are reserved.
-			 */
-			HALT_ON_ERRORCOND(memorytype == 0 || memorytype == 1 ||
-								memorytype == 4 || memorytype == 5 ||
-								memorytype == 6);
-			if ((paddr >= (rpb->XtVmmRuntimePhysBase - PA_PAGE_SIZE_2M)) &&
-				(paddr < (rpb->XtVmmRuntimePhysBase + rpb->XtVmmRuntimeSize))) {
-				lower = 0x0;	/* not present */
-			} else {
-				lower = 0x7;	/* present */
+	u64 eptcap = vcpu->vmx_msrs[INDEX_IA32_VMX_EPT_VPID_CAP_MSR];
+	u32 i;
+
+	/* Use 2M pages (bit 16) and 1G pages (bit 17) if supported */
+	vcpu->vmx_ept01_max_leaf_lvl = 1;
+	if (eptcap & (1ULL << 16)) {
+		vcpu->vmx_ept01_max_leaf_lvl = 2;
+		if (eptcap & (1ULL << 17)) {
+			vcpu->vmx_ept01_max_leaf_lvl = 3;
+		}
+	}
+
+	_vmx_ept01_lock(vcpu);
+#ifdef __VMX_SHARED_EPT__
+	/* The first CPU builds EPT01 for all CPUs */
+	if (g_vmx_ept01_shared_lvl != 0) {
+		HALT_ON_ERRORCOND(g_vmx_ept01_shared_lvl == vcpu->vmx_ept01_max_leaf_lvl);
+		_vmx_ept01_unlock(vcpu);
+		return;
+	}
+	g_vmx_ept01_shared_lvl = vcpu->vmx_ept01_max_leaf_lvl;
+#endif /* __VMX_SHARED_EPT__ */
+	for (i = 0; i < P4L_NPDPT; i++) {
+		u64 *pdp_table = pdp_entry + i * EPT01_NENTRIES;
+		pml4_entry[i] = hva2spa(pdp_table) | EPT01_TABLE_FLAGS;
+		_vmx_ept01_fill(vcpu, pdp_table, 3, (u64)i << PAGE_SHIFT_512G);
+	}
+	_vmx_ept01_unlock(vcpu);
+}
+
+/*
+ * Update memory types of EPT01 leaves in table at level lvl (mapping from
+ * base) that overlap with [start, end). Large pages that are no longer
+ * uniform are split, and tables that become uniform are merged.
+ */
+static void _vmx_ept01_update_memtype(VCPU *vcpu, u64 *table, u32 lvl,
+									  u64 base, u64 start, u64 end){
+	u64 span = EPT01_LVL_SPAN(lvl);
+	u32 i;
+
+	for (i = 0; i < EPT01_NENTRIES; i++) {
+		u64 addr = base + i * span;
+		u64 *entry = &table[i];
+		u64 memorytype;
+		if (addr + span <= start || addr >= end) {
+			continue;
+		}
+		if (lvl > 1 && !(*entry & EPT01_LARGE)) {
+			if ((*entry & EPT01_PROT_MASK) == 0) {
+				/* Not mapped (above MAX_PHYS_ADDR) */
+				continue;
 			}
-			p_entry[i] = paddr | (memorytype << 3) | lower;
+			_vmx_ept01_update_memtype(vcpu, _vmx_ept01_entry_table(vcpu, *entry),
+									  lvl - 1, addr, start, end);
+			_vmx_ept01_merge(vcpu, entry, lvl - 1, 0);
+			continue;
+		}
+		memorytype = _vmx_getmemorytypeforrange(vcpu, addr, span);
+		if (memorytype == MTRR_TYPE_RESV) {
+			_vmx_ept01_split(vcpu, entry, lvl);
+			_vmx_ept01_update_memtype(vcpu, _vmx_ept01_entry_table(vcpu, *entry),
+									  lvl - 1, addr, start, end);
+			continue;
 		}
+		HALT_ON_ERRORCOND(memorytype == 0 || memorytype == 1 ||
+							memorytype == 4 || memorytype == 5 ||
+							memorytype == 6);
+		*entry = (*entry & ~EPT01_MEMTYPE_MASK) | (memorytype << 3);
 	}
 }
 
@@ -371,18 +842,14 @@ static void _vmx_setupEPT(VCPU *vcpu){
  * end: end of address range to be updated
  */
 static void _vmx_updateEPT_memtype(VCPU *vcpu, u64 start, u64 end){
-	u64 *p_entry = (u64 *)vcpu->vmx_vaddr_ept_p_tables;
-    u64 paddr = 0;
+	u64 *pdp_entry = (u64 *)vcpu->vmx_vaddr_ept_pdp_table;
+	u32 i;
 
 	HALT_ON_ERRORCOND(PA_PAGE_ALIGNED_4K(start));
 	HALT_ON_ERRORCOND(PA_PAGE_ALIGNED_4K(end));
-	for (paddr = start; paddr < end; paddr += PA_PAGE_SIZE_4K) {
-		u64 i = paddr / PA_PAGE_SIZE_4K;
-		u64 memorytype = _vmx_getmemorytypeforphysicalpage(vcpu, paddr);
-		HALT_ON_ERRORCOND(memorytype == 0 || memorytype == 1 ||
-							memorytype == 4 || memorytype == 5 ||
-							memorytype == 6);
-		p_entry[i] = (p_entry[i] & ~0x38ULL) | (memorytype << 3);
+	for (i = 0; i < P4L_NPDPT; i++) {
+		_vmx_ept01_update_memtype(vcpu, pdp_entry + i * EPT01_NENTRIES, 3,
+								  (u64)i << PAGE_SHIFT_512G, start, end);
 	}
 }
 
@@ -538,34 +1005,66 @@ u32 xmhf_memprot_arch_x86vmx_mtrr_write(VCPU *vcpu, u32 msr, u64 val) {
 		 * complicated logic.
 		 */
 		printf("CPU(0x%02x): Update EPT memory types due to MTRR\n", vcpu->id);
+		_vmx_ept01_lock(vcpu);
 		_vmx_updateEPT_memtype(vcpu, 0, MAX_PHYS_ADDR);
+		_vmx_ept01_unlock(vcpu);
+#ifdef __VMX_SHARED_EPT__
+		/*
+		 * EPT01 memory types follow the MTRRs of the CPU that writes last.
+		 * The guest is expected to program the same MTRRs on all CPUs. CPUs
+		 * that have not started the guest have nothing to flush.
+		 */
+		{
+			memp_cpuset_t cpus;
+			_vmx_ept01_running_cpus(&cpus);
+			xmhf_memprot_flushmappings_shootdown(vcpu, &cpus,
+												 MEMP_FLUSHTLB_MT_ENTRY,
+												 MEMP_FLUSHTLB_GPA_LO_ALL,
+												 MEMP_FLUSHTLB_GPA_HI_ALL);
+		}
+#else /* !__VMX_SHARED_EPT__ */
 		xmhf_memprot_arch_x86vmx_flushmappings_localtlb(vcpu, MEMP_FLUSHTLB_MT_ENTRY);
+#endif /* __VMX_SHARED_EPT__ */
 	}
 	return 0;
 }
 
 //flush hardware page table mappings (TLB)
 void xmhf_memprot_arch_x86vmx_flushmappings_localtlb(VCPU *vcpu, u32 flags){
-  (void)vcpu;
+  xmhf_memprot_arch_x86vmx_flushmappings_localtlb_range(vcpu, flags,
+                                                        MEMP_FLUSHTLB_GPA_LO_ALL,
+                                                        MEMP_FLUSHTLB_GPA_HI_ALL);
+}
 
+//flush hardware page table mappings (TLB), only entries for guest physical
+//addresses in [gpa_lo, gpa_hi) changed
+void xmhf_memprot_arch_x86vmx_flushmappings_localtlb_range(VCPU *vcpu, u32 flags,
+                                                           u64 gpa_lo, u64 gpa_hi){
   /*
    * Note: when only EPTP changes, there is no need to call INVEPT.
-   * Note: currently the API does not specify which EPT's entries are changed.
+   * Note: INVEPT cannot invalidate individual addresses, so the range is only
+   * used by EPT02.
    */
   if ((flags & (MEMP_FLUSHTLB_ENTRY | MEMP_FLUSHTLB_MT_ENTRY)) != 0) {
+    /* EPT01 tables retired before this point can be freed after INVEPT */
+    u32 epoch = g_vmx_ept01_epoch;
     HALT_ON_ERRORCOND(__vmx_invept(VMX_INVEPT_GLOBAL, 0ULL));
+    vcpu->vmx_ept01_flushed_epoch = epoch;
   }
 
 #ifdef __NESTED_VIRTUALIZATION__
-  /* When nested virtualization, invalidate all EPT02's */
-  xmhf_nested_arch_x86vmx_flush_ept02(vcpu, flags);
+  /* When nested virtualization, invalidate EPT02 entries derived from range */
+  xmhf_nested_arch_x86vmx_flush_ept02_range(vcpu, flags, gpa_lo, gpa_hi);
+#else /* !__NESTED_VIRTUALIZATION__ */
+  (void)gpa_lo;
+  (void)gpa_hi;
 #endif /* __NESTED_VIRTUALIZATION__ */
 }
 
 //set protection for a given physical memory address
 void xmhf_memprot_arch_x86vmx_setprot(VCPU *vcpu, u64 gpa, u32 prottype){
-  u32 pfn;
   u64 *pt;
+  u32 lvl;
   u32 flags =0;
 
 #ifdef __XMHF_VERIFICATION_DRIVEASSERTS__
@@ -585,13 +1084,8 @@ void xmhf_memprot_arch_x86vmx_setprot(VCPU *vcpu, u64 gpa, u32 prottype){
 	);
 #endif
 
-  pfn = (u32)gpa / PAGE_SIZE_4K;	//grab page frame number
-  pt = (u64 *)vcpu->vmx_vaddr_ept_p_tables;
-
-  //default is not-present, read-only, no-execute
-  pt[pfn] &= ~(u64)7; //clear all previous flags
-
   //map high level protection type to EPT protection bits
+  //default is not-present, read-only, no-execute
   if(prottype & MEMP_PROT_PRESENT){
 	flags=1;	//present is defined by the read bit in EPT
 
@@ -602,16 +1096,25 @@ void xmhf_memprot_arch_x86vmx_setprot(VCPU *vcpu, u64 gpa, u32 prottype){
 		flags |= 0x4;
   }
 
-  //set new flags
-  pt[pfn] |= flags;
+  _vmx_ept01_lock(vcpu);
+
+  //nothing to do if the (possibly large) page already has the protection
+  pt = _vmx_ept01_walk(vcpu, gpa, &lvl, NULL);
+  if(!((*pt & EPT01_PROT_MASK) == flags && (lvl == 1 || (*pt & EPT01_LARGE)))){
+	//split large pages, set new flags, then merge back if possible
+	pt = _vmx_ept01_get_pte(vcpu, gpa);
+	*pt = (*pt & ~EPT01_PROT_MASK) | flags;
+	_vmx_ept01_coalesce(vcpu, gpa);
+  }
+
+  _vmx_ept01_unlock(vcpu);
 }
 
 
 //get protection for a given physical memory address
 u32 xmhf_memprot_arch_x86vmx_getprot(VCPU *vcpu, u64 gpa){
-  u32 pfn = (u32)gpa / PAGE_SIZE_4K;	//grab page frame number
-  u64 *pt = (u64 *)vcpu->vmx_vaddr_ept_p_tables;
-  u64 entry = pt[pfn];
+  u32 lvl;
+  u64 entry = *_vmx_ept01_walk(vcpu, gpa, &lvl, NULL);
   u32 prottype;
 
   if(! (entry & 0x1) ){
@@ -634,10 +1137,81 @@ u32 xmhf_memprot_arch_x86vmx_getprot(VCPU *vcpu, u64 gpa){
   return prottype;
 }
 
+//split EPT01 large pages so that gpa is mapped by a 4K page
+void xmhf_memprot_arch_x86vmx_split_page(VCPU *vcpu, u64 gpa){
+  _vmx_ept01_lock(vcpu);
+  _vmx_ept01_get_pte(vcpu, gpa);
+  _vmx_ept01_unlock(vcpu);
+}
+
+//start modifying EPT01 directly (e.g. using hptw), see _vmx_ept01_begin()
+void xmhf_memprot_arch_x86vmx_write_begin(VCPU *vcpu, bool lock){
+  _vmx_ept01_begin(vcpu, lock);
+}
+
+//finish modifying EPT01 directly, rebuilding overlays if EPT01 is shared
+void xmhf_memprot_arch_x86vmx_write_end(VCPU *vcpu){
+  _vmx_ept01_unlock(vcpu);
+}
+
+//merge EPT01 page tables mapping [gpa_lo, gpa_hi) into large pages when
+//possible. Tables removed are freed after all CPUs flush EPT TLB.
+void xmhf_memprot_arch_x86vmx_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi){
+  u64 gpa = gpa_lo & ~(PA_PAGE_SIZE_2M - 1);
+
+  if (gpa_hi > MAX_PHYS_ADDR) {
+    gpa_hi = MAX_PHYS_ADDR;
+  }
+  _vmx_ept01_lock(vcpu);
+  while (gpa < gpa_hi) {
+    u64 span = EPT01_LVL_SPAN(_vmx_ept01_coalesce(vcpu, gpa));
+    if (span < PA_PAGE_SIZE_2M) {
+      span = PA_PAGE_SIZE_2M;
+    }
+    gpa = (gpa & ~(span - 1)) + span;
+  }
+  _vmx_ept01_unlock(vcpu);
+}
+
+//set the 4K EPT01 leaf of gpa to value, splitting large pages as needed.
+//When EPT01 is shared, only the current CPU sees the change.
+void xmhf_memprot_arch_x86vmx_set_pte(VCPU *vcpu, u64 gpa, u64 value){
+#ifdef __VMX_SHARED_EPT__
+  _vmx_ept01_lock(vcpu);
+  _vmx_ept01_overlay_set(vcpu, gpa, value);
+  _vmx_ept01_unlock(vcpu);
+#else /* !__VMX_SHARED_EPT__ */
+  *_vmx_ept01_get_pte(vcpu, gpa) = value;
+#endif /* __VMX_SHARED_EPT__ */
+}
+
+//undo xmhf_memprot_arch_x86vmx_set_pte(): restore the identity mapping of the
+//4K page gpa, and merge it back into large pages if possible
+void xmhf_memprot_arch_x86vmx_reset_pte(VCPU *vcpu, u64 gpa){
+#ifdef __VMX_SHARED_EPT__
+  _vmx_ept01_lock(vcpu);
+  _vmx_ept01_overlay_reset(vcpu, gpa);
+  _vmx_ept01_unlock(vcpu);
+#else /* !__VMX_SHARED_EPT__ */
+  u64 leaf;
+  HALT_ON_ERRORCOND(_vmx_ept01_make_leaf(vcpu, gpa & ~(PA_PAGE_SIZE_4K - 1),
+                                         1, &leaf));
+  *_vmx_ept01_get_pte(vcpu, gpa) = leaf;
+  _vmx_ept01_coalesce(vcpu, gpa);
+#endif /* __VMX_SHARED_EPT__ */
+}
+
 /* Get EPT pointer. When nested virtualization, get EPT01. */
 u64 xmhf_memprot_arch_x86vmx_get_EPTP(VCPU *vcpu)
 {
   HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_INTEL);
+#ifdef __VMX_SHARED_EPT__
+  /* Hide the overlay, callers modify the shared EPT01 */
+  if (vcpu->vmx_ept01_overlay_count != 0) {
+    return (vcpu->vmcs.control_EPT_pointer & 0xFFFULL) |
+           hva2spa((void *)vcpu->vmx_vaddr_ept_pml4_table);
+  }
+#endif /* __VMX_SHARED_EPT__ */
   return vcpu->vmcs.control_EPT_pointer;
 }
 
@@ -652,6 +1226,13 @@ u64 xmhf_memprot_arch_x86vmx_get_EPTP(VCPU *vcpu)
 void xmhf_memprot_arch_x86vmx_set_EPTP(VCPU *vcpu, u64 eptp)
 {
   HALT_ON_ERRORCOND(vcpu->cpu_vendor == CPU_VENDOR_INTEL);
+#ifdef __VMX_SHARED_EPT__
+  /* EPTP cannot change while the overlay is in use */
+  if (vcpu->vmx_ept01_overlay_count != 0) {
+    HALT_ON_ERRORCOND(eptp == xmhf_memprot_arch_x86vmx_get_EPTP(vcpu));
+    return;
+  }
+#endif /* __VMX_SHARED_EPT__ */
   vcpu->vmcs.control_EPT_pointer = eptp;
 }
 
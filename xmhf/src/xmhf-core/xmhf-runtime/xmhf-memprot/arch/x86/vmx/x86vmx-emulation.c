@@ -55,6 +55,26 @@
 #define BIT_SIZE_16		2
 #define BIT_SIZE_8		1
 
+/*
+ * Instruction forms whose decoding can be cached. Each form corresponds to an
+ * emulate_*() function, see emulate_form().
+ */
+enum emu_form {
+	EMU_FORM_NONE = 0,
+	EMU_FORM_BT_EV_IB,
+	EMU_FORM_MOV_EV_GV,
+	EMU_FORM_MOV_GV_EV,
+	EMU_FORM_MOV_MOFFS,
+	EMU_FORM_MOV_EV_IZ,
+};
+
+/* Bits of emu_cache_entry_t::prefix_bits */
+#define EMU_PREFIX_LOCK		(1U << 0)
+#define EMU_PREFIX_REPE		(1U << 1)
+#define EMU_PREFIX_REPNE	(1U << 2)
+#define EMU_PREFIX_OPSIZE	(1U << 3)
+#define EMU_PREFIX_ADDRSIZE	(1U << 4)
+
 /* Environment used to access memory */
 typedef struct mem_access_env_t {
 	void *hvaddr;
@@ -67,41 +87,6 @@ typedef struct mem_access_env_t {
 
 static void _print_instruction(unsigned char* inst, uint32_t inst_len);
 
-// #define PREFIX_INFO_INITIALIZER 
-// 	{ false, false, false, CPU_SEG_UNKNOWN, false, false, { .raw=0 } }
-
-
-
-// /*
-//  * Handle access of special memory.
-//  * Interface similar to hptw_checked_access_va.
-//  */
-// static void access_special_memory(VCPU * vcpu, void *hva,
-// 								  hpt_prot_t access_type, hptw_cpl_t cpl,
-// 								  gpa_t gpa, size_t requested_sz,
-// 								  size_t *avail_sz)
-// {
-// 	if ((gpa & PAGE_MASK_4K) == g_vmx_lapic_base) {
-// 		HALT_ON_ERRORCOND(requested_sz == 4);
-// 		HALT_ON_ERRORCOND(gpa % 4 == 0);
-// 		HALT_ON_ERRORCOND(cpl == 0);
-// 		*avail_sz = 4;
-// 		if ((gpa & ADDR64_PAGE_OFFSET_4K) == LAPIC_ICR_LOW &&
-// 			(access_type & HPT_PROT_WRITE_MASK)) {
-// 			xmhf_smpguest_arch_x86vmx_eventhandler_icrlowwrite(vcpu,
-// 															   *(u32 *)hva);
-// 		} else {
-// 			if (access_type & HPT_PROT_WRITE_MASK) {
-// 				*(u32 *)(uintptr_t)gpa = *(u32 *)hva;
-// 			} else {
-// 				*(u32 *)hva = *(u32 *)(uintptr_t)gpa;
-// 			}
-// 		}
-// 	} else {
-// 		HALT_ON_ERRORCOND(0);
-// 	}
-// }
-
 static hva_t eval_guest_memory_gvaddr(guestmem_hptw_ctx_pair_t * ctx_pair, mem_access_env_t * env, uintptr_t guest_mem_linear_addr)
 {
 	VCPU *vcpu = ctx_pair->vcpu;
@@ -128,7 +113,6 @@ static int access_memory_gv(guestmem_hptw_ctx_pair_t * ctx_pair,
 	while (copied < env->size) {
 		hpt_va_t gva = lin_addr + copied;
 		size_t size = env->size - copied;
-		// size_t old_size;
 		hpt_va_t gpa;
 		void *hva;
 		spa_t spa = INVALID_SPADDR;
@@ -145,26 +129,6 @@ static int access_memory_gv(guestmem_hptw_ctx_pair_t * ctx_pair,
 			gpa = gva;
 		}
 
-		// /* Guest physical address -> hypervisor physical address */
-		// // old_size = size;
-		// hva = hptw_checked_access_va(&ctx_pair->host_ctx, env->mode, env->cpl,
-		// 							 gpa, size, &size);
-		// if (hva == NULL) {
-		// 	// /* Memory not in EPT, need special treatment */
-		// 	// access_special_memory(vcpu, env->hvaddr + copied, env->mode,
-		// 	// 					  env->cpl, gpa, old_size, &size);
-		// 	// copied += size;
-        //     return -1;
-		// } else {
-		// 	/* Perform normal memory access */
-		// 	if (env->mode & HPT_PROT_WRITE_MASK) {
-		// 		memcpy(hva, env->hvaddr + copied, size);
-		// 	} else {
-		// 		memcpy(env->hvaddr + copied, hva, size);
-		// 	}
-		// 	copied += size;
-		// }
-
 		spa = (spa_t)hptw_gpa_to_spa(&ctx_pair->host_ctx, gpa);
 		hva = spa2hva(spa);
 
@@ -172,8 +136,21 @@ static int access_memory_gv(guestmem_hptw_ctx_pair_t * ctx_pair,
 			return -1;
 		else
 		{
-			/* Perform normal memory access */
-			if (env->mode & HPT_PROT_WRITE_MASK) {
+			/*
+			 * Perform normal memory access. Aligned 32-bit accesses are
+			 * performed as a single access because MMIO such as LAPIC does
+			 * not support byte accesses.
+			 */
+			if (size == sizeof(u32) && ((uintptr_t)hva & 0x3) == 0) {
+				u32 val;
+				if (env->mode & HPT_PROT_WRITE_MASK) {
+					memcpy(&val, env->hvaddr + copied, sizeof(val));
+					*(volatile u32 *)hva = val;
+				} else {
+					val = *(volatile u32 *)hva;
+					memcpy(env->hvaddr + copied, &val, sizeof(val));
+				}
+			} else if (env->mode & HPT_PROT_WRITE_MASK) {
 				memcpy(hva, env->hvaddr + copied, size);
 			} else {
 				memcpy(env->hvaddr + copied, hva, size);
@@ -643,6 +620,391 @@ static void read_xmm0(void* buffer)
 		printf("Guest instruction emulation error: Not implemented! line %d, file %s\n",  __LINE__, __FILE__); \
 	} while (0)
 
+/* BT/BTS/BTR/BTC Ev, Ib (0f ba) */
+static int emulate_bt_ev_ib(emu_env_t * emu_env)
+{
+	// TODO: LOCK is not implemented
+    int ret = 0;
+	emu_env->prefix.lock = true;
+	HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
+	{
+		size_t operand_size = get_operand_size(emu_env);
+		u8 imm = *emu_env->postfix.immediate1;
+		u8 bit = imm % (operand_size * 8);
+		uintptr_t rm;	/* r, w */
+		uintptr_t value = 0;
+
+		if (eval_modrm_addr(emu_env, &rm)) 
+        {
+			// Source is a memory
+			uintptr_t guest_linear_addr = rm;
+			mem_access_env_t env = {
+				.hvaddr = &value,
+				.gaddr = guest_linear_addr,
+				.seg = emu_env->seg,
+				.size = operand_size,
+				.mode = HPT_PROT_READ_MASK,
+				.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
+			};
+
+			emu_env->src.type = OPERAND_MEM;
+			emu_env->src.operand_size = operand_size;
+			emu_env->src.mem.seg = emu_env->seg;
+			emu_env->src.mem.offset = guest_linear_addr;
+			emu_env->src.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
+			ret = eval_operand_value(emu_env, &emu_env->src);
+			if(ret)
+			{
+				printf("[X86-VMX Emulator] Emulate BT/BTS/BTR/BTC read's memory error!\n");
+				return -1;
+			}
+
+
+			// /* Read */
+			// mem_access_env_t env = {
+			// 	.hvaddr = &value,
+			// 	.gaddr = rm,
+			// 	.seg = emu_env->seg,
+			// 	.size = operand_size,
+			// 	.mode = HPT_PROT_READ_MASK,
+			// 	.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
+			// };
+			// ret = access_memory_gv(&emu_env->ctx_pair, &env);
+            // if(ret)
+            // {
+            //     printf("[X86-VMX Emulator] Emulate BT/BTS/BTR/BTC read error!\n");
+            //     status = -1;
+            //     goto L0xba_out;
+            // }
+
+			/* Store */
+			if ((value >> bit) & 1) {
+				emu_env->vcpu->vmcs.guest_RFLAGS |= EFLAGS_CF;
+			} else {
+				emu_env->vcpu->vmcs.guest_RFLAGS &= ~EFLAGS_CF;
+			}
+			/* Modify */
+			switch (emu_env->postfix.modrm.regop) {
+			case 4:	/* BT */
+				break;
+			case 5:	/* BTS */
+				value |= (1UL << bit);
+				break;
+			case 6:	/* BTR */
+				value &= ~(1UL << bit);
+				break;
+			case 7:	/* BTC */
+				value ^= (1UL << bit);
+				break;
+			default:
+				HALT_ON_ERRORCOND(0 && "Undefined opcode");
+			}
+
+			// Update emu_env->src.val
+            memcpy(emu_env->src.val, &value, sizeof(uintptr_t));
+
+			// Destination is the same as the source
+			emu_env->dst.type = OPERAND_MEM;
+			emu_env->dst.operand_size = operand_size;
+			emu_env->dst.mem.seg = emu_env->seg;
+			emu_env->dst.mem.offset = guest_linear_addr;
+			emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
+
+
+			// /* Write */
+			// env.mode = HPT_PROT_WRITE_MASK;
+			// ret = access_memory_gv(&emu_env->ctx_pair, &env);
+            // if(ret)
+            // {
+            //     printf("[X86-VMX Emulator] Emulate BT/BTS/BTR/BTC write error!\n");
+            //     status = -1;
+            //     goto L0xba_out;
+            // }
+		} else {
+			HALT_ON_ERRORCOND(0 && "Not implemented");
+		}
+	}
+
+	return 0;
+}
+
+/* MOV Ev, Gv (89) */
+static int emulate_mov_ev_gv(emu_env_t * emu_env)
+{
+	HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
+	{
+        int ret = 0;
+		size_t operand_size = get_operand_size(emu_env);
+		uintptr_t rm;	/* w */
+
+		emu_env->src.type = OPERAND_REG;
+		emu_env->src.reg_hvaddr = (hva_t)eval_modrm_reg(emu_env);	/* r */
+		emu_env->src.operand_size = operand_size;
+		ret = eval_operand_value(emu_env, &emu_env->src);
+		if(ret)
+		{
+			printf("[X86-VMX Emulator] Emulate mov write's source operand error!\n");
+			return -1;
+		}
+
+		if (eval_modrm_addr(emu_env, &rm)) 
+		{
+			// Destination is a memory
+			uintptr_t guest_linear_addr = rm;
+			mem_access_env_t env = {
+				.hvaddr = (void*)emu_env->src.reg_hvaddr,
+				.gaddr = guest_linear_addr,
+				.seg = emu_env->seg,
+				.size = operand_size,
+				.mode = HPT_PROT_WRITE_MASK,
+				.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
+			};
+
+			emu_env->dst.type = OPERAND_MEM;
+			emu_env->dst.operand_size = operand_size;
+			emu_env->dst.mem.seg = emu_env->seg;
+			emu_env->dst.mem.offset = guest_linear_addr;
+			emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
+
+
+			// ret = access_memory_gv(&emu_env->ctx_pair, &env);
+            // if(ret)
+            // {
+            //     printf("[X86-VMX Emulator] Emulate mov write error!\n");
+            //     status = -1;
+            //     goto L0x89_out;
+            // }
+		} else {
+			// Destination is a register
+			emu_env->dst.type = OPERAND_REG;
+			emu_env->dst.operand_size = operand_size;
+			emu_env->dst.reg_hvaddr = rm;
+
+			// memcpy((void *)rm, (void*)emu_env->src.reg_hvaddr, operand_size);
+		}
+	}
+
+	return 0;
+}
+
+/* MOV Gv, Ev (8b) */
+static int emulate_mov_gv_ev(emu_env_t * emu_env)
+{
+	HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
+	{
+        int ret = 0;
+		size_t operand_size = get_operand_size(emu_env);
+		uintptr_t rm;	/* r */
+
+		emu_env->dst.type = OPERAND_REG;
+		emu_env->dst.operand_size = operand_size;
+		emu_env->dst.reg_hvaddr = (hva_t)eval_modrm_reg(emu_env);	/* w */
+
+		if (eval_modrm_addr(emu_env, &rm)) 
+		{
+			// Source is a memory
+			uintptr_t guest_linear_addr = rm;
+			mem_access_env_t env = {
+				.hvaddr = (void*)emu_env->dst.reg_hvaddr,
+				.gaddr = guest_linear_addr,
+				.seg = emu_env->seg,
+				.size = operand_size,
+				.mode = HPT_PROT_READ_MASK,
+				.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
+			};
+
+			emu_env->src.type = OPERAND_MEM;
+			emu_env->src.operand_size = operand_size;
+			emu_env->src.mem.seg = emu_env->seg;
+			emu_env->src.mem.offset = guest_linear_addr;
+			emu_env->src.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
+			ret = eval_operand_value(emu_env, &emu_env->src);
+			if(ret)
+			{
+				printf("[X86-VMX Emulator] Emulate mov read's memory source operand error!\n");
+				return -1;
+			}
+
+
+			// ret = access_memory_gv(&emu_env->ctx_pair, &env);
+            // if(ret)
+            // {
+            //     printf("[X86-VMX Emulator] Emulate mov read error!\n");
+            //     status = -1;
+            //     goto L0x8b_out;
+            // }
+		} else {
+			// Source is a register
+			emu_env->src.type = OPERAND_REG;
+			emu_env->src.operand_size = operand_size;
+			emu_env->src.reg_hvaddr = rm;
+			ret = eval_operand_value(emu_env, &emu_env->src);
+			if(ret)
+			{
+				printf("[X86-VMX Emulator] Emulate mov read's register source operand error!\n");
+				return -1;
+			}
+
+			// memcpy(reg, (void *)rm, operand_size);
+		}
+	}
+
+	return 0;
+}
+
+/* MOV AL/rAX, Ob/Ov and MOV Ob/Ov, AL/rAX (a0 - a3) */
+static int emulate_mov_moffs(emu_env_t * emu_env)
+{
+	HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
+	{
+        int ret = 0;
+		size_t address_size = get_address_size(emu_env);
+		size_t operand_size = (emu_env->opcode & 1) ? get_operand_size(emu_env) : 1;
+		mem_access_env_t env;
+		uintptr_t guest_linear_addr = 0;
+
+		emu_env->src.type = OPERAND_REG;
+		emu_env->src.operand_size = operand_size;
+		emu_env->src.reg_hvaddr = (hva_t)get_reg_ptr(emu_env, CPU_REG_AX, operand_size);
+		ret = eval_operand_value(emu_env, &emu_env->src);
+		if(ret)
+		{
+			printf("[X86-VMX Emulator] Emulate mov read's AX source operand error!\n");
+			return -1;
+		}
+
+
+		compute_segment(emu_env, CPU_REG_AX);
+		env = (mem_access_env_t){
+			.hvaddr = get_reg_ptr(emu_env, CPU_REG_AX, operand_size),
+			.gaddr = 0,
+			.seg = emu_env->seg,
+			.size = operand_size,
+			.mode = (emu_env->opcode & 2) ? HPT_PROT_WRITE_MASK : HPT_PROT_READ_MASK,
+			.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
+		};
+		zero_extend(&env.gaddr, emu_env->postfix.immediate,
+					sizeof(env.gaddr), address_size);
+
+		guest_linear_addr = env.gaddr;
+		emu_env->dst.type = OPERAND_MEM;
+		emu_env->dst.operand_size = operand_size;
+		emu_env->dst.mem.seg = emu_env->seg;
+		emu_env->dst.mem.offset = guest_linear_addr;
+		emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
+
+		// ret = access_memory_gv(&emu_env->ctx_pair, &env);
+        // if(ret)
+        // {
+        //     printf("[X86-VMX Emulator] Emulate mov write offset error!\n");
+        //     status = -1;
+        //     goto L0xa3_out;
+        // }
+	}
+
+	return 0;
+}
+
+/* MOV Ev, Iz (c7 /0) */
+static int emulate_mov_ev_iz(emu_env_t * emu_env)
+{
+	HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
+	HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
+	if (emu_env->postfix.modrm.regop == 0) {
+		int ret = 0;
+		size_t operand_size = get_operand_size(emu_env);
+		// u64 imm;
+		// void *pimm;
+		uintptr_t rm;	/* w */
+		// if (operand_size == BIT_SIZE_64) {
+		// 	imm = (int64_t)*(int32_t *)emu_env->postfix.immediate4;
+		// 	pimm = &imm;
+		// } else {
+		// 	pimm = emu_env->postfix.immediate;
+		// }
+
+		emu_env->src.type = OPERAND_IMM;
+		emu_env->src.operand_size = operand_size;
+		ret = eval_operand_value(emu_env, &emu_env->src);
+		if(ret)
+		{
+			printf("[X86-VMX Emulator] Emulate mov write's immediate source operand error!\n");
+			return -1;
+		}
+
+		if (eval_modrm_addr(emu_env, &rm)) 
+		{
+			// Destination is a memory
+			uintptr_t guest_linear_addr = rm;
+			mem_access_env_t env = {
+				.hvaddr = (void *)NULL,
+				.gaddr = guest_linear_addr,
+				.seg = emu_env->seg,
+				.size = operand_size,
+				.mode = HPT_PROT_WRITE_MASK,
+				.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
+			};
+
+			emu_env->dst.type = OPERAND_MEM;
+			emu_env->dst.operand_size = operand_size;
+			emu_env->dst.mem.seg = emu_env->seg;
+			emu_env->dst.mem.offset = guest_linear_addr;
+			emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
+
+
+			// ret = access_memory_gv(&emu_env->ctx_pair, &env);
+            // if(ret)
+            // {
+            //     printf("[X86-VMX Emulator] Emulate mov write immediate error!\n");
+            //     status = -1;
+            //     goto L0xc7_out;
+            // }
+		} 
+		else 
+		{
+			// Destination is a register
+			emu_env->dst.type = OPERAND_REG;
+			emu_env->dst.operand_size = operand_size;
+			emu_env->dst.reg_hvaddr = rm;
+
+			// memcpy((void *)rm, (void *)pimm, operand_size);
+		}
+	} else {
+        printf("[X86-VMX Emulator] Unable to emulate instruction:\n");
+        _print_instruction(emu_env->pinst, emu_env->pinst_len);
+		HALT_ON_ERRORCOND(0 && "Not implemented");
+	}
+
+	return 0;
+}
+
+/*
+ * Evaluate the operands of an instruction in the given form. The prefixes and
+ * postfixes of the instruction must be already in emu_env, either parsed by
+ * parse_opcode_one() or restored from the decode cache.
+ */
+static int emulate_form(emu_env_t * emu_env, u8 form)
+{
+	emu_env->form = form;
+	switch (form) {
+	case EMU_FORM_BT_EV_IB: return emulate_bt_ev_ib(emu_env);
+	case EMU_FORM_MOV_EV_GV: return emulate_mov_ev_gv(emu_env);
+	case EMU_FORM_MOV_GV_EV: return emulate_mov_gv_ev(emu_env);
+	case EMU_FORM_MOV_MOFFS: return emulate_mov_moffs(emu_env);
+	case EMU_FORM_MOV_EV_IZ: return emulate_mov_ev_iz(emu_env);
+	default: HALT_ON_ERRORCOND(0 && "Invalid form");
+	}
+	return -1;
+}
+
 /* Parse second byte of opcode starting with 0x0f */
 static int parse_opcode_two_0f(emu_env_t * emu_env)
 {
@@ -652,6 +1014,7 @@ static int parse_opcode_two_0f(emu_env_t * emu_env)
 	opcode = emu_env->pinst[0];
 	emu_env->pinst++;
 	emu_env->pinst_len--;
+	emu_env->opcode = opcode;
 	switch (opcode) {
 	case 0x00: _emu_unimplemented_inst_print(emu_env); break;
 	case 0x01: _emu_unimplemented_inst_print(emu_env); break;
@@ -970,118 +1333,9 @@ static int parse_opcode_two_0f(emu_env_t * emu_env)
 	case 0xb8: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xb9: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xba:	/* BT/BTS/BTR/BTC Ev, Ib */
-    {
-		// TODO: LOCK is not implemented
-        int ret = 0;
-		emu_env->prefix.lock = true;
-		HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
 		parse_postfix(emu_env, true, false, 0, 1);
-		{
-			size_t operand_size = get_operand_size(emu_env);
-			u8 imm = *emu_env->postfix.immediate1;
-			u8 bit = imm % (operand_size * 8);
-			uintptr_t rm;	/* r, w */
-			uintptr_t value = 0;
-
-			if (eval_modrm_addr(emu_env, &rm)) 
-            {
-				// Source is a memory
-				uintptr_t guest_linear_addr = rm;
-				mem_access_env_t env = {
-					.hvaddr = &value,
-					.gaddr = guest_linear_addr,
-					.seg = emu_env->seg,
-					.size = operand_size,
-					.mode = HPT_PROT_READ_MASK,
-					.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
-				};
-
-				emu_env->src.type = OPERAND_MEM;
-				emu_env->src.operand_size = operand_size;
-				emu_env->src.mem.seg = emu_env->seg;
-				emu_env->src.mem.offset = guest_linear_addr;
-				emu_env->src.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
-				ret = eval_operand_value(emu_env, &emu_env->src);
-				if(ret)
-				{
-					printf("[X86-VMX Emulator] Emulate BT/BTS/BTR/BTC read's memory error!\n");
-					status = -1;
-					goto L0xba_out;
-				}
-
-
-				// /* Read */
-				// mem_access_env_t env = {
-				// 	.hvaddr = &value,
-				// 	.gaddr = rm,
-				// 	.seg = emu_env->seg,
-				// 	.size = operand_size,
-				// 	.mode = HPT_PROT_READ_MASK,
-				// 	.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
-				// };
-				// ret = access_memory_gv(&emu_env->ctx_pair, &env);
-                // if(ret)
-                // {
-                //     printf("[X86-VMX Emulator] Emulate BT/BTS/BTR/BTC read error!\n");
-                //     status = -1;
-                //     goto L0xba_out;
-                // }
-
-				/* Store */
-				if ((value >> bit) & 1) {
-					emu_env->vcpu->vmcs.guest_RFLAGS |= EFLAGS_CF;
-				} else {
-					emu_env->vcpu->vmcs.guest_RFLAGS &= ~EFLAGS_CF;
-				}
-				/* Modify */
-				switch (emu_env->postfix.modrm.regop) {
-				case 4:	/* BT */
-					break;
-				case 5:	/* BTS */
-					value |= (1UL << bit);
-					break;
-				case 6:	/* BTR */
-					value &= ~(1UL << bit);
-					break;
-				case 7:	/* BTC */
-					value ^= (1UL << bit);
-					break;
-				default:
-					HALT_ON_ERRORCOND(0 && "Undefined opcode");
-				}
-
-				// Update emu_env->src.val
-                memcpy(emu_env->src.val, &value, sizeof(uintptr_t));
-
-				// Destination is the same as the source
-				emu_env->dst.type = OPERAND_MEM;
-				emu_env->dst.operand_size = operand_size;
-				emu_env->dst.mem.seg = emu_env->seg;
-				emu_env->dst.mem.offset = guest_linear_addr;
-				emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
-
-
-				// /* Write */
-				// env.mode = HPT_PROT_WRITE_MASK;
-				// ret = access_memory_gv(&emu_env->ctx_pair, &env);
-                // if(ret)
-                // {
-                //     printf("[X86-VMX Emulator] Emulate BT/BTS/BTR/BTC write error!\n");
-                //     status = -1;
-                //     goto L0xba_out;
-                // }
-			} else {
-				HALT_ON_ERRORCOND(0 && "Not implemented");
-			}
-		}
-
-        // On success
-        status = 0;
-
-L0xba_out:
-        break;
-    }
+		status = emulate_form(emu_env, EMU_FORM_BT_EV_IB);
+		break;
 	case 0xbb: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xbc: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xbd: _emu_unimplemented_inst_print(emu_env); break;
@@ -1170,6 +1424,7 @@ static int parse_opcode_one(emu_env_t * emu_env)
 	opcode = emu_env->pinst[0];
 	emu_env->pinst++;
 	emu_env->pinst_len--;
+	emu_env->opcode = opcode;
 	switch (opcode) {
 	case 0x00: _emu_unimplemented_inst_print(emu_env); break;
 	case 0x01: _emu_unimplemented_inst_print(emu_env); break;
@@ -1391,143 +1646,14 @@ static int parse_opcode_one(emu_env_t * emu_env)
         break;
     }
 	case 0x89:	/* MOV Ev, Gv */
-    {
-		HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
 		parse_postfix(emu_env, true, false, 0, 0);
-		{
-            int ret = 0;
-			size_t operand_size = get_operand_size(emu_env);
-			uintptr_t rm;	/* w */
-
-			emu_env->src.type = OPERAND_REG;
-			emu_env->src.reg_hvaddr = (hva_t)eval_modrm_reg(emu_env);	/* r */
-			emu_env->src.operand_size = operand_size;
-			ret = eval_operand_value(emu_env, &emu_env->src);
-			if(ret)
-			{
-				printf("[X86-VMX Emulator] Emulate mov write's source operand error!\n");
-				status = -1;
-				goto L0x89_out;
-			}
-
-			if (eval_modrm_addr(emu_env, &rm)) 
-			{
-				// Destination is a memory
-				uintptr_t guest_linear_addr = rm;
-				mem_access_env_t env = {
-					.hvaddr = (void*)emu_env->src.reg_hvaddr,
-					.gaddr = guest_linear_addr,
-					.seg = emu_env->seg,
-					.size = operand_size,
-					.mode = HPT_PROT_WRITE_MASK,
-					.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
-				};
-
-				emu_env->dst.type = OPERAND_MEM;
-				emu_env->dst.operand_size = operand_size;
-				emu_env->dst.mem.seg = emu_env->seg;
-				emu_env->dst.mem.offset = guest_linear_addr;
-				emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
-
-
-				// ret = access_memory_gv(&emu_env->ctx_pair, &env);
-                // if(ret)
-                // {
-                //     printf("[X86-VMX Emulator] Emulate mov write error!\n");
-                //     status = -1;
-                //     goto L0x89_out;
-                // }
-			} else {
-				// Destination is a register
-				emu_env->dst.type = OPERAND_REG;
-				emu_env->dst.operand_size = operand_size;
-				emu_env->dst.reg_hvaddr = rm;
-
-				// memcpy((void *)rm, (void*)emu_env->src.reg_hvaddr, operand_size);
-			}
-		}
-
-        // On success
-        status = 0;
-
-L0x89_out:
+		status = emulate_form(emu_env, EMU_FORM_MOV_EV_GV);
 		break;
-    }
 	case 0x8a: _emu_unimplemented_inst_print(emu_env); break;
 	case 0x8b:	/* MOV Gv, Ev */
-    {
-		HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
 		parse_postfix(emu_env, true, false, 0, 0);
-		{
-            int ret = 0;
-			size_t operand_size = get_operand_size(emu_env);
-			uintptr_t rm;	/* r */
-
-			emu_env->dst.type = OPERAND_REG;
-			emu_env->dst.operand_size = operand_size;
-			emu_env->dst.reg_hvaddr = (hva_t)eval_modrm_reg(emu_env);	/* w */
-
-			if (eval_modrm_addr(emu_env, &rm)) 
-			{
-				// Source is a memory
-				uintptr_t guest_linear_addr = rm;
-				mem_access_env_t env = {
-					.hvaddr = (void*)emu_env->dst.reg_hvaddr,
-					.gaddr = guest_linear_addr,
-					.seg = emu_env->seg,
-					.size = operand_size,
-					.mode = HPT_PROT_READ_MASK,
-					.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
-				};
-
-				emu_env->src.type = OPERAND_MEM;
-				emu_env->src.operand_size = operand_size;
-				emu_env->src.mem.seg = emu_env->seg;
-				emu_env->src.mem.offset = guest_linear_addr;
-				emu_env->src.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
-				ret = eval_operand_value(emu_env, &emu_env->src);
-				if(ret)
-				{
-					printf("[X86-VMX Emulator] Emulate mov read's memory source operand error!\n");
-					status = -1;
-					goto L0x8b_out;
-				}
-
-
-				// ret = access_memory_gv(&emu_env->ctx_pair, &env);
-                // if(ret)
-                // {
-                //     printf("[X86-VMX Emulator] Emulate mov read error!\n");
-                //     status = -1;
-                //     goto L0x8b_out;
-                // }
-			} else {
-				// Source is a register
-				emu_env->src.type = OPERAND_REG;
-				emu_env->src.operand_size = operand_size;
-				emu_env->src.reg_hvaddr = rm;
-				ret = eval_operand_value(emu_env, &emu_env->src);
-				if(ret)
-				{
-					printf("[X86-VMX Emulator] Emulate mov read's register source operand error!\n");
-					status = -1;
-					goto L0x8b_out;
-				}
-
-				// memcpy(reg, (void *)rm, operand_size);
-			}
-		}
-
-		// On success
-        status = 0;
-
-L0x8b_out:
+		status = emulate_form(emu_env, EMU_FORM_MOV_GV_EV);
 		break;
-    }
 	case 0x8c: _emu_unimplemented_inst_print(emu_env); break;
 	case 0x8d: _emu_unimplemented_inst_print(emu_env); break;
 	case 0x8e: _emu_unimplemented_inst_print(emu_env); break;
@@ -1552,64 +1678,9 @@ L0x8b_out:
 	case 0xa1:	/* MOV rAX, Ov */
 	case 0xa2:	/* MOV Ob, AL */
 	case 0xa3:	/* MOV Ov, rAX */
-    {
-		HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
-		{
-            int ret = 0;
-			size_t address_size = get_address_size(emu_env);
-			size_t operand_size = (opcode & 1) ? get_operand_size(emu_env) : 1;
-			mem_access_env_t env;
-			uintptr_t guest_linear_addr = 0;
-
-			emu_env->src.type = OPERAND_REG;
-			emu_env->src.operand_size = operand_size;
-			emu_env->src.reg_hvaddr = (hva_t)get_reg_ptr(emu_env, CPU_REG_AX, operand_size);
-			ret = eval_operand_value(emu_env, &emu_env->src);
-			if(ret)
-			{
-				printf("[X86-VMX Emulator] Emulate mov read's AX source operand error!\n");
-				status = -1;
-				goto L0xa3_out;
-			}
-
-
-			parse_postfix(emu_env, false, false, 0, address_size);
-			compute_segment(emu_env, CPU_REG_AX);
-			env = (mem_access_env_t){
-				.hvaddr = get_reg_ptr(emu_env, CPU_REG_AX, operand_size),
-				.gaddr = 0,
-				.seg = emu_env->seg,
-				.size = operand_size,
-				.mode = (opcode & 2) ? HPT_PROT_WRITE_MASK : HPT_PROT_READ_MASK,
-				.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
-			};
-			zero_extend(&env.gaddr, emu_env->postfix.immediate,
-						sizeof(env.gaddr), address_size);
-
-			guest_linear_addr = env.gaddr;
-			emu_env->dst.type = OPERAND_MEM;
-			emu_env->dst.operand_size = operand_size;
-			emu_env->dst.mem.seg = emu_env->seg;
-			emu_env->dst.mem.offset = guest_linear_addr;
-			emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
-
-			// ret = access_memory_gv(&emu_env->ctx_pair, &env);
-            // if(ret)
-            // {
-            //     printf("[X86-VMX Emulator] Emulate mov write offset error!\n");
-            //     status = -1;
-            //     goto L0xa3_out;
-            // }
-		}
-        
-        // On success
-        status = 0;
-
-L0xa3_out:
-        break;
-    }
+		parse_postfix(emu_env, false, false, 0, get_address_size(emu_env));
+		status = emulate_form(emu_env, EMU_FORM_MOV_MOFFS);
+		break;
 	case 0xa4: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xa5: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xa6: _emu_unimplemented_inst_print(emu_env); break;
@@ -1646,84 +1717,10 @@ L0xa3_out:
 	case 0xc5: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xc6: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xc7:	/* MOV Ev, Iz */
-    {
-		HALT_ON_ERRORCOND(!emu_env->prefix.lock && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repe && "Not implemented");
-		HALT_ON_ERRORCOND(!emu_env->prefix.repne && "Not implemented");
-		if (emu_env->postfix.modrm.regop == 0) {
-			int ret = 0;
-			size_t operand_size = get_operand_size(emu_env);
-			size_t imm_size = MIN(operand_size, BIT_SIZE_32);
-			// u64 imm;
-			// void *pimm;
-			uintptr_t rm;	/* w */
-			parse_postfix(emu_env, true, false, 0, imm_size);
-			// if (operand_size == BIT_SIZE_64) {
-			// 	imm = (int64_t)*(int32_t *)emu_env->postfix.immediate4;
-			// 	pimm = &imm;
-			// } else {
-			// 	pimm = emu_env->postfix.immediate;
-			// }
-
-			emu_env->src.type = OPERAND_IMM;
-			emu_env->src.operand_size = operand_size;
-			ret = eval_operand_value(emu_env, &emu_env->src);
-			if(ret)
-			{
-				printf("[X86-VMX Emulator] Emulate mov write's immediate source operand error!\n");
-				status = -1;
-				goto L0xc7_out;
-			}
-
-			if (eval_modrm_addr(emu_env, &rm)) 
-			{
-				// Destination is a memory
-				uintptr_t guest_linear_addr = rm;
-				mem_access_env_t env = {
-					.hvaddr = (void *)NULL,
-					.gaddr = guest_linear_addr,
-					.seg = emu_env->seg,
-					.size = operand_size,
-					.mode = HPT_PROT_WRITE_MASK,
-					.cpl = emu_env->vcpu->vmcs.guest_CS_selector & 3,
-				};
-
-				emu_env->dst.type = OPERAND_MEM;
-				emu_env->dst.operand_size = operand_size;
-				emu_env->dst.mem.seg = emu_env->seg;
-				emu_env->dst.mem.offset = guest_linear_addr;
-				emu_env->dst.mem.gvaddr = eval_guest_memory_gvaddr(&emu_env->ctx_pair, &env, guest_linear_addr);
-
-
-				// ret = access_memory_gv(&emu_env->ctx_pair, &env);
-                // if(ret)
-                // {
-                //     printf("[X86-VMX Emulator] Emulate mov write immediate error!\n");
-                //     status = -1;
-                //     goto L0xc7_out;
-                // }
-			} 
-			else 
-			{
-				// Destination is a register
-				emu_env->dst.type = OPERAND_REG;
-				emu_env->dst.operand_size = operand_size;
-				emu_env->dst.reg_hvaddr = rm;
-
-				// memcpy((void *)rm, (void *)pimm, operand_size);
-			}
-		} else {
-            printf("[X86-VMX Emulator] Unable to emulate instruction:\n");
-            _print_instruction(emu_env->pinst, emu_env->pinst_len);
-			HALT_ON_ERRORCOND(0 && "Not implemented");
-		}
-
-		// On success
-        status = 0;
-
-L0xc7_out:
-        break;
-    }
+		parse_postfix(emu_env, true, false, 0,
+					  MIN(get_operand_size(emu_env), BIT_SIZE_32));
+		status = emulate_form(emu_env, EMU_FORM_MOV_EV_IZ);
+		break;
 	case 0xc8: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xc9: _emu_unimplemented_inst_print(emu_env); break;
 	case 0xca: _emu_unimplemented_inst_print(emu_env); break;
@@ -1811,45 +1808,179 @@ static void _print_instruction(unsigned char* inst, uint32_t inst_len)
 	printf("\n");
 }
 
-int x86_vmx_emulate_instruction(VCPU * vcpu, struct regs *r, emu_env_t* emu_env, unsigned char* inst, uint32_t inst_len)
+/*
+ * Decoded instruction cache
+ *
+ * Guests that trap repeatedly on the same instruction (e.g. an MMIO register
+ * access in a region protected by a hypapp) used to pay the full decode in
+ * parse_prefix() / parse_opcode_one() / parse_postfix() at every trap. Each
+ * VCPU caches the decoding result in vcpu->vmx_emu_cache, a direct mapped
+ * cache indexed by RIP and a hash of the instruction bytes. An entry matches
+ * when guest CR3, RIP, CPU mode (g64, cs_d) and the instruction bytes are
+ * all the same. On a hit, x86_vmx_emulate_instruction() restores prefixes and
+ * postfixes from the entry and goes directly to operand evaluation.
+ *
+ * Callers fetch the instruction bytes from guest memory at every trap, and
+ * the bytes are compared in full. So when the code page is written (by the
+ * guest or by XMHF), the entry no longer matches and is replaced. No other
+ * invalidation is needed because decoding does not depend on guest memory or
+ * page tables.
+ *
+ * Only instructions decoded by the generic path (see enum emu_form) are
+ * cached. Instructions matched byte by byte in parse_opcode_*() are not.
+ */
+
+/* FNV-1a hash of instruction bytes */
+static u32 emu_cache_hash(unsigned char *inst, uint32_t inst_len)
 {
-    int ret = 0;
+	u32 hash = 2166136261U;
+	uint32_t i;
+	for (i = 0; i < inst_len; i++) {
+		hash ^= inst[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
 
-	// Check: Parameters must be valid
-	if(!vcpu || !r || !emu_env || !inst || !inst_len)
-		return -1;
+static emu_cache_entry_t *emu_cache_slot(VCPU *vcpu, u64 rip, u32 hash)
+{
+	return &vcpu->vmx_emu_cache[(rip ^ hash) & (VMX_EMU_CACHE_SIZE - 1)];
+}
 
-    memset(emu_env, 0, sizeof(emu_env_t));
+/*
+ * Look up the decoded instruction cache. If hit, restore the decoding result
+ * to emu_env and return the form. Otherwise return EMU_FORM_NONE.
+ */
+static u8 emu_cache_lookup(emu_env_t *emu_env, unsigned char *inst,
+						   uint32_t inst_len, u32 hash, u64 cr3, u64 rip)
+{
+	VCPU *vcpu = emu_env->vcpu;
+	emu_cache_entry_t *entry = emu_cache_slot(vcpu, rip, hash);
+
+	if (!entry->valid || entry->hash != hash || entry->rip != rip ||
+		entry->cr3 != cr3 || entry->inst_len != inst_len ||
+		entry->g64 != emu_env->g64 || entry->cs_d != emu_env->cs_d ||
+		memcmp(entry->inst, inst, inst_len) != 0) {
+		vcpu->vmx_emu_cache_misses++;
+		return EMU_FORM_NONE;
+	}
+	vcpu->vmx_emu_cache_hits++;
+
+	emu_env->opcode = entry->opcode;
+	emu_env->prefix.seg = entry->prefix_seg;
+	emu_env->prefix.lock = !!(entry->prefix_bits & EMU_PREFIX_LOCK);
+	emu_env->prefix.repe = !!(entry->prefix_bits & EMU_PREFIX_REPE);
+	emu_env->prefix.repne = !!(entry->prefix_bits & EMU_PREFIX_REPNE);
+	emu_env->prefix.opsize = !!(entry->prefix_bits & EMU_PREFIX_OPSIZE);
+	emu_env->prefix.addrsize = !!(entry->prefix_bits & EMU_PREFIX_ADDRSIZE);
+	emu_env->prefix.rex.raw = entry->rex;
+	emu_env->postfix.modrm.raw = entry->modrm;
+	emu_env->postfix.sib.raw = entry->sib;
+	if (entry->disp_len) {
+		emu_env->postfix.displacement = inst + entry->disp_off;
+	}
+	if (entry->imm_len) {
+		emu_env->postfix.immediate = inst + entry->imm_off;
+	}
+	emu_env->displacement_len = entry->disp_len;
+	emu_env->immediate_len = entry->imm_len;
+	emu_env->pinst = inst + inst_len;
+	emu_env->pinst_len = 0;
+	return entry->form;
+}
 
+/* Store the decoding result in emu_env to the decoded instruction cache */
+static void emu_cache_fill(emu_env_t *emu_env, unsigned char *inst,
+						   uint32_t inst_len, u32 hash, u64 cr3, u64 rip)
+{
+	emu_cache_entry_t *entry = emu_cache_slot(emu_env->vcpu, rip, hash);
+	prefix_t *prefix = &emu_env->prefix;
+
+	entry->valid = true;
+	entry->g64 = emu_env->g64;
+	entry->cs_d = emu_env->cs_d;
+	entry->inst_len = inst_len;
+	entry->form = emu_env->form;
+	entry->opcode = emu_env->opcode;
+	entry->prefix_seg = prefix->seg;
+	entry->prefix_bits = (prefix->lock ? EMU_PREFIX_LOCK : 0) |
+						 (prefix->repe ? EMU_PREFIX_REPE : 0) |
+						 (prefix->repne ? EMU_PREFIX_REPNE : 0) |
+						 (prefix->opsize ? EMU_PREFIX_OPSIZE : 0) |
+						 (prefix->addrsize ? EMU_PREFIX_ADDRSIZE : 0);
+	entry->rex = prefix->rex.raw;
+	entry->modrm = emu_env->postfix.modrm.raw;
+	entry->sib = emu_env->postfix.sib.raw;
+	entry->disp_len = emu_env->displacement_len;
+	entry->disp_off = emu_env->displacement_len ?
+					  emu_env->postfix.displacement - inst : 0;
+	entry->imm_len = emu_env->immediate_len;
+	entry->imm_off = emu_env->immediate_len ?
+					 emu_env->postfix.immediate - inst : 0;
+	entry->hash = hash;
+	entry->cr3 = cr3;
+	entry->rip = rip;
+	memcpy(entry->inst, inst, inst_len);
+}
+
+void x86_vmx_emulate_cache_print_stats(VCPU * vcpu)
+{
+	printf("CPU(0x%02x): emulator decode cache: hit=%llu miss=%llu\n",
+		   vcpu->id, vcpu->vmx_emu_cache_hits, vcpu->vmx_emu_cache_misses);
+}
+
+/*
+ * Initialize emu_env. Only the fields read before being written are reset,
+ * src and dst are returned to callers.
+ */
+static void emu_env_init(VCPU * vcpu, struct regs *r, emu_env_t* emu_env)
+{
 	emu_env->vcpu = vcpu;
 	emu_env->r = r;
-	_prefix_init(&emu_env->prefix);
 	guestmem_init(vcpu, &emu_env->ctx_pair);
 	emu_env->g64 = VCPU_g64(vcpu);
 	emu_env->cs_d = !!(vcpu->vmcs.guest_CS_access_rights & (1 << 14));
+	memset(&emu_env->src, 0, sizeof(emu_env->src));
+	memset(&emu_env->dst, 0, sizeof(emu_env->dst));
+	_prefix_init(&emu_env->prefix);
+	memset(&emu_env->postfix, 0, sizeof(emu_env->postfix));
 	emu_env->seg = CPU_SEG_UNKNOWN;
+	emu_env->displacement_len = 0;
+	emu_env->immediate_len = 0;
+	emu_env->opcode = 0;
+	emu_env->form = EMU_FORM_NONE;
+}
+
+int x86_vmx_emulate_instruction(VCPU * vcpu, struct regs *r, emu_env_t* emu_env, unsigned char* inst, uint32_t inst_len)
+{
+    int ret = 0;
+	bool cacheable;
+	u32 hash = 0;
+	u64 cr3 = 0;
+	u64 rip = 0;
+	u8 form = EMU_FORM_NONE;
+
+	// Check: Parameters must be valid
+	if(!vcpu || !r || !emu_env || !inst || !inst_len)
+		return -1;
 
-	// /* Fetch instruction */
-	// HALT_ON_ERRORCOND(inst_len < INST_LEN_MAX);
-	// {
-	// 	mem_access_env_t env = {
-	// 		.hvaddr = inst,
-	// 		.gaddr = rip,
-	// 		.seg = CPU_SEG_CS,
-	// 		.size = inst_len,
-	// 		.mode = HPT_PROT_EXEC_MASK,
-	// 		.cpl = vcpu->vmcs.guest_CS_selector & 3,
-	// 	};
-
-	// 	ret = access_memory_gv(&emu_env->ctx_pair, &env);
-    //     if(ret)
-    //     {
-    //         printf("[X86-VMX Emulator] Failed to read current domain's instruction at gvaddr:0x%lX!\n", rip);
-    //         goto read_inst_err;
-    //     }
-	// }
-	// printf("CPU(0x%02x): emulation: %d 0x%llx\n", vcpu->id, inst_len,
-	// 	   *(u64 *)inst);
+	emu_env_init(vcpu, r, emu_env);
+
+	/* Look up decoded instruction cache */
+	cacheable = inst_len <= VMX_EMU_INST_LEN_MAX;
+	if (cacheable) {
+		hash = emu_cache_hash(inst, inst_len);
+		cr3 = vcpu->vmcs.guest_CR3;
+		rip = VCPU_grip(vcpu);
+		form = emu_cache_lookup(emu_env, inst, inst_len, hash, cr3, rip);
+	}
+	if (form != EMU_FORM_NONE) {
+		ret = emulate_form(emu_env, form);
+		if (ret) {
+			goto emu_inst_fail;
+		}
+		return 0;
+	}
 
 	/* Parse prefix and opcode */
 	emu_env->pinst = inst;
@@ -1859,11 +1990,13 @@ int x86_vmx_emulate_instruction(VCPU * vcpu, struct regs *r, emu_env_t* emu_env,
 	ret = parse_opcode_one(emu_env);
     if(ret)
     {
-		printf("[X86-VMX Emulator] Failed to emulate the instruction at gvaddr:0x%lX. Instruction: ", vcpu->vmcs.guest_RIP);
-		_print_instruction(inst, inst_len);
-        goto emu_inst_err;
+        goto emu_inst_fail;
     }
 
+	if (cacheable && emu_env->form != EMU_FORM_NONE) {
+		emu_cache_fill(emu_env, inst, inst_len, hash, cr3, rip);
+	}
+
 	// // TODO: Should not increase RIP if string instrcution
 	// HALT_ON_ERRORCOND(!emu_env->prefix.repe && !emu_env->prefix.repne);
 	// vcpu->vmcs.guest_RIP += inst_len;
@@ -1871,7 +2004,8 @@ int x86_vmx_emulate_instruction(VCPU * vcpu, struct regs *r, emu_env_t* emu_env,
     // On success
     return 0;
 
-emu_inst_err:
-// read_inst_err:
+emu_inst_fail:
+	printf("[X86-VMX Emulator] Failed to emulate the instruction at gvaddr:0x%lX. Instruction: ", vcpu->vmcs.guest_RIP);
+	_print_instruction(inst, inst_len);
     return -1;
 }
\ No newline at end of file
@@ -93,18 +93,54 @@ void xmhf_memprot_flushmappings_localtlb(VCPU *vcpu, u32 flags)
     xmhf_memprot_arch_flushmappings_localtlb(vcpu, flags);
 }
 
+// flush the TLB of all nested page tables in the current core, only entries
+// for guest physical addresses in [gpa_lo, gpa_hi) changed
+void xmhf_memprot_flushmappings_localtlb_range(VCPU *vcpu, u32 flags,
+                                               u64 gpa_lo, u64 gpa_hi)
+{
+    xmhf_memprot_arch_flushmappings_localtlb_range(vcpu, flags, gpa_lo, gpa_hi);
+}
+
 // flush the TLB of all nested page tables in all cores
 // Requirement: Other cores has been quiesced
 void xmhf_memprot_flushmappings_alltlb(VCPU *vcpu, u32 flags)
+{
+    xmhf_memprot_flushmappings_alltlb_range(vcpu, flags,
+                                            MEMP_FLUSHTLB_GPA_LO_ALL,
+                                            MEMP_FLUSHTLB_GPA_HI_ALL);
+}
+
+// flush the TLB of all nested page tables in all cores, only entries for guest
+// physical addresses in [gpa_lo, gpa_hi) changed
+// Requirement: Other cores has been quiesced
+void xmhf_memprot_flushmappings_alltlb_range(VCPU *vcpu, u32 flags,
+                                             u64 gpa_lo, u64 gpa_hi)
 {
     HALT_ON_ERRORCOND(g_vmx_quiesce);
 
-    // Notice all cores to flush EPT TLB
-    g_vmx_flush_all_tlb_signal = flags;
+    // Notice all cores to flush EPT TLB. If called multiple times during one
+    // quiesce, merge the flags and the address ranges.
+    g_vmx_flush_all_tlb_signal |= flags;
+    if (gpa_lo < g_vmx_flush_all_tlb_gpa_lo) {
+        g_vmx_flush_all_tlb_gpa_lo = gpa_lo;
+    }
+    if (gpa_hi > g_vmx_flush_all_tlb_gpa_hi) {
+        g_vmx_flush_all_tlb_gpa_hi = gpa_hi;
+    }
 
     // TODO: can move this call to xmhf_smpguest_arch_x86vmx_endquiesce(), save
     // a little bit of time.
-    xmhf_memprot_flushmappings_localtlb(vcpu, flags);
+    xmhf_memprot_flushmappings_localtlb_range(vcpu, flags, gpa_lo, gpa_hi);
+}
+
+// flush the TLB of all nested page tables in cores in cpus (all cores if
+// NULL), only entries for guest physical addresses in [gpa_lo, gpa_hi) changed
+// Other cores do not need to be quiesced
+void xmhf_memprot_flushmappings_shootdown(VCPU *vcpu, const memp_cpuset_t *cpus,
+                                          u32 flags, u64 gpa_lo, u64 gpa_hi)
+{
+    xmhf_memprot_arch_flushmappings_shootdown(vcpu, cpus, flags, gpa_lo,
+                                              gpa_hi);
 }
 
 // set protection for a given physical memory address
@@ -133,6 +169,29 @@ u32 xmhf_memprot_getprot(VCPU *vcpu, u64 gpa)
     return xmhf_memprot_arch_getprot(vcpu, gpa);
 }
 
+// split large pages so that gpa is mapped by a 4K page
+void xmhf_memprot_split_page(VCPU *vcpu, u64 gpa)
+{
+    xmhf_memprot_arch_split_page(vcpu, gpa);
+}
+
+// merge page tables mapping [gpa_lo, gpa_hi) into large pages when possible
+void xmhf_memprot_coalesce_range(VCPU *vcpu, u64 gpa_lo, u64 gpa_hi)
+{
+    xmhf_memprot_arch_coalesce_range(vcpu, gpa_lo, gpa_hi);
+}
+
+// bracket direct modifications to the nested page table
+void xmhf_memprot_write_begin(VCPU *vcpu, bool lock)
+{
+    xmhf_memprot_arch_write_begin(vcpu, lock);
+}
+
+void xmhf_memprot_write_end(VCPU *vcpu)
+{
+    xmhf_memprot_arch_write_end(vcpu);
+}
+
 // Is the given system paddr belong to mHV (XMHF + hypapp)?
 bool xmhf_is_mhv_memory(spa_t spa)
 {
@@ -157,14 +216,6 @@ int xmhf_memprot_emulate_guest_instruction(VCPU *vcpu, struct regs *r, emu_env_t
     return x86_vmx_emulate_instruction(vcpu, r, emu_env, inst, inst_len);
 }
 
-#ifdef __I386__
-#define X86_INST_MAX_LEN 9
-#elif defined(__AMD64__)
-#define X86_INST_MAX_LEN 15
-#else
-#error "Unsupported Arch"
-#endif /* __I386__ */
-
 int xmhf_memprot_emulate_guest_ring0_read_size(VCPU *vcpu, struct regs *r, size_t *out_operand_size)
 {
     int status = 0;
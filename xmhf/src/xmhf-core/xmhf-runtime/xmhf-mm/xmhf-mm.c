@@ -6,7 +6,81 @@
 static u8 g_xmhf_heap[XMHF_HEAP_SIZE] __attribute__((aligned(PAGE_SIZE_4K)));
 static xmhf_tlsf_pool g_pool;
 
-// [Ticket 156][TODO] [SecBase][SecOS] Use Slab + Page Allocator to save memory space
+/* Lock for g_pool, because TLSF is not thread safe */
+static volatile u32 g_pool_lock = 1;
+
+/*
+ * Allocations are served by three layers, selected by _size_class():
+ * * Object slab: requests up to 2048 bytes are rounded up to a power of 2
+ *   size class. Objects of a class are carved from pages of the page slab.
+ *   Each CPU keeps a magazine (free list) per class, which is refilled from
+ *   and drained to a global depot in batches.
+ * * Page slab: single 4K page requests. This is also the page cache used by
+ *   xmhf_mm_pcpu_alloc_page() and xmhf_mm_pcpu_free_page().
+ * * TLSF (g_pool): everything else.
+ *
+ * xmhf_mm_free() finds the layer of a pointer in g_page_type, which records
+ * the owner of each 4K page of g_xmhf_heap. Pages given to the slabs are
+ * never returned to g_pool.
+ *
+ * xmhf_mm_malloc() and friends do not take a CPU argument. The CPU is found
+ * from the stack pointer when running on a runtime stack in g_cpustacks (see
+ * _this_cpu()). Otherwise (e.g. on the init stack during early boot), the
+ * global depot and page list are used directly under their locks.
+ */
+
+/*
+ * Page cache for xmhf_mm_pcpu_alloc_page() and xmhf_mm_pcpu_free_page().
+ *
+ * Free pages are linked through their first word. Each CPU keeps a private
+ * list (no locking needed). When the private list is empty, a batch of pages
+ * is moved from the global list (or carved from g_pool) to it. When the
+ * private list is full, a batch of pages is moved to the global list. Pages
+ * in the cache are never returned to g_pool.
+ */
+#define XMHF_MM_PCPU_PAGES_MAX		64
+#define XMHF_MM_PCPU_PAGES_BATCH	16
+
+/*
+ * Magazine size of a slab class is XMHF_MM_MAG_BYTES worth of objects,
+ * clamped to [XMHF_MM_MAG_MIN, XMHF_MM_MAG_MAX] objects. Half of it is moved
+ * to or from the depot at a time.
+ */
+#define XMHF_MM_MAG_BYTES			8192
+#define XMHF_MM_MAG_MIN				4
+#define XMHF_MM_MAG_MAX				64
+
+/* Page owners in g_page_type: 0 for TLSF, otherwise size class + 1 */
+#define XMHF_MM_PAGE_TLSF			0
+
+/* Number of buckets of the allocation record hash (power of 2) */
+#define XMHF_MM_RECORD_HASH_BITS	10
+#define XMHF_MM_RECORD_HASH_SIZE	(1U << XMHF_MM_RECORD_HASH_BITS)
+
+/* Free list of pages or slab objects, linked through their first word */
+typedef struct {
+	void *head;
+	u32 count;
+} xmhf_mm_free_list_t;
+
+static u8 g_page_type[XMHF_HEAP_SIZE >> PAGE_SHIFT_4K];
+
+static xmhf_mm_free_list_t g_pcpu_pages[MAX_VCPU_ENTRIES];
+static xmhf_mm_free_list_t g_global_pages;
+static volatile u32 g_global_pages_lock = 1;
+
+static xmhf_mm_free_list_t g_pcpu_objs[MAX_VCPU_ENTRIES][XMHF_MM_SLAB_CLASSES];
+static xmhf_mm_free_list_t g_depot_objs[XMHF_MM_SLAB_CLASSES];
+static volatile u32 g_depot_lock = 1;
+
+/*
+ * Statistics, one row per CPU so that no locking is needed. The last row is
+ * for code not running on a runtime stack.
+ */
+static xmhf_mm_stats_t g_stats[MAX_VCPU_ENTRIES + 1][XMHF_MM_NUM_CLASSES];
+
+static struct xmhf_mm_alloc_info *g_record_hash[XMHF_MM_RECORD_HASH_SIZE];
+static volatile u32 g_record_lock = 1;
 
 void xmhf_mm_init(void)
 {
@@ -22,14 +96,294 @@ void xmhf_mm_fini(void)
 	}
 }
 
+/*
+ * Return the index of the current CPU, found from the stack pointer. Return
+ * MAX_VCPU_ENTRIES if not running on a runtime stack.
+ */
+static inline u32 _this_cpu(void)
+{
+	hva_t offset = (hva_t)__builtin_frame_address(0) - (hva_t)g_cpustacks;
+	if (offset < (hva_t)RUNTIME_STACK_SIZE * MAX_VCPU_ENTRIES) {
+		return offset / RUNTIME_STACK_SIZE;
+	}
+	return MAX_VCPU_ENTRIES;
+}
+
+/* Return the size class (XMHF_MM_*) of an allocation */
+static inline u32 _size_class(uint32_t alignment, size_t size)
+{
+	size_t need = (size > alignment) ? size : alignment;
+	u32 c = 0;
+
+	if (size == 0) {
+		/* Keep the behavior of TLSF */
+		return XMHF_MM_CLASS_LARGE;
+	}
+	if (need <= (1UL << XMHF_MM_SLAB_MAX_SHIFT)) {
+		while ((1UL << (c + XMHF_MM_SLAB_MIN_SHIFT)) < need) {
+			c++;
+		}
+		return c;
+	}
+	if (size <= PAGE_SIZE_4K && alignment <= PAGE_SIZE_4K) {
+		return XMHF_MM_CLASS_PAGE;
+	}
+	return XMHF_MM_CLASS_LARGE;
+}
+
+/* Return the magazine size of slab class c */
+static inline u32 _mag_max(u32 c)
+{
+	u32 ans = XMHF_MM_MAG_BYTES >> (c + XMHF_MM_SLAB_MIN_SHIFT);
+	if (ans < XMHF_MM_MAG_MIN) {
+		return XMHF_MM_MAG_MIN;
+	}
+	if (ans > XMHF_MM_MAG_MAX) {
+		return XMHF_MM_MAG_MAX;
+	}
+	return ans;
+}
+
+/* Return the owner of the page containing ptr */
+static inline u8 _get_page_type(void *ptr)
+{
+	hva_t offset = (hva_t)ptr - (hva_t)g_xmhf_heap;
+	if (offset >= XMHF_HEAP_SIZE) {
+		return XMHF_MM_PAGE_TLSF;
+	}
+	return g_page_type[offset >> PAGE_SHIFT_4K];
+}
+
+static inline void _set_page_type(void *page, u32 num_pages, u8 type)
+{
+	hva_t offset = (hva_t)page - (hva_t)g_xmhf_heap;
+	u32 i;
+	for (i = 0; i < num_pages; i++) {
+		g_page_type[(offset >> PAGE_SHIFT_4K) + i] = type;
+	}
+}
+
+static inline void _list_push(xmhf_mm_free_list_t *list, void *p)
+{
+	*(void **)p = list->head;
+	list->head = p;
+	list->count++;
+}
+
+static inline void *_list_pop(xmhf_mm_free_list_t *list)
+{
+	void *p = list->head;
+	if (p) {
+		list->head = *(void **)p;
+		list->count--;
+	}
+	return p;
+}
+
+/*
+ * Carve a batch of XMHF_MM_PCPU_PAGES_BATCH pages (or a single page if the
+ * heap cannot satisfy a whole batch) from g_pool into the page slab, and add
+ * them to list.
+ */
+static void _page_slab_grow(u32 cpu, xmhf_mm_free_list_t *list)
+{
+	u32 num_pages = XMHF_MM_PCPU_PAGES_BATCH;
+	u8 *pages;
+	u32 i;
+
+	spin_lock(&g_pool_lock);
+	pages = xmhf_tlsf_memalign(g_pool, PAGE_SIZE_4K, num_pages * PAGE_SIZE_4K);
+	if (pages == NULL) {
+		num_pages = 1;
+		pages = xmhf_tlsf_memalign(g_pool, PAGE_SIZE_4K, PAGE_SIZE_4K);
+	}
+	spin_unlock(&g_pool_lock);
+	if (pages == NULL) {
+		return;
+	}
+
+	_set_page_type(pages, num_pages, XMHF_MM_CLASS_PAGE + 1);
+	for (i = 0; i < num_pages; i++) {
+		_list_push(list, pages + i * PAGE_SIZE_4K);
+	}
+	g_stats[cpu][XMHF_MM_CLASS_PAGE].pages += num_pages;
+}
+
+/*
+ * Refill the page cache of CPU cpu with up to XMHF_MM_PCPU_PAGES_BATCH pages.
+ * Pages are taken from the global list first. If the global list is empty,
+ * new pages are carved from g_pool.
+ */
+static void _pcpu_refill(u32 cpu)
+{
+	xmhf_mm_free_list_t *list = &g_pcpu_pages[cpu];
+	u32 i;
+
+	spin_lock(&g_global_pages_lock);
+	for (i = 0; i < XMHF_MM_PCPU_PAGES_BATCH; i++) {
+		void *page = _list_pop(&g_global_pages);
+		if (page == NULL) {
+			break;
+		}
+		_list_push(list, page);
+	}
+	spin_unlock(&g_global_pages_lock);
+	g_stats[cpu][XMHF_MM_CLASS_PAGE].refills++;
+
+	if (list->count == 0) {
+		_page_slab_grow(cpu, list);
+	}
+}
+
+/* Get a page from the page slab, not zeroed. cpu may be MAX_VCPU_ENTRIES. */
+static void *_page_get(u32 cpu)
+{
+	void *page;
+
+	if (cpu < MAX_VCPU_ENTRIES) {
+		if (g_pcpu_pages[cpu].count == 0) {
+			_pcpu_refill(cpu);
+		}
+		return _list_pop(&g_pcpu_pages[cpu]);
+	}
+
+	spin_lock(&g_global_pages_lock);
+	if (g_global_pages.count == 0) {
+		_page_slab_grow(cpu, &g_global_pages);
+	}
+	page = _list_pop(&g_global_pages);
+	spin_unlock(&g_global_pages_lock);
+	return page;
+}
+
+/* Return a page to the page slab. cpu may be MAX_VCPU_ENTRIES. */
+static void _page_put(u32 cpu, void *page)
+{
+	xmhf_mm_free_list_t *list;
+
+	HALT_ON_ERRORCOND(PAGE_ALIGNED_4K((hva_t)page));
+	if (cpu >= MAX_VCPU_ENTRIES) {
+		spin_lock(&g_global_pages_lock);
+		_list_push(&g_global_pages, page);
+		spin_unlock(&g_global_pages_lock);
+		return;
+	}
+
+	list = &g_pcpu_pages[cpu];
+	if (list->count >= XMHF_MM_PCPU_PAGES_MAX) {
+		u32 i;
+		spin_lock(&g_global_pages_lock);
+		for (i = 0; i < XMHF_MM_PCPU_PAGES_BATCH; i++) {
+			_list_push(&g_global_pages, _list_pop(list));
+		}
+		spin_unlock(&g_global_pages_lock);
+	}
+	_list_push(list, page);
+}
+
+/*
+ * Carve a page from the page slab into objects of slab class c and add them
+ * to the depot. Must hold g_depot_lock. Return false if out of memory.
+ */
+static bool _obj_slab_grow(u32 cpu, u32 c)
+{
+	size_t size = 1UL << (c + XMHF_MM_SLAB_MIN_SHIFT);
+	u8 *page = _page_get(cpu);
+	size_t offset;
+
+	if (page == NULL) {
+		return false;
+	}
+	_set_page_type(page, 1, c + 1);
+	for (offset = 0; offset < PAGE_SIZE_4K; offset += size) {
+		_list_push(&g_depot_objs[c], page + offset);
+	}
+	g_stats[cpu][c].pages++;
+	return true;
+}
+
+/* Allocate an object of slab class c, not zeroed */
+static void *_obj_alloc(u32 cpu, u32 c)
+{
+	xmhf_mm_free_list_t *depot = &g_depot_objs[c];
+	xmhf_mm_free_list_t *mag;
+	void *p;
+
+	if (cpu >= MAX_VCPU_ENTRIES) {
+		spin_lock(&g_depot_lock);
+		if (depot->count == 0) {
+			_obj_slab_grow(cpu, c);
+		}
+		p = _list_pop(depot);
+		spin_unlock(&g_depot_lock);
+		return p;
+	}
+
+	mag = &g_pcpu_objs[cpu][c];
+	if (mag->count == 0) {
+		u32 batch = _mag_max(c) / 2;
+		u32 i;
+		spin_lock(&g_depot_lock);
+		while (depot->count < batch && _obj_slab_grow(cpu, c)) {
+		}
+		for (i = 0; i < batch && depot->count > 0; i++) {
+			_list_push(mag, _list_pop(depot));
+		}
+		spin_unlock(&g_depot_lock);
+		g_stats[cpu][c].refills++;
+	}
+	return _list_pop(mag);
+}
+
+/* Free an object of slab class c */
+static void _obj_free(u32 cpu, u32 c, void *p)
+{
+	xmhf_mm_free_list_t *depot = &g_depot_objs[c];
+	xmhf_mm_free_list_t *mag;
+
+	HALT_ON_ERRORCOND(((hva_t)p & ((1UL << (c + XMHF_MM_SLAB_MIN_SHIFT)) - 1))
+					  == 0);
+	if (cpu >= MAX_VCPU_ENTRIES) {
+		spin_lock(&g_depot_lock);
+		_list_push(depot, p);
+		spin_unlock(&g_depot_lock);
+		return;
+	}
+
+	mag = &g_pcpu_objs[cpu][c];
+	if (mag->count >= _mag_max(c)) {
+		u32 batch = _mag_max(c) / 2;
+		u32 i;
+		spin_lock(&g_depot_lock);
+		for (i = 0; i < batch; i++) {
+			_list_push(depot, _list_pop(mag));
+		}
+		spin_unlock(&g_depot_lock);
+	}
+	_list_push(mag, p);
+}
+
 void* xmhf_mm_malloc_align(uint32_t alignment, size_t size)
 {
+	u32 cpu = _this_cpu();
+	u32 c = _size_class(alignment, size);
 	void *p = NULL;
 
-	p = xmhf_tlsf_memalign(g_pool, alignment, size);
+	if (c < XMHF_MM_SLAB_CLASSES) {
+		p = _obj_alloc(cpu, c);
+	} else if (c == XMHF_MM_CLASS_PAGE) {
+		p = _page_get(cpu);
+	} else {
+		spin_lock(&g_pool_lock);
+		p = xmhf_tlsf_memalign(g_pool, alignment, size);
+		spin_unlock(&g_pool_lock);
+	}
 
 	if(p)
+	{
+		g_stats[cpu][c].allocs++;
 		memset(p, 0, size);
+	}
 	return p;
 }
 
@@ -46,7 +400,115 @@ void* xmhf_mm_alloc_page(uint32_t num_pages)
 
 void xmhf_mm_free(void* ptr)
 {
-	xmhf_tlsf_free(g_pool, ptr);
+	u32 cpu = _this_cpu();
+	u8 type = _get_page_type(ptr);
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (type == XMHF_MM_PAGE_TLSF) {
+		spin_lock(&g_pool_lock);
+		xmhf_tlsf_free(g_pool, ptr);
+		spin_unlock(&g_pool_lock);
+		g_stats[cpu][XMHF_MM_CLASS_LARGE].frees++;
+	} else if (type - 1 < XMHF_MM_SLAB_CLASSES) {
+		_obj_free(cpu, type - 1, ptr);
+		g_stats[cpu][type - 1].frees++;
+	} else {
+		_page_put(cpu, ptr);
+		g_stats[cpu][XMHF_MM_CLASS_PAGE].frees++;
+	}
+}
+
+//! Allocate a 4K page using the page cache of CPU <cpu>. The page is not zeroed.
+//! Return NULL when the heap of XMHF is exhausted. Only CPU <cpu> may call this.
+void* xmhf_mm_pcpu_alloc_page(u32 cpu)
+{
+	void *page;
+
+	HALT_ON_ERRORCOND(cpu < MAX_VCPU_ENTRIES);
+	page = _page_get(cpu);
+	if (page) {
+		g_stats[cpu][XMHF_MM_CLASS_PAGE].allocs++;
+	}
+	return page;
+}
+
+//! Free a page allocated by xmhf_mm_pcpu_alloc_page() to the page cache of CPU
+//! <cpu>. The page may be allocated by another CPU. Only CPU <cpu> may call this.
+void xmhf_mm_pcpu_free_page(u32 cpu, void* page)
+{
+	HALT_ON_ERRORCOND(cpu < MAX_VCPU_ENTRIES);
+	_page_put(cpu, page);
+	g_stats[cpu][XMHF_MM_CLASS_PAGE].frees++;
+}
+
+void xmhf_mm_get_stats(u32 size_class, xmhf_mm_stats_t* stats)
+{
+	u32 i;
+
+	HALT_ON_ERRORCOND(size_class < XMHF_MM_NUM_CLASSES);
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i <= MAX_VCPU_ENTRIES; i++) {
+		stats->allocs += g_stats[i][size_class].allocs;
+		stats->frees += g_stats[i][size_class].frees;
+		stats->refills += g_stats[i][size_class].refills;
+		stats->pages += g_stats[i][size_class].pages;
+	}
+}
+
+void xmhf_mm_print_stats(void)
+{
+	u32 c;
+
+	for (c = 0; c < XMHF_MM_NUM_CLASSES; c++) {
+		xmhf_mm_stats_t stats;
+		xmhf_mm_get_stats(c, &stats);
+		if (c < XMHF_MM_SLAB_CLASSES) {
+			printf("mm: %5lu B:", 1UL << (c + XMHF_MM_SLAB_MIN_SHIFT));
+		} else if (c == XMHF_MM_CLASS_PAGE) {
+			printf("mm:    page:");
+		} else {
+			printf("mm:   large:");
+		}
+		printf(" alloc=%llu free=%llu refill=%llu pages=%llu\n",
+			   stats.allocs, stats.frees, stats.refills, stats.pages);
+	}
+}
+
+static inline u32 _record_bucket(void *hva)
+{
+	return ((u32)((hva_t)hva >> XMHF_MM_SLAB_MIN_SHIFT) * 2654435761U) >>
+		(32 - XMHF_MM_RECORD_HASH_BITS);
+}
+
+static void _record_insert(struct xmhf_mm_alloc_info* record)
+{
+	u32 bucket = _record_bucket(record->hva);
+
+	spin_lock(&g_record_lock);
+	record->hash_next = g_record_hash[bucket];
+	g_record_hash[bucket] = record;
+	spin_unlock(&g_record_lock);
+}
+
+/* Find the record of hva in the record hash and remove it. */
+static struct xmhf_mm_alloc_info* _record_remove(void* hva)
+{
+	struct xmhf_mm_alloc_info** pcur = &g_record_hash[_record_bucket(hva)];
+	struct xmhf_mm_alloc_info* record = NULL;
+
+	spin_lock(&g_record_lock);
+	for (; *pcur != NULL; pcur = &(*pcur)->hash_next) {
+		if ((*pcur)->hva == hva) {
+			record = *pcur;
+			*pcur = record->hash_next;
+			break;
+		}
+	}
+	spin_unlock(&g_record_lock);
+	return record;
 }
 
 //! Allocate an aligned memory from the heap of XMHF. Also it records the allocation in the <mm_alloc_infolist>
@@ -72,7 +534,15 @@ void* xmhf_mm_alloc_align_with_record(XMHFList* mm_alloc_infolist, uint32_t alig
 	record->hva = p;
 	record->alignment = alignment;
 	record->size = size;
-	xmhfstl_list_enqueue(mm_alloc_infolist, record, sizeof(struct xmhf_mm_alloc_info), LIST_ELEM_PTR);
+	record->list = mm_alloc_infolist;
+	record->node = xmhfstl_list_enqueue(mm_alloc_infolist, record, sizeof(struct xmhf_mm_alloc_info), LIST_ELEM_PTR);
+	if(!record->node)
+	{
+		xmhf_mm_free(record);
+		xmhf_mm_free(p);
+		return NULL;
+	}
+	_record_insert(record);
 
 	return p;
 }
@@ -92,28 +562,18 @@ void* xmhf_mm_alloc_page_with_record(XMHFList* mm_alloc_infolist, uint32_t num_p
 //! Free the memory allocated from the heap of XMHF. And also remove the record in the <mm_alloc_infolist>
 void xmhf_mm_free_from_record(XMHFList* mm_alloc_infolist, void* ptr)
 {
-	// void* p = NULL;
 	struct xmhf_mm_alloc_info* record = NULL;
-	XMHFListNode* node = NULL;
 
 	if(!mm_alloc_infolist || !ptr)
 		return;
 
-	{
-		XMHFLIST_FOREACH(mm_alloc_infolist, first, next, cur)
-		{
-			record = (struct xmhf_mm_alloc_info*)cur->value;
-
-			if(record->hva == ptr)
-			{
-				node = cur;
-				break;
-			}
-		}
-		END_XMHFLIST_FOREACH(mm_alloc_infolist);
-	}
+	// The record is found in the record hash, not by searching the list
+	record = _record_remove(ptr);
+	if(!record)
+		return;
+	HALT_ON_ERRORCOND(record->list == mm_alloc_infolist);
 
-	xmhfstl_list_remove(mm_alloc_infolist, node);
+	xmhfstl_list_remove(mm_alloc_infolist, record->node);
 
 	xmhf_mm_free(record->hva);
 	xmhf_mm_free(record);
@@ -132,6 +592,7 @@ void xmhf_mm_free_all_records(XMHFList* mm_alloc_infolist)
 		{
 			record = (struct xmhf_mm_alloc_info*)cur->value;
 
+			HALT_ON_ERRORCOND(_record_remove(record->hva) == record);
 			xmhf_mm_free(record->hva);
 		}
 		END_XMHFLIST_FOREACH(mm_alloc_infolist);
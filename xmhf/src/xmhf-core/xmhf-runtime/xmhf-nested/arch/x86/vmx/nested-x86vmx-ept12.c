@@ -53,11 +53,28 @@
 #include "nested-x86vmx-vmcs12.h"
 
 /*
- * Number of pages in page_pool in ept02_ctx_t.
+ * Maximum number of pages used by an ept02_ctx_t. Pages are allocated on
+ * demand, so this is only an upper bound.
  * This value is configured using --with-vmx-nested-ept02-page-pool-size.
  */
 #define EPT02_PAGE_POOL_SIZE (__VMX_NESTED_EPT02_PAGE_POOL_SIZE__)
 
+/* Number of page tables to free when an EPT02 runs out of pages */
+#define EPT02_EVICT_BATCH ((EPT02_PAGE_POOL_SIZE + 7) / 8)
+
+/*
+ * When filling an EPT02 leaf for a 4K page, also fill the other 4K pages in
+ * the aligned window of this many pages around it, if their EPT12 and EPT01
+ * entries are already present in the same page tables. 0 or 1 disables this.
+ * This value is configured using --with-vmx-nested-ept02-prefetch-window.
+ */
+#define EPT02_PREFETCH_WINDOW (__VMX_NESTED_EPT02_PREFETCH_WINDOW__)
+
+#if EPT02_PREFETCH_WINDOW > 512 || \
+	(EPT02_PREFETCH_WINDOW & (EPT02_PREFETCH_WINDOW - 1)) != 0
+#error "EPT02 prefetch window must be a power of 2 not larger than 512"
+#endif
+
 /*
  * For each CPU, information about all EPT12 -> EPT02 it caches.
  *
@@ -67,50 +84,141 @@
  */
 static ept02_cache_set_t ept02_cache[MAX_VCPU_ENTRIES];
 
-/* Page pool for ept02_cache */
-static u8 ept02_page_pool[MAX_VCPU_ENTRIES][VMX_NESTED_MAX_ACTIVE_EPT]
-	[EPT02_PAGE_POOL_SIZE][PAGE_SIZE_4K]
-	__attribute__((aligned(PAGE_SIZE_4K)));
+/*
+ * VPID02s are assigned to VPID12s per CPU in generations, similar to how
+ * Linux KVM assigns SVM ASIDs. VPID 0 is reserved by hardware and VPID 1 is
+ * for L1 guest, so each generation assigns VPID02 = VPID02_FIRST, ...,
+ * VPID02_FIRST + VMX_NESTED_MAX_ACTIVE_VPID - 1 in order. When they run out,
+ * a new generation starts and the VPID02s assigned are flushed. So a VPID12
+ * keeps its VPID02 (and its TLB entries) until the generation ends, and
+ * assigning a VPID02 does not need INVVPID.
+ */
+#define VPID02_FIRST 2
+
+#if VMX_NESTED_MAX_ACTIVE_VPID < 1 || VMX_NESTED_MAX_ACTIVE_VPID > 65534
+#error "Number of active VPIDs must be between 1 and 65534"
+#endif
+
+typedef struct {
+	/* Generation when vpid02 is assigned, 0 if never assigned */
+	u16 gen;
+	u16 vpid02;
+} vpid02_map_entry_t;
+
+typedef struct {
+	/* Current generation, never 0 */
+	u16 gen;
+	/* Next VPID02 to assign in the current generation */
+	u32 next;
+	/* VPID02 of each VPID12, valid if map[vpid12].gen == gen */
+	vpid02_map_entry_t map[65536];
+} vpid02_alloc_t;
+
+/* For each CPU, information about all VPID12 -> VPID02 it assigns */
+static vpid02_alloc_t vpid02_alloc[MAX_VCPU_ENTRIES];
+
+/*
+ * Reverse map from L1 physical pages to EPT02 leaves derived from them. When
+ * EPT01 changes for a range of L1 physical addresses, only the EPT02 leaves
+ * found in the reverse map are removed.
+ *
+ * Entries are allocated in ring order and chained in hash buckets by L1 page.
+ * An entry is only live if its gen matches the rmap_gen of its EPT02, so
+ * emptying an EPT02 does not need to touch the reverse map. Stale entries are
+ * harmless: they at most cause an unnecessary EPT02 leaf removal. When a live
+ * entry is overwritten, its EPT02 is marked rmap_lost and will be emptied
+ * entirely on the next flush.
+ */
+#define EPT02_RMAP_SIZE 16384
+#define EPT02_RMAP_NONE 0xffffffffU
 
-/* Page allocation flags for ept02_cache */
-static u8 ept02_page_alloc[MAX_VCPU_ENTRIES][VMX_NESTED_MAX_ACTIVE_EPT]
-	[EPT02_PAGE_POOL_SIZE];
+typedef struct {
+	/* L1 physical page number that the EPT02 leaf is derived from */
+	u64 guest1_pfn;
+	/* L2 physical address of the EPT02 leaf (4K aligned) */
+	u64 guest2_paddr;
+	/* ept02_ctx_t.rmap_gen when the entry is added */
+	u32 gen;
+	/* ept02_ctx_t.index, or EPT02_RMAP_NONE if the entry is unused */
+	u32 index;
+	/* Next entry in the same hash bucket, or EPT02_RMAP_NONE */
+	u32 next;
+} ept02_rmap_entry_t;
 
-/* For each CPU, information about all VPID12 -> VPID02 it caches */
-static vpid02_cache_set_t vpid02_cache[MAX_VCPU_ENTRIES];
+typedef struct {
+	/* First entry in each hash bucket, or EPT02_RMAP_NONE */
+	u32 buckets[EPT02_RMAP_SIZE];
+	ept02_rmap_entry_t entries[EPT02_RMAP_SIZE];
+	/* Next entry to be allocated */
+	u32 cursor;
+} ept02_rmap_t;
+
+/* For each CPU, reverse map for EPT02s in ept02_cache, allocated when init */
+static ept02_rmap_t *ept02_rmap[MAX_VCPU_ENTRIES];
 
 static void *ept02_gzp(void *vctx, size_t alignment, size_t sz)
 {
 	ept02_ctx_t *ept02_ctx = (ept02_ctx_t *) vctx;
-	u32 i;
+	void *page;
 	HALT_ON_ERRORCOND(alignment == PAGE_SIZE_4K);
 	HALT_ON_ERRORCOND(sz == PAGE_SIZE_4K);
-	for (i = 0; i < EPT02_PAGE_POOL_SIZE; i++) {
-		if (!ept02_ctx->page_alloc[i]) {
-			void *page = ept02_ctx->page_pool[i];
-			ept02_ctx->page_alloc[i] = 1;
-			memset(page, 0, PAGE_SIZE_4K);
-			return page;
-		}
+	if (ept02_ctx->page_count >= EPT02_PAGE_POOL_SIZE) {
+		return NULL;
 	}
-	return NULL;
+	page = xmhf_mm_pcpu_alloc_page(ept02_ctx->cpu);
+	if (page == NULL) {
+		return NULL;
+	}
+	ept02_ctx->page_count++;
+	memset(page, 0, PAGE_SIZE_4K);
+	return page;
 }
 
-static hpt_pa_t ept02_ptr2pa(void *vctx, void *ptr)
+/* Return a page allocated by ept02_gzp() */
+static void ept02_free_page(ept02_ctx_t * ept02_ctx, void *page)
 {
-	(void)vctx;
-	return hva2spa(ptr);
+	HALT_ON_ERRORCOND(ept02_ctx->page_count > 0);
+	ept02_ctx->page_count--;
+	xmhf_mm_pcpu_free_page(ept02_ctx->cpu, page);
 }
 
-static void *ept02_pa2ptr(void *vctx, hpt_pa_t spa, size_t sz,
-						  hpt_prot_t access_type, hptw_cpl_t cpl,
-						  size_t *avail_sz)
+/* Size of L2 physical address space mapped by one EPT02 entry at level lvl */
+static inline u64 ept02_entry_span(int lvl)
+{
+	return 1ULL << (hpt_va_idx_hi[HPT_TYPE_EPT][lvl - 1] + 1);
+}
+
+/* Set pmo to the page map pointed to by the non-leaf entry pmeo */
+static void ept02_pmeo_to_pmo(hpt_pmo_t * pmo, const hpt_pmeo_t * pmeo)
+{
+	pmo->pm = spa2hva(hpt_pmeo_get_address(pmeo));
+	pmo->t = pmeo->t;
+	pmo->lvl = pmeo->lvl - 1;
+}
+
+/* Free the page map pmo and all page maps it points to */
+static void ept02_free_pm(ept02_ctx_t * ept02_ctx, hpt_pmo_t * pmo)
+{
+	if (pmo->lvl > HPT_LVL_PT1) {
+		u64 span = ept02_entry_span(pmo->lvl);
+		u32 i;
+		for (i = 0; i < HPT_PM_SIZE / sizeof(hpt_pme_t); i++) {
+			hpt_pmeo_t pmeo;
+			hpt_pm_get_pmeo_by_va(&pmeo, pmo, i * span);
+			if (hpt_pmeo_is_present(&pmeo) && !hpt_pmeo_is_page(&pmeo)) {
+				hpt_pmo_t child;
+				ept02_pmeo_to_pmo(&child, &pmeo);
+				ept02_free_pm(ept02_ctx, &child);
+			}
+		}
+	}
+	ept02_free_page(ept02_ctx, pmo->pm);
+}
+
+static hpt_pa_t ept02_ptr2pa(void *vctx, void *ptr)
 {
 	(void)vctx;
-	(void)access_type;
-	(void)cpl;
-	*avail_sz = sz;
-	return spa2hva(spa);
+	return hva2spa(ptr);
 }
 
 static void *ept12_gzp(void *vctx, size_t alignment, size_t sz)
@@ -135,10 +243,13 @@ static void *ept12_pa2ptr(void *vctx, hpt_pa_t spa, size_t sz,
 {
 	ept12_ctx_t *ctx = vctx;
 	void *ans;
-	memprot_x86vmx_eptlock_read_lock(ctx->ctx01.vcpu);
-	ans = hptw_checked_access_va(&ctx->ctx01.host_ctx, access_type, cpl, spa,
-								 sz, avail_sz);
-	memprot_x86vmx_eptlock_read_unlock(ctx->ctx01.vcpu);
+	u32 seq;
+	/* Only reads EPT01, so the critical section can be retried */
+	do {
+		seq = memprot_x86vmx_eptlock_read_begin(ctx->ctx01.vcpu);
+		ans = hptw_checked_access_va(&ctx->ctx01.host_ctx, access_type, cpl,
+									 spa, sz, avail_sz);
+	} while (memprot_x86vmx_eptlock_read_retry(ctx->ctx01.vcpu, seq));
 	return ans;
 }
 
@@ -148,10 +259,14 @@ static void *ept12_pa2ptr(void *vctx, hpt_pa_t spa, size_t sz,
  */
 static void ept02_ctx_init(VCPU * vcpu, u32 index, ept02_ctx_t * ept02_ctx)
 {
-	ept02_ctx->page_pool = ept02_page_pool[vcpu->idx][index];
-	ept02_ctx->page_alloc = ept02_page_alloc[vcpu->idx][index];
+	ept02_ctx->cpu = vcpu->idx;
+	ept02_ctx->index = index;
+	ept02_ctx->page_count = 0;
+	ept02_ctx->evict_cursor = 0;
+	ept02_ctx->rmap_gen = 0;
+	ept02_ctx->rmap_lost = false;
 	ept02_ctx->ctx.gzp = ept02_gzp;
-	ept02_ctx->ctx.pa2ptr = ept02_pa2ptr;
+	ept02_ctx->ctx.pa2ptr = hptw_identity_pa2ptr;
 	ept02_ctx->ctx.ptr2pa = ept02_ptr2pa;
 	/* root_pa will be assigned to by ept02_ctx_reset() later */
 	ept02_ctx->ctx.root_pa = 0;
@@ -172,21 +287,285 @@ static void ept12_ctx_init(VCPU * vcpu, ept12_ctx_t * ept12_ctx)
 /*
  * Handle EPT02 reset (e.g. due to EPT TLB flush).
  * Most fields in ept02_ctx_t do not change, so this function only updates the
- * fields that change. This function also flushes L0's EPT TLB.
+ * fields that change. All pages of the old EPT02 are freed and a new root is
+ * allocated. This function also flushes L0's EPT TLB.
  */
 static void ept02_ctx_reset(ept02_ctx_t * ept02_ctx)
 {
-	u32 i;
+	void *root;
 	spa_t root_pa;
-	for (i = 0; i < EPT02_PAGE_POOL_SIZE; i++) {
-		ept02_ctx->page_alloc[i] = 0;
+	if (ept02_ctx->ctx.root_pa != 0) {
+		hpt_pmo_t pmo = {
+			.pm = spa2hva(ept02_ctx->ctx.root_pa),
+			.t = HPT_TYPE_EPT,
+			.lvl = hpt_root_lvl(HPT_TYPE_EPT),
+		};
+		ept02_free_pm(ept02_ctx, &pmo);
 	}
-	root_pa = hva2spa(ept02_gzp(&ept02_ctx->ctx, PAGE_SIZE_4K, PAGE_SIZE_4K));
+	HALT_ON_ERRORCOND(ept02_ctx->page_count == 0);
+	ept02_ctx->evict_cursor = 0;
+	ept02_ctx->rmap_gen++;
+	ept02_ctx->rmap_lost = false;
+	root = ept02_gzp(&ept02_ctx->ctx, PAGE_SIZE_4K, PAGE_SIZE_4K);
+	HALT_ON_ERRORCOND(root != NULL);
+	root_pa = hva2spa(root);
 	ept02_ctx->ctx.root_pa = root_pa;
 	HALT_ON_ERRORCOND(__vmx_invept(VMX_INVEPT_SINGLECONTEXT,
 								   root_pa | 0x1eULL));
 }
 
+/*
+ * Free some page tables (level 1) of EPT02 when it runs out of pages.
+ *
+ * EPT02 has no accessed bits, so cold page tables are approximated using a
+ * clock hand: page tables are freed in L2 physical address order, starting
+ * from evict_cursor, which is remembered for the next call. The page table
+ * that maps keep_paddr is not freed. At most target page tables are freed.
+ * Return the number of page tables freed. When it is not 0, this function
+ * also flushes L0's EPT TLB.
+ */
+static u32 ept02_ctx_evict(ept02_ctx_t * ept02_ctx, u64 keep_paddr, u32 target)
+{
+	const int root_lvl = hpt_root_lvl(HPT_TYPE_EPT);
+	const u64 pd_span = ept02_entry_span(HPT_LVL_PD2);
+	const u64 limit = ept02_entry_span(root_lvl + 1);
+	u64 paddr = ept02_ctx->evict_cursor;
+	u64 scanned = 0;
+	u32 freed = 0;
+
+	while (scanned < limit && freed < target) {
+		hpt_pmo_t pmo = {
+			.pm = spa2hva(ept02_ctx->ctx.root_pa),
+			.t = HPT_TYPE_EPT,
+			.lvl = root_lvl,
+		};
+		hpt_pmeo_t pmeo;
+		u64 span;
+		u64 next;
+
+		/* Walk to the PDE of paddr, or stop at a non-present / page entry */
+		while (1) {
+			hpt_pm_get_pmeo_by_va(&pmeo, &pmo, paddr);
+			if (pmo.lvl == HPT_LVL_PD2 || !hpt_pmeo_is_present(&pmeo) ||
+				hpt_pmeo_is_page(&pmeo)) {
+				break;
+			}
+			ept02_pmeo_to_pmo(&pmo, &pmeo);
+		}
+
+		if (pmo.lvl == HPT_LVL_PD2 && hpt_pmeo_is_present(&pmeo) &&
+			!hpt_pmeo_is_page(&pmeo) &&
+			paddr / pd_span != keep_paddr / pd_span) {
+			hpt_pmo_t pt;
+			ept02_pmeo_to_pmo(&pt, &pmeo);
+			ept02_free_pm(ept02_ctx, &pt);
+			pmeo.pme = 0;
+			hpt_pmo_set_pme_by_va(&pmo, &pmeo, paddr);
+			freed++;
+		}
+
+		/* Skip the address range mapped by the entry where the walk stops */
+		span = ept02_entry_span(pmo.lvl);
+		next = (paddr & ~(span - 1)) + span;
+		scanned += next - paddr;
+		paddr = next & (limit - 1);
+	}
+
+	ept02_ctx->evict_cursor = paddr;
+	if (freed) {
+		HALT_ON_ERRORCOND(__vmx_invept(VMX_INVEPT_SINGLECONTEXT,
+									   ept02_ctx->ctx.root_pa | 0x1eULL));
+	}
+	return freed;
+}
+
+/*
+ * Remove all entries of EPT02 without changing its root (so that VMCS02s
+ * pointing to it stay valid). This function also flushes L0's EPT TLB.
+ */
+static void ept02_ctx_clear(ept02_ctx_t * ept02_ctx)
+{
+	hpt_pmo_t pmo = {
+		.pm = spa2hva(ept02_ctx->ctx.root_pa),
+		.t = HPT_TYPE_EPT,
+		.lvl = hpt_root_lvl(HPT_TYPE_EPT),
+	};
+	u64 span = ept02_entry_span(pmo.lvl);
+	u32 i;
+	for (i = 0; i < HPT_PM_SIZE / sizeof(hpt_pme_t); i++) {
+		hpt_pmeo_t pmeo;
+		hpt_pm_get_pmeo_by_va(&pmeo, &pmo, i * span);
+		if (hpt_pmeo_is_present(&pmeo)) {
+			if (!hpt_pmeo_is_page(&pmeo)) {
+				hpt_pmo_t child;
+				ept02_pmeo_to_pmo(&child, &pmeo);
+				ept02_free_pm(ept02_ctx, &child);
+			}
+			pmeo.pme = 0;
+			hpt_pmo_set_pme_by_va(&pmo, &pmeo, i * span);
+		}
+	}
+	HALT_ON_ERRORCOND(ept02_ctx->page_count == 1);
+	ept02_ctx->evict_cursor = 0;
+	ept02_ctx->rmap_gen++;
+	ept02_ctx->rmap_lost = false;
+	HALT_ON_ERRORCOND(__vmx_invept(VMX_INVEPT_SINGLECONTEXT,
+								   ept02_ctx->ctx.root_pa | 0x1eULL));
+}
+
+/* Hash bucket of L1 physical page number guest1_pfn in reverse map */
+static inline u32 ept02_rmap_bucket(u64 guest1_pfn)
+{
+	return (u32) ((guest1_pfn * 0x9e3779b97f4a7c15ULL) >> 32) &
+		(EPT02_RMAP_SIZE - 1);
+}
+
+/*
+ * Record that the EPT02 leaf at guest2_paddr (level lvl) in ept02_ctx is
+ * derived from L1 physical address guest1_paddr.
+ */
+static void ept02_rmap_add(VCPU * vcpu, ept02_ctx_t * ept02_ctx,
+						   u64 guest1_paddr, u64 guest2_paddr, int lvl)
+{
+	ept02_rmap_t *rmap = ept02_rmap[vcpu->idx];
+	u64 guest1_pfn = guest1_paddr >> PAGE_SHIFT_4K;
+	u32 bucket = ept02_rmap_bucket(guest1_pfn);
+	u32 i;
+	ept02_rmap_entry_t *entry;
+
+	if (lvl != HPT_LVL_PT1) {
+		/* Large EPT02 leaves are not tracked */
+		ept02_ctx->rmap_lost = true;
+		return;
+	}
+	guest2_paddr &= ~(u64) (PAGE_SIZE_4K - 1);
+
+	/* Do not add duplicate entries (e.g. EPT02 leaf is filled again) */
+	for (i = rmap->buckets[bucket]; i != EPT02_RMAP_NONE;
+		 i = rmap->entries[i].next) {
+		entry = &rmap->entries[i];
+		if (entry->guest1_pfn == guest1_pfn &&
+			entry->guest2_paddr == guest2_paddr &&
+			entry->index == ept02_ctx->index &&
+			entry->gen == ept02_ctx->rmap_gen) {
+			return;
+		}
+	}
+
+	/* Reuse the oldest entry */
+	i = rmap->cursor;
+	rmap->cursor = (rmap->cursor + 1) & (EPT02_RMAP_SIZE - 1);
+	entry = &rmap->entries[i];
+	if (entry->index != EPT02_RMAP_NONE) {
+		ept02_cache_line_t *line = &ept02_cache[vcpu->id].elems[entry->index];
+		u32 *pi;
+		if (line->valid && line->value.ept02_ctx.rmap_gen == entry->gen) {
+			line->value.ept02_ctx.rmap_lost = true;
+		}
+		/* Unlink from its hash bucket */
+		pi = &rmap->buckets[ept02_rmap_bucket(entry->guest1_pfn)];
+		while (*pi != i) {
+			HALT_ON_ERRORCOND(*pi != EPT02_RMAP_NONE);
+			pi = &rmap->entries[*pi].next;
+		}
+		*pi = entry->next;
+	}
+	entry->guest1_pfn = guest1_pfn;
+	entry->guest2_paddr = guest2_paddr;
+	entry->gen = ept02_ctx->rmap_gen;
+	entry->index = ept02_ctx->index;
+	entry->next = rmap->buckets[bucket];
+	rmap->buckets[bucket] = i;
+}
+
+/*
+ * If entry is live and its L1 page is in [pfn_lo, pfn_hi), remove the EPT02
+ * leaf it points to. Set flush[index] if INVEPT is needed for the EPT02.
+ */
+static void ept02_rmap_remove_leaf(VCPU * vcpu, ept02_rmap_entry_t * entry,
+								   u64 pfn_lo, u64 pfn_hi, bool *flush)
+{
+	ept02_cache_line_t *line;
+	ept02_ctx_t *ept02_ctx;
+	hpt_pmo_t pmo;
+	hpt_pmeo_t pmeo;
+
+	if (entry->index == EPT02_RMAP_NONE || entry->guest1_pfn < pfn_lo ||
+		entry->guest1_pfn >= pfn_hi) {
+		return;
+	}
+	line = &ept02_cache[vcpu->id].elems[entry->index];
+	ept02_ctx = &line->value.ept02_ctx;
+	if (!line->valid || ept02_ctx->rmap_gen != entry->gen) {
+		return;
+	}
+	hptw_get_pmo(&pmo, &ept02_ctx->ctx, HPT_LVL_PT1, entry->guest2_paddr);
+	if (pmo.pm == NULL || pmo.lvl != HPT_LVL_PT1) {
+		return;
+	}
+	hpt_pm_get_pmeo_by_va(&pmeo, &pmo, entry->guest2_paddr);
+	if (hpt_pmeo_is_present(&pmeo)) {
+		pmeo.pme = 0;
+		hpt_pmo_set_pme_by_va(&pmo, &pmeo, entry->guest2_paddr);
+		flush[entry->index] = true;
+	}
+}
+
+/*
+ * Remove EPT02 leaves derived from L1 physical addresses in [gpa_lo, gpa_hi),
+ * for all EPT02s of the current CPU. EPT02 roots do not change.
+ */
+static void ept02_rmap_invalidate(VCPU * vcpu, u64 gpa_lo, u64 gpa_hi)
+{
+	ept02_rmap_t *rmap = ept02_rmap[vcpu->idx];
+	bool flush[VMX_NESTED_MAX_ACTIVE_EPT];
+	u64 pfn_lo = gpa_lo >> PAGE_SHIFT_4K;
+	u64 pfn_hi = (gpa_hi >> PAGE_SHIFT_4K) +
+		((gpa_hi & (PAGE_SIZE_4K - 1)) ? 1 : 0);
+	ept02_cache_index_t index;
+	ept02_cache_line_t *line;
+	u32 i;
+
+	if (rmap == NULL || gpa_lo >= gpa_hi) {
+		/* EPT02 not initialized yet, or nothing changed */
+		return;
+	}
+
+	/* EPT02s whose reverse map is incomplete are emptied */
+	LRU_FOREACH(index, line, &ept02_cache[vcpu->id]) {
+		flush[index] = false;
+		if (line->valid && line->value.ept02_ctx.rmap_lost) {
+			ept02_ctx_clear(&line->value.ept02_ctx);
+		}
+	}
+
+	if (pfn_hi - pfn_lo <= EPT02_RMAP_SIZE / 16) {
+		/* Small range, look up each page */
+		u64 pfn;
+		for (pfn = pfn_lo; pfn < pfn_hi; pfn++) {
+			for (i = rmap->buckets[ept02_rmap_bucket(pfn)];
+				 i != EPT02_RMAP_NONE; i = rmap->entries[i].next) {
+				ept02_rmap_remove_leaf(vcpu, &rmap->entries[i], pfn, pfn + 1,
+									   flush);
+			}
+		}
+	} else {
+		/* Large range, scan all entries */
+		for (i = 0; i < EPT02_RMAP_SIZE; i++) {
+			ept02_rmap_remove_leaf(vcpu, &rmap->entries[i], pfn_lo, pfn_hi,
+								   flush);
+		}
+	}
+
+	LRU_FOREACH(index, line, &ept02_cache[vcpu->id]) {
+		if (flush[index]) {
+			spa_t root_pa = line->value.ept02_ctx.ctx.root_pa;
+			HALT_ON_ERRORCOND(__vmx_invept(VMX_INVEPT_SINGLECONTEXT,
+										   root_pa | 0x1eULL));
+		}
+	}
+}
+
 /*
  * Most fields in ept12_ctx_t do not change. This function only updates the
  * fields that change. The fields are EPT12 (in argument) and EPT01 (from
@@ -203,27 +582,63 @@ void xmhf_nested_arch_x86vmx_ept_init(VCPU * vcpu)
 {
 	ept02_cache_index_t index;
 	ept02_cache_line_t *line;
-	LRU_SET_INIT(&ept02_cache[vcpu->id]);
+	ept02_rmap_t *rmap;
+	u32 i;
+	LRU_HASH_SET_INIT(&ept02_cache[vcpu->id]);
 	LRU_FOREACH(index, line, &ept02_cache[vcpu->id]) {
 		ept02_ctx_init(vcpu, index, &line->value.ept02_ctx);
 		ept12_ctx_init(vcpu, &line->value.ept12_ctx);
 	}
+	rmap = xmhf_mm_malloc(sizeof(ept02_rmap_t));
+	HALT_ON_ERRORCOND(rmap != NULL);
+	for (i = 0; i < EPT02_RMAP_SIZE; i++) {
+		rmap->buckets[i] = EPT02_RMAP_NONE;
+		rmap->entries[i].index = EPT02_RMAP_NONE;
+	}
+	rmap->cursor = 0;
+	ept02_rmap[vcpu->idx] = rmap;
 }
 
-void xmhf_nested_arch_x86vmx_vpid_init(VCPU * vcpu)
+/*
+ * Start a new generation of VPID02 assignment. VPID02s assigned in the
+ * current generation are flushed, because they will be assigned to other
+ * VPID12s.
+ */
+static void vpid02_new_generation(vpid02_alloc_t * alloc)
 {
-	vpid02_cache_index_t index;
-	vpid02_cache_line_t *line;
-	LRU_SET_INIT(&vpid02_cache[vcpu->id]);
-	LRU_FOREACH(index, line, &vpid02_cache[vcpu->id]) {
-		/*
-		 * VPID 0 is reserved by hardware, VPID 1 is for L1 guest. Ideally we
-		 * map VPID01 = 1 - 65535 to VPID02 = 2 - 65535. However, here we only
-		 * use VPID02 = 2 - (2 + VMX_NESTED_MAX_ACTIVE_VPID).
-		 */
-		HALT_ON_ERRORCOND(index + 2 > 0);
-		line->value = index + 2;
+	u32 vpid02;
+	for (vpid02 = VPID02_FIRST; vpid02 < alloc->next; vpid02++) {
+		HALT_ON_ERRORCOND(__vmx_invvpid
+						  (VMX_INVVPID_SINGLECONTEXT, vpid02, 0));
+	}
+	alloc->gen++;
+	if (alloc->gen == 0) {
+		/* Generation wraps around, entries of old generations may match */
+		memset(alloc->map, 0, sizeof(alloc->map));
+		alloc->gen = 1;
 	}
+	alloc->next = VPID02_FIRST;
+}
+
+/* Return whether VPID12 has a VPID02 in the current generation */
+static bool vpid02_lookup(vpid02_alloc_t * alloc, u16 vpid12, u16 * vpid02)
+{
+	vpid02_map_entry_t *entry = &alloc->map[vpid12];
+	if (entry->gen != alloc->gen) {
+		return false;
+	}
+	*vpid02 = entry->vpid02;
+	return true;
+}
+
+void xmhf_nested_arch_x86vmx_vpid_init(VCPU * vcpu)
+{
+	vpid02_alloc_t *alloc = &vpid02_alloc[vcpu->idx];
+	memset(alloc->map, 0, sizeof(alloc->map));
+	alloc->gen = 1;
+	/* VPID02s may be used before (e.g. by a previous XMHF), flush them */
+	alloc->next = VPID02_FIRST + VMX_NESTED_MAX_ACTIVE_VPID;
+	vpid02_new_generation(alloc);
 }
 
 /*
@@ -276,7 +691,7 @@ bool xmhf_nested_arch_x86vmx_check_ept_lower_bits(u64 eptp12, gpa_t * ept_pml4t)
 void xmhf_nested_arch_x86vmx_invept_single_context(VCPU * vcpu, gpa_t ept12)
 {
 	ept02_cache_line_t *line;
-	if (LRU_SET_INVALIDATE(&ept02_cache[vcpu->id], ept12, line)) {
+	if (LRU_HASH_SET_INVALIDATE(&ept02_cache[vcpu->id], ept12, line)) {
 		/*
 		 * INVEPT will be executed in ept02_ctx_reset() when this EPT02 is used
 		 * the next time.
@@ -292,7 +707,7 @@ void xmhf_nested_arch_x86vmx_invept_single_context(VCPU * vcpu, gpa_t ept12)
  */
 void xmhf_nested_arch_x86vmx_invept_global(VCPU * vcpu)
 {
-	LRU_SET_INVALIDATE_ALL(&ept02_cache[vcpu->id]);
+	LRU_HASH_SET_INVALIDATE_ALL(&ept02_cache[vcpu->id]);
 	/*
 	 * INVEPT will be executed in ept02_ctx_reset() when the EPT02 is used the
 	 * next time.
@@ -306,7 +721,7 @@ void xmhf_nested_arch_x86vmx_invept_global(VCPU * vcpu)
 bool xmhf_nested_arch_x86vmx_invvpid_indiv_addr(VCPU * vcpu, u16 vpid12,
 												u64 address)
 {
-	vpid02_cache_line_t *line;
+	u16 vpid02;
 	ulong_t addr = address;
 
 	/* Check whether the address is canonical */
@@ -333,42 +748,37 @@ bool xmhf_nested_arch_x86vmx_invvpid_indiv_addr(VCPU * vcpu, u16 vpid12,
 		}
 	}
 
-	if (LRU_SET_FIND_IMMUTABLE(&vpid02_cache[vcpu->id], vpid12, line)) {
-		u16 vpid02 = line->value;
+	if (vpid02_lookup(&vpid02_alloc[vcpu->idx], vpid12, &vpid02)) {
 		HALT_ON_ERRORCOND(__vmx_invvpid
 						  (VMX_INVVPID_INDIVIDUALADDRESS, vpid02, addr));
 	}
 	return true;
 }
 
-/* Invalidate one VPID */
+/*
+ * Invalidate one VPID. If the VPID12 has no VPID02 in the current generation,
+ * its TLB entries were flushed when the generation started.
+ */
 void xmhf_nested_arch_x86vmx_invvpid_single_ctx(VCPU * vcpu, u16 vpid12)
 {
-	vpid02_cache_line_t *line;
-	if (LRU_SET_INVALIDATE(&vpid02_cache[vcpu->id], vpid12, line)) {
-		/*
-		 * INVVPID will be executed in xmhf_nested_arch_x86vmx_get_vpid02()
-		 * when this VPID02 is used the next time.
-		 */
+	u16 vpid02;
+	if (vpid02_lookup(&vpid02_alloc[vcpu->idx], vpid12, &vpid02)) {
+		HALT_ON_ERRORCOND(__vmx_invvpid
+						  (VMX_INVVPID_SINGLECONTEXT, vpid02, 0));
 	}
 }
 
 /* Invalidate all VPIDs */
 void xmhf_nested_arch_x86vmx_invvpid_all_ctx(VCPU * vcpu)
 {
-	LRU_SET_INVALIDATE_ALL(&vpid02_cache[vcpu->id]);
-	/*
-	 * INVVPID will be executed in xmhf_nested_arch_x86vmx_get_vpid02() when
-	 * the VPID02 is used the next time.
-	 */
+	vpid02_new_generation(&vpid02_alloc[vcpu->idx]);
 }
 
 /* Invalidate one VPID except global transitions */
 void xmhf_nested_arch_x86vmx_invvpid_single_ctx_global(VCPU * vcpu, u16 vpid12)
 {
-	vpid02_cache_line_t *line;
-	if (LRU_SET_FIND_IMMUTABLE(&vpid02_cache[vcpu->id], vpid12, line)) {
-		u16 vpid02 = line->value;
+	u16 vpid02;
+	if (vpid02_lookup(&vpid02_alloc[vcpu->idx], vpid12, &vpid02)) {
 		HALT_ON_ERRORCOND(__vmx_invvpid
 						  (VMX_INVVPID_SINGLECONTEXTGLOBAL, vpid02, 0));
 	}
@@ -388,8 +798,8 @@ spa_t xmhf_nested_arch_x86vmx_get_ept02(VCPU * vcpu, gpa_t ept12,
 	bool hit;
 	spa_t addr;
 	ept02_cache_index_t index;
-	ept02_cache_line_t *line = LRU_SET_FIND_EVICT(&ept02_cache[vcpu->id],
-												  ept12, index, hit);
+	ept02_cache_line_t *line = LRU_HASH_SET_FIND_EVICT(&ept02_cache[vcpu->id],
+													   ept12, index, hit);
 	(void)index;
 	if (!hit) {
 		ept02_ctx_reset(&line->value.ept02_ctx);
@@ -425,20 +835,190 @@ spa_t xmhf_nested_arch_x86vmx_get_ept02(VCPU * vcpu, gpa_t ept12,
 	return addr | 0x1e;			// TODO: remove magic number
 }
 
-/* Get value of a VPID02 for current VPID12 */
+/*
+ * Get value of a VPID02 for current VPID12. If VPID12 does not have a VPID02
+ * in the current generation, assign the next one (starting a new generation
+ * if all are assigned). The VPID02 assigned has no TLB entries.
+ */
 u16 xmhf_nested_arch_x86vmx_get_vpid02(VCPU * vcpu, u16 vpid12, bool *cache_hit)
 {
-	bool hit;
-	vpid02_cache_index_t index;
-	vpid02_cache_line_t *line = LRU_SET_FIND_EVICT(&vpid02_cache[vcpu->id],
-												   vpid12, index, hit);
-	(void)index;
-	if (!hit) {
-		HALT_ON_ERRORCOND(__vmx_invvpid
-						  (VMX_INVVPID_SINGLECONTEXT, line->value, 0));
+	vpid02_alloc_t *alloc = &vpid02_alloc[vcpu->idx];
+	vpid02_map_entry_t *entry = &alloc->map[vpid12];
+	if (entry->gen == alloc->gen) {
+		*cache_hit = true;
+		return entry->vpid02;
+	}
+	if (alloc->next == VPID02_FIRST + VMX_NESTED_MAX_ACTIVE_VPID) {
+		vpid02_new_generation(alloc);
+	}
+	entry->gen = alloc->gen;
+	entry->vpid02 = (u16) alloc->next++;
+#ifdef __DEBUG_EVENT_LOGGER__
+	xmhf_dbg_log_event(vcpu, 1, XMHF_DBG_EVENTLOG_vpid02_miss, &vpid12);
+#endif							/* __DEBUG_EVENT_LOGGER__ */
+	*cache_hit = false;
+	return entry->vpid02;
+}
+
+/*
+ * Construct the EPT02 leaf pmeo02 from the EPT12 leaf pmeo12 and the EPT01
+ * leaf pmeo01. prot12 and prot01 are the protections granted by the EPT12 and
+ * EPT01 walks. xmhf_paddr is the L0 physical address being mapped.
+ */
+static void ept02_make_pmeo(hpt_pmeo_t * pmeo02, const hpt_pmeo_t * pmeo12,
+							hpt_prot_t prot12, const hpt_pmeo_t * pmeo01,
+							hpt_prot_t prot01, spa_t xmhf_paddr)
+{
+	pmeo02->pme = 0;
+	pmeo02->t = HPT_TYPE_EPT;
+	pmeo02->lvl = pmeo12->lvl < pmeo01->lvl ? pmeo12->lvl : pmeo01->lvl;
+	hpt_pmeo_set_page(pmeo02, true);
+	/* hpt_pmeo_set_address() does not clear offset bits of large pages */
+	xmhf_paddr &= ~(u64) (hpt_pmeo_page_size(pmeo02) - 1);
+	hpt_pmeo_set_address(pmeo02, xmhf_paddr);
+	hpt_pmeo_setprot(pmeo02, prot01 & prot12);
+	{
+		/*
+		 * MTRRs do not affect guest memory type, so EPT02's memory type is
+		 * determined only by EPT12. EPT01 has nothing to do with EPT02's
+		 * memory type.
+		 */
+		hpt_pmeo_setcache(pmeo02, hpt_pmeo_getcache(pmeo12));
+	}
+	{
+		bool user01 = hpt_pmeo_getuser(pmeo01);
+		bool user12 = hpt_pmeo_getuser(pmeo12);
+		hpt_pmeo_setuser(pmeo02, user01 && user12);
+	}
+}
+
+/*
+ * Before putting a large page leaf at level lvl for guest2_paddr, free the
+ * page tables that EPT02 may already have below that entry (e.g. 4K leaves
+ * filled before EPT12 or EPT01 started using large pages). Otherwise these
+ * page tables are leaked.
+ */
+static void ept02_prepare_large_leaf(ept02_ctx_t * ept02_ctx, int lvl,
+									 u64 guest2_paddr)
+{
+	hpt_pmo_t pmo;
+	hpt_pmeo_t pmeo;
+	hptw_get_pmo(&pmo, &ept02_ctx->ctx, lvl, guest2_paddr);
+	if (pmo.pm == NULL || pmo.lvl != lvl) {
+		return;
+	}
+	hpt_pm_get_pmeo_by_va(&pmeo, &pmo, guest2_paddr);
+	if (hpt_pmeo_is_present(&pmeo) && !hpt_pmeo_is_page(&pmeo)) {
+		hpt_pmo_t child;
+		ept02_pmeo_to_pmo(&child, &pmeo);
+		ept02_free_pm(ept02_ctx, &child);
+		pmeo.pme = 0;
+		hpt_pmo_set_pme_by_va(&pmo, &pmeo, guest2_paddr);
+		HALT_ON_ERRORCOND(__vmx_invept(VMX_INVEPT_SINGLECONTEXT,
+									   ept02_ctx->ctx.root_pa | 0x1eULL));
+	}
+}
+
+/*
+ * Walk ctx to the page table (level 1) that maps va without allocating.
+ * Return true if the page table exists, in which case it is stored in pmo,
+ * and the protections granted by all upper levels are stored in prot.
+ */
+static bool ept02_prefetch_get_pt(hptw_ctx_t * ctx, u64 va, hpt_pmo_t * pmo,
+								  hpt_prot_t * prot)
+{
+	*prot = HPT_PROTS_RWX;
+	hptw_get_pmo(pmo, ctx, hpt_root_lvl(ctx->t), va);
+	while (pmo->pm != NULL && pmo->lvl > HPT_LVL_PT1) {
+		hpt_pmeo_t pmeo;
+		hpt_pm_get_pmeo_by_va(&pmeo, pmo, va);
+		*prot &= hpt_pmeo_getprot(&pmeo);
+		if (!hptw_next_lvl(ctx, pmo, va)) {
+			return false;
+		}
+	}
+	return pmo->pm != NULL && pmo->lvl == HPT_LVL_PT1;
+}
+
+/*
+ * After filling the EPT02 leaf for 4K page guest2_paddr (mapped to L1 physical
+ * address guest1_paddr), fill the other not-present leaves in the aligned
+ * window of EPT02_PREFETCH_WINDOW pages around it.
+ *
+ * Only leaves whose EPT12 entry is in the same EPT12 page table, and whose
+ * EPT01 entry is in the same EPT01 page table, are filled. So the cost is
+ * bounded by the window size and no new EPT02 page tables are allocated.
+ * Leaves that would cause EPT violations / misconfigurations are skipped; they
+ * are handled by the normal path when L2 accesses them. Changing EPT02 entries
+ * from not-present to present does not require INVEPT.
+ */
+static void ept02_prefetch(VCPU * vcpu, ept02_cache_line_t * cache_line,
+						   u64 guest2_paddr, u64 guest1_paddr)
+{
+	const u64 window = EPT02_PREFETCH_WINDOW * PAGE_SIZE_4K;
+	const u64 pt_span = ept02_entry_span(HPT_LVL_PD2);
+	ept12_ctx_t *ept12_ctx = &cache_line->value.ept12_ctx;
+	ept02_ctx_t *ept02_ctx = &cache_line->value.ept02_ctx;
+	u64 guest2_base = guest2_paddr & ~(window - 1);
+	u64 guest2_page = guest2_paddr & ~(u64) (PAGE_SIZE_4K - 1);
+	u64 guest1_pt = guest1_paddr & ~(pt_span - 1);
+	hpt_pmo_t pmo12;
+	hpt_pmo_t pmo01;
+	hpt_pmo_t pmo02;
+	hpt_prot_t prot12;
+	hpt_prot_t prot01;
+	hpt_prot_t prot02;
+	u64 addr2;
+
+	if (!ept02_prefetch_get_pt(&ept02_ctx->ctx, guest2_paddr, &pmo02,
+							   &prot02) ||
+		!ept02_prefetch_get_pt(&ept12_ctx->ctx, guest2_paddr, &pmo12,
+							   &prot12) ||
+		!ept02_prefetch_get_pt(&ept12_ctx->ctx01.host_ctx, guest1_paddr,
+							   &pmo01, &prot01)) {
+		return;
+	}
+
+	for (addr2 = guest2_base; addr2 < guest2_base + window;
+		 addr2 += PAGE_SIZE_4K) {
+		hpt_pmeo_t pmeo12;
+		hpt_pmeo_t pmeo01;
+		hpt_pmeo_t pmeo02;
+		hpt_prot_t leaf_prot12;
+		hpt_prot_t leaf_prot01;
+		u64 addr1;
+
+		if (addr2 == guest2_page) {
+			continue;
+		}
+		hpt_pm_get_pmeo_by_va(&pmeo02, &pmo02, addr2);
+		if (hpt_pmeo_is_present(&pmeo02)) {
+			continue;
+		}
+
+		/* EPT12 leaf must be readable (not violation / misconfig) */
+		hpt_pm_get_pmeo_by_va(&pmeo12, &pmo12, addr2);
+		leaf_prot12 = prot12 & hpt_pmeo_getprot(&pmeo12);
+		if (!(leaf_prot12 & HPT_PROT_READ_MASK)) {
+			continue;
+		}
+
+		/* EPT01 leaf must be in the page table already walked */
+		addr1 = hpt_pmeo_va_to_pa(&pmeo12, addr2);
+		if ((addr1 & ~(pt_span - 1)) != guest1_pt) {
+			continue;
+		}
+		hpt_pm_get_pmeo_by_va(&pmeo01, &pmo01, addr1);
+		leaf_prot01 = prot01 & hpt_pmeo_getprot(&pmeo01);
+		if (!(leaf_prot12 & leaf_prot01 & HPT_PROT_READ_MASK)) {
+			continue;
+		}
+
+		ept02_make_pmeo(&pmeo02, &pmeo12, leaf_prot12, &pmeo01, leaf_prot01,
+						hpt_pmeo_va_to_pa(&pmeo01, addr1));
+		hpt_pmo_set_pme_by_va(&pmo02, &pmeo02, addr2);
+		ept02_rmap_add(vcpu, ept02_ctx, addr1, addr2, HPT_LVL_PT1);
 	}
-	*cache_hit = hit;
-	return vpid12;
 }
 
 /*
@@ -506,31 +1086,13 @@ static int xmhf_nested_arch_x86vmx_walk_ept02(VCPU * vcpu,
 	*pxmhf_paddr = xmhf_paddr;
 
 	/* Construct page map entry for EPT02 */
-	pmeo02.pme = 0;
-	pmeo02.t = HPT_TYPE_EPT;
-	pmeo02.lvl = pmeo12.lvl < pmeo01.lvl ? pmeo12.lvl : pmeo01.lvl;
-	hpt_pmeo_set_page(&pmeo02, true);
-	hpt_pmeo_set_address(&pmeo02, xmhf_paddr);
-	{
-		hpt_prot_t prot01 = hpt_pmeo_getprot(&pmeo01);
-		hpt_prot_t prot12 = hpt_pmeo_getprot(&pmeo12);
-		hpt_pmeo_setprot(&pmeo02, prot01 & prot12);
-	}
-	{
-		/*
-		 * MTRRs do not affect guest memory type, so EPT02's memory type is
-		 * determined only by EPT12. EPT01 has nothing to do with EPT02's
-		 * memory type.
-		 */
-		hpt_pmeo_setcache(&pmeo02, hpt_pmeo_getcache(&pmeo12));
-	}
-	{
-		bool user01 = hpt_pmeo_getuser(&pmeo01);
-		bool user12 = hpt_pmeo_getuser(&pmeo12);
-		hpt_pmeo_setuser(&pmeo02, user01 && user12);
-	}
+	ept02_make_pmeo(&pmeo02, &pmeo12, hpt_pmeo_getprot(&pmeo12), &pmeo01,
+					hpt_pmeo_getprot(&pmeo01), xmhf_paddr);
 
 	/* Put page map entry into EPT02 */
+	if (pmeo02.lvl != HPT_LVL_PT1) {
+		ept02_prepare_large_leaf(ept02_ctx, pmeo02.lvl, guest2_paddr);
+	}
 	if (hptw_insert_pmeo_alloc(&ept02_ctx->ctx, &pmeo02, guest2_paddr)) {
 		{
 			gpa_t ept12 = ept12_ctx->ctx.root_pa;
@@ -541,9 +1103,20 @@ static int xmhf_nested_arch_x86vmx_walk_ept02(VCPU * vcpu,
 				printf("CPU(0x%02x): EPT02 full 0x%08llx\n", vcpu->id, ept12);
 			}
 		}
-		ept02_ctx_reset(ept02_ctx);
-		HALT_ON_ERRORCOND(hptw_insert_pmeo_alloc(&ept02_ctx->ctx, &pmeo02,
-												 guest2_paddr) == 0);
+		/*
+		 * Free cold page tables and retry. If still not enough pages, fall
+		 * back to resetting the whole EPT02.
+		 */
+		if (ept02_ctx_evict(ept02_ctx, guest2_paddr, EPT02_EVICT_BATCH) == 0 ||
+			hptw_insert_pmeo_alloc(&ept02_ctx->ctx, &pmeo02, guest2_paddr)) {
+			ept02_ctx_reset(ept02_ctx);
+			HALT_ON_ERRORCOND(hptw_insert_pmeo_alloc(&ept02_ctx->ctx, &pmeo02,
+													 guest2_paddr) == 0);
+		}
+	}
+	ept02_rmap_add(vcpu, ept02_ctx, guest1_paddr, guest2_paddr, pmeo02.lvl);
+	if (EPT02_PREFETCH_WINDOW > 1 && pmeo02.lvl == HPT_LVL_PT1) {
+		ept02_prefetch(vcpu, cache_line, guest2_paddr, guest1_paddr);
 	}
 	if (0) {
 		printf("CPU(0x%02x): EPT: L2=0x%08llx L1=0x%08llx L0=0x%08llx\n",
@@ -706,11 +1279,18 @@ void xmhf_nested_arch_x86vmx_set_ept12(VCPU * vcpu, bool enable, gpa_t ept12)
  * This function is what xmhf_nested_arch_x86vmx_flush_ept02() does when no
  * blocking occurs.
  */
-static void xmhf_nested_arch_x86vmx_flush_ept02_effect(VCPU * vcpu, u32 flags)
+static void xmhf_nested_arch_x86vmx_flush_ept02_effect(VCPU * vcpu, u32 flags,
+													  u64 gpa_lo, u64 gpa_hi)
 {
 	if ((flags & MEMP_FLUSHTLB_ENTRY) != 0) {
-		LRU_SET_INVALIDATE_ALL(&ept02_cache[vcpu->id]);
-		xmhf_nested_arch_x86vmx_clear_all_vmcs12_ept02(vcpu);
+		if (gpa_lo == MEMP_FLUSHTLB_GPA_LO_ALL &&
+			gpa_hi == MEMP_FLUSHTLB_GPA_HI_ALL) {
+			LRU_HASH_SET_INVALIDATE_ALL(&ept02_cache[vcpu->id]);
+			xmhf_nested_arch_x86vmx_clear_all_vmcs12_ept02(vcpu);
+		} else {
+			/* Only remove EPT02 leaves derived from the range */
+			ept02_rmap_invalidate(vcpu, gpa_lo, gpa_hi);
+		}
 	}
 
 	/*
@@ -739,14 +1319,33 @@ static void xmhf_nested_arch_x86vmx_flush_ept02_effect(VCPU * vcpu, u32 flags)
  * Flags is same as the value passed to xmhf_memprot_flushmappings_*().
  */
 void xmhf_nested_arch_x86vmx_flush_ept02(VCPU * vcpu, u32 flags)
+{
+	xmhf_nested_arch_x86vmx_flush_ept02_range(vcpu, flags,
+											  MEMP_FLUSHTLB_GPA_LO_ALL,
+											  MEMP_FLUSHTLB_GPA_HI_ALL);
+}
+
+/*
+ * Same as xmhf_nested_arch_x86vmx_flush_ept02(), but EPT01 only changes for
+ * L1 physical addresses in [gpa_lo, gpa_hi). EPT02 entries not derived from
+ * this range are kept.
+ */
+void xmhf_nested_arch_x86vmx_flush_ept02_range(VCPU * vcpu, u32 flags,
+											   u64 gpa_lo, u64 gpa_hi)
 {
 	mb();
 	if (vcpu->vmx_nested_ept02_flush_disable) {
 		mb();
 		vcpu->vmx_nested_ept02_flush_visited |= flags;
+		if (gpa_lo < vcpu->vmx_nested_ept02_flush_gpa_lo) {
+			vcpu->vmx_nested_ept02_flush_gpa_lo = gpa_lo;
+		}
+		if (gpa_hi > vcpu->vmx_nested_ept02_flush_gpa_hi) {
+			vcpu->vmx_nested_ept02_flush_gpa_hi = gpa_hi;
+		}
 	} else {
 		mb();
-		xmhf_nested_arch_x86vmx_flush_ept02_effect(vcpu, flags);
+		xmhf_nested_arch_x86vmx_flush_ept02_effect(vcpu, flags, gpa_lo, gpa_hi);
 	}
 	mb();
 }
@@ -771,14 +1370,20 @@ void xmhf_nested_arch_x86vmx_unblock_ept02_flush(VCPU * vcpu)
 	mb();
 	while (vcpu->vmx_nested_ept02_flush_visited) {
 		u32 flags;
+		u64 gpa_lo;
+		u64 gpa_hi;
 		mb();
 		flags = vcpu->vmx_nested_ept02_flush_visited;
+		gpa_lo = vcpu->vmx_nested_ept02_flush_gpa_lo;
+		gpa_hi = vcpu->vmx_nested_ept02_flush_gpa_hi;
 		mb();
 		vcpu->vmx_nested_ept02_flush_visited = 0;
+		vcpu->vmx_nested_ept02_flush_gpa_lo = MEMP_FLUSHTLB_GPA_HI_ALL;
+		vcpu->vmx_nested_ept02_flush_gpa_hi = MEMP_FLUSHTLB_GPA_LO_ALL;
 		mb();
 		vcpu->vmx_nested_ept02_flush_disable = true;
 		mb();
-		xmhf_nested_arch_x86vmx_flush_ept02_effect(vcpu, flags);
+		xmhf_nested_arch_x86vmx_flush_ept02_effect(vcpu, flags, gpa_lo, gpa_hi);
 		mb();
 		vcpu->vmx_nested_ept02_flush_disable = false;
 		mb();
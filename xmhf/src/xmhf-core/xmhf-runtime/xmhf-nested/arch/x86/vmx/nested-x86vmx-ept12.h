@@ -57,8 +57,11 @@
  */
 #define VMX_NESTED_MAX_ACTIVE_EPT (__VMX_NESTED_MAX_ACTIVE_EPT__)
 
-/* Maximum number of active VPIDs per CPU */
-#define VMX_NESTED_MAX_ACTIVE_VPID 4
+/*
+ * Maximum number of active VPIDs per CPU.
+ * This value is configured using --with-vmx-nested-max-active-vpid.
+ */
+#define VMX_NESTED_MAX_ACTIVE_VPID (__VMX_NESTED_MAX_ACTIVE_VPID__)
 
 /* Exit codes for xmhf_nested_arch_x86vmx_handle_ept02_exit() */
 #define VMX_NESTED_EPT02_CACHEMISS	1
@@ -78,10 +81,18 @@ typedef struct {
 typedef struct {
 	/* Context */
 	hptw_ctx_t ctx;
-	/* List of pages to be allocated by ctx, limit = EPT02_PAGE_POOL_SIZE */
-	 u8(*page_pool)[PAGE_SIZE_4K];
-	/* Whether the corresponding page in page_pool is allocated */
-	u8 *page_alloc;
+	/* CPU index, pages are allocated from this CPU's page cache in xmhf-mm */
+	u32 cpu;
+	/* Index of this EPT02 in the CPU's ept02_cache */
+	u32 index;
+	/* Generation of reverse map entries, incremented when EPT02 is emptied */
+	u32 rmap_gen;
+	/* Whether some leaves of this EPT02 are not in the reverse map */
+	bool rmap_lost;
+	/* Number of pages allocated by ctx, limit = EPT02_PAGE_POOL_SIZE */
+	u32 page_count;
+	/* Clock hand (L2 physical address) for evicting page tables */
+	u64 evict_cursor;
 } ept02_ctx_t;
 
 typedef u32 ept02_cache_index_t;
@@ -96,15 +107,13 @@ typedef struct {
 	ept12_ctx_t ept12_ctx;
 } ept02_cache_value_t;
 
-LRU_NEW_SET(ept02_cache_set_t, ept02_cache_line_t, VMX_NESTED_MAX_ACTIVE_EPT,
-			ept02_cache_index_t, ept02_cache_key_t, ept02_cache_value_t);
-
-typedef u16 vpid02_cache_index_t;
-typedef u16 vpid02_cache_key_t;
-typedef u16 vpid02_cache_value_t;
-
-LRU_NEW_SET(vpid02_cache_set_t, vpid02_cache_line_t, VMX_NESTED_MAX_ACTIVE_VPID,
-			vpid02_cache_index_t, vpid02_cache_key_t, vpid02_cache_value_t);
+/*
+ * The number of EPT02 lines can be large (see VMX_NESTED_MAX_ACTIVE_EPT), so
+ * use the hashed LRU implementation.
+ */
+LRU_HASH_NEW_SET(ept02_cache_set_t, ept02_cache_line_t,
+				 VMX_NESTED_MAX_ACTIVE_EPT, ept02_cache_index_t,
+				 ept02_cache_key_t, ept02_cache_value_t);
 
 void xmhf_nested_arch_x86vmx_ept_init(VCPU * vcpu);
 void xmhf_nested_arch_x86vmx_vpid_init(VCPU * vcpu);
@@ -103,12 +103,25 @@ static vmcs12_info_t
 static u8 cpu_vmcs02[MAX_VCPU_ENTRIES][VMX_NESTED_MAX_ACTIVE_VMCS][PAGE_SIZE_4K]
 	__attribute__((aligned(PAGE_SIZE_4K)));
 
+#ifdef __VMX_NESTED_MSR_BITMAP__
+/* Copies of L1's MSR bitmaps and MSR bitmaps of VMCS02's in each CPU */
+static u8 cpu_msr_bitmap12[MAX_VCPU_ENTRIES][VMX_NESTED_MAX_ACTIVE_VMCS]
+	[PAGE_SIZE_4K]
+	__attribute__((aligned(PAGE_SIZE_4K)));
+static u8 cpu_msr_bitmap02[MAX_VCPU_ENTRIES][VMX_NESTED_MAX_ACTIVE_VMCS]
+	[PAGE_SIZE_4K]
+	__attribute__((aligned(PAGE_SIZE_4K)));
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
+
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
 /*
- * A blank page in memory that is only read from. This page is used as VMREAD
- * and VMWRITE bitmaps when using shadow VMCS.
+ * VMREAD and VMWRITE bitmaps of VMCS01 in each CPU when using shadow VMCS.
+ * Computed by xmhf_nested_arch_x86vmx_shadow_vmcs_bitmaps_init().
  */
-static u8 blank_page[PAGE_SIZE_4K] __attribute__((aligned(PAGE_SIZE_4K)));
+static u8 cpu_vmread_bitmap[MAX_VCPU_ENTRIES][PAGE_SIZE_4K]
+	__attribute__((aligned(PAGE_SIZE_4K)));
+static u8 cpu_vmwrite_bitmap[MAX_VCPU_ENTRIES][PAGE_SIZE_4K]
+	__attribute__((aligned(PAGE_SIZE_4K)));
 
 /* The shadow VMCS12's in each CPU */
 static u8 cpu_shadow_vmcs12[MAX_VCPU_ENTRIES][VMX_NESTED_MAX_ACTIVE_VMCS]
@@ -248,6 +261,12 @@ static void active_vmcs12_array_init(VCPU * vcpu)
 		cpu_active_vmcs12[vcpu->idx][i].index = i;
 		cpu_active_vmcs12[vcpu->idx][i].vmcs12_ptr = CUR_VMCS_PTR_INVALID;
 		cpu_active_vmcs12[vcpu->idx][i].vmcs02_ptr = vmcs02_ptr;
+#ifdef __VMX_NESTED_MSR_BITMAP__
+		cpu_active_vmcs12[vcpu->idx][i].msr_bitmap12 =
+			cpu_msr_bitmap12[vcpu->idx][i];
+		cpu_active_vmcs12[vcpu->idx][i].msr_bitmap02 =
+			cpu_msr_bitmap02[vcpu->idx][i];
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
 		cpu_active_vmcs12[vcpu->idx][i].vmcs12_shadow_ptr = vmcs12_shadow_ptr;
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
@@ -305,6 +324,8 @@ static vmcs12_info_t *new_active_vmcs12(VCPU * vcpu, gpa_t vmcs_ptr, u32 rev)
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
 	vmcs12_info->launched = 0;
 	/* vmcs12_info->vmcs12_value will be initialized by caller */
+	memset(&vmcs12_info->vmcs12_dirty, 0, sizeof(vmcs12_info->vmcs12_dirty));
+	vmcs12_info->vmcs02_resync = true;
 	/* vmcs02_vmexit_msr_store_area need to process the same MSRs as VMCS01 */
 	memset(&vmcs12_info->vmcs02_vmexit_msr_store_area, 0,
 		   sizeof(vmcs12_info->vmcs02_vmexit_msr_store_area));
@@ -352,6 +373,21 @@ vmcs12_info_t *xmhf_nested_arch_x86vmx_find_current_vmcs12(VCPU * vcpu)
 	return &cpu_active_vmcs12[vcpu->idx][vcpu->vmx_nested_cur_vmcs12];
 }
 
+/*
+ * Record that L0 wrote the VMCS02 field with the given encoding while L2 is
+ * running. Identity fields are only translated at VMENTRY when dirty, so
+ * marking the field makes the next VMENTRY restore the VMCS12 value instead
+ * of keeping the value written by L0.
+ */
+void xmhf_nested_arch_x86vmx_vmcs02_written(VCPU * vcpu, ulong_t encoding)
+{
+	vmcs12_info_t *vmcs12_info;
+	HALT_ON_ERRORCOND(vcpu->vmx_nested_operation_mode ==
+					  NESTED_VMX_MODE_NONROOT);
+	vmcs12_info = xmhf_nested_arch_x86vmx_find_current_vmcs12(vcpu);
+	xmhf_nested_arch_x86vmx_vmcs_mark_dirty(vmcs12_info, encoding);
+}
+
 /* The VMsucceed pseudo-function in SDM "29.2 CONVENTIONS" */
 static void _vmx_nested_vm_succeed(VCPU * vcpu)
 {
@@ -371,7 +407,7 @@ static void _vmx_nested_vm_fail_valid(VCPU * vcpu, u32 error_number)
 		HALT_ON_ERRORCOND(__vmx_vmptrst(&cur_vmcs));
 		HALT_ON_ERRORCOND(cur_vmcs == hva2spa((void *)vcpu->vmx_vmcs_vaddr));
 		HALT_ON_ERRORCOND(__vmx_vmptrld(vmcs12_info->vmcs12_shadow_ptr));
-		__vmx_vmwrite32(VMCSENC_info_vminstr_error, error_number);
+		xmhf_nested_arch_x86vmx_shadow_vmcs_push(vcpu, vmcs12_info, false);
 		HALT_ON_ERRORCOND(__vmx_vmptrld(cur_vmcs));
 	}
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
@@ -571,11 +607,22 @@ void xmhf_nested_arch_x86vmx_vcpu_init(VCPU * vcpu)
 	}
 	vcpu->vmx_nested_ept02_flush_disable = false;
 	vcpu->vmx_nested_ept02_flush_visited = false;
+	vcpu->vmx_nested_ept02_flush_gpa_lo = MEMP_FLUSHTLB_GPA_HI_ALL;
+	vcpu->vmx_nested_ept02_flush_gpa_hi = MEMP_FLUSHTLB_GPA_LO_ALL;
 
 	/* Initialize EPT and VPID cache */
 	xmhf_nested_arch_x86vmx_ept_init(vcpu);
 	xmhf_nested_arch_x86vmx_vpid_init(vcpu);
 
+#ifdef VMX_NESTED_USE_SHADOW_VMCS
+	/* Select fields that L1 can access without VMEXIT */
+	if (_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps)) {
+		xmhf_nested_arch_x86vmx_shadow_vmcs_bitmaps_init
+			(vcpu, cpu_vmread_bitmap[vcpu->idx],
+			 cpu_vmwrite_bitmap[vcpu->idx]);
+	}
+#endif							/* VMX_NESTED_USE_SHADOW_VMCS */
+
 #ifdef __DEBUG_QEMU__
 	/* Compute is_in_kvm */
 	{
@@ -658,6 +705,7 @@ void xmhf_nested_arch_x86vmx_handle_invept(VCPU * vcpu, struct regs *r)
 			break;
 		}
 		xmhf_nested_arch_x86vmx_unblock_ept02_flush(vcpu);
+		guestmem_tlb_invalidate(vcpu);
 		vcpu->vmcs.guest_RIP += vcpu->vmcs.info_vmexit_instruction_length;
 	}
 }
@@ -729,6 +777,7 @@ void xmhf_nested_arch_x86vmx_handle_invvpid(VCPU * vcpu, struct regs *r)
 			_vmx_nested_vm_fail(vcpu,
 								VM_INST_ERRNO_INVALID_OPERAND_INVEPT_INVVPID);
 		}
+		guestmem_tlb_invalidate(vcpu);
 		vcpu->vmcs.guest_RIP += vcpu->vmcs.info_vmexit_instruction_length;
 	}
 }
@@ -774,10 +823,9 @@ void xmhf_nested_arch_x86vmx_handle_vmclear(VCPU * vcpu, struct regs *r)
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
 				/* Read VMCS12 values from the shadow VMCS */
 				if (_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps)) {
-					struct _vmx_vmcsfields *vmcs12 = &vmcs12_info->vmcs12_value;
 					HALT_ON_ERRORCOND(__vmx_vmptrld
 									  (vmcs12_info->vmcs12_shadow_ptr));
-					xmhf_nested_arch_x86vmx_vmcs_read_all(vcpu, vmcs12);
+					xmhf_nested_arch_x86vmx_shadow_vmcs_pull(vcpu, vmcs12_info);
 					HALT_ON_ERRORCOND(__vmx_vmptrld
 									  (hva2spa((void *)vcpu->vmx_vmcs_vaddr)));
 				}
@@ -907,11 +955,11 @@ void xmhf_nested_arch_x86vmx_handle_vmptrld(VCPU * vcpu, struct regs *r)
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
 					/* Write VMCS12 values to the shadow VMCS */
 					if (_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps)) {
-						struct _vmx_vmcsfields *vmcs12 =
-							&vmcs12_info->vmcs12_value;
 						HALT_ON_ERRORCOND(__vmx_vmptrld
 										  (vmcs12_info->vmcs12_shadow_ptr));
-						xmhf_nested_arch_x86vmx_vmcs_write_all(vcpu, vmcs12);
+						xmhf_nested_arch_x86vmx_shadow_vmcs_push(vcpu,
+																 vmcs12_info,
+																 true);
 						HALT_ON_ERRORCOND(__vmx_vmptrld
 										  (hva2spa
 										   ((void *)vcpu->vmx_vmcs_vaddr)));
@@ -988,10 +1036,10 @@ void xmhf_nested_arch_x86vmx_handle_vmread(VCPU * vcpu, struct regs *r)
 			size_t size = _vmx_decode_vmread_vmwrite(vcpu, r, 1, &encoding,
 													 &pvalue, &value_mem_reg,
 													 HPT_PROT_WRITE_MASK);
-#ifdef VMX_NESTED_USE_SHADOW_VMCS
-			/* If using shadow VMCS, there should be no VMREAD exits */
-			HALT_ON_ERRORCOND(!_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps));
-#endif							/* VMX_NESTED_USE_SHADOW_VMCS */
+			/*
+			 * If using shadow VMCS, only VMREAD of fields not in the shadow
+			 * VMCS cause VMEXIT. These fields are up-to-date in vmcs12_value.
+			 */
 			if (!xmhf_nested_arch_x86vmx_vmcs_readable(encoding)) {
 				_vmx_nested_vm_fail_valid
 					(vcpu, VM_INST_ERRNO_VMRDWR_UNSUPP_VMCS_COMP);
@@ -1042,10 +1090,10 @@ void xmhf_nested_arch_x86vmx_handle_vmwrite(VCPU * vcpu, struct regs *r)
 			size_t size = _vmx_decode_vmread_vmwrite(vcpu, r, 1, &encoding,
 													 &pvalue, &value_mem_reg,
 													 HPT_PROT_READ_MASK);
-#ifdef VMX_NESTED_USE_SHADOW_VMCS
-			/* If using shadow VMCS, there should be no VMWRITE exits */
-			HALT_ON_ERRORCOND(!_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps));
-#endif							/* VMX_NESTED_USE_SHADOW_VMCS */
+			/*
+			 * If using shadow VMCS, only VMWRITE of fields not in the shadow
+			 * VMCS cause VMEXIT. These fields are only stored in vmcs12_value.
+			 */
 			if (!xmhf_nested_arch_x86vmx_vmcs_writable(encoding)) {
 				/*
 				 * Note: currently not supporting writing to VM-exit
@@ -1072,6 +1120,7 @@ void xmhf_nested_arch_x86vmx_handle_vmwrite(VCPU * vcpu, struct regs *r)
 				}
 				xmhf_nested_arch_x86vmx_vmcs_write(&vmcs12_info->vmcs12_value,
 												   encoding, value, size);
+				xmhf_nested_arch_x86vmx_vmcs_mark_dirty(vmcs12_info, encoding);
 				_vmx_nested_vm_succeed(vcpu);
 			}
 		}
@@ -1178,9 +1227,9 @@ void xmhf_nested_arch_x86vmx_handle_vmxon(VCPU * vcpu, struct regs *r)
 
 						/* Write VMREAD / VMWRITE bitmap */
 						vcpu->vmcs.control_VMREAD_bitmap_address =
-							hva2spa(blank_page);
+							hva2spa(cpu_vmread_bitmap[vcpu->idx]);
 						vcpu->vmcs.control_VMWRITE_bitmap_address =
-							hva2spa(blank_page);
+							hva2spa(cpu_vmwrite_bitmap[vcpu->idx]);
 					}
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
 					active_vmcs12_array_init(vcpu);
@@ -308,10 +308,10 @@ u32 xmhf_nested_arch_x86vmx_handle_vmentry(VCPU * vcpu,
 	 */
 
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
-	/* Read VMCS12 values from the shadow VMCS */
+	/* Read VMCS12 values L1 may have modified from the shadow VMCS */
 	if (_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps)) {
 		HALT_ON_ERRORCOND(__vmx_vmptrld(vmcs12_info->vmcs12_shadow_ptr));
-		xmhf_nested_arch_x86vmx_vmcs_read_all(vcpu, &vmcs12_info->vmcs12_value);
+		xmhf_nested_arch_x86vmx_shadow_vmcs_pull(vcpu, vmcs12_info);
 		/* No need to VMPTRLD because the next line does so */
 	}
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
@@ -714,15 +714,16 @@ static void _nested_vmx_inject_gp(void)
 	_nested_vmx_inject_exception(injection_info.ui, 0, 0);
 }
 
-/* Check whether the RDMSR / WRMSR should cause VMEXIT to L1 */
+/*
+ * Check whether the RDMSR / WRMSR should cause VMEXIT to L1. L1's MSR bitmap
+ * is read from the copy taken at VMENTRY.
+ */
 static bool check_msr_bitmap(vmcs12_info_t * vmcs12_info, u32 msr_val,
-							 bool is_wrmsr, guestmem_hptw_ctx_pair_t * ctx_pair)
+							 bool is_wrmsr)
 {
 	u32 bit_num = UINT32_MAX;
 	u32 bit_offset;
 	u32 byte_offset;
-	unsigned char val;
-	gpa_t addr;
 	if (!_vmx_hasctl_use_msr_bitmaps(&vmcs12_info->ctls12)) {
 		return true;
 	}
@@ -745,9 +746,7 @@ static bool check_msr_bitmap(vmcs12_info_t * vmcs12_info, u32 msr_val,
 	byte_offset = bit_num / 8;
 	bit_offset = bit_num % 8;
 	HALT_ON_ERRORCOND(byte_offset < PAGE_SIZE_4K);
-	addr = vmcs12_info->vmcs12_value.control_MSR_Bitmaps_address + byte_offset;
-	guestmem_copy_gp2h(ctx_pair, 0, &val, addr, sizeof(val));
-	if ((1U << bit_offset) & val) {
+	if ((1U << bit_offset) & vmcs12_info->msr_bitmap12[byte_offset]) {
 		return true;
 	}
 	return false;
@@ -762,9 +761,7 @@ static bool check_msr_bitmap(vmcs12_info_t * vmcs12_info, u32 msr_val,
 static u32 handle_vmexit20_rdmsr(VCPU * vcpu, vmcs12_info_t * vmcs12_info,
 								 struct regs *r)
 {
-	guestmem_hptw_ctx_pair_t ctx_pair;
-	guestmem_init(vcpu, &ctx_pair);
-	if (check_msr_bitmap(vmcs12_info, r->ecx, false, &ctx_pair)) {
+	if (check_msr_bitmap(vmcs12_info, r->ecx, false)) {
 		return NESTED_VMEXIT_HANDLE_201;
 	} else {
 		u32 index;
@@ -830,9 +827,7 @@ static u32 handle_vmexit20_rdmsr(VCPU * vcpu, vmcs12_info_t * vmcs12_info,
 static u32 handle_vmexit20_wrmsr(VCPU * vcpu, vmcs12_info_t * vmcs12_info,
 								 struct regs *r)
 {
-	guestmem_hptw_ctx_pair_t ctx_pair;
-	guestmem_init(vcpu, &ctx_pair);
-	if (check_msr_bitmap(vmcs12_info, r->ecx, true, &ctx_pair)) {
+	if (check_msr_bitmap(vmcs12_info, r->ecx, true)) {
 		return NESTED_VMEXIT_HANDLE_201;
 	} else {
 		msr_entry_t *msr02 = vmcs12_info->vmcs02_vmentry_msr_load_area;
@@ -892,13 +887,17 @@ static u32 handle_vmexit20_vmcall(VCPU * vcpu, struct regs *r)
 		return NESTED_VMEXIT_HANDLE_201;
 	}
 	/* Quiesce, invoke hypapp */
+#ifdef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
 	xmhf_smpguest_arch_x86vmx_quiesce(vcpu);
+#endif /* __XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
 	if (xmhf_app_handlehypercall(vcpu, r) != APP_SUCCESS) {
 		printf("CPU(0x%02x): error(halt), unhandled L2 hypercall 0x%08x!\n",
 			   vcpu->id, r->eax);
 		HALT();
 	}
+#ifdef __XMHF_QUIESCE_CPU_IN_HYPERCALL__
 	xmhf_smpguest_arch_x86vmx_endquiesce(vcpu);
+#endif /* __XMHF_QUIESCE_CPU_IN_HYPERCALL__ */
 	/* Increase RIP since instruction is emulated */
 	{
 		ulong_t rip = __vmx_vmreadNW(VMCSENC_guest_RIP);
@@ -1033,11 +1032,10 @@ static void handle_vmexit20_forward(VCPU * vcpu, vmcs12_info_t * vmcs12_info,
 		(vcpu, &vcpu->vmcs.control_VMX_cpu_based);
 
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
-	/* Write VMCS12 values to the shadow VMCS */
+	/* Write VMCS12 values changed by the VMEXIT to the shadow VMCS */
 	if (_vmx_hasctl_vmcs_shadowing(&vcpu->vmx_caps)) {
 		HALT_ON_ERRORCOND(__vmx_vmptrld(vmcs12_info->vmcs12_shadow_ptr));
-		xmhf_nested_arch_x86vmx_vmcs_write_all(vcpu,
-											   &vmcs12_info->vmcs12_value);
+		xmhf_nested_arch_x86vmx_shadow_vmcs_push(vcpu, vmcs12_info, false);
 		/* No need to VMPTRLD because the next line does so */
 	}
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
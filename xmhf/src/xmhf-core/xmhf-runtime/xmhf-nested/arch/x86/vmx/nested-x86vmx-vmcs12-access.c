@@ -0,0 +1,174 @@
+/*
+ * @XMHF_LICENSE_HEADER_START@
+ *
+ * eXtensible, Modular Hypervisor Framework (XMHF)
+ * Copyright (c) 2009-2012 Carnegie Mellon University
+ * Copyright (c) 2010-2012 VDG Inc.
+ * All Rights Reserved.
+ *
+ * Developed by: XMHF Team
+ *               Carnegie Mellon University / CyLab
+ *               VDG Inc.
+ *               http://xmhf.org
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * Neither the names of Carnegie Mellon or VDG Inc, nor the names of
+ * its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @XMHF_LICENSE_HEADER_END@
+ */
+
+// nested-x86vmx-vmcs12-access.c
+// Handle VMREAD and VMWRITE to VMCS12 fields stored in XMHF's format
+
+#include <xmhf.h>
+#include "nested-x86vmx-vmcs12-access.h"
+
+/* Check that the field can be indexed by VMCS12_FIELD_KEY() */
+#define DECLARE_FIELD_16(encoding, name, ...) \
+	_Static_assert(((encoding) & ~VMCS12_FIELD_ENCODING_MASK) == 0, \
+				   "Unsupported encoding for " #name);
+#define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
+#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
+
+#define _FIELD_ENTRY(encoding, name, delta, size, flags) \
+	[VMCS12_FIELD_KEY(encoding)] = { \
+		offsetof(struct _vmx_vmcsfields, name) + (delta), (size), (flags), \
+		VMCSIDX_##name \
+	},
+#define _FIELD_SIZE(name) sizeof(((struct _vmx_vmcsfields *)0)->name)
+
+/*
+ * VMCS12 field table. For 64-bit fields, the full access (encoding) and the
+ * high access (encoding + 1) have separate entries. The high access entry
+ * points to the high 32 bits of the field.
+ */
+const vmcs12_field_t vmcs12_field_table[VMCS12_FIELD_TABLE_SIZE] = {
+#define DECLARE_FIELD_16_RO(encoding, name, ...) \
+	_FIELD_ENTRY(encoding, name, 0, _FIELD_SIZE(name), 0)
+#define DECLARE_FIELD_64_RO(encoding, name, ...) \
+	_FIELD_ENTRY(encoding, name, 0, sizeof(u64), VMCS12_FIELD_64_FULL) \
+	_FIELD_ENTRY((encoding) + 1, name, sizeof(u32), sizeof(u32), \
+				 VMCS12_FIELD_64_HIGH)
+#define DECLARE_FIELD_32_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
+#define DECLARE_FIELD_16_RW(encoding, name, ...) \
+	_FIELD_ENTRY(encoding, name, 0, _FIELD_SIZE(name), VMCS12_FIELD_RW)
+#define DECLARE_FIELD_64_RW(encoding, name, ...) \
+	_FIELD_ENTRY(encoding, name, 0, sizeof(u64), \
+				 VMCS12_FIELD_RW | VMCS12_FIELD_64_FULL) \
+	_FIELD_ENTRY((encoding) + 1, name, sizeof(u32), sizeof(u32), \
+				 VMCS12_FIELD_RW | VMCS12_FIELD_64_HIGH)
+#define DECLARE_FIELD_32_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
+};
+
+#undef _FIELD_ENTRY
+#undef _FIELD_SIZE
+
+bool xmhf_nested_arch_x86vmx_vmcs_readable(ulong_t encoding)
+{
+	return vmcs12_field_lookup(encoding) != NULL;
+}
+
+bool xmhf_nested_arch_x86vmx_vmcs_writable(ulong_t encoding)
+{
+	const vmcs12_field_t *field = vmcs12_field_lookup(encoding);
+	return field != NULL && (field->flags & VMCS12_FIELD_RW);
+}
+
+/*
+ * Return number of bytes of the field accessed by a VMREAD / VMWRITE with
+ * operand size size. A 64-bit field accessed with a 32-bit operand only has
+ * its low 32 bits accessed.
+ */
+static size_t _vmcs12_access_size(const vmcs12_field_t *field, size_t size)
+{
+	if (field->flags & VMCS12_FIELD_64_FULL) {
+		if (size == sizeof(u64)) {
+			return sizeof(u64);
+		}
+		HALT_ON_ERRORCOND(size == sizeof(u32));
+		return sizeof(u32);
+	}
+	if (field->flags & VMCS12_FIELD_64_HIGH) {
+		HALT_ON_ERRORCOND(size == sizeof(u32));
+	}
+	return field->size;
+}
+
+/* Used when handling L2 performing VMREAD, return true if successful */
+ulong_t xmhf_nested_arch_x86vmx_vmcs_read(struct _vmx_vmcsfields *vmcs12,
+										  ulong_t encoding, size_t size)
+{
+	const vmcs12_field_t *field = vmcs12_field_lookup(encoding);
+	void *ptr;
+	HALT_ON_ERRORCOND(field != NULL && "Unknown guest VMCS field");
+	ptr = (u8 *)vmcs12 + field->offset;
+	switch (_vmcs12_access_size(field, size)) {
+	case sizeof(u16):
+		return (ulong_t) *(u16 *)ptr;
+	case sizeof(u32):
+		return (ulong_t) *(u32 *)ptr;
+	case sizeof(u64):
+		return (ulong_t) *(u64 *)ptr;
+	default:
+		HALT_ON_ERRORCOND(0 && "Unexpected VMCS field size");
+		return 0;
+	}
+}
+
+void xmhf_nested_arch_x86vmx_vmcs_write(struct _vmx_vmcsfields *vmcs12,
+										ulong_t encoding, ulong_t value,
+										size_t size)
+{
+	const vmcs12_field_t *field = vmcs12_field_lookup(encoding);
+	void *ptr;
+	HALT_ON_ERRORCOND(field != NULL && "Unknown guest VMCS field");
+	HALT_ON_ERRORCOND((field->flags & VMCS12_FIELD_RW) &&
+					  "Write to read-only VMCS field");
+	ptr = (u8 *)vmcs12 + field->offset;
+	switch (_vmcs12_access_size(field, size)) {
+	case sizeof(u16):
+		*(u16 *)ptr = (u16) value;
+		break;
+	case sizeof(u32):
+		*(u32 *)ptr = (u32) value;
+		break;
+	case sizeof(u64):
+		*(u64 *)ptr = (u64) value;
+		break;
+	default:
+		HALT_ON_ERRORCOND(0 && "Unexpected VMCS field size");
+		break;
+	}
+}
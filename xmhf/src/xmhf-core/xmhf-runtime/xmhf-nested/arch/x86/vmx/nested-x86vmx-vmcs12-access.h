@@ -0,0 +1,110 @@
+/*
+ * @XMHF_LICENSE_HEADER_START@
+ *
+ * eXtensible, Modular Hypervisor Framework (XMHF)
+ * Copyright (c) 2009-2012 Carnegie Mellon University
+ * Copyright (c) 2010-2012 VDG Inc.
+ * All Rights Reserved.
+ *
+ * Developed by: XMHF Team
+ *               Carnegie Mellon University / CyLab
+ *               VDG Inc.
+ *               http://xmhf.org
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in
+ * the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * Neither the names of Carnegie Mellon or VDG Inc, nor the names of
+ * its contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @XMHF_LICENSE_HEADER_END@
+ */
+
+// nested-x86vmx-vmcs12-access.h
+// Look up VMCS12 fields by encoding for VMREAD and VMWRITE
+
+#ifndef _NESTED_X86VMX_VMCS12_ACCESS_H_
+#define _NESTED_X86VMX_VMCS12_ACCESS_H_
+
+/*
+ * A VMCS field encoding consists of access type (bit 0), index (bits 9:1),
+ * type (bits 11:10) and width (bits 14:13). All other bits are 0. All fields
+ * in nested-x86vmx-vmcs12-fields.h have index < 32, so the width, the type,
+ * the index and the access type fit in 10 bits. Encodings with other bits set
+ * are not supported.
+ */
+#define VMCS12_FIELD_ENCODING_MASK	0x6c3fUL
+#define VMCS12_FIELD_TABLE_SIZE		1024
+#define VMCS12_FIELD_KEY(encoding) \
+	((((encoding) >> 5) & 0x300) | (((encoding) >> 4) & 0xc0) | \
+	 ((encoding) & 0x3f))
+
+/* Flags in vmcs12_field_t */
+#define VMCS12_FIELD_RW			0x01	/* Field is writable by L1 */
+#define VMCS12_FIELD_64_FULL	0x02	/* Full access to a 64-bit field */
+#define VMCS12_FIELD_64_HIGH	0x04	/* High access to a 64-bit field */
+
+/*
+ * Entry of the VMCS12 field table, indexed by VMCS12_FIELD_KEY(encoding).
+ * size is 0 if the encoding is not supported.
+ */
+typedef struct {
+	/* Offset of the field in struct _vmx_vmcsfields */
+	u16 offset;
+	/* Number of bytes accessed, 2, 4 or 8 */
+	u8 size;
+	/* VMCS12_FIELD_* */
+	u8 flags;
+	/* VMCSIDX_* */
+	u16 index;
+} vmcs12_field_t;
+
+extern const vmcs12_field_t vmcs12_field_table[VMCS12_FIELD_TABLE_SIZE];
+
+/* Return the table entry for encoding, or NULL if it is not supported */
+static inline const vmcs12_field_t *vmcs12_field_lookup(ulong_t encoding)
+{
+	const vmcs12_field_t *field;
+	if (encoding & ~VMCS12_FIELD_ENCODING_MASK) {
+		return NULL;
+	}
+	field = &vmcs12_field_table[VMCS12_FIELD_KEY(encoding)];
+	if (field->size == 0) {
+		return NULL;
+	}
+	return field;
+}
+
+bool xmhf_nested_arch_x86vmx_vmcs_readable(ulong_t encoding);
+bool xmhf_nested_arch_x86vmx_vmcs_writable(ulong_t encoding);
+ulong_t xmhf_nested_arch_x86vmx_vmcs_read(struct _vmx_vmcsfields *vmcs12,
+										  ulong_t encoding, size_t size);
+void xmhf_nested_arch_x86vmx_vmcs_write(struct _vmx_vmcsfields *vmcs12,
+										ulong_t encoding, ulong_t value,
+										size_t size);
+
+#endif							/* _NESTED_X86VMX_VMCS12_ACCESS_H_ */
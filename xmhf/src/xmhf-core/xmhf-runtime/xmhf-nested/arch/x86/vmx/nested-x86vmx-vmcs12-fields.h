@@ -159,7 +159,8 @@ DECLARE_FIELD_16_RW(0x0800, guest_ES_selector,
 					UNDEFINED)
 /* Guest CS selector */
 DECLARE_FIELD_16_RW(0x0802, guest_CS_selector,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -201,13 +202,15 @@ DECLARE_FIELD_16_RW(0x080E, guest_TR_selector,
 					UNDEFINED)
 /* Guest interrupt status */
 DECLARE_FIELD_16_RW(0x0810, guest_interrupt_status,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(_vmx_hasctl_virtual_interrupt_delivery(FIELD_CTLS_ARG)),
 					,
 					UNDEFINED)
 /* PML index */
 DECLARE_FIELD_16_RW(0x0812, guest_PML_index,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(_vmx_hasctl_enable_pml(FIELD_CTLS_ARG)),
 					,
 					UNDEFINED)
@@ -242,13 +245,13 @@ DECLARE_FIELD_16_RW(0x0C06, host_DS_selector,
 					UNDEFINED)
 /* Host FS selector */
 DECLARE_FIELD_16_RW(0x0C08, host_FS_selector,
-					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST),
+					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
 /* Host GS selector */
 DECLARE_FIELD_16_RW(0x0C0A, host_GS_selector,
-					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST),
+					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
@@ -438,7 +441,7 @@ DECLARE_FIELD_64_RW(0x2036, control_ENCLV_exiting_bitmap,
 
 /* Guest-physical address */
 DECLARE_FIELD_64_RO(0x2400, guest_paddr,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(_vmx_hasctl_enable_ept(FIELD_CTLS_ARG)),
 					,
 					UNDEFINED)
@@ -561,13 +564,14 @@ DECLARE_FIELD_32_RW(0x4000, control_VMX_pin_based,
 					UNDEFINED)
 /* Primary processor-based VM-execution controls */
 DECLARE_FIELD_32_RW(0x4002, control_VMX_cpu_based,
-					(FIELD_PROP_CTRL),
+					(FIELD_PROP_CTRL | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
 /* Exception bitmap */
 DECLARE_FIELD_32_RW(0x4004, control_exception_bitmap,
-					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY),
+					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -621,25 +625,26 @@ DECLARE_FIELD_32_RW(0x4014, control_VM_entry_MSR_load_count,
 					UNDEFINED)
 /* VM-entry interruption-information field */
 DECLARE_FIELD_32_RW(0x4016, control_VM_entry_interruption_information,
-					(FIELD_PROP_CTRL),
+					(FIELD_PROP_CTRL | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
 /* VM-entry exception error code */
 DECLARE_FIELD_32_RW(0x4018, control_VM_entry_exception_errorcode,
-					(FIELD_PROP_CTRL | FIELD_PROP_IGNORE),
+					(FIELD_PROP_CTRL | FIELD_PROP_IGNORE | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
 /* VM-entry instruction length */
 DECLARE_FIELD_32_RW(0x401A, control_VM_entry_instruction_length,
-					(FIELD_PROP_CTRL | FIELD_PROP_IGNORE),
+					(FIELD_PROP_CTRL | FIELD_PROP_IGNORE | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
 /* TPR threshold */
 DECLARE_FIELD_32_RW(0x401C, control_Task_PRivilege_Threshold,
-					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY),
+					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY |
+					 FIELD_PROP_SHADOW),
 					(_vmx_hasctl_use_tpr_shadow(FIELD_CTLS_ARG)),
 					,
 					UNDEFINED)
@@ -668,43 +673,43 @@ DECLARE_FIELD_32_RW(0x4022, control_PLE_window,
 
 /* VM-instruction error */
 DECLARE_FIELD_32_RO(0x4400, info_vminstr_error,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Exit reason */
 DECLARE_FIELD_32_RO(0x4402, info_vmexit_reason,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* VM-exit interruption information */
 DECLARE_FIELD_32_RO(0x4404, info_vmexit_interrupt_information,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* VM-exit interruption error code */
 DECLARE_FIELD_32_RO(0x4406, info_vmexit_interrupt_error_code,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* IDT-vectoring information field */
 DECLARE_FIELD_32_RO(0x4408, info_IDT_vectoring_information,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* IDT-vectoring error code */
 DECLARE_FIELD_32_RO(0x440A, info_IDT_vectoring_error_code,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* VM-exit instruction length */
 DECLARE_FIELD_32_RO(0x440C, info_vmexit_instruction_length,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -787,7 +792,8 @@ DECLARE_FIELD_32_RW(0x4814, guest_ES_access_rights,
 					UNDEFINED)
 /* Guest CS access rights */
 DECLARE_FIELD_32_RW(0x4816, guest_CS_access_rights,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -829,7 +835,7 @@ DECLARE_FIELD_32_RW(0x4822, guest_TR_access_rights,
 					UNDEFINED)
 /* Guest interruptibility state */
 DECLARE_FIELD_32_RW(0x4824, guest_interruptibility,
-					(FIELD_PROP_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
@@ -875,7 +881,8 @@ DECLARE_FIELD_32_RW(0x4C00, host_SYSENTER_CS,
 
 /* CR0 guest/host mask */
 DECLARE_FIELD_NW_RW(0x6000, control_CR0_mask,
-					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY),
+					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -887,13 +894,15 @@ DECLARE_FIELD_NW_RW(0x6002, control_CR4_mask,
 					UNDEFINED)
 /* CR0 read shadow */
 DECLARE_FIELD_NW_RW(0x6004, control_CR0_shadow,
-					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY),
+					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* CR4 read shadow */
 DECLARE_FIELD_NW_RW(0x6006, control_CR4_shadow,
-					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY),
+					(FIELD_PROP_CTRL | FIELD_PROP_ID_GUEST | FIELD_PROP_SWWRONLY |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -928,7 +937,7 @@ DECLARE_FIELD_NW_RW(0x600E, control_CR3_target3,
 
 /* Exit qualification */
 DECLARE_FIELD_NW_RO(0x6400, info_exit_qualification,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -958,7 +967,7 @@ DECLARE_FIELD_NW_RO(0x6408, info_IO_RIP,
 					UNDEFINED)
 /* Guest-linear address */
 DECLARE_FIELD_NW_RO(0x640A, info_guest_linear_address,
-					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_RO | FIELD_PROP_ID_GUEST | FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -969,55 +978,64 @@ DECLARE_FIELD_NW_RO(0x640A, info_guest_linear_address,
 
 /* Guest CR0 */
 DECLARE_FIELD_NW_RW(0x6800, guest_CR0,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest CR3 */
 DECLARE_FIELD_NW_RW(0x6802, guest_CR3,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest CR4 */
 DECLARE_FIELD_NW_RW(0x6804, guest_CR4,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest ES base */
 DECLARE_FIELD_NW_RW(0x6806, guest_ES_base,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest CS base */
 DECLARE_FIELD_NW_RW(0x6808, guest_CS_base,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest SS base */
 DECLARE_FIELD_NW_RW(0x680A, guest_SS_base,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest DS base */
 DECLARE_FIELD_NW_RW(0x680C, guest_DS_base,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest FS base */
 DECLARE_FIELD_NW_RW(0x680E, guest_FS_base,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest GS base */
 DECLARE_FIELD_NW_RW(0x6810, guest_GS_base,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -1053,19 +1071,22 @@ DECLARE_FIELD_NW_RW(0x681A, guest_DR7,
 					UNDEFINED)
 /* Guest RSP */
 DECLARE_FIELD_NW_RW(0x681C, guest_RSP,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest RIP */
 DECLARE_FIELD_NW_RW(0x681E, guest_RIP,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
 /* Guest RFLAGS */
 DECLARE_FIELD_NW_RW(0x6820, guest_RFLAGS,
-					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST),
+					(FIELD_PROP_GUEST | FIELD_PROP_ID_GUEST |
+					 FIELD_PROP_SHADOW),
 					(1),
 					,
 					UNDEFINED)
@@ -1130,13 +1151,13 @@ DECLARE_FIELD_NW_RW(0x6C04, host_CR4,
 					UNDEFINED)
 /* Host FS base */
 DECLARE_FIELD_NW_RW(0x6C06, host_FS_base,
-					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST),
+					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
 /* Host GS base */
 DECLARE_FIELD_NW_RW(0x6C08, host_GS_base,
-					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST),
+					(FIELD_PROP_HOST | FIELD_PROP_ID_HOST | FIELD_PROP_SHADOW),
 					(1),
 					_unused,
 					UNDEFINED)
@@ -53,168 +53,149 @@
 #include "nested-x86vmx-vminsterr.h"
 #include "nested-x86vmx-ept12.h"
 
-bool xmhf_nested_arch_x86vmx_vmcs_readable(ulong_t encoding)
+/*
+ * Record that L1 modified the VMCS12 field with the given encoding, so that
+ * the next VMENTRY translates it to VMCS02.
+ */
+void xmhf_nested_arch_x86vmx_vmcs_mark_dirty(vmcs12_info_t * vmcs12_info,
+											 ulong_t encoding)
 {
-	switch (encoding) {
-#define DECLARE_FIELD_16(encoding, name, ...) \
-	case encoding: \
-		return true;
-#define DECLARE_FIELD_64(encoding, name, ...) \
-	case encoding: \
-		return true; \
-	case encoding + 1: \
-		return true;
-#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
-#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
-#include "nested-x86vmx-vmcs12-fields.h"
-	default:
-		return false;
-	}
+	const vmcs12_field_t *field = vmcs12_field_lookup(encoding);
+	HALT_ON_ERRORCOND(field != NULL && "Unknown guest VMCS field");
+	vmcs_bitmap_set(&vmcs12_info->vmcs12_dirty, field->index);
 }
 
-bool xmhf_nested_arch_x86vmx_vmcs_writable(ulong_t encoding)
+#ifdef VMX_NESTED_USE_SHADOW_VMCS
+
+/*
+ * Whether a field is stored in the shadow VMCS. Read-only fields need to be
+ * written by L0, so they are only shadowed if the CPU supports VMWRITE to
+ * any supported field (bit 29 of IA32_VMX_MISC).
+ */
+#define _SHADOW_FIELD(prop, exist, writable) \
+	(((prop) & FIELD_PROP_SHADOW) && (exist) && \
+	 ((writable) || (vcpu->vmx_msrs[INDEX_IA32_VMX_MISC_MSR] & (1ULL << 29))))
+
+/* Clear bit for encoding in VMREAD / VMWRITE bitmap (i.e. no VMEXIT) */
+static void _shadow_bitmap_clear(u8 * bitmap, u32 encoding)
 {
-	switch (encoding) {
-#define DECLARE_FIELD_16_RW(encoding, name, ...) \
-	case encoding: \
-		return true;
-#define DECLARE_FIELD_64_RW(encoding, name, ...) \
-	case encoding: \
-		return true; \
-	case encoding + 1: \
-		return true;
-#define DECLARE_FIELD_32_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
-#define DECLARE_FIELD_NW_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
-#include "nested-x86vmx-vmcs12-fields.h"
-	default:
-		return false;
-	}
+	HALT_ON_ERRORCOND(encoding < PAGE_SIZE_4K * 8);
+	bitmap[encoding >> 3] &= ~(1U << (encoding & 7));
 }
 
-/* Used when handling L2 performing VMREAD, return true if successful */
-ulong_t xmhf_nested_arch_x86vmx_vmcs_read(struct _vmx_vmcsfields *vmcs12,
-										  ulong_t encoding, size_t size)
+/*
+ * Compute VMREAD and VMWRITE bitmaps for VMCS01. L1's VMREAD / VMWRITE cause
+ * VMEXIT unless the field is shadowed. Read-only fields are not shadowed in
+ * the VMWRITE bitmap, so L1 cannot modify them.
+ */
+void xmhf_nested_arch_x86vmx_shadow_vmcs_bitmaps_init(VCPU * vcpu,
+													   u8 * vmread_bitmap,
+													   u8 * vmwrite_bitmap)
 {
-	switch (encoding) {
-#define DECLARE_FIELD_16(encoding, name, ...) \
-	case encoding: \
-		return (ulong_t) vmcs12->name;
-#define DECLARE_FIELD_64(encoding, name, ...) \
-	case encoding: \
-		if (size == sizeof(u64)) { \
-			return (ulong_t) vmcs12->name; \
-		} else { \
-			HALT_ON_ERRORCOND(size == sizeof(u32)); \
-			return (ulong_t) *(u32 *)(void *)&vmcs12->name; \
-		} \
-	case encoding + 1: \
-		HALT_ON_ERRORCOND(size == sizeof(u32)); \
-		return (ulong_t) ((u32 *)(void *)&vmcs12->name)[1];
-#define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
-#define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
-#include "nested-x86vmx-vmcs12-fields.h"
-	default:
-		HALT_ON_ERRORCOND(0 && "Unknown guest VMCS field");
-	}
-}
-
-void xmhf_nested_arch_x86vmx_vmcs_write(struct _vmx_vmcsfields *vmcs12,
-										size_t encoding, ulong_t value,
-										size_t size)
-{
-	switch (encoding) {
-#define DECLARE_FIELD_16_RO(encoding, name, ...) \
-	case encoding: \
-		HALT_ON_ERRORCOND(0 && "Write to read-only VMCS field"); \
-		break;
-#define DECLARE_FIELD_64_RO(encoding, name, ...) \
-	case encoding: \
-		HALT_ON_ERRORCOND(0 && "Write to read-only VMCS field"); \
-		break; \
-	case encoding + 1: \
-		HALT_ON_ERRORCOND(0 && "Write to read-only VMCS field"); \
-		break;
+	memset(vmread_bitmap, 0xff, PAGE_SIZE_4K);
+	memset(vmwrite_bitmap, 0xff, PAGE_SIZE_4K);
+#define FIELD_CTLS_ARG (&vcpu->vmx_caps)
+#define DECLARE_FIELD_16_RO(encoding, name, prop, exist, ...) \
+	if (_SHADOW_FIELD(prop, exist, false)) { \
+		_shadow_bitmap_clear(vmread_bitmap, encoding); \
+	}
+#define DECLARE_FIELD_64_RO(encoding, name, prop, exist, ...) \
+	if (_SHADOW_FIELD(prop, exist, false)) { \
+		_shadow_bitmap_clear(vmread_bitmap, encoding); \
+		_shadow_bitmap_clear(vmread_bitmap, encoding + 1); \
+	}
 #define DECLARE_FIELD_32_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
 #define DECLARE_FIELD_NW_RO(...) DECLARE_FIELD_16_RO(__VA_ARGS__)
-#define DECLARE_FIELD_16_RW(encoding, name, ...) \
-	case encoding: \
-		vmcs12->name = (u16) value; \
-		break;
-#define DECLARE_FIELD_64_RW(encoding, name, ...) \
-	case encoding: \
-		if (size == sizeof(u64)) { \
-			vmcs12->name = (u64) value; \
-		} else { \
-			HALT_ON_ERRORCOND(size == sizeof(u32)); \
-			*(u32 *)(void *)&vmcs12->name = (u32) value; \
-		} \
-		break; \
-	case encoding + 1: \
-		HALT_ON_ERRORCOND(size == sizeof(u32)); \
-		((u32 *)(void *)&vmcs12->name)[1] = (u32) value; \
-		break;
-#define DECLARE_FIELD_32_RW(encoding, name, ...) \
-	case encoding: \
-		vmcs12->name = (u32) value; \
-		break;
-#define DECLARE_FIELD_NW_RW(encoding, name, ...) \
-	case encoding: \
-		vmcs12->name = (ulong_t) value; \
-		break;
-#include "nested-x86vmx-vmcs12-fields.h"
-	default:
-		HALT_ON_ERRORCOND(0 && "Unknown guest VMCS field");
+#define DECLARE_FIELD_16_RW(encoding, name, prop, exist, ...) \
+	if (_SHADOW_FIELD(prop, exist, true)) { \
+		_shadow_bitmap_clear(vmread_bitmap, encoding); \
+		_shadow_bitmap_clear(vmwrite_bitmap, encoding); \
+	}
+#define DECLARE_FIELD_64_RW(encoding, name, prop, exist, ...) \
+	if (_SHADOW_FIELD(prop, exist, true)) { \
+		_shadow_bitmap_clear(vmread_bitmap, encoding); \
+		_shadow_bitmap_clear(vmread_bitmap, encoding + 1); \
+		_shadow_bitmap_clear(vmwrite_bitmap, encoding); \
+		_shadow_bitmap_clear(vmwrite_bitmap, encoding + 1); \
 	}
+#define DECLARE_FIELD_32_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#define DECLARE_FIELD_NW_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
+#include "nested-x86vmx-vmcs12-fields.h"
 }
 
-/* VMREAD all fields in current VMCS and put the result to vmcs12 */
-void xmhf_nested_arch_x86vmx_vmcs_read_all(VCPU * vcpu,
-										   struct _vmx_vmcsfields *vmcs12)
+/*
+ * Read fields that L1 may have modified (i.e. shadowed read-write fields)
+ * from the shadow VMCS to vmcs12_value. Fields that L1 changed are marked in
+ * vmcs12_info->vmcs12_dirty. The shadow VMCS must be the current VMCS.
+ */
+void xmhf_nested_arch_x86vmx_shadow_vmcs_pull(VCPU * vcpu,
+											  vmcs12_info_t * vmcs12_info)
 {
-#define FIELD_CTLS_ARG (&vcpu->vmx_caps)
-#define DECLARE_FIELD_16(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		vmcs12->name = __vmx_vmread16(encoding); \
-	}
-#define DECLARE_FIELD_64(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		vmcs12->name = __vmx_vmread64(encoding); \
-	}
-#define DECLARE_FIELD_32(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		vmcs12->name = __vmx_vmread32(encoding); \
-	}
-#define DECLARE_FIELD_NW(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		vmcs12->name = __vmx_vmreadNW(encoding); \
+	struct _vmx_vmcsfields *vmcs12 = &vmcs12_info->vmcs12_value;
+	struct _vmx_vmcsfields *shadow = &vmcs12_info->vmcs12_shadow_value;
+#define _SHADOW_PULL(size, encoding, name, prop, exist) \
+	if (_SHADOW_FIELD(prop, exist, true)) { \
+		shadow->name = __vmx_vmread##size(encoding); \
+		if (vmcs12->name != shadow->name) { \
+			vmcs12->name = shadow->name; \
+			vmcs_bitmap_set(&vmcs12_info->vmcs12_dirty, VMCSIDX_##name); \
+		} \
 	}
+#define FIELD_CTLS_ARG (&vcpu->vmx_caps)
+#define DECLARE_FIELD_16_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PULL(16, encoding, name, prop, exist)
+#define DECLARE_FIELD_64_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PULL(64, encoding, name, prop, exist)
+#define DECLARE_FIELD_32_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PULL(32, encoding, name, prop, exist)
+#define DECLARE_FIELD_NW_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PULL(NW, encoding, name, prop, exist)
 #include "nested-x86vmx-vmcs12-fields.h"
+#undef _SHADOW_PULL
 }
 
-/* VMWRITE all fields of current VMCS using the values from vmcs12 */
-void xmhf_nested_arch_x86vmx_vmcs_write_all(VCPU * vcpu,
-											struct _vmx_vmcsfields *vmcs12)
+/*
+ * Write shadowed fields in vmcs12_value to the shadow VMCS. If all is false,
+ * only write fields that changed since the last synchronization. The shadow
+ * VMCS must be the current VMCS.
+ */
+void xmhf_nested_arch_x86vmx_shadow_vmcs_push(VCPU * vcpu,
+											  vmcs12_info_t * vmcs12_info,
+											  bool all)
 {
-#define FIELD_CTLS_ARG (&vcpu->vmx_caps)
-#define DECLARE_FIELD_16(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		__vmx_vmwrite16(encoding, vmcs12->name); \
-	}
-#define DECLARE_FIELD_64(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		__vmx_vmwrite64(encoding, vmcs12->name); \
-	}
-#define DECLARE_FIELD_32(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		__vmx_vmwrite32(encoding, vmcs12->name); \
-	}
-#define DECLARE_FIELD_NW(encoding, name, prop, exist, ...) \
-	if (exist) { \
-		__vmx_vmwriteNW(encoding, vmcs12->name); \
+	struct _vmx_vmcsfields *vmcs12 = &vmcs12_info->vmcs12_value;
+	struct _vmx_vmcsfields *shadow = &vmcs12_info->vmcs12_shadow_value;
+#define _SHADOW_PUSH(size, encoding, name, prop, exist, writable) \
+	if (_SHADOW_FIELD(prop, exist, writable) && \
+		(all || vmcs12->name != shadow->name)) { \
+		__vmx_vmwrite##size(encoding, vmcs12->name); \
+		shadow->name = vmcs12->name; \
 	}
+#define FIELD_CTLS_ARG (&vcpu->vmx_caps)
+#define DECLARE_FIELD_16_RO(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(16, encoding, name, prop, exist, false)
+#define DECLARE_FIELD_64_RO(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(64, encoding, name, prop, exist, false)
+#define DECLARE_FIELD_32_RO(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(32, encoding, name, prop, exist, false)
+#define DECLARE_FIELD_NW_RO(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(NW, encoding, name, prop, exist, false)
+#define DECLARE_FIELD_16_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(16, encoding, name, prop, exist, true)
+#define DECLARE_FIELD_64_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(64, encoding, name, prop, exist, true)
+#define DECLARE_FIELD_32_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(32, encoding, name, prop, exist, true)
+#define DECLARE_FIELD_NW_RW(encoding, name, prop, exist, ...) \
+	_SHADOW_PUSH(NW, encoding, name, prop, exist, true)
 #include "nested-x86vmx-vmcs12-fields.h"
+#undef _SHADOW_PUSH
 }
 
+#undef _SHADOW_FIELD
+
+#endif							/* VMX_NESTED_USE_SHADOW_VMCS */
+
 /* Dump all fields in vmcs12 */
 void xmhf_nested_arch_x86vmx_vmcs_dump(VCPU * vcpu,
 									   struct _vmx_vmcsfields *vmcs12,
@@ -486,13 +467,11 @@ static void _vmcs12_to_vmcs02_flip_bits(vmx_ctls_t * ctls02)
 	_vmx_setctl_virtual_nmis(ctls02);
 	/* XMHF needs to activate secondary controls because of EPT */
 	_vmx_setctl_activate_secondary_controls(ctls02);
-#ifdef __VMX_NESTED_MSR_BITMAP__
 	/*
-	 * Nested hypervisor may use MSR bitmaps (VMCS12 = 1), but XMHF does not
-	 * use them during nested virtualization (VMCS02 = 0).
+	 * When nested hypervisor uses MSR bitmaps (VMCS12 = 1), VMCS02 uses L1's
+	 * MSR bitmap merged with XMHF's (VMCS02 = 1). Otherwise all RDMSR / WRMSR
+	 * cause VMEXIT (VMCS02 = 0).
 	 */
-	_vmx_clearctl_use_msr_bitmaps(ctls02);
-#endif							/* __VMX_NESTED_MSR_BITMAP__ */
 	/*
 	 * The "Host address-space size" bit need to match XMHF. A mismatch can
 	 * only happen when amd64 XMHF runs i386 guest hypervisor.
@@ -598,6 +577,34 @@ static void _vmcs02_to_vmcs12_ctls(ARG01 * arg, vmx_ctls_t * ctls12)
 	HALT_ON_ERRORCOND(memcmp(&_ctls02, &_ctls12, sizeof(vmx_ctls_t)) == 0);
 }
 
+/*
+ * Whether a field is translated by copying between VMCS12 and VMCS02, i.e.
+ * FIELD_PROP_ID_GUEST without a special translation function (trans_suf is
+ * empty). Translation of other fields has side effects or depends on other
+ * fields, so they are translated at every VMENTRY / VMEXIT.
+ */
+#define _FIELD_TRANS_IDENTITY 1
+#define _FIELD_TRANS_IDENTITY_unused 0
+#define _FIELD_IS_IDENTITY(prop, trans_suf) \
+	(((prop) & FIELD_PROP_ID_GUEST) && _FIELD_TRANS_IDENTITY##trans_suf)
+
+/*
+ * Whether the VMCS02 value of a field needs to be translated back to VMCS12
+ * at VMEXIT. Hardware never changes identity fields that are read-only to it
+ * (FIELD_PROP_SWWRONLY), so VMCS12 already holds the value L1 set. L0 may
+ * still write such a field in VMCS02 while L2 runs (e.g.
+ * VCPU_exception_bitmap_set()); that value is not L1's, so it is not copied
+ * to VMCS12. Instead xmhf_nested_arch_x86vmx_vmcs02_written() marks the
+ * field dirty, and the next VMENTRY translates it from VMCS12 again.
+ *
+ * This relies on every L0 write to such a field calling
+ * xmhf_nested_arch_x86vmx_vmcs02_written(). When __DEBUG_QEMU__, VMEXIT
+ * halts if a skipped field that is not dirty differs between VMCS02 and
+ * VMCS12, i.e. L0 wrote it without marking it.
+ */
+#define _FIELD_HW_WRITABLE(prop, trans_suf) \
+	(!_FIELD_IS_IDENTITY(prop, trans_suf) || !((prop) & FIELD_PROP_SWWRONLY))
+
 #define FIELD_CTLS_ARG (arg->ctls)
 
 #define DECLARE_FIELD_16_RW(encoding, name, prop, exist, trans_suf, ...) \
@@ -905,14 +912,17 @@ static u32 _vmcs12_to_vmcs02_control_MSR_Bitmaps_address(ARG10 * arg)
 		HALT_ON_ERRORCOND(PA_PAGE_ALIGNED_4K
 						  (arg->vmcs12->control_MSR_Bitmaps_address));
 	}
+#ifdef __VMX_NESTED_MSR_BITMAP__
 	/*
-	 * XMHF does not use MSR bitmaps in VMCS02, so set to invalid value.
-	 *
-	 * Note: use MSR bitmaps in VMCS02, XMHF needs to merge VMCS01 and VMCS12.
-	 * It also needs to set MSR bitmaps in VMCS12 as read-only, so it can pick
-	 * up changes when the guest updates MSR bitmaps in VMCS12.
+	 * VMCS02 always points to the merged MSR bitmap. Its content is computed
+	 * at every VMENTRY by _vmcs12_to_vmcs02_msr_bitmap().
 	 */
+	__vmx_vmwrite64(VMCSENC_control_MSR_Bitmaps_address,
+					hva2spa(arg->vmcs12_info->msr_bitmap02));
+#else							/* !__VMX_NESTED_MSR_BITMAP__ */
+	/* XMHF does not use MSR bitmaps in VMCS02, so set to invalid value. */
 	__vmx_vmwrite64(VMCSENC_control_MSR_Bitmaps_address, UINT64_MAX);
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
 	return VM_INST_SUCCESS;
 	(void)arg;
 	(void)_vmcs12_to_vmcs02_control_MSR_Bitmaps_address_unused;
@@ -921,7 +931,12 @@ static u32 _vmcs12_to_vmcs02_control_MSR_Bitmaps_address(ARG10 * arg)
 static void _vmcs02_to_vmcs12_control_MSR_Bitmaps_address(ARG01 * arg)
 {
 	u16 encoding = VMCSENC_control_MSR_Bitmaps_address;
+#ifdef __VMX_NESTED_MSR_BITMAP__
+	HALT_ON_ERRORCOND(__vmx_vmread64(encoding) ==
+					  hva2spa(arg->vmcs12_info->msr_bitmap02));
+#else							/* !__VMX_NESTED_MSR_BITMAP__ */
 	HALT_ON_ERRORCOND(__vmx_vmread64(encoding) == UINT64_MAX);
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
 	(void)arg;
 	(void)_vmcs02_to_vmcs12_control_MSR_Bitmaps_address_unused;
 }
@@ -1732,6 +1747,29 @@ static void _vmcs02_to_vmcs12_guest_interruptibility(ARG01 * arg)
  * Natural-Width Host-State Fields
  */
 
+#ifdef __VMX_NESTED_MSR_BITMAP__
+/*
+ * Copy L1's MSR bitmap and compute the MSR bitmap of VMCS02. L1 may change
+ * its MSR bitmap whenever L2 is not running, so this is done at every
+ * VMENTRY when L1 uses MSR bitmaps. L2 RDMSR / WRMSR that neither L1 nor
+ * XMHF intercepts then do not cause VMEXIT, and the ones that do cause
+ * VMEXIT are checked against the copy instead of walking guest memory.
+ */
+static void _vmcs12_to_vmcs02_msr_bitmap(VCPU * vcpu,
+										 vmcs12_info_t * vmcs12_info,
+										 guestmem_hptw_ctx_pair_t * ctx_pair)
+{
+	gpa_t addr = vmcs12_info->vmcs12_value.control_MSR_Bitmaps_address;
+	if (!_vmx_hasctl_use_msr_bitmaps(&vmcs12_info->ctls12)) {
+		return;
+	}
+	guestmem_copy_gp2h(ctx_pair, 0, vmcs12_info->msr_bitmap12, addr,
+					   PAGE_SIZE_4K);
+	xmhf_partition_arch_x86vmx_merge_msrbitmap(vcpu, vmcs12_info->msr_bitmap02,
+											   vmcs12_info->msr_bitmap12);
+}
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
+
 /*
  * Translate VMCS12 (vmcs12) to VMCS02 (already loaded as current VMCS).
  * Return an error code following VM instruction error number, or 0 when
@@ -1779,17 +1817,34 @@ u32 xmhf_nested_arch_x86vmx_vmcs12_to_vmcs02(VCPU * vcpu,
 	arg.ia32_efer_index = ia32_efer_index;
 	/* TODO: Check settings of VMX controls and host-state area */
 
-#define DECLARE_FIELD_16_RW(encoding, name, ...) \
-	{ \
+	/*
+	 * Identity fields are only translated when L1 modified them since the
+	 * last VMENTRY, or when VMCS02 is new. After translation, a field that
+	 * does not exist in VMCS02 stays dirty, because it is not written.
+	 */
+#define FIELD_CTLS_ARG (arg.ctls)
+#define DECLARE_FIELD_16_RW(encoding, name, prop, exist, trans_suf, ...) \
+	if (!_FIELD_IS_IDENTITY(prop, trans_suf) || vmcs12_info->vmcs02_resync || \
+		vmcs_bitmap_test(&vmcs12_info->vmcs12_dirty, VMCSIDX_##name)) { \
 		u32 status = _vmcs12_to_vmcs02_##name(&arg); \
 		if (status != VM_INST_SUCCESS) { \
 			return status; \
 		} \
+		if (exist) { \
+			vmcs_bitmap_clear(&vmcs12_info->vmcs12_dirty, VMCSIDX_##name); \
+		} else { \
+			vmcs_bitmap_set(&vmcs12_info->vmcs12_dirty, VMCSIDX_##name); \
+		} \
 	}
 #define DECLARE_FIELD_64_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
 #define DECLARE_FIELD_32_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
 #define DECLARE_FIELD_NW_RW(...) DECLARE_FIELD_16_RW(__VA_ARGS__)
 #include "nested-x86vmx-vmcs12-fields.h"
+	vmcs12_info->vmcs02_resync = false;
+
+#ifdef __VMX_NESTED_MSR_BITMAP__
+	_vmcs12_to_vmcs02_msr_bitmap(vcpu, vmcs12_info, &ctx_pair);
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
 
 	/* Perform MSR load */
 	{
@@ -1928,10 +1983,22 @@ void xmhf_nested_arch_x86vmx_vmcs02_to_vmcs12(VCPU * vcpu,
 	}
 	arg.ia32_efer_index = ia32_efer_index;
 
-#define DECLARE_FIELD_16(encoding, name, ...) \
-	{ \
+#ifdef __DEBUG_QEMU__
+	/*
+	 * For FIELD_PROP_SWWRONLY, _vmcs02_to_vmcs12_*() halts if VMCS02 and
+	 * VMCS12 differ. Dirty fields are skipped because L0 wrote them.
+	 */
+#define DECLARE_FIELD_16(encoding, name, prop, exist, trans_suf, ...) \
+	if (_FIELD_HW_WRITABLE(prop, trans_suf) || \
+		!vmcs_bitmap_test(&vmcs12_info->vmcs12_dirty, VMCSIDX_##name)) { \
+		_vmcs02_to_vmcs12_##name(&arg); \
+	}
+#else /* !__DEBUG_QEMU__ */
+#define DECLARE_FIELD_16(encoding, name, prop, exist, trans_suf, ...) \
+	if (_FIELD_HW_WRITABLE(prop, trans_suf)) { \
 		_vmcs02_to_vmcs12_##name(&arg); \
 	}
+#endif /* __DEBUG_QEMU__ */
 #define DECLARE_FIELD_64(...) DECLARE_FIELD_16(__VA_ARGS__)
 #define DECLARE_FIELD_32(...) DECLARE_FIELD_16(__VA_ARGS__)
 #define DECLARE_FIELD_NW(...) DECLARE_FIELD_16(__VA_ARGS__)
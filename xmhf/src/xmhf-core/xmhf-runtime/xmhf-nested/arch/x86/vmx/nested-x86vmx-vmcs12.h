@@ -52,6 +52,7 @@
 #define _NESTED_X86VMX_VMCS12_H_
 
 #include "nested-x86vmx-ept12.h"
+#include "nested-x86vmx-vmcs12-access.h"
 
 /*
  * Rules:
@@ -59,6 +60,7 @@
  * * At most one bit should be set in mask 0x1f0
  * * FIELD_PROP_GPADDR (0x20) can only be set for 64-bit fields
  * * FIELD_PROP_SWWRONLY (0x200) can only be set when 0x10 or 0x20 is set
+ * * FIELD_PROP_SHADOW (0x400) can be set for any field
  * Notes:
  * * FIELD_PROP_ID_HOST is implicitly ignored. nested-x86vmx-vmcs12-guesthost.h
  *   is used instead.
@@ -74,12 +76,18 @@
 #define FIELD_PROP_IGNORE	0x00000080	/* VMCS12 value is ignored */
 #define FIELD_PROP_UNSUPP	0x00000100	/* VMCS12 field is not supported */
 #define FIELD_PROP_SWWRONLY	0x00000200	/* Read-only by hardware */
+#define FIELD_PROP_SHADOW	0x00000400	/* Stored in shadow VMCS */
 
 /*
  * Control whether XMHF (L0) uses shadow VMCS if provided by hardware.
- * Ideally this should be a configuration option, but not implemented yet.
+ * Only fields with FIELD_PROP_SHADOW are stored in the shadow VMCS, so L1's
+ * VMREAD / VMWRITE to these fields do not cause VMEXIT. Other fields are
+ * stored in vmcs12_info->vmcs12_value and accessed through VMREAD / VMWRITE
+ * intercepts.
  */
+#ifdef __VMX_NESTED_SHADOW_VMCS__
 #define VMX_NESTED_USE_SHADOW_VMCS
+#endif							/* __VMX_NESTED_SHADOW_VMCS__ */
 
 /*
  * Maximum number of MSRs in VMCS02's VMENTRY/VMEXIT MSR load / store. This
@@ -113,6 +121,11 @@ typedef struct vmcs12_info {
 #ifdef VMX_NESTED_USE_SHADOW_VMCS
 	/* Pointer to shadow VMCS12 in host */
 	spa_t vmcs12_shadow_ptr;
+	/*
+	 * Values of fields in shadow VMCS12 when L0 last synchronized it with
+	 * vmcs12_value. Only fields with FIELD_PROP_SHADOW are meaningful.
+	 */
+	struct _vmx_vmcsfields vmcs12_shadow_value;
 #endif							/* VMX_NESTED_USE_SHADOW_VMCS */
 	/* Whether this VMCS has launched */
 	int launched;
@@ -127,6 +140,17 @@ typedef struct vmcs12_info {
 	/* VMENTRY MSR load area */
 	msr_entry_t vmcs02_vmentry_msr_load_area[VMX_NESTED_MAX_MSR_COUNT]
 		__attribute__((aligned(16)));
+#ifdef __VMX_NESTED_MSR_BITMAP__
+	/*
+	 * When L1 uses MSR bitmaps, copy of L1's MSR bitmap taken at the last
+	 * VMENTRY. L1 cannot change its MSR bitmap while L2 runs (Intel SDM
+	 * "Software Access to Related Structures"), so this copy is used to
+	 * decide whether an L2 RDMSR / WRMSR VMEXIT should be forwarded to L1.
+	 */
+	u8 *msr_bitmap12;
+	/* MSR bitmap in VMCS02, L1's MSR bitmap merged with XMHF's */
+	u8 *msr_bitmap02;
+#endif							/* __VMX_NESTED_MSR_BITMAP__ */
 	/*
 	 * If guest is using EPT, pointer to EPT12 root. Otherwise,
 	 * GUEST_EPT_ROOT_INVALID.
@@ -161,19 +185,33 @@ typedef struct vmcs12_info {
 	bool guest_vmcs_block_nmi;
 	/* During L2 operation, control information in VMCS12 */
 	vmx_ctls_t ctls12;
+	/*
+	 * VMCS12 fields modified by L1 (VMWRITE or shadow VMCS) since the last
+	 * VMENTRY, indexed by VMCSIDX_*. Unmodified fields that are copied as-is
+	 * (FIELD_PROP_ID_GUEST) already have the same value in VMCS02, so
+	 * VMENTRY does not translate them.
+	 */
+	vmcs_bitmap_t vmcs12_dirty;
+	/*
+	 * Whether all fields need to be translated at the next VMENTRY. Set when
+	 * VMCS02 is created by VMPTRLD (including when L1 moves the VMCS12 to
+	 * another CPU, which requires VMCLEAR and VMPTRLD).
+	 */
+	bool vmcs02_resync;
 } vmcs12_info_t;
 
-bool xmhf_nested_arch_x86vmx_vmcs_readable(ulong_t encoding);
-bool xmhf_nested_arch_x86vmx_vmcs_writable(size_t offset);
-ulong_t xmhf_nested_arch_x86vmx_vmcs_read(struct _vmx_vmcsfields *vmcs12,
-										  ulong_t encoding, size_t size);
-void xmhf_nested_arch_x86vmx_vmcs_write(struct _vmx_vmcsfields *vmcs12,
-										size_t offset, ulong_t value,
-										size_t size);
-void xmhf_nested_arch_x86vmx_vmcs_read_all(VCPU * vcpu,
-										   struct _vmx_vmcsfields *vmcs12);
-void xmhf_nested_arch_x86vmx_vmcs_write_all(VCPU * vcpu,
-											struct _vmx_vmcsfields *vmcs12);
+void xmhf_nested_arch_x86vmx_vmcs_mark_dirty(vmcs12_info_t * vmcs12_info,
+											 ulong_t encoding);
+#ifdef VMX_NESTED_USE_SHADOW_VMCS
+void xmhf_nested_arch_x86vmx_shadow_vmcs_bitmaps_init(VCPU * vcpu,
+													   u8 * vmread_bitmap,
+													   u8 * vmwrite_bitmap);
+void xmhf_nested_arch_x86vmx_shadow_vmcs_pull(VCPU * vcpu,
+											  vmcs12_info_t * vmcs12_info);
+void xmhf_nested_arch_x86vmx_shadow_vmcs_push(VCPU * vcpu,
+											  vmcs12_info_t * vmcs12_info,
+											  bool all);
+#endif							/* VMX_NESTED_USE_SHADOW_VMCS */
 void xmhf_nested_arch_x86vmx_vmcs_dump(VCPU * vcpu,
 									   struct _vmx_vmcsfields *vmcs12,
 									   char *prefix);
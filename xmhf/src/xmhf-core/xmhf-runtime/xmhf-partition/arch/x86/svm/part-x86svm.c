@@ -85,6 +85,12 @@ static void _svm_initSVM(VCPU *vcpu){
 
 	printf("CPU(0x%02x): Total ASID is valid\n", vcpu->id);
 
+  // remember optional SVM features used on the intercept path
+  vcpu->svm_features = edx;
+  printf("CPU(0x%02x): SVM features: NRIP save=%u, VMCB clean=%u, decode assists=%u\n",
+         vcpu->id, !!(edx & SVM_FEATURE_NRIPS), !!(edx & SVM_FEATURE_VMCBCLEAN),
+         !!(edx & SVM_FEATURE_DECODEASSISTS));
+
   // enable SVM and debugging support (if required)
   rdmsr((u32)VM_CR_MSR, &eax, &edx);
   eax &= (~(1<<VM_CR_DPD));
@@ -160,6 +166,10 @@ static void _svm_initVMCB(VCPU *vcpu){
   memset(vmcb, 0, sizeof(struct _svm_vmcbfields));
   #endif
 
+  // no clean bits: the first VMRUN loads the whole VMCB; afterwards the
+  // intercept handler tracks which state groups change
+  vmcb->vmcb_clean = 0;
+
   // set up CS descr
   vmcb->cs.selector = 0x0;
   vmcb->cs.base = 0x0;
@@ -355,7 +355,7 @@ static void set_msrbitmap(u8 *bitmap, u32 msr) {
 	if (msr < 0x2000U) {
 		bit_num = msr;
 	} else if (0xc0000000U <= msr && msr < 0xc0002000U) {
-		bit_num = msr - 0xc0000000U;
+		bit_num = msr - 0xc0000000U + 1024 * 8;
 	} else {
 		return;
 	}
@@ -375,7 +375,7 @@ static void clear_msrbitmap(u8 *bitmap, u32 msr) {
 	if (msr < 0x2000U) {
 		bit_num = msr;
 	} else if (0xc0000000U <= msr && msr < 0xc0002000U) {
-		bit_num = msr - 0xc0000000U;
+		bit_num = msr - 0xc0000000U + 1024 * 8;
 	} else {
 		return;
 	}
@@ -464,6 +464,29 @@ void xmhf_partition_arch_x86vmx_clear_msrbitmap_x2apic_icr(VCPU *vcpu) {
 	clear_msrbitmap(bitmap, IA32_X2APIC_ICR);
 }
 
+#ifdef __NESTED_VIRTUALIZATION__
+// Compute the MSR bitmap of VMCS02 for the current VCPU. An MSR access of L2
+// causes VMEXIT if L1 intercepts it (bitmap12) or XMHF intercepts it
+// (vmx_msr_bitmaps). XMHF-managed MSRs are always intercepted, because VMCS02
+// uses different VMENTRY MSR load and VMEXIT MSR store areas. IA32_X2APIC_ICR
+// is always intercepted, because it may be added to vmx_msr_bitmaps while L2
+// is running.
+void xmhf_partition_arch_x86vmx_merge_msrbitmap(VCPU *vcpu, u8 *bitmap02,
+												const u8 *bitmap12) {
+	const u64 *src01 = (const u64 *)vmx_msr_bitmaps[vcpu->idx];
+	const u64 *src12 = (const u64 *)bitmap12;
+	u64 *dst = (u64 *)bitmap02;
+	u32 i;
+	for (i = 0; i < PAGE_SIZE_4K / sizeof(u64); i++) {
+		dst[i] = src01[i] | src12[i];
+	}
+	for (i = 0; i < vmx_msr_area_msrs_count; i++) {
+		set_msrbitmap(bitmap02, vmx_msr_area_msrs[i]);
+	}
+	set_msrbitmap(bitmap02, IA32_X2APIC_ICR);
+}
+#endif /* __NESTED_VIRTUALIZATION__ */
+
 /* Set the state of guest to after INIT interrupt, as specified by Intel SDM */
 void xmhf_partition_arch_x86vmx_guestVMCS_INIT(VCPU *vcpu)
 {
@@ -885,6 +908,7 @@ void vmx_initunrestrictedguestVMCS(VCPU *vcpu){
 	vcpu->vmx_guest_nmi_cfg.guest_nmi_block = false;
 	vcpu->vmx_guest_nmi_cfg.guest_nmi_pending = 0;
 	vcpu->vmx_eptlock_reading = false;
+	vcpu->vmx_shootdown_pending = 0;
 
 	//write VMX controls to VMCS
 	vcpu->vmcs.control_VMX_pin_based = vmx_ctls.pinbased_ctls;
@@ -933,6 +957,7 @@ static void _vmx_start_hvm(VCPU *vcpu, u32 vmcs_phys_addr){
   printf("CPU(0x%02x): VMPTRLD success.\n", vcpu->id);
 
   //put VMCS to CPU
+  xmhf_baseplatform_arch_x86vmx_vmcs_cache_init(vcpu);
   xmhf_baseplatform_arch_x86vmx_putVMCS(vcpu);
   printf("CPU(0x%02x): VMWRITEs success.\n", vcpu->id);
   HALT_ON_ERRORCOND( vcpu->vmcs.guest_VMCS_link_pointer == 0xFFFFFFFFFFFFFFFFULL );
@@ -1038,6 +1063,7 @@ void __vmx_vmentry_fail_callback(ulong_t is_resume, ulong_t valid)
 			printf("CPU(0x%02x): %s error; code=0x%lx.\n", vcpu->id, inst_name,
 					code);
 		}
+		xmhf_baseplatform_arch_x86vmx_vmcs_cache_reset(vcpu);
 		xmhf_baseplatform_arch_x86vmx_getVMCS(vcpu);
 		xmhf_baseplatform_arch_x86vmx_dump_vcpu(vcpu);
 		printf("CPU(0x%02x): HALT!\n", vcpu->id);
@@ -55,17 +55,17 @@
 void xmhf_gpa_changemapping(VCPU *vcpu, gpa_t dev_reg_gpaddr, gpa_t new_dev_reg_gpaddr, u64 mapflag)
 {
 #ifndef __XMHF_VERIFICATION__
-	u64 *pts;
 	u64 gpfn;
 	u64 value;
 
-	pts = (u64 *)vcpu->vmx_vaddr_ept_p_tables;
 	gpfn = dev_reg_gpaddr / PAGE_SIZE_4K;
 	value = (u64)new_dev_reg_gpaddr | mapflag;
 
-	pts[gpfn] = value;
+	xmhf_memprot_arch_x86vmx_set_pte(vcpu, gpfn * PAGE_SIZE_4K, value);
 
 	//   xmhf_memprot_arch_x86vmx_flushmappings_localtlb(vcpu, MEMP_FLUSHTLB_ENTRY);
-	xmhf_memprot_arch_flushmappings_localtlb(vcpu, MEMP_FLUSHTLB_ENTRY);
+	xmhf_memprot_arch_flushmappings_localtlb_range(vcpu, MEMP_FLUSHTLB_ENTRY,
+												   gpfn * PAGE_SIZE_4K,
+												   (gpfn + 1) * PAGE_SIZE_4K);
 #endif //__XMHF_VERIFICATION__
 }
\ No newline at end of file
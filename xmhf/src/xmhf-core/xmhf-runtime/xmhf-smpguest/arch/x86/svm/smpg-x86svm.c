@@ -70,6 +70,8 @@ static void svm_lapic_changemapping(VCPU *vcpu, u32 lapic_paddr, u32 new_lapic_p
     u64 *pts;
     u32 lapic_page;
 
+    //the LAPIC page may be in a 2M page, make sure it has its own PTE
+    xmhf_memprot_arch_x86svm_split_page(vcpu, lapic_paddr);
     pts = (u64 *)vcpu->npt_vaddr_pts;
 
     lapic_page = lapic_paddr / PAGE_SIZE_4K;
@@ -220,6 +222,7 @@ u32 xmhf_smpguest_arch_x86svm_eventhandler_hwpgtblviolation(VCPU *vcpu, struct r
 
         // setup #DB intercept in vmcb
         vmcb->exception_intercepts_bitmask |= (u32)EXCEPTION_INTERCEPT_DB;
+        svm_vmcb_dirty(vmcb, VMCB_CLEAN_I);
 
         // set guest TF
         vmcb->rflags |= (u64)EFLAGS_TF;
@@ -247,6 +250,7 @@ u32 xmhf_smpguest_arch_x86svm_eventhandler_hwpgtblviolation(VCPU *vcpu, struct r
 
         // setup #DB intercept in vmcb
         vmcb->exception_intercepts_bitmask |= (u32)EXCEPTION_INTERCEPT_DB;
+        svm_vmcb_dirty(vmcb, VMCB_CLEAN_I);
 
         // set guest TF
         vmcb->rflags |= (u64)EFLAGS_TF;
@@ -382,6 +386,7 @@ void xmhf_smpguest_arch_x86svm_eventhandler_dbexception(VCPU *vcpu, struct regs
 
     // clear #DB intercept in VMCB
     vmcb->exception_intercepts_bitmask &= ~(u32)EXCEPTION_INTERCEPT_DB;
+    svm_vmcb_dirty(vmcb, VMCB_CLEAN_I);
 
     // clear guest TF
     vmcb->rflags &= ~(u64)EFLAGS_TF;
@@ -583,6 +588,7 @@ void xmhf_smpguest_arch_x86svm_postCPUwakeup(VCPU *vcpu)
     vmcb->cs.selector = ((vcpu->sipivector * PAGE_SIZE_4K) >> 4);
     vmcb->cs.base = (vcpu->sipivector * PAGE_SIZE_4K);
     vmcb->rip = 0x0ULL;
+    svm_vmcb_dirty(vmcb, VMCB_CLEAN_SEG);
 }
 
 // walk guest page tables; returns pointer to corresponding guest physical address
@@ -97,3 +97,9 @@ volatile u32 g_vmx_lock_quiesce_resume_signal __attribute__(( section(".data") )
 //Flush all EPT TLB on all cores
 //smpguest x86vmx
 volatile u32 g_vmx_flush_all_tlb_signal __attribute__(( section(".data") )) = 0;
+
+//Guest physical address range [lo, hi) of g_vmx_flush_all_tlb_signal, empty
+//when there is no signal
+//smpguest x86vmx
+volatile u64 g_vmx_flush_all_tlb_gpa_lo __attribute__(( section(".data") )) = MEMP_FLUSHTLB_GPA_HI_ALL;
+volatile u64 g_vmx_flush_all_tlb_gpa_hi __attribute__(( section(".data") )) = MEMP_FLUSHTLB_GPA_LO_ALL;
@@ -64,6 +64,13 @@ static u32 g_vmx_lapic_guest_intr_nmimask __attribute__((section(".data"))) = 0;
 // guest exception bitmap during LAPIC emulation
 static u32 g_vmx_lapic_exception_bitmap __attribute__((section(".data"))) = 0;
 
+// whether LAPIC accesses are intercepted using "virtualize APIC accesses"
+// (one APIC-access VMEXIT per access) instead of EPT and single-stepping
+static bool g_vmx_lapic_use_apic_access __attribute__((section(".data"))) = false;
+
+// SMP lock to serialize xmhf_smpguest_arch_x86vmx_tlb_shootdown()
+static volatile u32 g_vmx_lock_shootdown __attribute__((section(".data"))) = 1;
+
 /*
  * xmhf_smpguest_arch_x86vmx_quiesce() needs to access printf locks defined
  * in xmhfc-putchar.c
@@ -94,19 +101,49 @@ static inline void atomic_dec(volatile u32 *v)
 static void vmx_lapic_changemapping(VCPU *vcpu, u32 lapic_paddr, u32 new_lapic_paddr, u64 mapflag)
 {
 #ifndef __XMHF_VERIFICATION__
-    u64 *pts;
     u32 lapic_page;
     u64 value;
 
-    pts = (u64 *)vcpu->vmx_vaddr_ept_p_tables;
     lapic_page = lapic_paddr / PAGE_SIZE_4K;
     value = (u64)new_lapic_paddr | mapflag;
 
-    pts[lapic_page] = value;
+    if (new_lapic_paddr == lapic_paddr && mapflag == VMX_LAPIC_MAP) {
+        // identity mapping, allow EPT01 to use large page again
+        xmhf_memprot_arch_x86vmx_reset_pte(vcpu, (u64)lapic_page * PAGE_SIZE_4K);
+    } else {
+        xmhf_memprot_arch_x86vmx_set_pte(vcpu, (u64)lapic_page * PAGE_SIZE_4K, value);
+    }
 
-    xmhf_memprot_arch_x86vmx_flushmappings_localtlb(vcpu, MEMP_FLUSHTLB_ENTRY);
+    xmhf_memprot_arch_x86vmx_flushmappings_localtlb_range(vcpu, MEMP_FLUSHTLB_ENTRY,
+                                                          (u64)lapic_page * PAGE_SIZE_4K,
+                                                          ((u64)lapic_page + 1) * PAGE_SIZE_4K);
 #endif //__XMHF_VERIFICATION__
 }
+
+// start (intercept = true) or stop (intercept = false) intercepting guest
+// accesses to the LAPIC page
+static void vmx_lapic_intercept(VCPU *vcpu, bool intercept)
+{
+    if (g_vmx_lapic_use_apic_access)
+    {
+        if (intercept)
+        {
+            vcpu->vmcs.control_APIC_access_address = g_vmx_lapic_base;
+            vcpu->vmcs.control_VMX_seccpu_based |=
+                (1U << VMX_SECPROCBASED_VIRTUALIZE_APIC_ACCESS);
+        }
+        else
+        {
+            vcpu->vmcs.control_VMX_seccpu_based &=
+                ~(1U << VMX_SECPROCBASED_VIRTUALIZE_APIC_ACCESS);
+        }
+    }
+    else
+    {
+        vmx_lapic_changemapping(vcpu, g_vmx_lapic_base, g_vmx_lapic_base,
+                                intercept ? VMX_LAPIC_UNMAP : VMX_LAPIC_MAP);
+    }
+}
 //----------------------------------------------------------------------
 
 //---checks if all logical cores have received SIPI
@@ -329,10 +366,16 @@ void xmhf_smpguest_arch_x86vmx_initialize(VCPU *vcpu, u32 unmaplapic)
     g_vmx_lapic_base = eax & 0xFFFFF000U;
     // printf("BSP(0x%02x): LAPIC base=0x%08x\n", vcpu->id, g_vmx_lapic_base);
 
+    // prefer APIC-access VMEXITs, which complete each access in one VMEXIT
+    g_vmx_lapic_use_apic_access =
+        _vmx_hasctl_virtualize_apic_access(&vcpu->vmx_caps);
+
     if (unmaplapic)
     {
-        // unmap LAPIC page
-        vmx_lapic_changemapping(vcpu, g_vmx_lapic_base, g_vmx_lapic_base, VMX_LAPIC_UNMAP);
+        printf("BSP(0x%02x): intercepting LAPIC using %s\n", vcpu->id,
+               g_vmx_lapic_use_apic_access ? "APIC-access VMEXITs" :
+               "EPT and single-stepping");
+        vmx_lapic_intercept(vcpu, true);
     }
 }
 //----------------------------------------------------------------------
@@ -343,7 +386,7 @@ void xmhf_smpguest_arch_x86vmx_initialize(VCPU *vcpu, u32 unmaplapic)
 void xmhf_smpguest_arch_x86vmx_link_lapic(VCPU *vcpu)
 {
     printf("%s: linking LAPIC interception to watch for SIPI\n", __FUNCTION__);
-    vmx_lapic_changemapping(vcpu, g_vmx_lapic_base, g_vmx_lapic_base, VMX_LAPIC_UNMAP);
+    vmx_lapic_intercept(vcpu, true);
     xmhf_partition_arch_x86vmx_set_msrbitmap_x2apic_icr(vcpu);
     g_all_cores_booted_up = 0;
 }
@@ -355,7 +398,7 @@ void xmhf_smpguest_arch_x86vmx_link_lapic(VCPU *vcpu)
 static void xmhf_smpguest_arch_x86vmx_delink_lapic(VCPU *vcpu)
 {
     printf("%s: delinking LAPIC interception since all cores have SIPI\n", __FUNCTION__);
-    vmx_lapic_changemapping(vcpu, g_vmx_lapic_base, g_vmx_lapic_base, VMX_LAPIC_MAP);
+    vmx_lapic_intercept(vcpu, false);
     xmhf_partition_arch_x86vmx_clear_msrbitmap_x2apic_icr(vcpu);
     g_all_cores_booted_up = 1;
 }
@@ -553,7 +596,21 @@ void xmhf_smpguest_arch_x86vmx_eventhandler_dbexception(VCPU *vcpu, struct regs
     }
 
     // remove LAPIC interception if all cores have booted up
-    if (delink_lapic_interception)
+    if (g_vmx_lapic_use_apic_access)
+    {
+        // single-stepping fallback of APIC-access VMEXIT, see
+        // xmhf_smpguest_arch_x86vmx_eventhandler_apicaccess()
+        vmx_lapic_changemapping(vcpu, g_vmx_lapic_base, g_vmx_lapic_base, VMX_LAPIC_MAP);
+        if (delink_lapic_interception)
+        {
+            xmhf_smpguest_arch_x86vmx_delink_lapic(vcpu);
+        }
+        else
+        {
+            vmx_lapic_intercept(vcpu, true);
+        }
+    }
+    else if (delink_lapic_interception)
     {
         xmhf_smpguest_arch_x86vmx_delink_lapic(vcpu);
     }
@@ -580,6 +637,123 @@ void xmhf_smpguest_arch_x86vmx_eventhandler_dbexception(VCPU *vcpu, struct regs
 #endif
 }
 
+/*
+ * Perform a guest write of value to ICR_LOW or ICR_HIGH (reg) for
+ * xmhf_smpguest_arch_x86vmx_eventhandler_apicaccess(). ICR writes are recorded
+ * in g_vmx_virtual_LAPIC_base. INIT and SIPI are processed by XMHF, other
+ * writes are forwarded to the physical LAPIC. Return 1 if LAPIC interception
+ * has to be discontinued, else 0.
+ */
+static u32 vmx_lapic_icr_write(VCPU *vcpu, u32 reg, u32 value)
+{
+    u32 icr_value_high;
+
+    *((u32 *)((hva_t)g_vmx_virtual_LAPIC_base + reg)) = value;
+    if (reg == LAPIC_ICR_LOW)
+    {
+        icr_value_high = *((u32 *)((hva_t)g_vmx_virtual_LAPIC_base + (u32)LAPIC_ICR_HIGH));
+        switch (value & 0x00000F00)
+        {
+        case 0x500:
+            printf("0x%04x:0x%08x -> (ICR=0x%08x write) INIT IPI detected, value=0x%08x\n",
+                   (u16)vcpu->vmcs.guest_CS_selector, (u32)vcpu->vmcs.guest_RIP, reg, value);
+            processINIT(vcpu, value, icr_value_high >> 24);
+            return 0;
+        case 0x600:
+            printf("0x%04x:0x%08x -> (ICR=0x%08x write) STARTUP IPI detected, value=0x%08x\n",
+                   (u16)vcpu->vmcs.guest_CS_selector, (u32)vcpu->vmcs.guest_RIP, reg, value);
+            // we assume that destination is always physical and
+            // specified via top 8 bits of icr_high_value
+            return processSIPI(vcpu, value, icr_value_high >> 24);
+        default:
+            break;
+        }
+    }
+
+    // neither an INIT or SIPI, just propagate this to physical LAPIC
+    *((volatile u32 *)((hva_t)g_vmx_lapic_base + reg)) = value;
+    return 0;
+}
+
+/*
+ * Handle APIC-access VMEXIT. This happens when the guest accesses the LAPIC
+ * page through a linear address and "virtualize APIC accesses" is enabled by
+ * vmx_lapic_intercept(). The access is emulated here in a single VMEXIT:
+ * reads and writes of ICR are handled as in the single-stepping path, other
+ * registers are accessed on the physical LAPIC. Only 32-bit MOVs are emulated.
+ * Other instructions (e.g. XCHG) fall back to single-stepping: "virtualize APIC
+ * accesses" is turned off until the #DB after the instruction.
+ */
+void xmhf_smpguest_arch_x86vmx_eventhandler_apicaccess(VCPU *vcpu, struct regs *r)
+{
+    ulong_t qualification = vcpu->vmcs.info_exit_qualification;
+    u32 reg = qualification & APIC_ACCESS_OFFSET_MASK;
+    u32 type = (qualification >> APIC_ACCESS_TYPE_SHIFT) & APIC_ACCESS_TYPE_MASK;
+    u32 len = vcpu->vmcs.info_vmexit_instruction_length;
+    u32 delink_lapic_interception = 0;
+    unsigned char inst[X86_INST_MAX_LEN] = {0};
+    guestmem_hptw_ctx_pair_t ctx_pair;
+    emu_env_t ctxt;
+    u32 value;
+
+    HALT_ON_ERRORCOND(g_vmx_lapic_use_apic_access);
+    HALT_ON_ERRORCOND(type == APIC_ACCESS_LINEAR_READ ||
+                      type == APIC_ACCESS_LINEAR_WRITE);
+    HALT_ON_ERRORCOND((reg & 0x3) == 0);
+    HALT_ON_ERRORCOND(len > 0 && len <= X86_INST_MAX_LEN);
+
+    // decode the instruction performing the access
+    guestmem_init(vcpu, &ctx_pair);
+    guestmem_copy_gv2h(&ctx_pair, 0, inst, VCPU_grip(vcpu), len);
+    if (xmhf_memprot_emulate_guest_instruction(vcpu, r, &ctxt, inst, len) != 0 ||
+        (type == APIC_ACCESS_LINEAR_WRITE &&
+         ctxt.src.operand_size != sizeof(u32)) ||
+        (type == APIC_ACCESS_LINEAR_READ &&
+         (ctxt.dst.type != OPERAND_REG ||
+          ctxt.dst.operand_size != sizeof(u32))))
+    {
+        vmx_lapic_intercept(vcpu, false);
+        xmhf_smpguest_arch_x86vmx_eventhandler_hwpgtblviolation(
+            vcpu, r, g_vmx_lapic_base + reg,
+            type == APIC_ACCESS_LINEAR_WRITE ? EPT_ERRORCODE_WRITE : 0);
+        return;
+    }
+
+    if (type == APIC_ACCESS_LINEAR_WRITE)
+    { // LAPIC write
+        value = *((u32 *)ctxt.src.val);
+        if (reg == LAPIC_ICR_LOW || reg == LAPIC_ICR_HIGH)
+        {
+            delink_lapic_interception = vmx_lapic_icr_write(vcpu, reg, value);
+        }
+        else
+        {
+            *((volatile u32 *)((hva_t)g_vmx_lapic_base + reg)) = value;
+        }
+    }
+    else
+    { // LAPIC read
+        if (reg == LAPIC_ICR_LOW || reg == LAPIC_ICR_HIGH)
+        {
+            value = *((u32 *)((hva_t)g_vmx_virtual_LAPIC_base + reg));
+        }
+        else
+        {
+            value = *((volatile u32 *)((hva_t)g_vmx_lapic_base + reg));
+        }
+        // 32-bit MOV to a general purpose register zero-extends
+        *((ulong_t *)ctxt.dst.reg_hvaddr) = value;
+    }
+
+    vcpu->vmcs.guest_RIP += len;
+
+    // remove LAPIC interception if all cores have booted up
+    if (delink_lapic_interception)
+    {
+        xmhf_smpguest_arch_x86vmx_delink_lapic(vcpu);
+    }
+}
+
 /*
  * This function is called by WRMSR interception where ECX=0x830. value is
  * EDX:EAX. Return 1 if smpguest handles this WRMSR. Return 0 if smpguest does
@@ -679,6 +853,158 @@ static void _vmx_send_quiesce_signal(VCPU __attribute__((unused)) * vcpu)
     // printf("%s: CPU(0x%02x): NMIs fired!\n", __FUNCTION__, vcpu->id);
 }
 
+/* Send NMI to a single CPU with LAPIC ID dest_lapic_id */
+static void _vmx_send_nmi(u32 dest_lapic_id)
+{
+    u32 eax, edx;
+
+    /* Check whether x2APIC is enabled */
+    rdmsr(MSR_APIC_BASE, &eax, &edx);
+
+    if (eax & (1U << 10))
+    {
+        /* x2APIC enabled, use it */
+        wrmsr(IA32_X2APIC_ICR, 0x00000400U, dest_lapic_id);
+    }
+    else
+    {
+        /* use LAPIC */
+        volatile u32 *icr_low = (u32 *)(0xFEE00000 + 0x300);
+        volatile u32 *icr_high = (u32 *)(0xFEE00000 + 0x310);
+        u32 prev_icr_high_value;
+
+        prev_icr_high_value = *icr_high;
+
+        *icr_high = dest_lapic_id << 24; // physical destination
+        *icr_low = 0x00000400U;          // send NMI, no shorthand
+
+#ifndef __XMHF_VERIFICATION__
+        while ((*icr_low) & 0x00001000U)
+        {
+            xmhf_cpu_relax();
+        }
+#endif
+
+        // restore icr high
+        *icr_high = prev_icr_high_value;
+    }
+}
+
+/*
+ * Process TLB shootdown request posted to the current CPU, if any. Return 1
+ * if a request is processed, 0 otherwise.
+ */
+static u32 _vmx_process_shootdown(VCPU *vcpu)
+{
+    mb();
+    if (!vcpu->vmx_shootdown_pending)
+    {
+        return 0;
+    }
+    xmhf_memprot_flushmappings_localtlb_range(vcpu, vcpu->vmx_shootdown_flags,
+                                              vcpu->vmx_shootdown_gpa_lo,
+                                              vcpu->vmx_shootdown_gpa_hi);
+    mb();
+    vcpu->vmx_shootdown_pending = 0;
+    mb();
+    return 1;
+}
+
+/*
+ * Classify an NMI received by the current CPU. Return 1 if it is sent by
+ * xmhf_smpguest_arch_x86vmx_tlb_shootdown(), 0 otherwise. The shootdown
+ * request itself may have been processed earlier by polling.
+ */
+static u32 _vmx_receive_shootdown_nmi(VCPU *vcpu)
+{
+    mb();
+    if (vcpu->vmx_shootdown_nmi_received == vcpu->vmx_shootdown_nmi_sent)
+    {
+        return 0;
+    }
+    vcpu->vmx_shootdown_nmi_received++;
+    mb();
+    return 1;
+}
+
+/*
+ * Flush EPT TLB of CPUs in cpus (all CPUs if cpus is NULL), only entries for
+ * guest physical addresses in [gpa_lo, gpa_hi) changed.
+ *
+ * Unlike xmhf_smpguest_arch_x86vmx_quiesce(), other CPUs are not stopped.
+ * The request is posted in the VCPU of each target CPU, and a directed NMI is
+ * sent to each of them (NMI is used instead of an interrupt vector because
+ * external interrupts are not intercepted by XMHF). The target CPU flushes
+ * its TLB in xmhf_smpguest_arch_x86vmx_nmi_check_quiesce() and continues.
+ * This function returns after all target CPUs have flushed.
+ *
+ * If a previous shootdown NMI has not been received by the target CPU yet, no
+ * new NMI is sent. The pending NMI will process the new request, and the
+ * hardware may merge two pending NMIs into one, which would leave an extra
+ * count that misclassifies the next NMI for the guest.
+ *
+ * The caller must not hold locks that the NMI handler may acquire (e.g.
+ * memprot_x86vmx_eptlock_write_lock()).
+ */
+void xmhf_smpguest_arch_x86vmx_tlb_shootdown(VCPU *vcpu,
+                                             const memp_cpuset_t *cpus,
+                                             u32 flags, u64 gpa_lo,
+                                             u64 gpa_hi)
+{
+    bool flush_self;
+    u32 i;
+
+    if (flags == 0)
+    {
+        return;
+    }
+
+    spin_lock(&g_vmx_lock_shootdown);
+
+    /* Post requests and send NMIs */
+    for (i = 0; i < g_midtable_numentries; i++)
+    {
+        VCPU *target = (VCPU *)g_midtable[i].vcpu_vaddr_ptr;
+        if (target == vcpu || (cpus && !MEMP_CPUSET_HAS(cpus, target->idx)))
+        {
+            continue;
+        }
+        HALT_ON_ERRORCOND(!target->vmx_shootdown_pending);
+        target->vmx_shootdown_flags = flags;
+        target->vmx_shootdown_gpa_lo = gpa_lo;
+        target->vmx_shootdown_gpa_hi = gpa_hi;
+        mb();
+        target->vmx_shootdown_pending = 1;
+        mb();
+        if (target->vmx_shootdown_nmi_sent ==
+            target->vmx_shootdown_nmi_received)
+        {
+            target->vmx_shootdown_nmi_sent++;
+            mb();
+            _vmx_send_nmi(target->id);
+        }
+    }
+
+    /* Flush the current CPU while other CPUs are flushing */
+    flush_self = (cpus == NULL || MEMP_CPUSET_HAS(cpus, vcpu->idx));
+    if (flush_self)
+    {
+        xmhf_memprot_flushmappings_localtlb_range(vcpu, flags, gpa_lo, gpa_hi);
+    }
+
+    /* Wait for all target CPUs */
+    for (i = 0; i < g_midtable_numentries; i++)
+    {
+        VCPU *target = (VCPU *)g_midtable[i].vcpu_vaddr_ptr;
+        while (target->vmx_shootdown_pending)
+        {
+            xmhf_cpu_relax();
+        }
+    }
+
+    spin_unlock(&g_vmx_lock_shootdown);
+}
+
 /* Unblock NMI by executing iret, but do not jump to somewhere else */
 void xmhf_smpguest_arch_x86vmx_unblock_nmi(void)
 {
@@ -812,6 +1138,8 @@ void xmhf_smpguest_arch_x86vmx_endquiesce(VCPU *vcpu)
     // Reset flush all TLB signal
     if (g_vmx_flush_all_tlb_signal)
         g_vmx_flush_all_tlb_signal = 0;
+    g_vmx_flush_all_tlb_gpa_lo = MEMP_FLUSHTLB_GPA_HI_ALL;
+    g_vmx_flush_all_tlb_gpa_hi = MEMP_FLUSHTLB_GPA_LO_ALL;
 
     // release quiesce lock
     // printf("CPU(0x%02x): releasing quiesce lock.\n", vcpu->id);
@@ -819,10 +1147,13 @@ void xmhf_smpguest_arch_x86vmx_endquiesce(VCPU *vcpu)
 }
 
 /*
- * Check whether an NMI received by the CPU is for quiesce.
+ * Check whether an NMI received by the CPU is for quiesce or TLB shootdown.
  *
  * If the NMI is for quiesce, this function processes the quiesce and returns
- * 1. The caller should simply return (and unblock NMI if needed).
+ * 1. The caller should simply return (and unblock NMI if needed). Similarly,
+ * if the NMI is sent by xmhf_smpguest_arch_x86vmx_tlb_shootdown() (see
+ * _vmx_receive_shootdown_nmi()), 1 is returned. Pending TLB shootdown
+ * requests are always processed.
  *
  * If the NMI is not for quiesce, this function returns 0. The caller should
  * process the NMI (e.g. inject the NMI to the guest OS). The caller also needs
@@ -841,6 +1172,10 @@ void xmhf_smpguest_arch_x86vmx_endquiesce(VCPU *vcpu)
  */
 u32 xmhf_smpguest_arch_x86vmx_nmi_check_quiesce(VCPU *vcpu)
 {
+    u32 shootdown = _vmx_receive_shootdown_nmi(vcpu);
+
+    _vmx_process_shootdown(vcpu);
+
     mb();
     if (g_vmx_quiesce && !vcpu->quiesced)
     {
@@ -856,6 +1191,11 @@ u32 xmhf_smpguest_arch_x86vmx_nmi_check_quiesce(VCPU *vcpu)
         // printf("CPU(0x%02x): Quiesced\n", vcpu->id);
         while (!g_vmx_quiesce_resume_signal)
         {
+            /*
+             * NMI is blocked here, so TLB shootdown requests from CPUs not
+             * quiesced yet need to be polled.
+             */
+            _vmx_process_shootdown(vcpu);
             xmhf_cpu_relax();
         }
         // printf("CPU(0x%02x): EOQ received, resuming...\n", vcpu->id);
@@ -866,7 +1206,9 @@ u32 xmhf_smpguest_arch_x86vmx_nmi_check_quiesce(VCPU *vcpu)
         // [TODO][Issue 95] Move EPT TLB flush out of <g_vmx_quiesce>. Otherwise, TLB flushing incorrectly depends on CPU quiescing.
         if (g_vmx_flush_all_tlb_signal)
         {
-            xmhf_memprot_flushmappings_localtlb(vcpu, g_vmx_flush_all_tlb_signal);
+            xmhf_memprot_flushmappings_localtlb_range(vcpu, g_vmx_flush_all_tlb_signal,
+                                                      g_vmx_flush_all_tlb_gpa_lo,
+                                                      g_vmx_flush_all_tlb_gpa_hi);
         }
 
         spin_lock(&g_vmx_lock_quiesce_resume_counter);
@@ -879,7 +1221,7 @@ u32 xmhf_smpguest_arch_x86vmx_nmi_check_quiesce(VCPU *vcpu)
     }
     else
     {
-        return 0;
+        return shootdown;
     }
 }
 
@@ -62,6 +62,12 @@ void emhfc_putchar_linelock(void *arg)
   spin_lock(arg);
 }
 
+/* Same as emhfc_putchar_linelock(), but return false instead of waiting */
+bool emhfc_putchar_linetrylock(void *arg)
+{
+  return __sync_bool_compare_and_swap((volatile u32 *)arg, 1, 0);
+}
+
 void emhfc_putchar_lineunlock(void *arg)
 {
   spin_unlock(arg);